@@ -0,0 +1,43 @@
+const char futility_version[] = "v0.0.42-58a50b3-dirty 2026-10-18 10:05:53 ";
+#define _CMD(NAME) extern const struct futil_cmd_t __cmd_##NAME;
+_CMD(bdb)
+_CMD(create)
+_CMD(dump_fmap)
+_CMD(dump_kernel_config)
+_CMD(gbb_utility)
+_CMD(help)
+_CMD(load_fmap)
+_CMD(pcr)
+_CMD(show)
+_CMD(sign)
+_CMD(sign_server)
+_CMD(validate_rec_mrc)
+_CMD(vbutil_firmware)
+_CMD(vbutil_kernel)
+_CMD(vbutil_key)
+_CMD(vbutil_keyblock)
+_CMD(verify)
+_CMD(version)
+#undef _CMD
+#define _CMD(NAME) &__cmd_##NAME,
+const struct futil_cmd_t *const futil_cmds[] = {
+_CMD(bdb)
+_CMD(create)
+_CMD(dump_fmap)
+_CMD(dump_kernel_config)
+_CMD(gbb_utility)
+_CMD(help)
+_CMD(load_fmap)
+_CMD(pcr)
+_CMD(show)
+_CMD(sign)
+_CMD(sign_server)
+_CMD(validate_rec_mrc)
+_CMD(vbutil_firmware)
+_CMD(vbutil_kernel)
+_CMD(vbutil_key)
+_CMD(vbutil_keyblock)
+_CMD(verify)
+_CMD(version)
+0};  /* null-terminated */
+#undef _CMD
@@ -0,0 +1,15 @@
+const char futility_version[] = "v0.0.42-58a50b3-dirty 2026-10-18 10:05:49 ";
+#define _CMD(NAME) extern const struct futil_cmd_t __cmd_##NAME;
+_CMD(dump_fmap)
+_CMD(gbb_utility)
+_CMD(help)
+_CMD(version)
+#undef _CMD
+#define _CMD(NAME) &__cmd_##NAME,
+const struct futil_cmd_t *const futil_cmds[] = {
+_CMD(dump_fmap)
+_CMD(gbb_utility)
+_CMD(help)
+_CMD(version)
+0};  /* null-terminated */
+#undef _CMD
@@ -12,6 +12,7 @@
 #include <uuid/uuid.h>
 
 #include "cgpt.h"
+#include "cgpt_nor.h"
 #include "vboot_host.h"
 
 const char* progname;
@@ -49,6 +50,8 @@ void Usage(void) {
   for (i = 0; i < sizeof(cmds)/sizeof(cmds[0]); ++i) {
     printf("    %-15s  %s\n", cmds[i].name, cmds[i].comment);
   }
+  printf("\nSet CGPT_CACHE_DIR (e.g. /run/cgpt) to let read-only commands "
+         "reuse the\nvalidated GPT of an unchanged drive.\n");
   printf("\nFor more detailed usage, use %s COMMAND -h\n\n", progname);
 }
 
@@ -87,8 +90,22 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (match_count == 1)
+  if (match_count == 1) {
+    // GPT structs of MTD devices live in NOR flash. Work on them in memory.
+    const char *mtd_device = FindMtdDevice(argc, (const char *const *)argv);
+    if (mtd_device) {
+      uint8_t *nor_image;
+      uint64_t nor_image_size;
+      int ret;
+      if (OpenNorImage(mtd_device, &nor_image, &nor_image_size) != 0)
+        return CGPT_FAILED;
+      ret = cmds[match_index].fp(argc, argv);
+      if (CloseNorImage(nor_image, nor_image_size) != 0)
+        ret = CGPT_FAILED;
+      return ret;
+    }
     return cmds[match_index].fp(argc, argv);
+  }
 
   // Couldn't find a single matching command.
   Usage();
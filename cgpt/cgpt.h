@@ -46,7 +46,11 @@ struct drive {
   uint64_t size;    /* total size (in bytes) */
   GptData gpt;
   struct pmbr pmbr;
-  int fd;       /* file descriptor */
+  int fd;       /* file descriptor, or -1 when backed by an in-memory image */
+  uint8_t *image;       /* in-memory GPT image, see DriveSetImage() */
+  uint64_t image_size;  /* size of 'image' (in bytes) */
+  char *cache_path;     /* parse cache file, see DriveSanityCheck() */
+  int cached;           /* entries and validation came from the cache */
 };
 
 // Opens a block device or file, loads raw GPT data from it.
@@ -61,8 +65,27 @@ struct drive {
 int DriveOpen(const char *drive_path, struct drive *drive, int mode,
               uint64_t drive_size);
 int DriveClose(struct drive *drive, int update_as_needed);
+
+// Registers an in-memory image holding the GPT structs for 'drive_path'.
+// Subsequent DriveOpen() calls on 'drive_path' read from and write to 'image'
+// instead of opening the path. 'drive_size' is used as the size of the device
+// where partitions reside, just as DriveOpen() would use it. Passing a NULL
+// 'drive_path' unregisters the image. The caller keeps ownership of 'image'.
+void DriveSetImage(const char *drive_path, uint8_t *image, uint64_t image_size,
+                   uint64_t drive_size);
+
+// Returns non-zero if the registered image's contents have changed since it
+// was set with DriveSetImage(). Saving identical data doesn't count.
+int DriveImageModified(void);
 int CheckValid(const struct drive *drive);
 
+// Validates the GPT of 'drive' like GptSanityCheck(). If the environment
+// variable CGPT_CACHE_DIR names a directory (e.g. /run/cgpt), drives opened
+// read-only keep the result there, keyed by device and both GPT headers, so
+// later read-only runs on the unchanged drive skip reading and CRC-checking
+// the entry arrays. Returns GPT_SUCCESS or a GPT_ERROR_* code.
+int DriveSanityCheck(struct drive *drive);
+
 /* Loads sectors from 'drive'.
  * *buf is pointed to an allocated memory when returned, and should be
  * freed.
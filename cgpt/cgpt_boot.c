@@ -24,7 +24,7 @@ int CgptGetBootPartitionNumber(CgptBootParams *params) {
                            params->drive_size))
     return CGPT_FAILED;
 
-  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
+  if (GPT_SUCCESS != (gpt_retval = DriveSanityCheck(&drive))) {
     Error("GptSanityCheck() returned %d: %s\n",
           gpt_retval, GptError(gpt_retval));
     retval = CGPT_FAILED;
@@ -76,6 +76,56 @@ int CheckValid(const struct drive *drive) {
   return CGPT_OK;
 }
 
+// In-memory image registered with DriveSetImage().
+static struct {
+  const char *path;
+  uint8_t *data;
+  uint64_t size;
+  uint64_t drive_size;
+  uint32_t crc32;       // of the image as it was registered
+  int modified;
+} registered_image;
+
+static uint32_t ImageCrc32(const uint8_t *data, uint64_t size) {
+  uint32_t crc = 0;
+  uint32_t count;
+
+  while (size) {
+    count = size > UINT32_MAX ? UINT32_MAX : size;
+    crc = Crc32Update(crc, data, count);
+    data += count;
+    size -= count;
+  }
+  return crc;
+}
+
+void DriveSetImage(const char *drive_path, uint8_t *image, uint64_t image_size,
+                   uint64_t drive_size) {
+  registered_image.path = drive_path;
+  registered_image.data = drive_path ? image : NULL;
+  registered_image.size = drive_path ? image_size : 0;
+  registered_image.drive_size = drive_path ? drive_size : 0;
+  registered_image.crc32 = ImageCrc32(registered_image.data,
+                                      registered_image.size);
+  registered_image.modified = 0;
+}
+
+int DriveImageModified(void) {
+  // Saving the same GPT back (as most commands do when they close the
+  // drive) leaves the image as it was, and isn't worth writing out.
+  return registered_image.modified &&
+         ImageCrc32(registered_image.data, registered_image.size) !=
+             registered_image.crc32;
+}
+
+// Check that 'count' bytes at 'offset' fit in the drive's in-memory image.
+static int ImageRange(const struct drive *drive, uint64_t offset,
+                      uint64_t count) {
+  if (offset > drive->image_size || count > drive->image_size - offset)
+    return CGPT_FAILED;
+  return CGPT_OK;
+}
+
 int Load(struct drive *drive, uint8_t **buf,
                 const uint64_t sector,
                 const uint64_t sector_bytes,
@@ -99,6 +149,16 @@ int Load(struct drive *drive, uint8_t **buf,
   *buf = malloc(count);
   require(*buf);
 
+  if (drive->image) {
+    if (ImageRange(drive, sector * sector_bytes, count) != CGPT_OK) {
+      Error("Can't read enough: %d bytes at sector %d lie outside image\n",
+            count, (int)sector);
+      goto error_free;
+    }
+    memcpy(*buf, drive->image + sector * sector_bytes, count);
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, sector * sector_bytes, SEEK_SET)) {
     Error("Can't seek: %s\n", strerror(errno));
     goto error_free;
@@ -120,6 +180,13 @@ error_free:
 
 
 int ReadPMBR(struct drive *drive) {
+  if (drive->image) {
+    if (ImageRange(drive, 0, sizeof(struct pmbr)) != CGPT_OK)
+      return CGPT_FAILED;
+    memcpy(&drive->pmbr, drive->image, sizeof(struct pmbr));
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, 0, SEEK_SET))
     return CGPT_FAILED;
 
@@ -131,6 +198,14 @@ int ReadPMBR(struct drive *drive) {
 }
 
 int WritePMBR(struct drive *drive) {
+  if (drive->image) {
+    if (ImageRange(drive, 0, sizeof(struct pmbr)) != CGPT_OK)
+      return CGPT_FAILED;
+    memcpy(drive->image, &drive->pmbr, sizeof(struct pmbr));
+    registered_image.modified = 1;
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, 0, SEEK_SET))
     return CGPT_FAILED;
 
@@ -151,6 +226,14 @@ int Save(struct drive *drive, const uint8_t *buf,
   require(buf);
   count = sector_bytes * sector_count;
 
+  if (drive->image) {
+    if (ImageRange(drive, sector * sector_bytes, count) != CGPT_OK)
+      return CGPT_FAILED;
+    memcpy(drive->image + sector * sector_bytes, buf, count);
+    registered_image.modified = 1;
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, sector * sector_bytes, SEEK_SET))
     return CGPT_FAILED;
 
@@ -161,6 +244,347 @@ int Save(struct drive *drive, const uint8_t *buf,
   return CGPT_OK;
 }
 
+// Size in bytes of the entry array GptLoad() reads for 'header'.
+static uint64_t EntriesBytes(const struct drive *drive, GptHeader *header,
+                             int secondary) {
+  if (CheckHeader(header, secondary, drive->gpt.streaming_drive_sectors,
+                  drive->gpt.gpt_drive_sectors, drive->gpt.flags) == 0)
+    return (uint64_t)drive->gpt.sector_bytes *
+        CalculateEntriesSectors(header);
+  return MAX_NUMBER_OF_ENTRIES * sizeof(GptEntry);
+}
+
+/* GPT parse cache.
+ *
+ * Scripts tend to run cgpt on the same unchanged drive several times in a row.
+ * When CGPT_CACHE_ENV names a directory (e.g. /run/cgpt), drives opened
+ * read-only keep their validated GptData there, in a file named after the
+ * dev_t and inode of the drive. The next run only reads both GPT headers, and
+ * if they are byte-for-byte the ones the cache was made from, it takes the
+ * entry arrays and validation results from the cache instead of reading and
+ * CRC-checking the entry arrays again.
+ *
+ * A forged cache could hand a forged GPT to a privileged cgpt, so the directory
+ * and the file must belong to us and be writable by nobody else, and what's
+ * read back is still checked against the headers read from the drive.
+ */
+#define CGPT_CACHE_ENV "CGPT_CACHE_DIR"
+#define CGPT_CACHE_MAGIC 0x43545047  /* "GPTC" */
+
+struct cache_header {
+  uint32_t magic;
+  uint32_t headers_crc32;  /* digest of both header sectors as read */
+  uint32_t sector_bytes;
+  uint32_t flags;
+  uint64_t streaming_drive_sectors;
+  uint64_t gpt_drive_sectors;
+  uint64_t primary_entries_bytes;
+  uint64_t secondary_entries_bytes;
+  uint8_t valid_headers;
+  uint8_t valid_entries;
+  uint8_t ignored;
+  uint8_t reserved[5];
+  /* Followed by both header sectors as read, both header sectors as
+   * validated, then the primary and the secondary entry arrays. */
+};
+
+// Returns the cache file for the drive open on 'fd', or NULL if caching is
+// off. The caller must free the returned string.
+static char *CachePath(int fd) {
+  const char *dir = getenv(CGPT_CACHE_ENV);
+  struct stat stat;
+  char *path;
+
+  if (!dir || !*dir || fstat(fd, &stat) != 0)
+    return NULL;
+  if (S_ISBLK(stat.st_mode))
+    stat.st_ino = 0;
+  else
+    stat.st_rdev = stat.st_dev;
+  if (asprintf(&path, "%s/%llx-%llu", dir, (unsigned long long)stat.st_rdev,
+               (unsigned long long)stat.st_ino) == -1)
+    return NULL;
+  return path;
+}
+
+// Returns non-zero if the file open on 'fd' belongs to us, and nobody else can
+// write to it.
+static int CacheTrusted(int fd) {
+  struct stat stat;
+
+  return fstat(fd, &stat) == 0 && stat.st_uid == geteuid() &&
+         !(stat.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// Opens the directory holding the cache file 'path' if it can be trusted, and
+// points 'name' at the file name within it. Returns the directory's file
+// descriptor, or -1.
+static int CacheDirOpen(const char *path, const char **name) {
+  char *dir = strdup(path);
+  int fd;
+
+  if (!dir)
+    return -1;
+  *strrchr(dir, '/') = '\0';
+  *name = strrchr(path, '/') + 1;
+  fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(dir);
+  if (fd >= 0 && !CacheTrusted(fd)) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+// Returns non-zero if the entry array 'entries' of 'entries_bytes' has the CRC
+// that one of the valid headers in 'headers' (both header sectors as read)
+// gives for it.
+static int CacheEntriesMatch(const struct drive *drive, const uint8_t *headers,
+                             const uint8_t *entries, uint64_t entries_bytes) {
+  GptHeader *header;
+  uint64_t size;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    header = (GptHeader *)(headers + i * drive->gpt.sector_bytes);
+    if (CheckHeader(header, i, drive->gpt.streaming_drive_sectors,
+                    drive->gpt.gpt_drive_sectors, drive->gpt.flags))
+      continue;
+    size = (uint64_t)header->number_of_entries * header->size_of_entry;
+    if (size <= entries_bytes && size <= UINT32_MAX &&
+        Crc32(entries, size) == header->entries_crc32)
+      return 1;
+  }
+  return 0;
+}
+
+// Copy both header sectors as they are now into a new buffer.
+static uint8_t *CopyHeaders(const struct drive *drive) {
+  uint32_t sector_bytes = drive->gpt.sector_bytes;
+  uint8_t *headers = malloc(2 * sector_bytes);
+
+  if (headers) {
+    memcpy(headers, drive->gpt.primary_header, sector_bytes);
+    memcpy(headers + sector_bytes, drive->gpt.secondary_header, sector_bytes);
+  }
+  return headers;
+}
+
+// Fills in the entries and validation results of 'drive' from its cache file
+// if that was made from the header sectors just read. Returns CGPT_OK if so.
+static int CacheLoad(struct drive *drive) {
+  uint32_t sector_bytes = drive->gpt.sector_bytes;
+  struct cache_header *hdr;
+  struct stat stat;
+  const char *name;
+  uint8_t *data = NULL;
+  uint8_t *headers = NULL;
+  uint8_t *p;
+  uint64_t entries_bytes[2];
+  uint64_t rest;
+  int retval = CGPT_FAILED;
+  int dirfd, fd = -1;
+  int i;
+
+  dirfd = CacheDirOpen(drive->cache_path, &name);
+  if (dirfd < 0)
+    return CGPT_FAILED;
+  fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0 || !CacheTrusted(fd))
+    goto done;
+  if (fstat(fd, &stat) != 0 || !S_ISREG(stat.st_mode) ||
+      stat.st_size < sizeof(*hdr) + 4 * (uint64_t)sector_bytes ||
+      !(data = malloc(stat.st_size)) ||
+      pread(fd, data, stat.st_size, 0) != stat.st_size)
+    goto done;
+
+  // The entry arrays must be the size GptLoad() would have read for these
+  // headers, and fill the rest of the file exactly.
+  hdr = (struct cache_header *)data;
+  headers = CopyHeaders(drive);
+  if (!headers)
+    goto done;
+  entries_bytes[0] = EntriesBytes(drive, (GptHeader *)headers, 0);
+  entries_bytes[1] = EntriesBytes(drive,
+                                  (GptHeader *)(headers + sector_bytes), 1);
+  rest = stat.st_size - sizeof(*hdr) - 4 * (uint64_t)sector_bytes;
+  if (hdr->magic != CGPT_CACHE_MAGIC ||
+      hdr->headers_crc32 != Crc32(headers, 2 * sector_bytes) ||
+      hdr->sector_bytes != sector_bytes ||
+      hdr->flags != drive->gpt.flags ||
+      hdr->streaming_drive_sectors != drive->gpt.streaming_drive_sectors ||
+      hdr->gpt_drive_sectors != drive->gpt.gpt_drive_sectors ||
+      hdr->primary_entries_bytes != entries_bytes[0] ||
+      hdr->secondary_entries_bytes != entries_bytes[1] ||
+      entries_bytes[0] > rest ||
+      rest - entries_bytes[0] != entries_bytes[1])
+    goto done;
+
+  p = data + sizeof(*hdr);
+  if (memcmp(p, headers, 2 * sector_bytes))
+    goto done;
+  p += 2 * sector_bytes;
+
+  // Validation only ever copies one header over the other, so each validated
+  // header must be one of those read, and only headers that check out can be
+  // called valid.
+  for (i = 0; i < 2; i++) {
+    if (memcmp(p + i * sector_bytes, headers, sector_bytes) &&
+        memcmp(p + i * sector_bytes, headers + sector_bytes, sector_bytes))
+      goto done;
+    if ((hdr->valid_headers & (i ? MASK_SECONDARY : MASK_PRIMARY)) &&
+        CheckHeader((GptHeader *)(headers + i * sector_bytes), i,
+                    drive->gpt.streaming_drive_sectors,
+                    drive->gpt.gpt_drive_sectors, drive->gpt.flags))
+      goto done;
+  }
+
+  // Any entry array the cache calls valid must have a valid header's CRC.
+  if (!hdr->valid_entries ||
+      ((hdr->valid_entries & MASK_PRIMARY) &&
+       !CacheEntriesMatch(drive, headers, p + 2 * sector_bytes,
+                          entries_bytes[0])) ||
+      ((hdr->valid_entries & MASK_SECONDARY) &&
+       !CacheEntriesMatch(drive, headers,
+                          p + 2 * sector_bytes + entries_bytes[0],
+                          entries_bytes[1])))
+    goto done;
+
+  drive->gpt.primary_entries = malloc(entries_bytes[0]);
+  drive->gpt.secondary_entries = malloc(entries_bytes[1]);
+  require(drive->gpt.primary_entries && drive->gpt.secondary_entries);
+  memcpy(drive->gpt.primary_header, p, sector_bytes);
+  p += sector_bytes;
+  memcpy(drive->gpt.secondary_header, p, sector_bytes);
+  p += sector_bytes;
+  memcpy(drive->gpt.primary_entries, p, entries_bytes[0]);
+  p += entries_bytes[0];
+  memcpy(drive->gpt.secondary_entries, p, entries_bytes[1]);
+
+  drive->gpt.valid_headers = hdr->valid_headers;
+  drive->gpt.valid_entries = hdr->valid_entries;
+  drive->gpt.ignored = hdr->ignored;
+  drive->cached = 1;
+  retval = CGPT_OK;
+
+done:
+  free(headers);
+  free(data);
+  if (fd >= 0)
+    close(fd);
+  close(dirfd);
+  return retval;
+}
+
+static int WriteAll(int fd, const void *buf, uint64_t count) {
+  const uint8_t *p = buf;
+
+  while (count) {
+    ssize_t nwrote = write(fd, p, count);
+    if (nwrote <= 0)
+      return CGPT_FAILED;
+    p += nwrote;
+    count -= nwrote;
+  }
+  return CGPT_OK;
+}
+
+// Stores the validated GptData of 'drive' in its cache file. 'headers' holds
+// both header sectors as read, and 'entries_bytes' the size of both entry
+// arrays. The cache is only a shortcut, so failures are silently ignored.
+static void CacheSave(const struct drive *drive, const uint8_t *headers,
+                      const uint64_t entries_bytes[2]) {
+  uint32_t sector_bytes = drive->gpt.sector_bytes;
+  struct cache_header hdr;
+  const char *name;
+  char *dir;
+  char *tmp_name;
+  int dirfd, fd;
+
+  dir = strdup(drive->cache_path);
+  if (!dir)
+    return;
+  *strrchr(dir, '/') = '\0';
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    free(dir);
+    return;
+  }
+  free(dir);
+
+  // Only write into a directory nobody else could have planted files in.
+  dirfd = CacheDirOpen(drive->cache_path, &name);
+  if (dirfd < 0)
+    return;
+  if (asprintf(&tmp_name, "%s.%d", name, (int)getpid()) == -1) {
+    close(dirfd);
+    return;
+  }
+  unlinkat(dirfd, tmp_name, 0);
+  fd = openat(dirfd, tmp_name,
+              O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0600);
+  if (fd < 0) {
+    free(tmp_name);
+    close(dirfd);
+    return;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CGPT_CACHE_MAGIC;
+  hdr.headers_crc32 = Crc32(headers, 2 * sector_bytes);
+  hdr.sector_bytes = sector_bytes;
+  hdr.flags = drive->gpt.flags;
+  hdr.streaming_drive_sectors = drive->gpt.streaming_drive_sectors;
+  hdr.gpt_drive_sectors = drive->gpt.gpt_drive_sectors;
+  hdr.primary_entries_bytes = entries_bytes[0];
+  hdr.secondary_entries_bytes = entries_bytes[1];
+  hdr.valid_headers = drive->gpt.valid_headers;
+  hdr.valid_entries = drive->gpt.valid_entries;
+  hdr.ignored = drive->gpt.ignored;
+
+  // Write to a temp file and rename it, so readers never see a partial one.
+  int ok = (CGPT_OK == WriteAll(fd, &hdr, sizeof(hdr)) &&
+            CGPT_OK == WriteAll(fd, headers, 2 * sector_bytes) &&
+            CGPT_OK == WriteAll(fd, drive->gpt.primary_header, sector_bytes) &&
+            CGPT_OK == WriteAll(fd, drive->gpt.secondary_header,
+                                sector_bytes) &&
+            CGPT_OK == WriteAll(fd, drive->gpt.primary_entries,
+                                entries_bytes[0]) &&
+            CGPT_OK == WriteAll(fd, drive->gpt.secondary_entries,
+                                entries_bytes[1]));
+  if (close(fd) != 0)
+    ok = 0;
+  if (!ok || renameat(dirfd, tmp_name, dirfd, name) != 0)
+    unlinkat(dirfd, tmp_name, 0);
+  free(tmp_name);
+  close(dirfd);
+}
+
+int DriveSanityCheck(struct drive *drive) {
+  uint8_t *headers = NULL;
+  uint64_t entries_bytes[2];
+  int retval;
+
+  // Validation results came from the cache along with the entries.
+  if (drive->cached)
+    return GPT_SUCCESS;
+
+  if (drive->cache_path) {
+    headers = CopyHeaders(drive);
+    entries_bytes[0] = EntriesBytes(drive,
+                                    (GptHeader *)drive->gpt.primary_header, 0);
+    entries_bytes[1] = EntriesBytes(drive,
+                                    (GptHeader *)drive->gpt.secondary_header,
+                                    1);
+  }
+
+  retval = GptSanityCheck(&drive->gpt);
+  if (headers && retval == GPT_SUCCESS)
+    CacheSave(drive, headers, entries_bytes);
+
+  free(headers);
+  return retval;
+}
+
 static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
   drive->gpt.sector_bytes = sector_bytes;
   if (drive->size % drive->gpt.sector_bytes) {
@@ -188,6 +612,10 @@ static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
     Error("Cannot read secondary GPT header\n");
     return -1;
   }
+  // An unchanged GPT may already have been validated by a previous run.
+  if (drive->cache_path && CacheLoad(drive) == CGPT_OK)
+    return 0;
+
   GptHeader* primary_header = (GptHeader*)drive->gpt.primary_header;
   if (CheckHeader(primary_header, 0, drive->gpt.streaming_drive_sectors,
                   drive->gpt.gpt_drive_sectors,
@@ -251,7 +679,8 @@ static int GptSave(struct drive *drive) {
     }
 
     // Sync primary GPT before touching secondary so one is always valid.
-    if (drive->gpt.modified & (GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1))
+    if (drive->fd >= 0 &&
+        (drive->gpt.modified & (GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1)))
       if (fsync(drive->fd) < 0 && errno == EIO) {
         errors++;
         Error("I/O error when trying to write primary GPT\n");
@@ -333,22 +762,34 @@ int DriveOpen(const char *drive_path, struct drive *drive, int mode,
   // Clear struct for proper error handling.
   memset(drive, 0, sizeof(struct drive));
 
-  drive->fd = open(drive_path, mode | 
+  sector_bytes = 512;
+  uint64_t gpt_drive_size;
+  if (registered_image.path && !strcmp(drive_path, registered_image.path)) {
+    drive->fd = -1;
+    drive->image = registered_image.data;
+    drive->image_size = registered_image.size;
+    gpt_drive_size = drive->image_size;
+    if (drive_size == 0)
+      drive_size = registered_image.drive_size;
+  } else {
+    drive->fd = open(drive_path, mode |
 #ifndef HAVE_MACOS
-		               O_LARGEFILE |
+                                 O_LARGEFILE |
 #endif
-			       O_NOFOLLOW);
-  if (drive->fd == -1) {
-    Error("Can't open %s: %s\n", drive_path, strerror(errno));
-    return CGPT_FAILED;
-  }
+                                 O_NOFOLLOW);
+    if (drive->fd == -1) {
+      Error("Can't open %s: %s\n", drive_path, strerror(errno));
+      return CGPT_FAILED;
+    }
 
-  sector_bytes = 512;
-  uint64_t gpt_drive_size;
-  if (ObtainDriveSize(drive->fd, &gpt_drive_size, &sector_bytes) != 0) {
-    Error("Can't get drive size and bytes per sector for %s: %s\n",
-          drive_path, strerror(errno));
-    goto error_close;
+    if (ObtainDriveSize(drive->fd, &gpt_drive_size, &sector_bytes) != 0) {
+      Error("Can't get drive size and bytes per sector for %s: %s\n",
+            drive_path, strerror(errno));
+      goto error_close;
+    }
+
+    if (mode == O_RDONLY)
+      drive->cache_path = CachePath(drive->fd);
   }
 
   drive->gpt.gpt_drive_sectors = gpt_drive_size / sector_bytes;
@@ -386,9 +827,12 @@ int DriveClose(struct drive *drive, int update_as_needed) {
   // Sync early! Only sync file descriptor here, and leave the whole system sync
   // outside cgpt because whole system sync would trigger tons of disk accesses
   // and timeout tests.
-  fsync(drive->fd);
-
-  close(drive->fd);
+  if (drive->fd >= 0) {
+    fsync(drive->fd);
+    close(drive->fd);
+  }
+  free(drive->cache_path);
+  drive->cache_path = NULL;
 
   return errors ? CGPT_FAILED : CGPT_OK;
 }
@@ -827,6 +1271,7 @@ void SetRaw(struct drive *drive, int secondary, uint32_t entry_index,
 }
 
 void UpdateAllEntries(struct drive *drive) {
+  GptIndexInvalidate(&drive->gpt);
   RepairEntries(&drive->gpt, MASK_PRIMARY);
   RepairHeader(&drive->gpt, MASK_PRIMARY);
 
@@ -1027,7 +1472,7 @@ int CgptGetNumNonEmptyPartitions(CgptShowParams *params) {
                            params->drive_size))
     return CGPT_FAILED;
 
-  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
+  if (GPT_SUCCESS != (gpt_retval = DriveSanityCheck(&drive))) {
     Error("GptSanityCheck() returned %d: %s\n",
           gpt_retval, GptError(gpt_retval));
     retval = CGPT_FAILED;
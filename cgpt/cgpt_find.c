@@ -18,24 +18,36 @@
 #define LBA_SIZE 512
 
 
-// fill comparebuf with the data to be examined, returning true on success.
-static int FillBuffer(CgptFindParams *params, int fd, uint64_t pos,
-                       uint64_t count) {
-  uint8_t *bufptr = params->comparebuf;
-
-  if (-1 == lseek(fd, pos, SEEK_SET))
-    return 0;
+// read exactly count bytes at pos into buf, returning true on success.
+static int ReadFully(int fd, uint8_t *buf, uint64_t pos, uint64_t count) {
+  uint64_t done = 0;
 
   // keep reading until done or error
-  while (count) {
-    ssize_t bytes_read = read(fd, bufptr, count);
+  while (done < count) {
+    ssize_t bytes_read = pread(fd, buf + done, count - done, pos + done);
     // negative means error, 0 means (unexpected) EOF
     if (bytes_read <= 0)
       return 0;
-    count -= bytes_read;
-    bufptr += bytes_read;
+    done += bytes_read;
   }
+  return 1;
+}
 
+// fill comparebuf with the data to be examined, returning true on success.
+// The data isn't read again if the previous call already brought in the same
+// region.
+static int FillBuffer(CgptFindParams *params, int fd, uint64_t pos,
+                       uint64_t count) {
+  if (params->comparelen && pos == params->comparepos &&
+      count <= params->comparelen)
+    return 1;
+  params->comparelen = 0;
+
+  if (!ReadFully(fd, params->comparebuf, pos, count))
+    return 0;
+
+  params->comparepos = pos;
+  params->comparelen = count;
   return 1;
 }
 
@@ -43,28 +55,59 @@ static int FillBuffer(CgptFindParams *params, int fd, uint64_t pos,
 static int match_content(CgptFindParams *params, struct drive *drive,
                              GptEntry *entry) {
   uint64_t part_size;
+  uint64_t window;
+  uint64_t pos, count, keep;
 
   if (!params->matchlen)
     return 1;
 
+  // Partition data doesn't live with GPT structs kept in memory.
+  if (drive->image) {
+    Error("unable to read partition data\n");
+    return 0;
+  }
+
   // Ensure that the region we want to match against is inside the partition.
   part_size = LBA_SIZE * (entry->ending_lba - entry->starting_lba + 1);
   if (params->matchoffset + params->matchlen > part_size) {
     return 0;
   }
 
-  // Read the partition data.
-  if (!FillBuffer(params,
-                  drive->fd,
-                  (LBA_SIZE * entry->starting_lba) + params->matchoffset,
-                  params->matchlen)) {
+  // The content may start anywhere within matchrange bytes past the offset,
+  // as long as it still ends inside the partition.
+  window = params->matchlen + params->matchrange;
+  if (window > part_size - params->matchoffset)
+    window = part_size - params->matchoffset;
+
+  // Search it a buffer at a time. Each buffer after the first starts with
+  // the last matchlen - 1 bytes of the one before, so content straddling
+  // the boundary is still found.
+  pos = (LBA_SIZE * entry->starting_lba) + params->matchoffset;
+  count = window < params->comparesize ? window : params->comparesize;
+  keep = params->matchlen - 1;
+  if (!FillBuffer(params, drive->fd, pos, count)) {
     Error("unable to read partition data\n");
     return 0;
   }
 
-  // Compare it
-  if (0 == memcmp(params->matchbuf, params->comparebuf, params->matchlen)) {
-    return 1;
+  for (;;) {
+    // Look for it
+    if (memmem(params->comparebuf, count, params->matchbuf, params->matchlen))
+      return 1;
+    if (count == window)
+      break;
+
+    // Slide along, and read what follows the bytes we kept.
+    window -= count - keep;
+    pos += count - keep;
+    memmove(params->comparebuf, params->comparebuf + count - keep, keep);
+    count = window < params->comparesize ? window : params->comparesize;
+    params->comparelen = 0;
+    if (!ReadFully(drive->fd, params->comparebuf + keep, pos + keep,
+                   count - keep)) {
+      Error("unable to read partition data\n");
+      return 0;
+    }
   }
 
   // Nope.
@@ -111,6 +154,30 @@ static void chromeos_mtd_show(CgptFindParams *params, char *filename,
   }
 }
 
+// Convert a label to the UTF-16 name a GPT entry would need to have it. Returns
+// false if no entry could have that name.
+static int label_to_name(const char *label, uint16_t *name, unsigned int units) {
+  unsigned int len;
+
+  // Leave room to notice labels that are too long.
+  if (CGPT_OK != UTF8ToUTF16((const uint8_t *)label, name, units + 2))
+    return 0;
+  for (len = 0; name[len]; len++)
+    ;
+  return len <= units;
+}
+
+// Flag every entry whose key of the given kind matches.
+static void mark_matches(struct drive *drive, const GptEntry *entries,
+                         uint32_t num, int kind, const void *key,
+                         uint8_t *found) {
+  int i;
+
+  for (i = GptIndexFind(&drive->gpt, entries, num, kind, key, -1); i >= 0;
+       i = GptIndexFind(&drive->gpt, entries, num, kind, key, i))
+    found[i] = 1;
+}
+
 // This returns true if a GPT partition matches the search criteria. If a match
 // isn't found (or if the file doesn't contain a GPT), it returns false. The
 // filename and partition number that matched is left in a global, since we
@@ -118,35 +185,39 @@ static void chromeos_mtd_show(CgptFindParams *params, char *filename,
 static int gpt_search(CgptFindParams *params, struct drive *drive,
                       char *filename) {
   int i;
-  GptEntry *entry;
+  GptEntry *entries;
+  uint32_t num;
   int retval = 0;
-  char partlabel[GPT_PARTNAME_LEN];
+  uint8_t found[MAX_NUMBER_OF_ENTRIES];
+  uint16_t name[sizeof(entries->name) / sizeof(entries->name[0]) + 2];
 
-  if (GPT_SUCCESS != GptSanityCheck(&drive->gpt)) {
+  if (GPT_SUCCESS != DriveSanityCheck(drive)) {
     return 0;
   }
 
-  for (i = 0; i < GetNumberOfEntries(drive); ++i) {
-    entry = GetEntry(&drive->gpt, ANY_VALID, i);
-
-    if (GuidIsZero(&entry->type))
-      continue;
-
-    int found = 0;
-    if ((params->set_unique && GuidEqual(&params->unique_guid, &entry->unique))
-        || (params->set_type && GuidEqual(&params->type_guid, &entry->type))) {
-      found = 1;
-    } else if (params->set_label) {
-      if (CGPT_OK != UTF16ToUTF8(entry->name,
-                                 sizeof(entry->name) / sizeof(entry->name[0]),
-                                 (uint8_t *)partlabel, sizeof(partlabel))) {
-        Error("The label cannot be converted from UTF16, so abort.\n");
-        return 0;
-      }
-      if (!strncmp(params->label, partlabel, sizeof(partlabel)))
-        found = 1;
-    }
-    if (found && match_content(params, drive, entry)) {
+  num = GetNumberOfEntries(drive);
+  if (num > MAX_NUMBER_OF_ENTRIES)
+    return 0;
+  entries = GetEntry(&drive->gpt, ANY_VALID, 0);
+
+  // Look the criteria up in the GPT's index rather than comparing (and
+  // converting the label of) every entry.
+  memset(found, 0, sizeof(found));
+  if (params->set_unique)
+    mark_matches(drive, entries, num, GPT_INDEX_UNIQUE, &params->unique_guid,
+                 found);
+  if (params->set_type)
+    mark_matches(drive, entries, num, GPT_INDEX_TYPE, &params->type_guid,
+                 found);
+  if (params->set_label &&
+      label_to_name(params->label, name,
+                    sizeof(entries->name) / sizeof(entries->name[0])))
+    mark_matches(drive, entries, num, GPT_INDEX_LABEL, name, found);
+
+  for (i = 0; i < num; ++i) {
+    GptEntry *entry = entries + i;
+
+    if (found[i] && match_content(params, drive, entry)) {
       params->hits++;
       retval++;
       showmatch(params, filename, i+1, entry);
@@ -165,6 +236,9 @@ static int do_search(CgptFindParams *params, char *fileName) {
   if (CGPT_OK != DriveOpen(fileName, &drive, O_RDONLY, params->drive_size))
     return 0;
 
+  // Data read from another drive can't be shared.
+  params->comparelen = 0;
+
   retval = gpt_search(params, &drive, fileName);
 
   (void) DriveClose(&drive, 0);
@@ -273,26 +347,19 @@ static int scan_real_devs(CgptFindParams *params) {
                partname, &sz, &erasesz, name) != 4)
       continue;
     if (strcmp(partname, "mtd0") == 0) {
-      char temp_dir[] = "/tmp/cgpt_find.XXXXXX";
-      if (params->drive_size == 0) {
-        if (GetMtdSize("/dev/mtd0", &params->drive_size) != 0) {
-          perror("GetMtdSize");
-          goto cleanup;
-        }
-      }
-      if (ReadNorFlash(temp_dir) != 0) {
-        perror("ReadNorFlash");
+      char nor_file[] = "/dev/mtd0";
+      uint8_t *nor_image;
+      uint64_t nor_image_size;
+      if (OpenNorImage(nor_file, &nor_image, &nor_image_size) != 0) {
+        perror("OpenNorImage");
         goto cleanup;
       }
-      char nor_file[64];
-      if (snprintf(nor_file, sizeof(nor_file), "%s/rw_gpt", temp_dir) > 0) {
-        params->show_fn = chromeos_mtd_show;
-        if (do_search(params, nor_file)) {
-          found++;
-        }
-        params->show_fn = NULL;
+      params->show_fn = chromeos_mtd_show;
+      if (do_search(params, nor_file)) {
+        found++;
       }
-      RemoveDir(temp_dir);
+      params->show_fn = NULL;
+      CloseNorImage(nor_image, nor_image_size);
       break;
     }
   }
@@ -6,7 +6,6 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <ftw.h>
 #include <inttypes.h>
 #include <linux/major.h>
 #include <stdbool.h>
@@ -15,7 +14,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -92,168 +93,125 @@ int ForkExecL(const char *cwd, const char *cmd, ...) {
   return ret;
 }
 
-static int read_write(int source_fd,
-                      uint64_t size,
-                      const char *src_name,
-                      int idx) {
-  int ret = 1;
-  const int bufsize = 4096;
-  char *buf = malloc(bufsize);
-  if (buf == NULL) {
-    goto clean_exit;
-  }
-
-  ret++;
-  char *dest;
-  if (asprintf(&dest, "%s_%d", src_name, idx) == -1) {
-    goto free_buf;
-  }
-
-  ret++;
-  int dest_fd = open(dest, O_WRONLY | O_CLOEXEC | O_CREAT, 0600);
-  if (dest_fd < 0) {
-    goto free_dest;
+// Create an in-memory file holding |size| bytes of |data| (if non-NULL), and
+// store a path through which a child process can open it in |path|.
+static int create_mem_file(const char *name, const uint8_t *data,
+                           uint64_t size, char *path, size_t path_len) {
+  int fd = memfd_create(name, 0);
+  if (fd < 0) {
+    return -1;
   }
-
-  ret++;
-  uint64_t copied = 0;
-  ssize_t nr_read;
-  ssize_t nr_write;
-  while (copied < size) {
-    size_t to_read = size - copied;
-    if (to_read > bufsize) {
-      to_read = bufsize;
-    }
-    nr_read = read(source_fd, buf, to_read);
-    if (nr_read < 0) {
-      goto close_dest_fd;
-    }
-    nr_write = 0;
-    while (nr_write < nr_read) {
-      ssize_t s = write(dest_fd, buf + nr_write, nr_read - nr_write);
+  if (data) {
+    uint64_t written = 0;
+    while (written < size) {
+      ssize_t s = write(fd, data + written, size - written);
       if (s < 0) {
-        goto close_dest_fd;
+        close(fd);
+        return -1;
       }
-      nr_write += s;
+      written += s;
     }
-    copied += nr_read;
   }
+  // flashrom runs as our child and inherits |fd|, so it can reopen it here.
+  snprintf(path, path_len, "/proc/self/fd/%d", fd);
+  return fd;
+}
 
-  ret = 0;
-
-close_dest_fd:
-  close(dest_fd);
-free_dest:
-  free(dest);
-free_buf:
-  free(buf);
-clean_exit:
+// Run flashrom with stdout closed so that it does not muck up cgpt's output.
+static int run_flashrom(const char *region, const char *op,
+                        const char *extra) {
+  int ret;
+  int fd_flags = fcntl(1, F_GETFD);
+  if (0 != fcntl(1, F_SETFD, FD_CLOEXEC))
+    Warning("Can't stop flashrom from mucking up our output\n");
+  ret = ForkExecL(NULL, FLASHROM_PATH, "-i", region, op, extra, NULL);
+  if (0 != fcntl(1, F_SETFD, fd_flags))
+    Warning("Can't restore stdout flags\n");
   return ret;
 }
 
-static int split_gpt(const char *dir_name, const char *file_name) {
-  int ret = 1;
-  char *source;
-  if (asprintf(&source, "%s/%s", dir_name, file_name) == -1) {
-    goto clean_exit;
-  }
+int ReadNorFlash(uint8_t **data, uint64_t *size) {
+  int ret = 0;
+  char path[32];
+  char region[48];
+
+  *data = NULL;
+  *size = 0;
 
   ret++;
-  int fd = open(source, O_RDONLY | O_CLOEXEC);
+  int fd = create_mem_file("rw_gpt", NULL, 0, path, sizeof(path));
   if (fd < 0) {
-    goto free_source;
+    Error("Cannot create an in-memory file for RW_GPT.\n");
+    return ret;
   }
 
+  // Read RW_GPT section from NOR flash straight into the in-memory file.
   ret++;
-  struct stat stat;
-  if (fstat(fd, &stat) != 0 || (stat.st_size & 1) != 0) {
+  snprintf(region, sizeof(region), "RW_GPT:%s", path);
+  if (run_flashrom(region, "-r", NULL) != 0) {
+    Error("Cannot exec flashrom to read from RW_GPT section.\n");
     goto close_fd;
   }
-  uint64_t half_size = stat.st_size / 2;
 
   ret++;
-  if (read_write(fd, half_size, source, 1) != 0 ||
-      read_write(fd, half_size, source, 2) != 0) {
+  struct stat stat;
+  if (fstat(fd, &stat) != 0 || stat.st_size <= 0 || (stat.st_size & 1) != 0) {
+    Error("Unexpected RW_GPT section size.\n");
     goto close_fd;
   }
-
+  *data = malloc(stat.st_size);
+  if (*data == NULL) {
+    goto close_fd;
+  }
+  if (pread(fd, *data, stat.st_size, 0) != stat.st_size) {
+    Error("Cannot read back RW_GPT section.\n");
+    free(*data);
+    *data = NULL;
+    goto close_fd;
+  }
+  *size = stat.st_size;
   ret = 0;
+
 close_fd:
   close(fd);
-free_source:
-  free(source);
-clean_exit:
   return ret;
 }
 
-static int remove_file_or_dir(const char *fpath, const struct stat *sb,
-                              int typeflag, struct FTW *ftwbuf) {
-  return remove(fpath);
-}
-
-int RemoveDir(const char *dir) {
-  return nftw(dir, remove_file_or_dir, 20, FTW_DEPTH | FTW_PHYS);
-}
-
-// Read RW_GPT from NOR flash to "rw_gpt" in a temp dir |temp_dir_template|.
-// |temp_dir_template| is passed to mkdtemp() so it must satisfy all
-// requirements by mkdtemp.
-int ReadNorFlash(char *temp_dir_template) {
-  int ret = 0;
+// Write one half of RW_GPT to |region_name| with flashrom.
+static int write_half(const char *region_name, const uint8_t *data,
+                      uint64_t size) {
+  char path[32];
+  char region[48];
+  int ret = 1;
 
-  // Create a temp dir to work in.
-  ret++;
-  if (mkdtemp(temp_dir_template) == NULL) {
-    Error("Cannot create a temporary directory.\n");
+  int fd = create_mem_file(region_name, data, size, path, sizeof(path));
+  if (fd < 0) {
     return ret;
   }
-
-  // Read RW_GPT section from NOR flash to "rw_gpt".
-  ret++;
-  int fd_flags = fcntl(1, F_GETFD);
-  // Close stdout on exec so that flashrom does not muck up cgpt's output.
-  if (0 != fcntl(1, F_SETFD, FD_CLOEXEC))
-    Warning("Can't stop flashrom from mucking up our output\n");
-  if (ForkExecL(temp_dir_template, FLASHROM_PATH, "-i", "RW_GPT:rw_gpt", "-r",
-                NULL) != 0) {
-    Error("Cannot exec flashrom to read from RW_GPT section.\n");
-    RemoveDir(temp_dir_template);
-  } else {
-    ret = 0;
-  }
-
-  // Restore stdout flags
-  if (0 != fcntl(1, F_SETFD, fd_flags))
-    Warning("Can't restore stdout flags\n");
+  snprintf(region, sizeof(region), "%s:%s", region_name, path);
+  ret = run_flashrom(region, "-w", "--fast-verify");
+  close(fd);
   return ret;
 }
 
-// Write "rw_gpt" back to NOR flash. We write the file in two parts for safety.
-int WriteNorFlash(const char *dir) {
+int WriteNorFlash(const uint8_t *data, uint64_t size) {
   int ret = 0;
   ret++;
-  if (split_gpt(dir, "rw_gpt") != 0) {
+  if ((size & 1) != 0) {
     Error("Cannot split rw_gpt in two.\n");
     return ret;
   }
   ret++;
   int nr_fails = 0;
-  int fd_flags = fcntl(1, F_GETFD);
-  // Close stdout on exec so that flashrom does not muck up cgpt's output.
-  if (0 != fcntl(1, F_SETFD, FD_CLOEXEC))
-    Warning("Can't stop flashrom from mucking up our output\n");
-  if (ForkExecL(dir, FLASHROM_PATH, "-i", "RW_GPT_PRIMARY:rw_gpt_1",
-                "-w", "--fast-verify", NULL) != 0) {
+  uint64_t half_size = size / 2;
+  if (write_half("RW_GPT_PRIMARY", data, half_size) != 0) {
     Warning("Cannot write the 1st half of rw_gpt back with flashrom.\n");
     nr_fails++;
   }
-  if (ForkExecL(dir, FLASHROM_PATH, "-i", "RW_GPT_SECONDARY:rw_gpt_2",
-                "-w", "--fast-verify", NULL) != 0) {
+  if (write_half("RW_GPT_SECONDARY", data + half_size, half_size) != 0) {
     Warning("Cannot write the 2nd half of rw_gpt back with flashrom.\n");
     nr_fails++;
   }
-  if (0 != fcntl(1, F_SETFD, fd_flags))
-    Warning("Can't restore stdout flags\n");
   switch (nr_fails) {
     case 0: ret = 0; break;
     case 1: Warning("It might still be okay.\n"); break;
@@ -261,3 +219,69 @@ int WriteNorFlash(const char *dir) {
   }
   return ret;
 }
+
+// Check if cmdline |argv| has "-D". "-D" signifies that GPT structs are stored
+// off device, and hence we should not read them from NOR flash.
+static bool has_dash_D(int argc, const char *const argv[]) {
+  int i;
+  // We go from 2, because the second arg is a cgpt command such as "create".
+  for (i = 2; i < argc; ++i) {
+    if (strcmp("-D", argv[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Check if |device_path| is an MTD device based on its major number being 90.
+static bool is_mtd(const char *device_path) {
+  struct stat stat;
+  if (lstat(device_path, &stat) != 0) {
+    return false;
+  }
+
+  if (major(stat.st_rdev) != MTD_CHAR_MAJOR) {
+    return false;
+  }
+
+  return true;
+}
+
+const char *FindMtdDevice(int argc, const char *const argv[]) {
+  int i;
+  if (has_dash_D(argc, argv)) {
+    return NULL;
+  }
+  for (i = 2; i < argc; ++i) {
+    if (is_mtd(argv[i])) {
+      return argv[i];
+    }
+  }
+  return NULL;
+}
+
+int OpenNorImage(const char *mtd_device, uint8_t **data, uint64_t *size) {
+  uint64_t drive_size = 0;
+
+  if (GetMtdSize(mtd_device, &drive_size) != 0) {
+    Error("Cannot get the size of %s.\n", mtd_device);
+    return 1;
+  }
+  if (ReadNorFlash(data, size) != 0) {
+    return 1;
+  }
+  DriveSetImage(mtd_device, *data, *size, drive_size);
+  return 0;
+}
+
+int CloseNorImage(uint8_t *data, uint64_t size) {
+  int ret = 0;
+
+  // Only touch the flash if cgpt actually saved something.
+  if (DriveImageModified()) {
+    ret = WriteNorFlash(data, size);
+  }
+  DriveSetImage(NULL, NULL, 0, 0);
+  free(data);
+  return ret;
+}
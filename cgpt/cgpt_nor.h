@@ -3,7 +3,8 @@
  * found in the LICENSE file.
  *
  * This module provides some utility functions to use "flashrom" to read from
- * and write to NOR flash.
+ * and write to NOR flash. The GPT read from NOR flash is kept in memory and
+ * only written back when modified.
  */
 
 #ifndef VBOOT_REFERCENCE_CGPT_CGPT_NOR_H_
@@ -20,15 +21,28 @@ int ForkExecV(const char *cwd, const char *const argv[]);
 // Similar to ForkExecV but with a vararg instead of an array of pointers.
 int ForkExecL(const char *cwd, const char *cmd, ...);
 
-// Exec "rm" to remove |dir|.
-int RemoveDir(const char *dir);
-
-// Read RW_GPT from NOR flash to "rw_gpt" in a temp dir |temp_dir_template|.
-// |temp_dir_template| is passed to mkdtemp() so it must satisfy all
-// requirements by mkdtemp().
-int ReadNorFlash(char *temp_dir_template);
-
-// Write "rw_gpt" back to NOR flash. We write the file in two parts for safety.
-int WriteNorFlash(const char *dir);
+// Read RW_GPT from NOR flash into a newly allocated buffer |*data| of |*size|
+// bytes. flashrom writes into an in-memory file, so no temp dir is needed.
+// The caller must free |*data|. This function returns 0 on success.
+int ReadNorFlash(uint8_t **data, uint64_t *size);
+
+// Write |data| back to NOR flash as RW_GPT. We write it in two parts for
+// safety. This function returns 0 on success.
+int WriteNorFlash(const uint8_t *data, uint64_t size);
+
+// Return the element in |argv| that is an MTD device, or NULL if there is
+// none or if "-D" is given, which signifies that GPT structs are stored off
+// device.
+const char *FindMtdDevice(int argc, const char *const argv[]);
+
+// Read RW_GPT from NOR flash and register it with DriveSetImage() so that
+// DriveOpen() on |mtd_device| works on it in memory. The size of the MTD is
+// used as the drive size. Returns 0 on success, in which case the caller must
+// hand |*data| and |*size| back to CloseNorImage().
+int OpenNorImage(const char *mtd_device, uint8_t **data, uint64_t *size);
+
+// Unregister the image from OpenNorImage() and free it, writing it back to NOR
+// flash first if anything was saved to it. Returns 0 on success.
+int CloseNorImage(uint8_t *data, uint64_t size);
 
 #endif  // VBOOT_REFERCENCE_CGPT_CGPT_NOR_H_
@@ -178,7 +178,7 @@ void EntriesDetails(struct drive *drive, const int secondary, int raw) {
 
 static int GptShow(struct drive *drive, CgptShowParams *params) {
   int gpt_retval;
-  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive->gpt))) {
+  if (GPT_SUCCESS != (gpt_retval = DriveSanityCheck(drive))) {
     Error("GptSanityCheck() returned %d: %s\n",
           gpt_retval, GptError(gpt_retval));
     return CGPT_FAILED;
@@ -29,6 +29,9 @@ static void Usage(void)
          "      Matching partition data must also contain FILE content\n"
          "  -O NUM"
          "       Byte offset into partition to match content (default 0)\n"
+         "  -R NUM"
+         "       Content may also start up to NUM bytes past the offset\n"
+         "                 (default 0)\n"
          "\n", progname);
   PrintTypes();
 }
@@ -80,7 +83,7 @@ int cmd_find(int argc, char *argv[]) {
   int c;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hv1nt:u:l:M:O:D:")) != -1)
+  while ((c=getopt(argc, argv, ":hv1nt:u:l:M:O:R:D:")) != -1)
   {
     switch (c)
     {
@@ -122,18 +125,15 @@ int cmd_find(int argc, char *argv[]) {
         Error("Unable to read from %s\n", optarg);
         errorcnt++;
       }
-      // Go ahead and allocate space for the comparison too
-      params.comparebuf = (uint8_t *)malloc(params.matchlen);
-      if (!params.comparebuf) {
-        Error("Unable to allocate %" PRIu64 "bytes for comparison buffer\n",
-              params.matchlen);
-        errorcnt++;
-      }
       break;
     case 'O':
       params.matchoffset = strtoull(optarg, &e, 0);
       errorcnt += check_int_parse(c, e);
       break;
+    case 'R':
+      params.matchrange = strtoull(optarg, &e, 0);
+      errorcnt += check_int_parse(c, e);
+      break;
 
     case 'h':
       Usage();
@@ -155,6 +155,19 @@ int cmd_find(int argc, char *argv[]) {
     Error("You must specify at least one of -t, -u, or -l\n");
     errorcnt++;
   }
+  if (params.matchlen) {
+    // Go ahead and allocate space for the comparison too. However large the
+    // range is, it's searched one window at a time.
+    uint64_t chunk = params.matchrange < CGPT_FIND_CHUNK ?
+        params.matchrange + 1 : CGPT_FIND_CHUNK;
+    params.comparesize = params.matchlen - 1 + chunk;
+    if (params.comparesize < params.matchlen ||
+        !(params.comparebuf = (uint8_t *)malloc(params.comparesize))) {
+      Error("Unable to allocate %" PRIu64 "bytes for comparison buffer\n",
+            params.comparesize);
+      errorcnt++;
+    }
+  }
   if (errorcnt)
   {
     Usage();
@@ -14,8 +14,17 @@ struct BmpBlockHeader;
 struct ImageInfo;
 struct GoogleBinaryBlockHeader;
 struct ScreenLayout;
+struct VbImageCache;
 struct VbPublicKey;
 
+/*
+ * Bytes of decoded images and layouts VbGbbReadImageCached() may keep. Set
+ * IMAGE_CACHE_SIZE when building to change it; 0 turns the cache off.
+ */
+#ifndef VB_IMAGE_CACHE_SIZE
+#define VB_IMAGE_CACHE_SIZE (2 * 1024 * 1024)
+#endif
+
 /**
  * Read the GBB header
  *
@@ -80,4 +89,29 @@ VbError_t VbGbbReadImage(VbCommonParams *cparams,
 			 struct ImageInfo *image_info, char **image_datap,
 			 uint32_t *image_data_sizep);
 
+/**
+ * Read a image from the GBB, through a cache of decoded images
+ *
+ * Like VbGbbReadImage(), but the most recently used images, layouts and
+ * missing images are kept in cparams, up to VB_IMAGE_CACHE_SIZE bytes, so
+ * redrawing a screen doesn't read or decompress anything again.
+ *
+ * The caller must NOT free *image_datap. It stays valid until the next call
+ * to this function or VbGbbFreeImageCache().
+ *
+ * Parameters and return value are the same as for VbGbbReadImage().
+ */
+VbError_t VbGbbReadImageCached(VbCommonParams *cparams,
+			       uint32_t localization, uint32_t screen_index,
+			       uint32_t image_num, struct ScreenLayout *layout,
+			       struct ImageInfo *image_info,
+			       char **image_datap, uint32_t *image_data_sizep);
+
+/**
+ * Free the images kept by VbGbbReadImageCached()
+ *
+ * @param cparams	Vboot common parameters
+ */
+void VbGbbFreeImageCache(VbCommonParams *cparams);
+
 #endif
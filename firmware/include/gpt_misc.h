@@ -65,6 +65,29 @@ enum {
 /* If this bit is 1, the GPT is stored in another from the streaming data */
 #define GPT_FLAG_EXTERNAL	0x1
 
+/*
+ * Hash index over one GPT entries array, by type GUID, unique GUID and label.
+ * Bucket heads and chains hold an entry number plus one, so zero ends a chain;
+ * chains are in table order.  Unused entries aren't indexed.
+ */
+#define GPT_INDEX_MAX_ENTRIES 128
+#define GPT_INDEX_BUCKETS 64
+
+enum {
+	GPT_INDEX_TYPE = 0,
+	GPT_INDEX_UNIQUE,
+	GPT_INDEX_LABEL,
+	GPT_INDEX_KINDS,
+};
+
+typedef struct {
+	/* Entries array the index describes, or NULL if not built */
+	const void *entries;
+	uint32_t number_of_entries;
+	uint8_t head[GPT_INDEX_KINDS][GPT_INDEX_BUCKETS];
+	uint8_t next[GPT_INDEX_KINDS][GPT_INDEX_MAX_ENTRIES];
+} GptIndex;
+
 /*
  * A note about stored_on_device and gpt_drive_sectors:
  *
@@ -110,6 +133,8 @@ typedef struct {
 	/* Internal variables */
 	uint8_t valid_headers, valid_entries, ignored;
 	int current_priority;
+	/* Built on the first lookup, dropped when the entries change */
+	GptIndex index;
 } GptData;
 
 /**
@@ -193,6 +193,7 @@ typedef struct VbCommonParams {
 	/* For internal use of Vboot - do not examine or modify! */
 	struct GoogleBinaryBlockHeader *gbb;
 	struct BmpBlockHeader *bmp;
+	struct VbImageCache *image_cache;
 } VbCommonParams;
 
 /* Flags for VbInitParams.flags */
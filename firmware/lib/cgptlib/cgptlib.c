@@ -216,17 +216,33 @@ int GptUpdateKernelEntry(GptData *gpt, uint32_t update_type)
  */
 GptEntry *GptFindNthEntry(GptData *gpt, const Guid *guid, unsigned int n)
 {
+	static const Guid guid_unused = GPT_ENT_TYPE_UNUSED;
 	GptHeader *header = (GptHeader *)gpt->primary_header;
 	GptEntry *entries = (GptEntry *)gpt->primary_entries;
 	GptEntry *e;
 	int i;
 
-	for (i = 0, e = entries; i < header->number_of_entries; i++, e++) {
-		if (!memcmp(&e->type, guid, sizeof(*guid))) {
-			if (n == 0)
-				return e;
-			n--;
+	/* Unused entries aren't in the index, so walk the table for those. */
+	if (!memcmp(guid, &guid_unused, sizeof(*guid))) {
+		for (i = 0, e = entries; i < header->number_of_entries;
+		     i++, e++) {
+			if (!memcmp(&e->type, guid, sizeof(*guid))) {
+				if (n == 0)
+					return e;
+				n--;
+			}
 		}
+		return NULL;
+	}
+
+	for (i = GptIndexFind(gpt, entries, header->number_of_entries,
+			      GPT_INDEX_TYPE, guid, -1);
+	     i >= 0;
+	     i = GptIndexFind(gpt, entries, header->number_of_entries,
+			      GPT_INDEX_TYPE, guid, i)) {
+		if (n == 0)
+			return entries + i;
+		n--;
 	}
 
 	return NULL;
@@ -12,6 +12,17 @@
 #include "gpt_misc.h"
 #include "utility.h"
 
+#ifdef FOR_TEST
+/*
+ * Compiling for the benchmark, which counts the GptEntry structs the checks
+ * read so it can compare them with the way they used to be checked.
+ */
+uint64_t gpt_entry_reads;
+#define COUNT_ENTRY_READ() (gpt_entry_reads++)
+#else
+#define COUNT_ENTRY_READ()
+#endif
+
 const static int SECTOR_SIZE = 512;
 
 size_t CalculateEntriesSectors(GptHeader* h)
@@ -157,27 +168,58 @@ int IsKernelEntry(const GptEntry *e)
 	return !memcmp(&e->type, &chromeos_kernel, sizeof(Guid));
 }
 
-int CheckEntries(GptEntry *entries, GptHeader *h)
+int ScanEntries(GptEntriesScan *scan, const GptEntry *entries,
+		const GptHeader *h)
 {
-	if (!entries)
-		return GPT_ERROR_INVALID_ENTRIES;
-	GptEntry *entry;
-	uint32_t crc32;
+	const GptEntry *entry;
+	uint32_t crc32 = 0;
 	uint32_t i;
 
+	scan->size = 0;
+	scan->num_used = 0;
+
+	if (h->size_of_entry != sizeof(GptEntry) ||
+	    h->number_of_entries > MAX_NUMBER_OF_ENTRIES)
+		return 1;
+
+	/*
+	 * Checksum each entry and note whether it's used while it's still in
+	 * cache, rather than walking the whole array once for the CRC and
+	 * again for the entries.
+	 */
+	for (i = 0, entry = entries; i < h->number_of_entries; i++, entry++) {
+		COUNT_ENTRY_READ();
+		crc32 = Crc32Update(crc32, entry, sizeof(GptEntry));
+		if (!IsUnusedEntry(entry))
+			scan->used[scan->num_used++] = i;
+	}
+
+	scan->size = h->size_of_entry * h->number_of_entries;
+	scan->crc32 = crc32;
+	return 0;
+}
+
+int CheckScannedEntries(const GptEntry *entries, const GptHeader *h,
+			const GptEntriesScan *scan)
+{
+	const GptEntry *entry;
+	uint32_t i;
+
+	if (!scan->size ||
+	    scan->size != h->size_of_entry * h->number_of_entries)
+		return GPT_ERROR_INVALID_ENTRIES;
+
 	/* Check CRC before examining entries. */
-	crc32 = Crc32((const uint8_t *)entries,
-		      h->size_of_entry * h->number_of_entries);
-	if (crc32 != h->entries_crc32)
+	if (scan->crc32 != h->entries_crc32)
 		return GPT_ERROR_CRC_CORRUPTED;
 
-	/* Check all entries. */
-	for (i = 0, entry = entries; i < h->number_of_entries; i++, entry++) {
-		GptEntry *e2;
+	/* Check all used entries. */
+	for (i = 0; i < scan->num_used; i++) {
+		const GptEntry *e2;
 		uint32_t i2;
 
-		if (IsUnusedEntry(entry))
-			continue;
+		entry = entries + scan->used[i];
+		COUNT_ENTRY_READ();
 
 		/* Entry must be in valid region. */
 		if ((entry->starting_lba < h->first_usable_lba) ||
@@ -186,10 +228,11 @@ int CheckEntries(GptEntry *entries, GptHeader *h)
 			return GPT_ERROR_OUT_OF_REGION;
 
 		/* Entry must not overlap other entries. */
-		for (i2 = 0, e2 = entries; i2 < h->number_of_entries;
-		     i2++, e2++) {
-			if (i2 == i || IsUnusedEntry(e2))
+		for (i2 = 0; i2 < scan->num_used; i2++) {
+			if (i2 == i)
 				continue;
+			e2 = entries + scan->used[i2];
+			COUNT_ENTRY_READ();
 
 			if ((entry->starting_lba >= e2->starting_lba) &&
 			    (entry->starting_lba <= e2->ending_lba))
@@ -209,6 +252,36 @@ int CheckEntries(GptEntry *entries, GptHeader *h)
 	return 0;
 }
 
+int CheckEntries(GptEntry *entries, GptHeader *h)
+{
+	GptEntriesScan scan;
+
+	if (!entries)
+		return GPT_ERROR_INVALID_ENTRIES;
+
+	if (ScanEntries(&scan, entries, h))
+		return GPT_ERROR_INVALID_ENTRIES;
+
+	return CheckScannedEntries(entries, h, &scan);
+}
+
+/*
+ * Check entries against header h, scanning the array only if the previous
+ * scan doesn't cover the size h describes.
+ */
+static int CheckEntriesWithScan(GptEntry *entries, GptHeader *h,
+				GptEntriesScan *scan)
+{
+	if (!entries)
+		return GPT_ERROR_INVALID_ENTRIES;
+
+	if (scan->size != h->size_of_entry * h->number_of_entries &&
+	    ScanEntries(scan, entries, h))
+		return GPT_ERROR_INVALID_ENTRIES;
+
+	return CheckScannedEntries(entries, h, scan);
+}
+
 int HeaderFieldsSame(GptHeader *h1, GptHeader *h2)
 {
 	if (memcmp(h1->signature, h2->signature, sizeof(h1->signature)))
@@ -243,7 +316,10 @@ int GptSanityCheck(GptData *gpt)
 	GptEntry *entries1 = (GptEntry *)(gpt->primary_entries);
 	GptEntry *entries2 = (GptEntry *)(gpt->secondary_entries);
 	GptHeader *goodhdr = NULL;
+	GptEntriesScan scan1, scan2;
 
+	scan1.size = scan2.size = 0;
+	GptIndexInvalidate(gpt);
 	gpt->valid_headers = 0;
 	gpt->valid_entries = 0;
 	gpt->ignored = 0;
@@ -280,10 +356,13 @@ int GptSanityCheck(GptData *gpt)
 	 * Note that we use the same header in both checks.  This way we'll
 	 * catch the case where (header1,entries1) and (header2,entries2) are
 	 * both valid, but (entries1 != entries2).
+	 *
+	 * Each array is scanned once; checking it against another header
+	 * below reuses the scan.
 	 */
-	if (0 == CheckEntries(entries1, goodhdr))
+	if (0 == CheckEntriesWithScan(entries1, goodhdr, &scan1))
 		gpt->valid_entries |= MASK_PRIMARY;
-	if (0 == CheckEntries(entries2, goodhdr))
+	if (0 == CheckEntriesWithScan(entries2, goodhdr, &scan2))
 		gpt->valid_entries |= MASK_SECONDARY;
 
 	/*
@@ -291,9 +370,9 @@ int GptSanityCheck(GptData *gpt)
 	 * entries with the secondary header.
 	 */
 	if (MASK_BOTH == gpt->valid_headers && !gpt->valid_entries) {
-		if (0 == CheckEntries(entries1, header2))
+		if (0 == CheckEntriesWithScan(entries1, header2, &scan1))
 			gpt->valid_entries |= MASK_PRIMARY;
-		if (0 == CheckEntries(entries2, header2))
+		if (0 == CheckEntriesWithScan(entries2, header2, &scan2))
 			gpt->valid_entries |= MASK_SECONDARY;
 		if (gpt->valid_entries) {
 			/*
@@ -370,11 +449,13 @@ void GptRepair(GptData *gpt)
 		/* Primary is good, secondary is bad */
 		memcpy(entries2, entries1, entries_size);
 		gpt->modified |= GPT_MODIFIED_ENTRIES2;
+		GptIndexInvalidate(gpt);
 	}
 	else if (MASK_SECONDARY == gpt->valid_entries) {
 		/* Secondary is good, primary is bad */
 		memcpy(entries1, entries2, entries_size);
 		gpt->modified |= GPT_MODIFIED_ENTRIES1;
+		GptIndexInvalidate(gpt);
 	}
 	gpt->valid_entries = MASK_BOTH;
 }
@@ -445,24 +526,163 @@ void GetCurrentKernelUniqueGuid(GptData *gpt, void *dest)
 
 void GptModified(GptData *gpt) {
 	GptHeader *header = (GptHeader *)gpt->primary_header;
+	uint32_t entries_size = header->size_of_entry *
+		header->number_of_entries;
+	uint32_t crc32 = 0;
+	uint32_t offset, chunk;
+
+	/*
+	 * Copy the primary entries over the secondary ones and update their
+	 * CRC in the same pass, so GptRepair() has no entries left to copy.
+	 */
+	for (offset = 0; offset < entries_size; offset += chunk) {
+		chunk = entries_size - offset;
+		if (chunk > sizeof(GptEntry))
+			chunk = sizeof(GptEntry);
+		memcpy(gpt->secondary_entries + offset,
+		       gpt->primary_entries + offset, chunk);
+		crc32 = Crc32Update(crc32, gpt->primary_entries + offset,
+				    chunk);
+	}
+
+	GptIndexInvalidate(gpt);
 
 	/* Update the CRCs */
-	header->entries_crc32 = Crc32(gpt->primary_entries,
-				      header->size_of_entry *
-				      header->number_of_entries);
+	header->entries_crc32 = crc32;
 	header->header_crc32 = HeaderCrc(header);
-	gpt->modified |= GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1;
+	gpt->modified |= GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1 |
+		GPT_MODIFIED_ENTRIES2;
 
-	/*
-	 * Use the repair function to update the other copy of the GPT.  This
-	 * is a tad inefficient, but is much faster than the disk I/O to update
-	 * the GPT on disk so it doesn't matter.
-	 */
+	/* Use the repair function to update the other header. */
 	gpt->valid_headers = MASK_PRIMARY;
-	gpt->valid_entries = MASK_PRIMARY;
+	gpt->valid_entries = MASK_BOTH;
 	GptRepair(gpt);
 }
 
+/* Number of UTF-16 units in a partition name, not counting any terminator */
+static uint32_t NameUnits(const uint16_t *name)
+{
+	const uint32_t max = sizeof(((GptEntry *)0)->name) / sizeof(uint16_t);
+	uint32_t n;
+
+	for (n = 0; n < max && name[n]; n++)
+		;
+	return n;
+}
+
+/* Return the bytes of the key of the given kind, and their size. */
+static const uint8_t *IndexKey(int kind, const void *key, uint32_t *size)
+{
+	if (kind == GPT_INDEX_LABEL) {
+		*size = NameUnits(key) * sizeof(uint16_t);
+	} else {
+		*size = sizeof(Guid);
+	}
+	return key;
+}
+
+static const void *EntryKey(const GptEntry *e, int kind)
+{
+	switch (kind) {
+	case GPT_INDEX_TYPE:
+		return &e->type;
+	case GPT_INDEX_UNIQUE:
+		return &e->unique;
+	default:
+		return e->name;
+	}
+}
+
+static uint32_t IndexBucket(const uint8_t *key, uint32_t size)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+	uint32_t i;
+
+	for (i = 0; i < size; i++)
+		hash = (hash ^ key[i]) * 16777619U;
+	return hash & (GPT_INDEX_BUCKETS - 1);
+}
+
+static int IndexMatch(const GptEntry *e, int kind, const uint8_t *key,
+		      uint32_t size)
+{
+	uint32_t esize;
+	const uint8_t *ekey = IndexKey(kind, EntryKey(e, kind), &esize);
+
+	return esize == size && !memcmp(ekey, key, size);
+}
+
+static void GptIndexBuild(GptData *gpt, const GptEntry *entries,
+			  uint32_t number_of_entries)
+{
+	GptIndex *index = &gpt->index;
+	const uint8_t *key;
+	uint32_t size, bucket;
+	uint32_t i;
+	int kind;
+
+	memset(index, 0, sizeof(*index));
+
+	/* Push the entries from the end so the chains come out in order. */
+	for (i = number_of_entries; i-- > 0; ) {
+		const GptEntry *e = entries + i;
+
+		if (IsUnusedEntry(e))
+			continue;
+
+		for (kind = 0; kind < GPT_INDEX_KINDS; kind++) {
+			key = IndexKey(kind, EntryKey(e, kind), &size);
+			bucket = IndexBucket(key, size);
+			index->next[kind][i] = index->head[kind][bucket];
+			index->head[kind][bucket] = i + 1;
+		}
+	}
+
+	index->entries = entries;
+	index->number_of_entries = number_of_entries;
+}
+
+int GptIndexFind(GptData *gpt, const GptEntry *entries,
+		 uint32_t number_of_entries, int kind, const void *key,
+		 int prev)
+{
+	GptIndex *index = &gpt->index;
+	const uint8_t *k;
+	uint32_t size;
+	uint32_t i;
+	uint8_t link;
+
+	k = IndexKey(kind, key, &size);
+
+	/* Tables too big to index are searched the slow way. */
+	if (number_of_entries > GPT_INDEX_MAX_ENTRIES) {
+		for (i = prev + 1; i < number_of_entries; i++) {
+			if (!IsUnusedEntry(entries + i) &&
+			    IndexMatch(entries + i, kind, k, size))
+				return i;
+		}
+		return -1;
+	}
+
+	if (index->entries != entries ||
+	    index->number_of_entries != number_of_entries)
+		GptIndexBuild(gpt, entries, number_of_entries);
+
+	for (link = index->head[kind][IndexBucket(k, size)]; link;
+	     link = index->next[kind][link - 1]) {
+		i = link - 1;
+		if ((int)i > prev && IndexMatch(entries + i, kind, k, size))
+			return i;
+	}
+
+	return -1;
+}
+
+void GptIndexInvalidate(GptData *gpt)
+{
+	gpt->index.entries = NULL;
+}
 
 const char *GptErrorText(int error_code)
 {
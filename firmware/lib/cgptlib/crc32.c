@@ -99,13 +99,18 @@ static uint32_t crc32_tab[] = {
 };
 
 
-uint32_t Crc32(const void *buffer, uint32_t len)
+uint32_t Crc32Update(uint32_t crc, const void *buffer, uint32_t len)
 {
 	uint8_t *byte = (uint8_t *)buffer;
 	uint32_t i;
-	uint32_t value = ~0U;
+	uint32_t value = crc ^ ~0U;
 
 	for (i = 0; i < len; ++i)
 		value = crc32_tab[(value ^ byte[i]) & 0xff] ^ (value >> 8);
 	return value ^ ~0U;
 }
+
+uint32_t Crc32(const void *buffer, uint32_t len)
+{
+	return Crc32Update(0, buffer, len);
+}
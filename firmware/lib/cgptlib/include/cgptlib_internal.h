@@ -98,6 +98,39 @@ int CheckHeader(GptHeader *h, int is_secondary,
  */
 uint32_t HeaderCrc(GptHeader *h);
 
+/*
+ * What a single walk over an entries array learns about it: the CRC of the
+ * whole array and the indices of the entries which are in use.  The array is
+ * only read once however many headers it is later checked against, and the
+ * per-entry checks only look at the entries which are in use.
+ */
+typedef struct {
+	/* Bytes covered by crc32; 0 if the array has not been scanned */
+	uint32_t size;
+	uint32_t crc32;
+	/* Indices of the used entries, in table order */
+	uint32_t num_used;
+	uint8_t used[MAX_NUMBER_OF_ENTRIES];
+} GptEntriesScan;
+
+/**
+ * Walk the entries array described by header h once, computing its CRC and
+ * collecting the used entries into scan.
+ *
+ * Returns 0 if successful, 1 if the header describes an array we can't parse.
+ */
+int ScanEntries(GptEntriesScan *scan, const GptEntry *entries,
+		const GptHeader *h);
+
+/**
+ * Check entries against header h, using the result of a previous
+ * ScanEntries() of the same array.  Only the used entries are touched.
+ *
+ * Returns 0 if entries are valid, else a GPT_ERROR_* code.
+ */
+int CheckScannedEntries(const GptEntry *entries, const GptHeader *h,
+			const GptEntriesScan *scan);
+
 /**
  * Check entries.
  *
@@ -142,6 +175,27 @@ void GptRepair(GptData *gpt);
  */
 void GptModified(GptData *gpt);
 
+/**
+ * Find the next used entry in entries (an array of number_of_entries) whose
+ * type GUID, unique GUID or label matches key, after entry prev; pass -1 for
+ * prev to find the first one.  For GPT_INDEX_LABEL the key is a UTF-16 name
+ * terminated by 0 unless it fills all 36 units.
+ *
+ * Builds gpt->index over the array the first time, so that later lookups don't
+ * need to walk the table.
+ *
+ * Returns the entry number, or -1 if there are no more matches.
+ */
+int GptIndexFind(GptData *gpt, const GptEntry *entries,
+		 uint32_t number_of_entries, int kind, const void *key,
+		 int prev);
+
+/**
+ * Forget the index built by GptIndexFind(); must be called whenever the entries
+ * are changed.
+ */
+void GptIndexInvalidate(GptData *gpt);
+
 /**
  * Return 1 if the entry is a Chrome OS kernel partition, else 0.
  */
@@ -9,4 +9,11 @@
 
 uint32_t Crc32(const void *buffer, uint32_t len);
 
+/*
+ * Continue a CRC over the next len bytes.  Crc32Update(0, ...) is the same as
+ * Crc32(), and feeding a buffer through in pieces gives the same result as
+ * feeding it all at once.
+ */
+uint32_t Crc32Update(uint32_t crc, const void *buffer, uint32_t len);
+
 #endif  /* VBOOT_REFERENCE_GPT_CRC32_H_ */
@@ -169,6 +169,153 @@ VbError_t VbGbbReadImage(VbCommonParams *cparams,
 	return VBERROR_SUCCESS;
 }
 
+/* One image, or the lack of one, kept by VbGbbReadImageCached() */
+struct VbImageCacheEntry {
+	struct VbImageCacheEntry *next;
+	uint32_t localization;
+	uint32_t screen_index;
+	uint32_t image_num;
+	VbError_t ret;		/* VBERROR_SUCCESS or VBERROR_NO_IMAGE_PRESENT */
+	ScreenLayout layout;
+	ImageInfo image_info;
+	char *data;
+	uint32_t data_size;
+};
+
+struct VbImageCache {
+	/* Most recently used first */
+	struct VbImageCacheEntry *entries;
+	/* Bytes of entries and their data */
+	uint32_t used;
+	/* An image too big to keep, freed on the next call */
+	char *uncached;
+};
+
+static uint32_t VbImageCacheEntrySize(const struct VbImageCacheEntry *entry)
+{
+	return sizeof(*entry) + entry->data_size;
+}
+
+static void VbImageCacheFreeEntry(struct VbImageCache *cache,
+				  struct VbImageCacheEntry *entry)
+{
+	cache->used -= VbImageCacheEntrySize(entry);
+	free(entry->data);
+	free(entry);
+}
+
+/* Drop least recently used entries until there's room for size more bytes */
+static void VbImageCacheMakeRoom(struct VbImageCache *cache, uint32_t size)
+{
+	struct VbImageCacheEntry **last;
+
+	while (cache->entries && cache->used + size > VB_IMAGE_CACHE_SIZE) {
+		last = &cache->entries;
+		while ((*last)->next)
+			last = &(*last)->next;
+		VbImageCacheFreeEntry(cache, *last);
+		*last = NULL;
+	}
+}
+
+VbError_t VbGbbReadImageCached(VbCommonParams *cparams,
+			       uint32_t localization, uint32_t screen_index,
+			       uint32_t image_num, ScreenLayout *layout,
+			       ImageInfo *image_info, char **image_datap,
+			       uint32_t *image_data_sizep)
+{
+	struct VbImageCache *cache;
+	struct VbImageCacheEntry *entry, **prev;
+	VbError_t ret;
+
+	if (!cparams)
+		return VBERROR_INVALID_GBB;
+
+	if (!cparams->image_cache) {
+		cparams->image_cache = malloc(sizeof(*cparams->image_cache));
+		if (!cparams->image_cache)
+			return VBERROR_UNKNOWN;
+		memset(cparams->image_cache, 0, sizeof(*cparams->image_cache));
+	}
+	cache = cparams->image_cache;
+
+	free(cache->uncached);
+	cache->uncached = NULL;
+
+	for (prev = &cache->entries; *prev; prev = &(*prev)->next) {
+		entry = *prev;
+		if (entry->localization != localization ||
+		    entry->screen_index != screen_index ||
+		    entry->image_num != image_num)
+			continue;
+
+		/* Move it to the front */
+		*prev = entry->next;
+		entry->next = cache->entries;
+		cache->entries = entry;
+
+		*layout = entry->layout;
+		*image_info = entry->image_info;
+		*image_datap = entry->data;
+		*image_data_sizep = entry->data_size;
+		return entry->ret;
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return VBERROR_UNKNOWN;
+	memset(entry, 0, sizeof(*entry));
+
+	ret = VbGbbReadImage(cparams, localization, screen_index, image_num,
+			     &entry->layout, &entry->image_info, &entry->data,
+			     &entry->data_size);
+	if (ret != VBERROR_SUCCESS && ret != VBERROR_NO_IMAGE_PRESENT) {
+		free(entry);
+		return ret;
+	}
+
+	*layout = entry->layout;
+	*image_info = entry->image_info;
+	*image_datap = entry->data;
+	*image_data_sizep = entry->data_size;
+
+	if (entry->data_size > VB_IMAGE_CACHE_SIZE ||
+	    VbImageCacheEntrySize(entry) > VB_IMAGE_CACHE_SIZE) {
+		cache->uncached = entry->data;
+		free(entry);
+		return ret;
+	}
+
+	VbImageCacheMakeRoom(cache, VbImageCacheEntrySize(entry));
+	entry->localization = localization;
+	entry->screen_index = screen_index;
+	entry->image_num = image_num;
+	entry->ret = ret;
+	entry->next = cache->entries;
+	cache->entries = entry;
+	cache->used += VbImageCacheEntrySize(entry);
+
+	return ret;
+}
+
+void VbGbbFreeImageCache(VbCommonParams *cparams)
+{
+	struct VbImageCache *cache = cparams->image_cache;
+	struct VbImageCacheEntry *entry;
+
+	if (!cache)
+		return;
+
+	while (cache->entries) {
+		entry = cache->entries;
+		cache->entries = entry->next;
+		VbImageCacheFreeEntry(cache, entry);
+	}
+	free(cache->uncached);
+	free(cache);
+	cparams->image_cache = NULL;
+}
+
 #define OUTBUF_LEN 128
 
 void VbRegionCheckVersion(VbCommonParams *cparams)
@@ -246,6 +246,7 @@ void VbApiKernelFree(VbCommonParams *cparams)
 		free(cparams->bmp);
 		cparams->bmp = NULL;
 	}
+	VbGbbFreeImageCache(cparams);
 }
 
 static VbError_t vb2_kernel_setup(VbCommonParams *cparams,
@@ -325,6 +326,7 @@ static VbError_t vb2_kernel_setup(VbCommonParams *cparams,
 
 	/* Read GBB header, since we'll needs flags from it */
 	cparams->bmp = NULL;
+	cparams->image_cache = NULL;
 	cparams->gbb = malloc(sizeof(*cparams->gbb));
 	uint32_t retval = VbGbbReadHeader_static(cparams, cparams->gbb);
 	if (retval)
@@ -491,6 +493,7 @@ VbError_t VbVerifyMemoryBootImage(VbCommonParams *cparams,
 
 	/* Read GBB Header */
 	cparams->bmp = NULL;
+	cparams->image_cache = NULL;
 	cparams->gbb = malloc(sizeof(*cparams->gbb));
 	retval = VbGbbReadHeader_static(cparams, cparams->gbb);
 	if (VBERROR_SUCCESS != retval) {
@@ -234,9 +234,10 @@ VbError_t VbDisplayScreenFromGBB(struct vb2_context *ctx,
 		ImageInfo image_info;
 		char hwid[256];
 
-		ret = VbGbbReadImage(cparams, localization, screen_index,
-				    i, &layout, &image_info,
-				    &fullimage, &inoutsize);
+		ret = VbGbbReadImageCached(cparams, localization,
+					   screen_index, i, &layout,
+					   &image_info, &fullimage,
+					   &inoutsize);
 		if (ret == VBERROR_NO_IMAGE_PRESENT) {
 			continue;
 		} else if (ret) {
@@ -300,8 +301,6 @@ VbError_t VbDisplayScreenFromGBB(struct vb2_context *ctx,
 			retval = VBERROR_INVALID_GBB;
 		}
 
-		free(fullimage);
-
 		if (VBERROR_SUCCESS != retval)
 			goto VbDisplayScreenFromGBB_exit;
 	}
@@ -196,7 +196,7 @@ static int vb2_make_keypair()
 		goto done;
 	}
 	/* Public keys doesn't have the private exponent */
-	has_priv = !!rsa_key->d;
+	has_priv = !!RSA_get0_d(rsa_key);
 	if (!has_priv)
 		fprintf(stderr, "%s has a public key only.\n", infile);
 
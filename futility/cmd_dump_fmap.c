@@ -166,6 +166,7 @@ struct node_s {
 	int num_children;
 	struct node_s **child;
 	struct dup_s *alias;
+	int area;		/* index into the FMAP's areas */
 };
 
 static struct node_s *all_nodes;
@@ -289,13 +290,43 @@ static void add_child(struct node_s *p, int n)
 		}
 }
 
-static int human_fmap(const FmapHeader *fmh)
+/*
+ * Collect the nodes that could overlap or enclose node i, in index order.
+ * Only the ones whose areas touch it can, and the FMAP index knows which
+ * those are. If the node's end wrapped around, just check everything.
+ */
+static int candidates(const struct fmap_handle *h, int i, int numnodes,
+		      const int *area_node, uint32_t *touching, int *cand)
 {
+	struct node_s *p = all_nodes + i;
+	uint32_t n, t;
+	int j, count = 0;
+
+	if (p->end < p->start) {
+		for (j = 0; j < numnodes; j++)
+			cand[count++] = j;
+		return count;
+	}
+
+	n = fmap_areas_touching(h, p->start, p->end, touching);
+	for (t = 0; t < n; t++) {
+		j = area_node[touching[t]];
+		if (j >= 0)
+			cand[count++] = j;
+	}
+	return count;
+}
+
+static int human_fmap(const struct fmap_handle *h)
+{
+	const FmapHeader *fmh = h->fmap;
 	FmapAreaHeader *ah;
-	int i, j, errorcnt = 0;
-	int numnodes;
+	int i, j, c, errorcnt = 0;
+	int numnodes, numcand;
+	int *area_node, *cand;
+	uint32_t *touching;
 
-	ah = (FmapAreaHeader *) (fmh + 1);
+	ah = h->areas;
 
 	/* The challenge here is to generate a directed graph from the
 	 * arbitrarily-ordered FMAP entries, and then to prune it until it's as
@@ -303,7 +334,7 @@ static int human_fmap(const FmapHeader *fmh)
 	 * Duplicate regions are okay, but may require special handling. */
 
 	/* Convert the FMAP info into our format. */
-	numnodes = fmh->fmap_nareas;
+	numnodes = h->nareas;
 
 	/* plus one for the all-enclosing "root" */
 	all_nodes = (struct node_s *) calloc(numnodes + 1,
@@ -324,6 +355,7 @@ static int human_fmap(const FmapHeader *fmh)
 		all_nodes[i].start = ah[i].area_offset;
 		all_nodes[i].size = ah[i].area_size;
 		all_nodes[i].end = ah[i].area_offset + ah[i].area_size;
+		all_nodes[i].area = i;
 	}
 	/* Now add the root node */
 	all_nodes[numnodes].name = strdup("-entire flash-");
@@ -341,6 +373,19 @@ static int human_fmap(const FmapHeader *fmh)
 		}
 	}
 
+	/* Which node did each area end up in, if any? */
+	area_node = malloc((h->nareas + 1) * sizeof(*area_node));
+	cand = malloc((h->nareas + 1) * sizeof(*cand));
+	touching = malloc((h->nareas + 1) * sizeof(*touching));
+	if (!area_node || !cand || !touching) {
+		perror("malloc failed");
+		exit(1);
+	}
+	for (i = 0; i < h->nareas; i++)
+		area_node[i] = -1;
+	for (i = 0; i < numnodes; i++)
+		area_node[all_nodes[i].area] = i;
+
 	/* Each node should have at most one parent, which is the smallest
 	 * enclosing node. Duplicate nodes "enclose" each other, but if there's
 	 * already a relationship in one direction, we won't create another.
@@ -348,7 +393,9 @@ static int human_fmap(const FmapHeader *fmh)
 	for (i = 0; i < numnodes; i++) {
 		/* Find the smallest parent, which might be the root node. */
 		int k = numnodes;
-		for (j = 0; j < numnodes; j++) { /* full O(N^2) comparison */
+		numcand = candidates(h, i, numnodes, area_node, touching, cand);
+		for (c = 0; c < numcand; c++) {
+			j = cand[c];
 			if (i == j)
 				continue;
 			if (overlaps(i, j)) {
@@ -371,6 +418,9 @@ static int human_fmap(const FmapHeader *fmh)
 		}
 		all_nodes[i].parent = all_nodes + k;
 	}
+	free(area_node);
+	free(cand);
+	free(touching);
 	if (errorcnt)
 		return 1;
 
@@ -427,7 +477,7 @@ static int do_dump_fmap(int argc, char *argv[])
 	int errorcnt = 0;
 	struct stat sb;
 	int fd;
-	const FmapHeader *fmap;
+	struct fmap_handle *fmap;
 	int retval = 1;
 
 	opterr = 0;		/* quiet, you */
@@ -498,7 +548,7 @@ static int do_dump_fmap(int argc, char *argv[])
 	close(fd);		/* done with this now */
 	size_of_rom = sb.st_size;
 
-	fmap = fmap_find(base_of_rom, size_of_rom);
+	fmap = fmap_open(base_of_rom, size_of_rom);
 	if (fmap) {
 		switch (opt_format) {
 		case FMT_HUMAN:
@@ -506,13 +556,15 @@ static int do_dump_fmap(int argc, char *argv[])
 			break;
 		case FMT_NORMAL:
 			printf("hit at 0x%08x\n",
-			       (uint32_t) ((char *)fmap - (char *)base_of_rom));
+			       (uint32_t) ((char *)fmap->fmap -
+					   (char *)base_of_rom));
 			/* fallthrough */
 		default:
-			retval = normal_fmap(fmap,
+			retval = normal_fmap(fmap->fmap,
 					     argc - optind - 1,
 					     argv + optind + 1);
 		}
+		fmap_close(fmap);
 	}
 
 	if (0 != munmap(base_of_rom, sb.st_size)) {
@@ -189,6 +189,7 @@ static int do_load_fmap(int argc, char *argv[])
 			errorcnt++;
 			break;
 		}
+		futil_map_dirty(area_buf, ah->area_size);
 	}
 
 done_map:
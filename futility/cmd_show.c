@@ -18,6 +18,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "2sysincludes.h"
@@ -39,6 +40,7 @@
 struct show_option_s show_option = {
 	.padding = 65536,
 	.type = FILE_TYPE_UNKNOWN,
+	.jobs = 1,
 };
 
 /* Shared work buffer */
@@ -256,6 +258,7 @@ int ft_show_fw_preamble(const char *name, uint8_t *buf, uint32_t len,
 		return 0;
 	}
 
+	futil_map_will_read(fv_data, fv_size);
 	if (VB2_SUCCESS !=
 	    vb2_verify_data(fv_data, fv_size, &pre2->body_signature,
 			    &data_key, &wb)) {
@@ -368,6 +371,7 @@ int ft_show_kernel_preamble(const char *name, uint8_t *buf, uint32_t len,
 		return 1;
 	}
 
+	futil_map_will_read(kernel_blob, kernel_size);
 	if (VB2_SUCCESS !=
 	    vb2_verify_data(kernel_blob, kernel_size, &pre2->body_signature,
 			    &data_key, &wb)) {
@@ -386,6 +390,7 @@ enum no_short_opts {
 	OPT_PADDING = 1000,
 	OPT_TYPE,
 	OPT_PUBKEY,
+	OPT_JOBS,
 	OPT_HELP,
 };
 
@@ -413,6 +418,8 @@ static const char usage[] = "\n"
 	"  --pad            NUM             Kernel vblock padding size\n"
 	"  --strict                         "
 	"Fail unless all signatures are valid\n"
+	"  --jobs           NUM             Look at up to NUM files at once\n"
+	"                                     (default 1, 0 for one per CPU)\n"
 	"\n";
 
 static void print_help(int argc, char *argv[])
@@ -434,13 +441,14 @@ static const struct option long_opts[] = {
 	{"type",        1, NULL, OPT_TYPE},
 	{"strict",      0, &show_option.strict, 1},
 	{"pubkey",      1, NULL, OPT_PUBKEY},
+	{"jobs",        1, NULL, OPT_JOBS},
 	{"help",        0, NULL, OPT_HELP},
 	{NULL, 0, NULL, 0},
 };
 static char *short_opts = ":f:k:t";
 
 
-static int show_type(char *filename)
+static int show_type(const char *filename)
 {
 	enum futil_file_err err;
 	enum futil_file_type type;
@@ -469,18 +477,200 @@ static int show_type(char *filename)
 	return 1;
 }
 
+/* Show one file, returning the number of errors */
+static int show_file(const char *infile, int type_override)
+{
+	enum futil_file_type type;
+	int errorcnt = 0;
+	uint8_t *buf;
+	uint32_t len;
+	int ifd;
+
+	if (show_option.t_flag)
+		return show_type(infile);
+
+	ifd = open(infile, O_RDONLY);
+	if (ifd < 0) {
+		fprintf(stderr, "Can't open %s: %s\n",
+			infile, strerror(errno));
+		return 1;
+	}
+
+	if (0 != futil_map_file_head(ifd, MAP_RO, &buf, &len)) {
+		errorcnt++;
+		goto boo;
+	}
+
+	/* Allow the user to override the type */
+	if (type_override)
+		type = show_option.type;
+	else
+		type = futil_file_type_buf(buf, len);
+
+	errorcnt += futil_file_type_show(type, infile, buf, len);
+
+	errorcnt += futil_unmap_file(ifd, MAP_RO, buf, len);
+boo:
+	if (close(ifd)) {
+		errorcnt++;
+		fprintf(stderr, "Error when closing %s: %s\n",
+			infile, strerror(errno));
+	}
+
+	return errorcnt;
+}
+
+/* A file being shown by a child process */
+struct show_job_s {
+	pid_t pid;
+	FILE *out;		/* Where its stdout went */
+	FILE *err;		/* Where its stderr went */
+	int done;
+	int status;		/* From wait(), or -1 if it never started */
+};
+
+static void copy_captured(FILE *from, FILE *to)
+{
+	char buf[BUFSIZ];
+	size_t n;
+
+	if (!from)
+		return;
+	rewind(from);
+	while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+		fwrite(buf, 1, n, to);
+	fclose(from);
+	fflush(to);
+}
+
+/* Print what the job said and return its number of errors */
+static int finish_show_job(const char *infile, struct show_job_s *job)
+{
+	copy_captured(job->out, stdout);
+	copy_captured(job->err, stderr);
+
+	if (job->status < 0)
+		return 1;
+	if (WIFSIGNALED(job->status)) {
+		fprintf(stderr, "%s: killed by signal %d\n",
+			infile, WTERMSIG(job->status));
+		return 1;
+	}
+	return WIFEXITED(job->status) ? WEXITSTATUS(job->status) : 1;
+}
+
+static int start_show_job(const char *infile, int type_override,
+			  struct show_job_s *job)
+{
+	int status;
+
+	job->status = -1;
+	job->out = tmpfile();
+	job->err = tmpfile();
+	if (!job->out || !job->err) {
+		fprintf(stderr, "%s: can't create temp file: %s\n",
+			infile, strerror(errno));
+		return 1;
+	}
+
+	/* Don't let the child repeat our buffered output */
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		fprintf(stderr, "%s: can't fork: %s\n",
+			infile, strerror(errno));
+		return 1;
+	}
+	if (!job->pid) {
+		if (dup2(fileno(job->out), STDOUT_FILENO) < 0 ||
+		    dup2(fileno(job->err), STDERR_FILENO) < 0)
+			_exit(1);
+		status = show_file(infile, type_override);
+		fflush(NULL);
+		_exit(status > 255 ? 255 : status);
+	}
+
+	return 0;
+}
+
+/*
+ * Show all the files. With more than one job, each file is handled by a child
+ * process whose stdout and stderr are captured in temporary files, which are
+ * copied out in argument order as the children finish. So the output and the
+ * result are the same as showing the files one at a time. Returns the number
+ * of errors.
+ */
+static int show_files(char *files[], int nfiles, int type_override)
+{
+	uint32_t jobs = show_option.jobs;
+	struct show_job_s *job;
+	int next = 0, emit = 0, running = 0;
+	int errorcnt = 0;
+	int i, status;
+	pid_t pid;
+
+	if (!jobs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpus > 0 ? cpus : 1;
+	}
+
+	if (jobs == 1 || nfiles == 1) {
+		for (i = 0; i < nfiles; i++)
+			errorcnt += show_file(files[i], type_override);
+		return errorcnt;
+	}
+
+	job = calloc(nfiles, sizeof(*job));
+	if (!job)
+		DIE;
+
+	while (emit < nfiles) {
+		/* Keep busy, but don't get too far ahead of the output */
+		while (running < jobs && next < nfiles &&
+		       next < emit + 4 * jobs) {
+			if (start_show_job(files[next], type_override,
+					   job + next))
+				job[next].done = 1;
+			else
+				running++;
+			next++;
+		}
+
+		if (running) {
+			pid = wait(&status);
+			if (pid < 0) {
+				fprintf(stderr, "wait failed: %s\n",
+					strerror(errno));
+				DIE;
+			}
+			for (i = emit; i < next; i++)
+				if (!job[i].done && job[i].pid == pid) {
+					job[i].done = 1;
+					job[i].status = status;
+					running--;
+					break;
+				}
+		}
+
+		while (emit < next && job[emit].done) {
+			errorcnt += finish_show_job(files[emit], job + emit);
+			emit++;
+		}
+	}
+
+	free(job);
+	return errorcnt;
+}
+
 static int do_show(int argc, char *argv[])
 {
 	uint8_t *pubkbuf = NULL;
 	struct vb2_public_key pubk2;
-	char *infile = 0;
-	int ifd, i;
+	int i;
 	int errorcnt = 0;
-	uint8_t *buf;
 	uint32_t len;
 	char *e = 0;
 	int type_override = 0;
-	enum futil_file_type type;
 
 	vb2_workbuf_init(&wb, workbuf, sizeof(workbuf));
 
@@ -541,6 +731,14 @@ static int do_show(int argc, char *argv[])
 				errorcnt++;
 			}
 			break;
+		case OPT_JOBS:
+			show_option.jobs = strtoul(optarg, &e, 0);
+			if (!*optarg || (e && *e)) {
+				fprintf(stderr,
+					"Invalid --jobs \"%s\"\n", optarg);
+				errorcnt++;
+			}
+			break;
 		case OPT_HELP:
 			print_help(argc, argv);
 			return !!errorcnt;
@@ -575,45 +773,8 @@ static int do_show(int argc, char *argv[])
 		return 1;
 	}
 
-	if (show_option.t_flag) {
-		for (i = optind; i < argc; i++)
-			errorcnt += show_type(argv[i]);
-		goto done;
-	}
+	errorcnt += show_files(argv + optind, argc - optind, type_override);
 
-	for (i = optind; i < argc; i++) {
-		infile = argv[i];
-		ifd = open(infile, O_RDONLY);
-		if (ifd < 0) {
-			errorcnt++;
-			fprintf(stderr, "Can't open %s: %s\n",
-				infile, strerror(errno));
-			continue;
-		}
-
-		if (0 != futil_map_file(ifd, MAP_RO, &buf, &len)) {
-			errorcnt++;
-			goto boo;
-		}
-
-		/* Allow the user to override the type */
-		if (type_override)
-			type = show_option.type;
-		else
-			type = futil_file_type_buf(buf, len);
-
-		errorcnt += futil_file_type_show(type, infile, buf, len);
-
-		errorcnt += futil_unmap_file(ifd, MAP_RO, buf, len);
-boo:
-		if (close(ifd)) {
-			errorcnt++;
-			fprintf(stderr, "Error when closing %s: %s\n",
-				infile, strerror(errno));
-		}
-	}
-
-done:
 	if (pubkbuf)
 		free(pubkbuf);
 	if (show_option.fv)
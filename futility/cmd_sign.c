@@ -15,6 +15,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "file_type.h"
@@ -26,6 +27,7 @@
 #include "host_common.h"
 #include "host_key2.h"
 #include "kernel_blob.h"
+#include "sign_server.h"
 #include "util_misc.h"
 #include "vb1_helper.h"
 #include "vb2_common.h"
@@ -46,6 +48,7 @@ struct sign_option_s sign_option = {
 	.ro_offset = 0xffffffff,
 	.rw_offset = 0xffffffff,
 	.sig_size = 1024,
+	.jobs = 1,
 };
 
 /* Helper to complain about invalid args. Returns num errors discovered */
@@ -58,6 +61,60 @@ static int no_opt_if(int expr, const char *optname)
 	return 0;
 }
 
+/*
+ * Ask the --server to sign data, using the version, flags, etc. from our
+ * options. Kernel blobs also need their layout from kb, and may bring their
+ * own keyblock for the server to keep. Returns a malloc'ed result, or NULL on
+ * error.
+ */
+static uint8_t *sign_remote(enum sign_server_op op,
+			    const struct kernel_blob_s *kb,
+			    const struct vb2_keyblock *keyblock,
+			    const void *data, uint32_t size,
+			    uint32_t *result_size)
+{
+	struct sign_server_request req = {
+		.magic = SIGN_SERVER_REQUEST_MAGIC,
+		.op = op,
+		.version = sign_option.version,
+		.flags = sign_option.flags,
+		.kloadaddr = sign_option.kloadaddr,
+		.padding = sign_option.padding,
+		.data_size = size,
+	};
+	uint8_t *payload = NULL;
+	uint8_t *result = NULL;
+	int fd;
+
+	/* A keyblock to keep goes in front of the data */
+	if (keyblock) {
+		req.keyblock_size = keyblock->keyblock_size;
+		req.data_size = keyblock->keyblock_size + size;
+		payload = malloc(req.data_size);
+		if (!payload)
+			DIE;
+		memcpy(payload, keyblock, keyblock->keyblock_size);
+		memcpy(payload + keyblock->keyblock_size, data, size);
+		data = payload;
+	}
+
+	if (kb) {
+		req.bootloader_address = kb->ondisk_bootloader_addr;
+		req.bootloader_size = kb->bootloader_size;
+		req.vmlinuz_header_address = kb->ondisk_vmlinuz_header_addr;
+		req.vmlinuz_header_size = kb->vmlinuz_header_size;
+	}
+
+	fd = sign_server_connect(sign_option.server);
+	if (fd >= 0) {
+		if (sign_server_call(fd, &req, data, &result, result_size))
+			result = NULL;
+		close(fd);
+	}
+	free(payload);
+	return result;
+}
+
 /* This wraps/signs a public key, producing a keyblock. */
 int ft_sign_pubkey(const char *name, uint8_t *buf, uint32_t len, void *data)
 {
@@ -69,7 +126,14 @@ int ft_sign_pubkey(const char *name, uint8_t *buf, uint32_t len, void *data)
 		return 1;
 	}
 
-	if (sign_option.pem_signpriv) {
+	if (sign_option.server) {
+		uint32_t block_size;
+		block = (struct vb2_keyblock *)sign_remote(
+			SIGN_SERVER_OP_KEYBLOCK, NULL, NULL, data_key, len,
+			&block_size);
+		if (!block)
+			return 1;
+	} else if (sign_option.pem_signpriv) {
 		if (sign_option.pem_external) {
 			/* External signing uses the PEM file directly. */
 			block = vb2_create_keyblock_external(
@@ -79,17 +143,20 @@ int ft_sign_pubkey(const char *name, uint8_t *buf, uint32_t len, void *data)
 				sign_option.flags,
 				sign_option.pem_external);
 		} else {
-			sign_option.signprivate = vb2_read_private_key_pem(
-				sign_option.pem_signpriv,
-				sign_option.pem_algo);
-			if (!sign_option.signprivate) {
+			/* Usually already read once for all the files. */
+			if (!sign_option.pem_private)
+				sign_option.pem_private =
+					vb2_read_private_key_pem(
+						sign_option.pem_signpriv,
+						sign_option.pem_algo);
+			if (!sign_option.pem_private) {
 				fprintf(stderr,
  					"Unable to read PEM signing key: %s\n",
 					strerror(errno));
 				return 1;
 			}
 			block = vb2_create_keyblock(data_key,
-						    sign_option.signprivate,
+						    sign_option.pem_private,
 						    sign_option.flags);
 		}
 	} else {
@@ -97,6 +164,10 @@ int ft_sign_pubkey(const char *name, uint8_t *buf, uint32_t len, void *data)
 		block = vb2_create_keyblock(data_key, sign_option.signprivate,
 					    sign_option.flags);
 	}
+	if (!block) {
+		fprintf(stderr, "Unable to create keyblock\n");
+		return 1;
+	}
 
 	/* Write it out */
 	return WriteSomeParts(sign_option.outfile,
@@ -107,35 +178,46 @@ int ft_sign_pubkey(const char *name, uint8_t *buf, uint32_t len, void *data)
 int ft_sign_raw_kernel(const char *name, uint8_t *buf, uint32_t len,
 		       void *data)
 {
+	struct kernel_blob_s kb;
 	uint8_t *vmlinuz_data, *kblob_data, *vblock_data;
-	uint32_t vmlinuz_size, kblob_size, vblock_size;
+	uint32_t vmlinuz_size, vblock_size;
 	int rv;
 
 	vmlinuz_data = buf;
 	vmlinuz_size = len;
 
-	kblob_data = CreateKernelBlob(
-		vmlinuz_data, vmlinuz_size,
-		sign_option.arch, sign_option.kloadaddr,
-		sign_option.config_data, sign_option.config_size,
-		sign_option.bootloader_data, sign_option.bootloader_size,
-		&kblob_size);
-	if (!kblob_data) {
+	/* The blob is only described, not built, so nothing is copied */
+	if (CreateKernelBlobParts(
+		    &kb, vmlinuz_data, vmlinuz_size,
+		    sign_option.arch, sign_option.kloadaddr,
+		    sign_option.config_data, sign_option.config_size,
+		    sign_option.bootloader_data, sign_option.bootloader_size)) {
 		fprintf(stderr, "Unable to create kernel blob\n");
 		return 1;
 	}
-	Debug("kblob_size = 0x%x\n", kblob_size);
-
-	vblock_data = SignKernelBlob(kblob_data, kblob_size,
-				     sign_option.padding,
-				     sign_option.version,
-				     sign_option.kloadaddr,
-				     sign_option.keyblock,
-				     sign_option.signprivate,
-				     sign_option.flags, &vblock_size);
+	Debug("kblob_size = 0x%x\n", kb.blob_size);
+
+	if (sign_option.server) {
+		/* The server needs to see the whole thing */
+		kblob_data = GatherKernelBlob(&kb);
+		vblock_data = kblob_data ?
+			sign_remote(SIGN_SERVER_OP_KERN_PREAMBLE, &kb, NULL,
+				    kblob_data, kb.blob_size,
+				    &vblock_size) : NULL;
+		free(kblob_data);
+	} else {
+		vblock_data = SignKernelBlobParts(&kb,
+						  sign_option.padding,
+						  sign_option.version,
+						  sign_option.kloadaddr,
+						  sign_option.keyblock,
+						  sign_option.signprivate,
+						  sign_option.flags,
+						  &vblock_size);
+	}
 	if (!vblock_data) {
 		fprintf(stderr, "Unable to sign kernel blob\n");
-		free(kblob_data);
+		FreeKernelBlobParts(&kb);
 		return 1;
 	}
 	Debug("vblock_size = 0x%x\n", vblock_size);
@@ -145,23 +227,18 @@ int ft_sign_raw_kernel(const char *name, uint8_t *buf, uint32_t len,
 	if (!sign_option.create_new_outfile)
 		DIE;
 
-	if (sign_option.vblockonly)
-		rv = WriteSomeParts(sign_option.outfile,
-				    vblock_data, vblock_size,
-				    NULL, 0);
-	else
-		rv = WriteSomeParts(sign_option.outfile,
-				    vblock_data, vblock_size,
-				    kblob_data, kblob_size);
+	rv = WriteKernelParts(sign_option.outfile, vblock_data, vblock_size,
+			      sign_option.vblockonly ? NULL : &kb);
 
 	free(vblock_data);
-	free(kblob_data);
+	FreeKernelBlobParts(&kb);
 	return rv;
 }
 
 int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 			  void *data)
 {
+	struct kernel_blob_s kb;
 	uint8_t *kpart_data, *kblob_data, *vblock_data;
 	uint32_t kpart_size, kblob_size, vblock_size;
 	struct vb2_keyblock *keyblock = NULL;
@@ -171,8 +248,8 @@ int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 	kpart_data = buf;
 	kpart_size = len;
 
-	/* Note: This just sets some static pointers. It doesn't malloc. */
-	kblob_data = unpack_kernel_partition(kpart_data, kpart_size,
+	/* Note: This just points kb into the buffer. It doesn't malloc. */
+	kblob_data = unpack_kernel_partition(&kb, kpart_data, kpart_size,
 					     sign_option.padding,
 					     &keyblock, &preamble, &kblob_size);
 
@@ -192,7 +269,7 @@ int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 
 	/* Replace the config if asked */
 	if (sign_option.config_data &&
-	    0 != UpdateKernelBlobConfig(kblob_data, kblob_size,
+	    0 != UpdateKernelBlobConfig(&kb, kblob_data, kblob_size,
 					sign_option.config_data,
 					sign_option.config_size)) {
 		fprintf(stderr, "Unable to update config\n");
@@ -212,15 +289,20 @@ int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 	if (sign_option.keyblock)
 		keyblock = sign_option.keyblock;
 
-	/* Compute the new signature */
-	vblock_data = SignKernelBlob(kblob_data, kblob_size,
-				     sign_option.padding,
-				     sign_option.version,
-				     sign_option.kloadaddr,
-				     keyblock,
-				     sign_option.signprivate,
-				     sign_option.flags,
-				     &vblock_size);
+	/* Compute the new signature, keeping the keyblock either way */
+	if (sign_option.server)
+		vblock_data = sign_remote(SIGN_SERVER_OP_KERN_PREAMBLE, &kb,
+					  keyblock, kblob_data, kblob_size,
+					  &vblock_size);
+	else
+		vblock_data = SignKernelBlob(&kb, kblob_data, kblob_size,
+					     sign_option.padding,
+					     sign_option.version,
+					     sign_option.kloadaddr,
+					     keyblock,
+					     sign_option.signprivate,
+					     sign_option.flags,
+					     &vblock_size);
 	if (!vblock_data) {
 		fprintf(stderr, "Unable to sign kernel blob\n");
 		return 1;
@@ -242,6 +324,7 @@ int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 		 * all our modifications to the buffer will get flushed to
 		 * disk when we close it. */
 		memcpy(kpart_data, vblock_data, vblock_size);
+		futil_map_dirty(kpart_data, vblock_size);
 	}
 
 	free(vblock_data);
@@ -254,8 +337,23 @@ int ft_sign_raw_firmware(const char *name, uint8_t *buf, uint32_t len,
 {
 	struct vb2_signature *body_sig;
 	struct vb2_fw_preamble *preamble;
+	uint8_t *vblock_data;
+	uint32_t vblock_size;
 	int rv;
 
+	if (sign_option.server) {
+		vblock_data = sign_remote(SIGN_SERVER_OP_FW_PREAMBLE, NULL,
+					  NULL, buf, len,
+					  &vblock_size);
+		if (!vblock_data)
+			return 1;
+		rv = WriteSomeParts(sign_option.outfile,
+				    vblock_data, vblock_size, NULL, 0);
+		free(vblock_data);
+		return rv;
+	}
+
+	futil_map_will_read(buf, len);
 	body_sig = vb2_calculate_signature(buf, len, sign_option.signprivate);
 	if (!body_sig) {
 		fprintf(stderr, "Error calculating body signature\n");
@@ -306,6 +404,9 @@ static const char usage_pubkey[] = "\n"
 	"  --pem_external   PROGRAM"
 	"         External program to compute the signature\n"
 	"                                     (requires a PEM signing key)\n"
+	"\n"
+	"  Set VB2_EXTERNAL_SIGNER_FRAMED=1 to run PROGRAM once with --framed\n"
+	"  for all the signatures, if it supports that.\n"
 	"\n";
 static void print_help_pubkey(int argc, char *argv[])
 {
@@ -530,6 +631,28 @@ static const char usage_default[] = "\n"
 	"  usbpd1 firmware image               same, or signed in-place\n"
 	"  RW device image                     same, or signed in-place\n"
 	"\n"
+	"To sign many files with the same keys and options, use\n"
+	"\n"
+	"  --manifest       FILE            Sign each \"INFILE [OUTFILE]\" line\n"
+	"                                     of FILE instead of one INFILE\n"
+	"  --jobs           NUM             Sign up to NUM files at once\n"
+	"                                     (default 1, 0 for one per CPU)\n"
+	"\n"
+	"To use the keys held by \"" MYNAME " sign_server\" instead of"
+	" reading them, use\n"
+	"\n"
+	"  --server         SOCKET          Send the signing to the server\n"
+	"                                     listening on SOCKET, instead of\n"
+	"                                     giving any keys. A kernel\n"
+	"                                     partition keeps its keyblock;\n"
+	"                                     anything new gets the server's.\n"
+	"\n"
+	"To sign a digest calculated elsewhere, use\n"
+	"\n"
+	"  --digest                         INFILE holds a digest made with\n"
+	"                                     the hash of the signing key;\n"
+	"                                     OUTFILE gets its raw signature\n"
+	"\n"
 	"For more information, use \"" MYNAME " help %s TYPE\", where\n"
 	"TYPE is one of:\n\n";
 static void print_help_default(int argc, char *argv[])
@@ -577,6 +700,10 @@ enum no_short_opts {
 	OPT_DATA_SIZE,
 	OPT_SIG_SIZE,
 	OPT_PRIKEY,
+	OPT_MANIFEST,
+	OPT_JOBS,
+	OPT_SERVER,
+	OPT_DIGEST,
 	OPT_HELP,
 };
 
@@ -616,6 +743,10 @@ static const struct option long_opts[] = {
 	{"sig_size",     1, NULL, OPT_SIG_SIZE},
 	{"prikey",       1, NULL, OPT_PRIKEY},
 	{"privkey",      1, NULL, OPT_PRIKEY},	/* alias */
+	{"manifest",     1, NULL, OPT_MANIFEST},
+	{"jobs",         1, NULL, OPT_JOBS},
+	{"server",       1, NULL, OPT_SERVER},
+	{"digest",       0, NULL, OPT_DIGEST},
 	{"help",         0, NULL, OPT_HELP},
 	{NULL,           0, NULL, 0},
 };
@@ -634,16 +765,488 @@ static int parse_number_opt(const char *arg, const char *name, uint32_t *dest)
 	return 0;
 }
 
+/*
+ * With --digest, INFILE holds a digest which was calculated elsewhere. Write
+ * its raw RSA signature to sign_option.outfile. Returns the total number of
+ * errors.
+ */
+static int sign_digest_file(char *infile, int errorcnt)
+{
+	struct vb2_signature *sig = NULL;
+	uint8_t *digest, *sig_data = NULL;
+	uint64_t digest_size;
+	uint32_t sig_size;
+
+	if (!sign_option.server)
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+	if (!sign_option.outfile) {
+		fprintf(stderr, "Missing output filename\n");
+		errorcnt++;
+	}
+	if (errorcnt)
+		return errorcnt;
+
+	digest = ReadFile(infile, &digest_size);
+	if (!digest) {
+		fprintf(stderr, "Can't read %s\n", infile);
+		return errorcnt + 1;
+	}
+
+	if (sign_option.server) {
+		sig_data = sign_remote(SIGN_SERVER_OP_DIGEST, NULL, NULL,
+				       digest, digest_size, &sig_size);
+	} else {
+		sig = vb2_sign_digest(digest, digest_size, 0,
+				      sign_option.signprivate);
+		if (sig) {
+			sig_data = vb2_signature_data(sig);
+			sig_size = sig->sig_size;
+		}
+	}
+
+	if (!sig_data) {
+		fprintf(stderr, "Unable to sign the digest in %s\n", infile);
+		errorcnt++;
+	} else {
+		errorcnt += WriteSomeParts(sign_option.outfile,
+					   sig_data, sig_size, NULL, 0);
+	}
+
+	if (sig)
+		free(sig);
+	else
+		free(sig_data);
+	free(digest);
+	return errorcnt;
+}
+
+/*
+ * A kernel partition can be much bigger than the vblock and kernel blob at the
+ * start of it (a >4GB block device, say). If it's too big to map all at once,
+ * map only the part that signing looks at or changes.
+ */
+static enum futil_file_err map_kernel_partition(int fd, int writeable,
+						uint8_t **buf, uint32_t *len)
+{
+	struct vb2_keyblock *keyblock;
+	struct vb2_kernel_preamble *preamble;
+	uint8_t *head;
+	uint64_t file_size, size;
+	enum futil_file_err err;
+
+	err = futil_file_size(fd, &file_size);
+	if (err)
+		return err;
+
+	if (file_size <= UINT32_MAX)
+		return futil_map_file(fd, writeable, buf, len);
+
+	/* The vblock has to fit in the padding, so look there first */
+	err = futil_map_window(fd, MAP_RO, 0, sign_option.padding, &head);
+	if (err)
+		return err;
+
+	keyblock = (struct vb2_keyblock *)head;
+	size = keyblock->keyblock_size;
+	if (size + sizeof(*preamble) > sign_option.padding) {
+		fprintf(stderr, "keyblock_size advances past %u byte padding\n",
+			sign_option.padding);
+		futil_unmap_file(fd, MAP_RO, head, sign_option.padding);
+		return FILE_ERR_SIZE;
+	}
+	preamble = (struct vb2_kernel_preamble *)(head + size);
+	size += (uint64_t)preamble->preamble_size +
+		preamble->body_signature.data_size;
+	futil_unmap_file(fd, MAP_RO, head, sign_option.padding);
+
+	if (size < sign_option.padding)
+		size = sign_option.padding;
+	if (size > UINT32_MAX || size > file_size) {
+		fprintf(stderr, "Kernel blob of 0x%" PRIx64 " bytes is too large"
+			" for a partition of 0x%" PRIx64 " bytes\n",
+			size, file_size);
+		return FILE_ERR_SIZE;
+	}
+
+	err = futil_map_window(fd, writeable, 0, size, buf);
+	if (err)
+		return err;
+
+	*len = (uint32_t)size;
+	return FILE_ERR_NONE;
+}
+
+/*
+ * Sign one INFILE, writing to sign_option.outfile (or in place if that's not
+ * set). The options are checked even if errorcnt says there were problems
+ * already, so they can all be reported. Returns the total number of errors.
+ */
+static int sign_file(char *infile, int errorcnt)
+{
+	int ifd = -1;
+	uint8_t *buf;
+	uint32_t buf_len;
+	int mapping;
+	enum futil_file_err err;
+
+	if (sign_option.digest)
+		return sign_digest_file(infile, errorcnt);
+
+	/* What are we looking at? */
+	if (sign_option.type == FILE_TYPE_UNKNOWN &&
+	    futil_file_type(infile, &sign_option.type)) {
+		errorcnt++;
+		goto done;
+	}
+
+	/* We may be able to infer the type based on the other args */
+	if (sign_option.type == FILE_TYPE_UNKNOWN) {
+		if (sign_option.bootloader_data || sign_option.config_data
+		    || sign_option.arch != ARCH_UNSPECIFIED)
+			sign_option.type = FILE_TYPE_RAW_KERNEL;
+		else if (sign_option.kernel_subkey || sign_option.fv_specified)
+			sign_option.type = FILE_TYPE_RAW_FIRMWARE;
+	}
+
+	Debug("type=%s\n", futil_file_type_name(sign_option.type));
+
+	/* The server holds the keys, so there's nothing to check for them */
+	if (sign_option.server) {
+		switch (sign_option.type) {
+		case FILE_TYPE_PUBKEY:
+		case FILE_TYPE_KERN_PREAMBLE:
+		case FILE_TYPE_RAW_FIRMWARE:
+		case FILE_TYPE_RAW_KERNEL:
+			break;
+		default:
+			fprintf(stderr, "--server can't sign %s files\n",
+				futil_file_type_name(sign_option.type));
+			return errorcnt + 1;
+		}
+	}
+
+	/* Check the arguments for the type of thing we want to sign */
+	switch (sign_option.type) {
+	case FILE_TYPE_PUBKEY:
+		sign_option.create_new_outfile = 1;
+		if (sign_option.server)
+			break;
+		if (sign_option.signprivate && sign_option.pem_signpriv) {
+			fprintf(stderr,
+				"Only one of --signprivate and --pem_signpriv"
+				" can be specified\n");
+			errorcnt++;
+		}
+		if ((sign_option.signprivate &&
+		     sign_option.pem_algo_specified) ||
+		    (sign_option.pem_signpriv &&
+		     !sign_option.pem_algo_specified)) {
+			fprintf(stderr, "--pem_algo must be used with"
+				" --pem_signpriv\n");
+			errorcnt++;
+		}
+		if (sign_option.pem_external && !sign_option.pem_signpriv) {
+			fprintf(stderr, "--pem_external must be used with"
+				" --pem_signpriv\n");
+			errorcnt++;
+		}
+		/* We'll wait to read the PEM file, since the external signer
+		 * may want to read it instead. */
+		break;
+	case FILE_TYPE_BIOS_IMAGE:
+	case FILE_TYPE_OLD_BIOS_IMAGE:
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
+		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
+		break;
+	case FILE_TYPE_KERN_PREAMBLE:
+		if (!sign_option.server)
+			errorcnt += no_opt_if(!sign_option.signprivate,
+					      "signprivate");
+		if (sign_option.vblockonly || sign_option.inout_file_count > 1)
+			sign_option.create_new_outfile = 1;
+		break;
+	case FILE_TYPE_RAW_FIRMWARE:
+		sign_option.create_new_outfile = 1;
+		if (!sign_option.server) {
+			errorcnt += no_opt_if(!sign_option.signprivate,
+					      "signprivate");
+			errorcnt += no_opt_if(!sign_option.keyblock,
+					      "keyblock");
+			errorcnt += no_opt_if(!sign_option.kernel_subkey,
+					      "kernelkey");
+		}
+		errorcnt += no_opt_if(!sign_option.version_specified,
+				      "version");
+		break;
+	case FILE_TYPE_RAW_KERNEL:
+		sign_option.create_new_outfile = 1;
+		if (!sign_option.server) {
+			errorcnt += no_opt_if(!sign_option.signprivate,
+					      "signprivate");
+			errorcnt += no_opt_if(!sign_option.keyblock,
+					      "keyblock");
+		}
+		errorcnt += no_opt_if(!sign_option.version_specified,
+				      "version");
+		errorcnt += no_opt_if(!sign_option.bootloader_data,
+				      "bootloader");
+		errorcnt += no_opt_if(!sign_option.config_data, "config");
+		errorcnt += no_opt_if(sign_option.arch == ARCH_UNSPECIFIED,
+				      "arch");
+		break;
+	case FILE_TYPE_USBPD1:
+		errorcnt += no_opt_if(!sign_option.pem_signpriv, "pem");
+		errorcnt += no_opt_if(sign_option.hash_alg == VB2_HASH_INVALID,
+				      "hash_alg");
+		break;
+	case FILE_TYPE_RWSIG:
+		errorcnt += no_opt_if(!sign_option.prikey, "prikey");
+		break;
+	default:
+		/* Anything else we don't care */
+		break;
+	}
+
+	Debug("infile=%s\n", infile);
+	Debug("sign_option.inout_file_count=%d\n", sign_option.inout_file_count);
+	Debug("sign_option.create_new_outfile=%d\n",
+	      sign_option.create_new_outfile);
+
+	/* Make sure we have an output file if one is needed */
+	if (!sign_option.outfile) {
+		if (sign_option.create_new_outfile) {
+			errorcnt++;
+			fprintf(stderr, "Missing output filename\n");
+			goto done;
+		} else {
+			sign_option.outfile = infile;
+		}
+	}
+
+	Debug("sign_option.outfile=%s\n", sign_option.outfile);
+
+	if (errorcnt)
+		goto done;
+
+	if (sign_option.create_new_outfile) {
+		/* The input is read-only, the output is write-only. */
+		mapping = MAP_RO;
+		Debug("open RO %s\n", infile);
+		ifd = open(infile, O_RDONLY);
+		if (ifd < 0) {
+			errorcnt++;
+			fprintf(stderr, "Can't open %s for reading: %s\n",
+				infile, strerror(errno));
+			goto done;
+		}
+	} else {
+		/* We'll read-modify-write the output file */
+	       mapping = MAP_RW;
+	       /* Just this file fails, not the rest of a manifest */
+	       if (sign_option.inout_file_count > 1 &&
+		   futil_copy_file(infile, sign_option.outfile)) {
+		       errorcnt++;
+		       goto done;
+	       }
+	       Debug("open RW %s\n", sign_option.outfile);
+	       infile = sign_option.outfile;
+	       ifd = open(sign_option.outfile, O_RDWR);
+	       if (ifd < 0) {
+		       errorcnt++;
+		       fprintf(stderr, "Can't open %s for writing: %s\n",
+			       sign_option.outfile, strerror(errno));
+		       goto done;
+	       }
+	}
+
+	if (sign_option.type == FILE_TYPE_KERN_PREAMBLE)
+		err = map_kernel_partition(ifd, mapping, &buf, &buf_len);
+	else
+		err = futil_map_file(ifd, mapping, &buf, &buf_len);
+	if (err) {
+		errorcnt++;
+		goto done;
+	}
+
+	errorcnt += futil_file_type_sign(sign_option.type, infile,
+					 buf, buf_len);
+
+	errorcnt += futil_unmap_file(ifd, mapping, buf, buf_len);
+
+done:
+	if (ifd >= 0 && close(ifd)) {
+		errorcnt++;
+		fprintf(stderr, "Error when closing ifd: %s\n",
+			strerror(errno));
+	}
+
+	return errorcnt;
+}
+
+/* One line of a --manifest file */
+struct sign_file_s {
+	char *infile;
+	char *outfile;
+};
+
+/*
+ * Read the "INFILE [OUTFILE]" lines of a manifest. Blank lines and lines
+ * starting with '#' are skipped. Returns zero on success.
+ */
+static int read_manifest(const char *filename, struct sign_file_s **files,
+			 int *nfiles)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t linesize = 0;
+	char *in, *out, *extra;
+	struct sign_file_s *list = NULL;
+	int count = 0, lineno = 0;
+	int errorcnt = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Can't open %s: %s\n", filename,
+			strerror(errno));
+		return 1;
+	}
+
+	while (getline(&line, &linesize, fp) >= 0) {
+		lineno++;
+		in = strtok(line, " \t\r\n");
+		if (!in || *in == '#')
+			continue;
+		out = strtok(NULL, " \t\r\n");
+		extra = strtok(NULL, " \t\r\n");
+		if (extra) {
+			fprintf(stderr, "%s:%d: expected \"INFILE [OUTFILE]\"\n",
+				filename, lineno);
+			errorcnt++;
+			continue;
+		}
+
+		list = realloc(list, (count + 1) * sizeof(*list));
+		if (!list)
+			DIE;
+		list[count].infile = strdup(in);
+		list[count].outfile = out ? strdup(out) : NULL;
+		count++;
+	}
+	free(line);
+	fclose(fp);
+
+	if (!count && !errorcnt) {
+		fprintf(stderr, "%s: no files to sign\n", filename);
+		errorcnt++;
+	}
+
+	*files = list;
+	*nfiles = count;
+	return errorcnt;
+}
+
+/* Sign one manifest entry, starting from the options given on the command line */
+static int sign_manifest_file(const struct sign_option_s *options,
+			      struct sign_file_s *file)
+{
+	sign_option = *options;
+	sign_option.outfile = file->outfile;
+	sign_option.inout_file_count = file->outfile ? 2 : 1;
+	return sign_file(file->infile, 0);
+}
+
+/*
+ * Sign all the manifest entries. The keys have already been read; with more
+ * than one job, each file is signed by a child process which inherits them.
+ * Returns the number of files that couldn't be signed.
+ */
+static int sign_files(struct sign_file_s *files, int nfiles)
+{
+	struct sign_option_s options = sign_option;
+	uint32_t jobs = sign_option.jobs;
+	pid_t *pids;
+	pid_t pid;
+	int running = 0, next = 0;
+	int errorcnt = 0;
+	int i, status;
+
+	if (!jobs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpus > 0 ? cpus : 1;
+	}
+
+	if (jobs == 1) {
+		for (i = 0; i < nfiles; i++) {
+			if (sign_manifest_file(&options, &files[i])) {
+				fprintf(stderr, "%s: signing failed\n",
+					files[i].infile);
+				errorcnt++;
+			}
+			/* Keep any key read for this file for the next one */
+			options.pem_private = sign_option.pem_private;
+		}
+		sign_option = options;
+		return errorcnt;
+	}
+
+	pids = calloc(nfiles, sizeof(*pids));
+	if (!pids)
+		DIE;
+
+	while (next < nfiles || running) {
+		while (running < jobs && next < nfiles) {
+			/* Don't let the child repeat our buffered output */
+			fflush(NULL);
+			pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "%s: can't fork: %s\n",
+					files[next].infile, strerror(errno));
+				errorcnt++;
+				next++;
+				continue;
+			}
+			if (!pid) {
+				status = sign_manifest_file(&options,
+							    &files[next]);
+				fflush(NULL);
+				_exit(!!status);
+			}
+			pids[next++] = pid;
+			running++;
+		}
+		if (!running)
+			break;
+
+		pid = wait(&status);
+		if (pid < 0) {
+			fprintf(stderr, "wait failed: %s\n", strerror(errno));
+			DIE;
+		}
+		for (i = 0; i < next && pids[i] != pid; i++)
+			;
+		if (i == next)
+			continue;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "%s: signing failed\n",
+				files[i].infile);
+			errorcnt++;
+		}
+	}
+
+	free(pids);
+	return errorcnt;
+}
+
 static int do_sign(int argc, char *argv[])
 {
 	char *infile = 0;
 	int i;
-	int ifd = -1;
 	int errorcnt = 0;
-	uint8_t *buf;
-	uint32_t buf_len;
 	char *e = 0;
-	int mapping;
+	struct sign_file_s *files = NULL;
+	int nfiles = 0;
 	int helpind = 0;
 	int longindex;
 
@@ -831,6 +1434,19 @@ static int do_sign(int argc, char *argv[])
 				errorcnt++;
 			}
 			break;
+		case OPT_MANIFEST:
+			sign_option.manifest = optarg;
+			break;
+		case OPT_JOBS:
+			errorcnt += parse_number_opt(optarg, "jobs",
+						     &sign_option.jobs);
+			break;
+		case OPT_SERVER:
+			sign_option.server = optarg;
+			break;
+		case OPT_DIGEST:
+			sign_option.digest = 1;
+			break;
 		case OPT_HELP:
 			helpind = optind - 1;
 			break;
@@ -866,180 +1482,88 @@ static int do_sign(int argc, char *argv[])
 		return !!errorcnt;
 	}
 
-	/* If we don't have an input file already, we need one */
-	if (!infile) {
-		if (argc - optind <= 0) {
-			errorcnt++;
-			fprintf(stderr, "ERROR: missing input filename\n");
-			goto done;
-		} else {
-			sign_option.inout_file_count++;
-			infile = argv[optind++];
-		}
-	}
-
-	/* Look for an output file if we don't have one, just in case. */
-	if (!sign_option.outfile && argc - optind > 0) {
-		sign_option.inout_file_count++;
-		sign_option.outfile = argv[optind++];
-	}
-
-	/* What are we looking at? */
-	if (sign_option.type == FILE_TYPE_UNKNOWN &&
-	    futil_file_type(infile, &sign_option.type)) {
+	/*
+	 * The server signs with its own keys, so local ones would be ignored.
+	 * Say so now, rather than quietly signing with something else.
+	 */
+	if (sign_option.server &&
+	    (sign_option.signprivate || sign_option.keyblock ||
+	     sign_option.kernel_subkey || sign_option.pem_signpriv ||
+	     sign_option.pem_external || sign_option.prikey)) {
+		fprintf(stderr, "ERROR: --server can't be used with local keys"
+			" (--signprivate, --keyblock, --kernelkey, --pem_*,"
+			" --prikey)\n");
 		errorcnt++;
 		goto done;
 	}
 
-	/* We may be able to infer the type based on the other args */
-	if (sign_option.type == FILE_TYPE_UNKNOWN) {
-		if (sign_option.bootloader_data || sign_option.config_data
-		    || sign_option.arch != ARCH_UNSPECIFIED)
-			sign_option.type = FILE_TYPE_RAW_KERNEL;
-		else if (sign_option.kernel_subkey || sign_option.fv_specified)
-			sign_option.type = FILE_TYPE_RAW_FIRMWARE;
-	}
-
-	Debug("type=%s\n", futil_file_type_name(sign_option.type));
-
-	/* Check the arguments for the type of thing we want to sign */
-	switch (sign_option.type) {
-	case FILE_TYPE_PUBKEY:
-		sign_option.create_new_outfile = 1;
-		if (sign_option.signprivate && sign_option.pem_signpriv) {
-			fprintf(stderr,
-				"Only one of --signprivate and --pem_signpriv"
-				" can be specified\n");
-			errorcnt++;
-		}
-		if ((sign_option.signprivate &&
-		     sign_option.pem_algo_specified) ||
-		    (sign_option.pem_signpriv &&
-		     !sign_option.pem_algo_specified)) {
-			fprintf(stderr, "--pem_algo must be used with"
-				" --pem_signpriv\n");
-			errorcnt++;
-		}
-		if (sign_option.pem_external && !sign_option.pem_signpriv) {
-			fprintf(stderr, "--pem_external must be used with"
-				" --pem_signpriv\n");
+	if (sign_option.manifest) {
+		if (infile || sign_option.outfile || argc - optind > 0) {
+			fprintf(stderr, "ERROR: --manifest can't be used with"
+				" other input or output files\n");
 			errorcnt++;
+			goto done;
 		}
-		/* We'll wait to read the PEM file, since the external signer
-		 * may want to read it instead. */
-		break;
-	case FILE_TYPE_BIOS_IMAGE:
-	case FILE_TYPE_OLD_BIOS_IMAGE:
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
-		break;
-	case FILE_TYPE_KERN_PREAMBLE:
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		if (sign_option.vblockonly || sign_option.inout_file_count > 1)
-			sign_option.create_new_outfile = 1;
-		break;
-	case FILE_TYPE_RAW_FIRMWARE:
-		sign_option.create_new_outfile = 1;
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
-		errorcnt += no_opt_if(!sign_option.version_specified,
-				      "version");
-		break;
-	case FILE_TYPE_RAW_KERNEL:
-		sign_option.create_new_outfile = 1;
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.version_specified,
-				      "version");
-		errorcnt += no_opt_if(!sign_option.bootloader_data,
-				      "bootloader");
-		errorcnt += no_opt_if(!sign_option.config_data, "config");
-		errorcnt += no_opt_if(sign_option.arch == ARCH_UNSPECIFIED,
-				      "arch");
-		break;
-	case FILE_TYPE_USBPD1:
-		errorcnt += no_opt_if(!sign_option.pem_signpriv, "pem");
-		errorcnt += no_opt_if(sign_option.hash_alg == VB2_HASH_INVALID,
-				      "hash_alg");
-		break;
-	case FILE_TYPE_RWSIG:
-		errorcnt += no_opt_if(!sign_option.prikey, "prikey");
-		break;
-	default:
-		/* Anything else we don't care */
-		break;
-	}
-
-	Debug("infile=%s\n", infile);
-	Debug("sign_option.inout_file_count=%d\n", sign_option.inout_file_count);
-	Debug("sign_option.create_new_outfile=%d\n",
-	      sign_option.create_new_outfile);
-
-	/* Make sure we have an output file if one is needed */
-	if (!sign_option.outfile) {
-		if (sign_option.create_new_outfile) {
+		if (read_manifest(sign_option.manifest, &files, &nfiles))
 			errorcnt++;
-			fprintf(stderr, "Missing output filename\n");
+		if (errorcnt)
 			goto done;
-		} else {
-			sign_option.outfile = infile;
-		}
-	}
 
-	Debug("sign_option.outfile=%s\n", sign_option.outfile);
+		/*
+		 * Read a PEM signing key now, not once for each file. It's
+		 * freed below, once all the files are signed.
+		 */
+		if (sign_option.pem_signpriv &&
+		    sign_option.pem_algo_specified &&
+		    !sign_option.pem_external && !sign_option.signprivate) {
+			sign_option.pem_private = vb2_read_private_key_pem(
+				sign_option.pem_signpriv,
+				sign_option.pem_algo);
+			if (!sign_option.pem_private) {
+				fprintf(stderr,
+					"Unable to read PEM signing key: %s\n",
+					strerror(errno));
+				errorcnt++;
+				goto done;
+			}
+		}
 
-	if (argc - optind > 0) {
-		errorcnt++;
-		fprintf(stderr, "ERROR: too many arguments left over\n");
-	}
+		errorcnt += sign_files(files, nfiles);
+	} else {
+		/* If we don't have an input file already, we need one */
+		if (!infile) {
+			if (argc - optind <= 0) {
+				errorcnt++;
+				fprintf(stderr,
+					"ERROR: missing input filename\n");
+				goto done;
+			} else {
+				sign_option.inout_file_count++;
+				infile = argv[optind++];
+			}
+		}
 
-	if (errorcnt)
-		goto done;
+		/* Look for an output file if we don't have one, just in case */
+		if (!sign_option.outfile && argc - optind > 0) {
+			sign_option.inout_file_count++;
+			sign_option.outfile = argv[optind++];
+		}
 
-	if (sign_option.create_new_outfile) {
-		/* The input is read-only, the output is write-only. */
-		mapping = MAP_RO;
-		Debug("open RO %s\n", infile);
-		ifd = open(infile, O_RDONLY);
-		if (ifd < 0) {
+		if (argc - optind > 0) {
 			errorcnt++;
-			fprintf(stderr, "Can't open %s for reading: %s\n",
-				infile, strerror(errno));
-			goto done;
+			fprintf(stderr, "ERROR: too many arguments left over\n");
 		}
-	} else {
-		/* We'll read-modify-write the output file */
-	       mapping = MAP_RW;
-	       if (sign_option.inout_file_count > 1)
-		       futil_copy_file_or_die(infile, sign_option.outfile);
-	       Debug("open RW %s\n", sign_option.outfile);
-	       infile = sign_option.outfile;
-	       ifd = open(sign_option.outfile, O_RDWR);
-	       if (ifd < 0) {
-		       errorcnt++;
-		       fprintf(stderr, "Can't open %s for writing: %s\n",
-			       sign_option.outfile, strerror(errno));
-		       goto done;
-	       }
-	}
 
-	if (0 != futil_map_file(ifd, mapping, &buf, &buf_len)) {
-		errorcnt++;
-		goto done;
+		errorcnt = sign_file(infile, errorcnt);
 	}
 
-	errorcnt += futil_file_type_sign(sign_option.type, infile,
-					 buf, buf_len);
-
-	errorcnt += futil_unmap_file(ifd, mapping, buf, buf_len);
-
 done:
-	if (ifd >= 0 && close(ifd)) {
-		errorcnt++;
-		fprintf(stderr, "Error when closing ifd: %s\n",
-			strerror(errno));
+	if (files) {
+		for (i = 0; i < nfiles; i++) {
+			free(files[i].infile);
+			free(files[i].outfile);
+		}
+		free(files);
 	}
 
 	if (sign_option.signprivate)
@@ -1050,6 +1574,8 @@ done:
 		free(sign_option.kernel_subkey);
 	if (sign_option.prikey)
 		vb2_private_key_free(sign_option.prikey);
+	if (sign_option.pem_private)
+		vb2_private_key_free(sign_option.pem_private);
 
 	if (errorcnt)
 		fprintf(stderr, "Use --help for usage instructions\n");
@@ -0,0 +1,536 @@
+/*
+ * Copyright 2016 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Serve signing requests over a local Unix socket, so that a keyset only has
+ * to be read once for any number of "futility sign --server" clients.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "futility.h"
+#include "host_common.h"
+#include "host_key2.h"
+#include "sign_server.h"
+#include "vb1_helper.h"
+#include "vb2_common.h"
+#include "vboot_common.h"
+
+/* The keyset, read once before accepting any connections */
+static struct vb2_private_key *signprivate;
+static struct vb2_keyblock *keyblock;
+static struct vb2_packed_key *kernel_subkey;
+
+static volatile sig_atomic_t stop_serving;
+
+/* Read exactly size bytes. Returns zero on success, non-zero on EOF/error. */
+static int read_all(int fd, void *buf, uint32_t size)
+{
+	uint8_t *ptr = buf;
+	ssize_t n;
+
+	while (size) {
+		n = read(fd, ptr, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 1;
+		ptr += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Write exactly size bytes. Returns zero on success. */
+static int write_all(int fd, const void *buf, uint32_t size)
+{
+	const uint8_t *ptr = buf;
+	ssize_t n;
+
+	while (size) {
+		n = write(fd, ptr, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 1;
+		ptr += n;
+		size -= n;
+	}
+	return 0;
+}
+
+int sign_server_connect(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Can't connect to %s: %s\n", socket_path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int sign_server_call(int fd, const struct sign_server_request *req,
+		     const void *data, uint8_t **result,
+		     uint32_t *result_size)
+{
+	struct sign_server_response resp;
+	uint8_t *buf;
+
+	if (write_all(fd, req, sizeof(*req)) ||
+	    write_all(fd, data, req->data_size)) {
+		fprintf(stderr, "Error sending request to sign server\n");
+		return 1;
+	}
+
+	if (read_all(fd, &resp, sizeof(resp)) ||
+	    resp.magic != SIGN_SERVER_RESPONSE_MAGIC ||
+	    resp.data_size > SIGN_SERVER_MAX_DATA_SIZE) {
+		fprintf(stderr, "Bad response from sign server\n");
+		return 1;
+	}
+
+	buf = malloc(resp.data_size ? resp.data_size : 1);
+	if (!buf)
+		DIE;
+	if (read_all(fd, buf, resp.data_size)) {
+		fprintf(stderr, "Truncated response from sign server\n");
+		free(buf);
+		return 1;
+	}
+
+	if (resp.status != SIGN_SERVER_OK) {
+		fprintf(stderr, "Sign server refused the request (status %d)\n",
+			resp.status);
+		free(buf);
+		return 1;
+	}
+
+	*result = buf;
+	*result_size = resp.data_size;
+	return 0;
+}
+
+/* Concatenate two parts into a malloc'ed result */
+static uint8_t *join_parts(const void *part1, uint32_t size1,
+			   const void *part2, uint32_t size2,
+			   uint32_t *size)
+{
+	uint8_t *buf = malloc(size1 + size2);
+
+	if (!buf)
+		DIE;
+	memcpy(buf, part1, size1);
+	memcpy(buf + size1, part2, size2);
+	*size = size1 + size2;
+	return buf;
+}
+
+/*
+ * Carry out one request. On success, *result is a malloc'ed buffer. Returns
+ * an enum sign_server_status.
+ */
+static int handle_request(const struct sign_server_request *req,
+			  uint8_t *data, uint8_t **result,
+			  uint32_t *result_size)
+{
+	struct kernel_blob_s kb;
+	struct vb2_keyblock *block, *kern_keyblock;
+	struct vb2_signature *sig;
+	struct vb2_fw_preamble *preamble;
+
+	if (!signprivate)
+		return SIGN_SERVER_NO_KEY;
+
+	switch (req->op) {
+	case SIGN_SERVER_OP_KEYBLOCK:
+		if (!packed_key_looks_ok((struct vb2_packed_key *)data,
+					 req->data_size))
+			return SIGN_SERVER_BAD_REQUEST;
+		block = vb2_create_keyblock((struct vb2_packed_key *)data,
+					    signprivate, req->flags);
+		if (!block)
+			return SIGN_SERVER_SIGN_FAILED;
+		*result = (uint8_t *)block;
+		*result_size = block->keyblock_size;
+		return SIGN_SERVER_OK;
+
+	case SIGN_SERVER_OP_FW_PREAMBLE:
+		if (!keyblock || !kernel_subkey)
+			return SIGN_SERVER_NO_KEY;
+		sig = vb2_calculate_signature(data, req->data_size,
+					      signprivate);
+		if (!sig)
+			return SIGN_SERVER_SIGN_FAILED;
+		preamble = vb2_create_fw_preamble(req->version, kernel_subkey,
+						  sig, signprivate,
+						  req->flags);
+		free(sig);
+		if (!preamble)
+			return SIGN_SERVER_SIGN_FAILED;
+		*result = join_parts(keyblock, keyblock->keyblock_size,
+				     preamble, preamble->preamble_size,
+				     result_size);
+		free(preamble);
+		return SIGN_SERVER_OK;
+
+	case SIGN_SERVER_OP_KERN_PREAMBLE:
+		/* Keep the keyblock the client already has, if it sent one */
+		kern_keyblock = keyblock;
+		if (req->keyblock_size) {
+			kern_keyblock = (struct vb2_keyblock *)data;
+			if (req->keyblock_size > req->data_size ||
+			    VB2_SUCCESS != vb2_check_keyblock(
+				    kern_keyblock, req->keyblock_size,
+				    &kern_keyblock->keyblock_signature) ||
+			    kern_keyblock->keyblock_size != req->keyblock_size)
+				return SIGN_SERVER_BAD_REQUEST;
+		}
+		if (!kern_keyblock)
+			return SIGN_SERVER_NO_KEY;
+		memset(&kb, 0, sizeof(kb));
+		kb.ondisk_bootloader_addr = req->bootloader_address;
+		kb.bootloader_size = req->bootloader_size;
+		kb.ondisk_vmlinuz_header_addr = req->vmlinuz_header_address;
+		kb.vmlinuz_header_size = req->vmlinuz_header_size;
+		*result = SignKernelBlob(&kb, data + req->keyblock_size,
+					 req->data_size - req->keyblock_size,
+					 req->padding,
+					 req->version, req->kloadaddr,
+					 kern_keyblock, signprivate, req->flags,
+					 result_size);
+		return *result ? SIGN_SERVER_OK : SIGN_SERVER_SIGN_FAILED;
+
+	case SIGN_SERVER_OP_DIGEST:
+		if (req->data_size != vb2_digest_size(signprivate->hash_alg))
+			return SIGN_SERVER_BAD_REQUEST;
+		sig = vb2_sign_digest(data, req->data_size, 0, signprivate);
+		if (!sig)
+			return SIGN_SERVER_SIGN_FAILED;
+		*result = join_parts(vb2_signature_data(sig), sig->sig_size,
+				     NULL, 0, result_size);
+		free(sig);
+		return SIGN_SERVER_OK;
+	}
+
+	return SIGN_SERVER_BAD_REQUEST;
+}
+
+/* Answer requests on one connection until the client hangs up. */
+static void serve_connection(int fd)
+{
+	struct sign_server_request req;
+	struct sign_server_response resp;
+	uint8_t *data, *result;
+	uint32_t result_size;
+
+	while (!read_all(fd, &req, sizeof(req))) {
+		if (req.magic != SIGN_SERVER_REQUEST_MAGIC ||
+		    req.data_size > SIGN_SERVER_MAX_DATA_SIZE) {
+			fprintf(stderr, "Bad request from client\n");
+			return;
+		}
+
+		data = malloc(req.data_size ? req.data_size : 1);
+		if (!data)
+			DIE;
+		if (read_all(fd, data, req.data_size)) {
+			free(data);
+			return;
+		}
+
+		result = NULL;
+		result_size = 0;
+		resp.magic = SIGN_SERVER_RESPONSE_MAGIC;
+		resp.status = handle_request(&req, data, &result,
+					     &result_size);
+		if (resp.status != SIGN_SERVER_OK)
+			result_size = 0;
+		resp.data_size = result_size;
+		Debug("op %d, %d bytes in, status %d, %d bytes out\n",
+		      req.op, req.data_size, resp.status, result_size);
+		free(data);
+
+		if (write_all(fd, &resp, sizeof(resp)) ||
+		    write_all(fd, result, result_size)) {
+			free(result);
+			return;
+		}
+		free(result);
+	}
+}
+
+static void stop_handler(int sig)
+{
+	stop_serving = 1;
+}
+
+/* Only serve clients running as the same user as the server. */
+static int peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+	    len != sizeof(cred)) {
+		fprintf(stderr, "Can't get peer credentials: %s\n",
+			strerror(errno));
+		return 0;
+	}
+	if (cred.uid != getuid()) {
+		fprintf(stderr, "Refusing connection from uid %u\n",
+			(unsigned)cred.uid);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Listen on socket_path, handing each connection to its own child process so
+ * that requests are signed concurrently. Returns when asked to stop.
+ */
+static int serve(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat sb;
+	mode_t old_umask;
+	int sock, fd, rv;
+	pid_t pid;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+		return 1;
+	}
+
+	/* Replace a stale socket, but nothing else */
+	if (!lstat(socket_path, &sb)) {
+		if (!S_ISSOCK(sb.st_mode)) {
+			fprintf(stderr, "%s exists and is not a socket\n",
+				socket_path);
+			return 1;
+		}
+		unlink(socket_path);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	/* The socket hands out signatures, so only its owner may connect */
+	old_umask = umask(077);
+	rv = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_umask);
+	if (!rv)
+		rv = chmod(socket_path, 0600);
+	if (rv || listen(sock, 16)) {
+		fprintf(stderr, "Can't listen on %s: %s\n", socket_path,
+			strerror(errno));
+		close(sock);
+		return 1;
+	}
+
+	/* Children are never waited for */
+	signal(SIGCHLD, SIG_IGN);
+
+	/* Without SA_RESTART, so accept() notices we've been asked to stop */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!stop_serving) {
+		fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "accept failed: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		if (!peer_allowed(fd)) {
+			close(fd);
+			continue;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "Can't fork: %s\n", strerror(errno));
+		} else if (!pid) {
+			close(sock);
+			serve_connection(fd);
+			close(fd);
+			_exit(0);
+		}
+		close(fd);
+	}
+
+	close(sock);
+	unlink(socket_path);
+	return !stop_serving;
+}
+
+enum no_short_opts {
+	OPT_SOCKET = 1000,
+	OPT_HELP,
+};
+
+static const struct option long_opts[] = {
+	/* name    hasarg *flag  val */
+	{"signprivate",  1, NULL, 's'},
+	{"keyblock",     1, NULL, 'b'},
+	{"kernelkey",    1, NULL, 'k'},
+	{"socket",       1, NULL, OPT_SOCKET},
+	{"help",         0, NULL, OPT_HELP},
+	{NULL,           0, NULL, 0},
+};
+static char *short_opts = ":s:b:k:";
+
+static const char usage[] = "\n"
+	"Usage:  " MYNAME " %s [PARAMS] --socket PATH\n"
+	"\n"
+	"Read a keyset once and sign requests from \"" MYNAME " sign"
+	" --server PATH\"\n"
+	"until interrupted. Each connection is served by its own process.\n"
+	"\n"
+	"Required PARAMS:\n"
+	"  --socket                    PATH    Unix socket to listen on\n"
+	"  -s|--signprivate            FILE.vbprivk\n"
+	"                                      The private key to sign with\n"
+	"\n"
+	"Optional PARAMS:\n"
+	"  -b|--keyblock               FILE.keyblock\n"
+	"                                      The keyblock returned with"
+	" firmware\n"
+	"                                        and kernel preambles\n"
+	"  -k|--kernelkey              FILE.vbpubk\n"
+	"                                      The kernel subkey named in"
+	" firmware\n"
+	"                                        preambles\n"
+	"\n";
+
+static void print_help(int argc, char *argv[])
+{
+	printf(usage, argv[0]);
+}
+
+static int do_sign_server(int argc, char *argv[])
+{
+	char *socket_path = NULL;
+	int errorcnt = 0;
+	int i;
+
+	opterr = 0;		/* quiet, you */
+	while ((i = getopt_long(argc, argv, short_opts, long_opts,
+				NULL)) != -1) {
+		switch (i) {
+		case 's':
+			signprivate = vb2_read_private_key(optarg);
+			if (!signprivate) {
+				fprintf(stderr, "Error reading %s\n", optarg);
+				errorcnt++;
+			}
+			break;
+		case 'b':
+			keyblock = vb2_read_keyblock(optarg);
+			if (!keyblock) {
+				fprintf(stderr, "Error reading %s\n", optarg);
+				errorcnt++;
+			}
+			break;
+		case 'k':
+			kernel_subkey = vb2_read_packed_key(optarg);
+			if (!kernel_subkey) {
+				fprintf(stderr, "Error reading %s\n", optarg);
+				errorcnt++;
+			}
+			break;
+		case OPT_SOCKET:
+			socket_path = optarg;
+			break;
+		case OPT_HELP:
+			print_help(argc, argv);
+			return !!errorcnt;
+		case '?':
+			if (optopt)
+				fprintf(stderr, "Unrecognized option: -%c\n",
+					optopt);
+			else
+				fprintf(stderr, "Unrecognized option: %s\n",
+					argv[optind - 1]);
+			errorcnt++;
+			break;
+		case ':':
+			fprintf(stderr, "Missing argument to -%c\n", optopt);
+			errorcnt++;
+			break;
+		default:
+			DIE;
+		}
+	}
+
+	if (!socket_path) {
+		fprintf(stderr, "Missing --socket\n");
+		errorcnt++;
+	}
+	if (!signprivate) {
+		fprintf(stderr, "Missing --signprivate\n");
+		errorcnt++;
+	}
+	if (argc - optind > 0) {
+		fprintf(stderr, "ERROR: too many arguments left over\n");
+		errorcnt++;
+	}
+
+	if (!errorcnt)
+		errorcnt += serve(socket_path);
+	else
+		fprintf(stderr, "Use --help for usage instructions\n");
+
+	if (signprivate)
+		vb2_private_key_free(signprivate);
+	free(keyblock);
+	free(kernel_subkey);
+	return !!errorcnt;
+}
+
+DECLARE_FUTIL_COMMAND(sign_server, do_sign_server, VBOOT_VERSION_ALL,
+		      "Serve signing requests from a warm keyset");
@@ -10,14 +10,9 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>		/* For PRIu64 */
-#ifndef HAVE_MACOS
-#include <linux/fs.h>		/* For BLKGETSIZE64 */
-#endif
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
 #include <unistd.h>
 
 #include "2sysincludes.h"
@@ -159,61 +154,129 @@ static void print_help(int argc, char *argv[])
 }
 
 
-/* Return an explanation when fread() fails. */
-static const char *error_fread(FILE *fp)
+/* How much of the old kernel partition to read (and hash) at a time */
+#define KPART_READ_CHUNK (1 << 20)
+
+/* Read exactly size bytes from offset in the file into buf, or die trying */
+static void ReadOrDie(int fd, const char *filename,
+		      uint8_t *buf, uint64_t size, uint64_t offset)
 {
-	const char *retval = "beats me why";
-	if (feof(fp))
-		retval = "EOF";
-	else if (ferror(fp))
-		retval = strerror(errno);
-	clearerr(fp);
-	return retval;
+	ssize_t n;
+
+	while (size) {
+		n = pread(fd, buf, size, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			Fatal("Unable to read entirety of %s: %s\n", filename,
+			      n ? strerror(errno) : "EOF");
+		buf += n;
+		size -= n;
+		offset += n;
+	}
 }
 
-
-/* This reads a complete kernel partition into a buffer */
+/*
+ * This reads the parts of a kernel partition that matter: the vblock, and
+ * then only as much of the kernel blob as the preamble says was signed. The
+ * partition itself is usually much bigger than that.
+ *
+ * If digest is not NULL, the kernel blob is hashed as it's read using the
+ * hash algorithm of the keyblock's data key, which is returned in
+ * digest_alg_ptr. That's VB2_HASH_INVALID if the blob wasn't hashed.
+ */
 static uint8_t *ReadOldKPartFromFileOrDie(const char *filename,
-					 uint32_t *size_ptr)
+					 uint32_t *size_ptr,
+					 uint8_t *digest,
+					 enum vb2_hash_algorithm *digest_alg_ptr)
 {
-	FILE *fp = NULL;
-	struct stat statbuf;
+	struct vb2_digest_context dc;
+	struct vb2_keyblock *keyblock;
+	struct vb2_kernel_preamble *preamble;
+	enum vb2_hash_algorithm alg = VB2_HASH_INVALID;
+	uint64_t file_size = 0;
+	uint64_t vblock_size = 0, end = 0, have, now, chunk;
 	uint8_t *buf;
-	uint32_t file_size = 0;
-
-	if (0 != stat(filename, &statbuf))
-		Fatal("Unable to stat %s: %s\n", filename, strerror(errno));
-
-	if (S_ISBLK(statbuf.st_mode)) {
-#ifndef HAVE_MACOS
-		int fd = open(filename, O_RDONLY);
-		if (fd >= 0) {
-			ioctl(fd, BLKGETSIZE64, &file_size);
-			close(fd);
-		}
-#endif
-	} else {
-		file_size = statbuf.st_size;
-	}
-	Debug("%s size is 0x%x\n", filename, file_size);
-	if (file_size < opt_pad)
-		Fatal("%s is too small to be a valid kernel blob\n");
+	int fd;
 
 	Debug("Reading %s\n", filename);
-	fp = fopen(filename, "rb");
-	if (!fp)
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
 		Fatal("Unable to open file %s: %s\n", filename,
 		      strerror(errno));
+	if (FILE_ERR_NONE != futil_file_size(fd, &file_size))
+		Fatal("Unable to stat %s\n", filename);
+	Debug("%s size is 0x%" PRIx64 "\n", filename, file_size);
+	if (file_size < opt_pad)
+		Fatal("%s is too small to be a valid kernel blob\n", filename);
+	if (opt_pad > UINT32_MAX)
+		Fatal("Padding 0x%" PRIx64 " is too large\n", opt_pad);
+	if (opt_pad < sizeof(*keyblock) + sizeof(*preamble))
+		Fatal("Padding 0x%" PRIx64 " is too small for a vblock\n",
+		      opt_pad);
+
+	/* The vblock comes first, and should fit in the padding */
+	buf = malloc(opt_pad);
+	if (!buf)
+		Fatal("Unable to allocate memory\n");
+	ReadOrDie(fd, filename, buf, opt_pad, 0);
+	have = opt_pad;
+
+	/* Find out how much of the kernel blob there is. If the vblock doesn't
+	 * make sense, don't read any more and let the caller complain. */
+	keyblock = (struct vb2_keyblock *)buf;
+	if ((uint64_t)keyblock->keyblock_size + sizeof(*preamble) <=
+	    opt_pad) {
+		preamble = (struct vb2_kernel_preamble *)
+			(buf + keyblock->keyblock_size);
+		vblock_size = (uint64_t)keyblock->keyblock_size +
+			preamble->preamble_size;
+		if (vblock_size <= opt_pad) {
+			end = vblock_size + preamble->body_signature.data_size;
+			if (digest)
+				alg = vb2_crypto_to_hash(
+					keyblock->data_key.algorithm);
+		}
+	}
+	if (end > file_size)
+		Fatal("%s is too small for its kernel blob\n", filename);
+	if (end > UINT32_MAX)
+		Fatal("%s has too large a kernel blob\n", filename);
+
+	if (end > have) {
+		Debug("Reading 0x%" PRIx64 " bytes of %s\n", end, filename);
+		buf = realloc(buf, end);
+		if (!buf)
+			Fatal("Unable to allocate memory\n");
+	}
 
-	buf = malloc(file_size);
-	if (1 != fread(buf, file_size, 1, fp))
-		Fatal("Unable to read entirety of %s: %s\n", filename,
-		      error_fread(fp));
+	if (alg != VB2_HASH_INVALID &&
+	    VB2_SUCCESS != vb2_digest_init(&dc, alg))
+		alg = VB2_HASH_INVALID;
+	for (now = vblock_size; now < end; now += chunk) {
+		chunk = end - now;
+		if (chunk > KPART_READ_CHUNK)
+			chunk = KPART_READ_CHUNK;
+		if (now + chunk > have) {
+			ReadOrDie(fd, filename, buf + have,
+				  now + chunk - have, have);
+			have = now + chunk;
+		}
+		/* Hash it while it's still in the cache */
+		if (alg != VB2_HASH_INVALID &&
+		    VB2_SUCCESS != vb2_digest_extend(&dc, buf + now, chunk))
+			alg = VB2_HASH_INVALID;
+	}
+	if (alg != VB2_HASH_INVALID &&
+	    VB2_SUCCESS != vb2_digest_finalize(&dc, digest,
+					       vb2_digest_size(alg)))
+		alg = VB2_HASH_INVALID;
+	close(fd);
 
 	if (size_ptr)
-		*size_ptr = file_size;
-
-	fclose(fp);
+		*size_ptr = have;
+	if (digest_alg_ptr)
+		*digest_alg_ptr = alg;
 	return buf;
 }
 
@@ -246,6 +309,8 @@ static int do_vbutil_kernel(int argc, char *argv[])
 	struct vb2_private_key *signpriv_key = NULL;
 	struct vb2_packed_key *signpub_key = NULL;
 	uint8_t *kpart_data = NULL;
+	uint8_t body_digest[VB2_MAX_DIGEST_SIZE];
+	enum vb2_hash_algorithm body_digest_alg;
 	uint32_t kpart_size = 0;
 	uint8_t *vmlinuz_buf = NULL;
 	uint32_t vmlinuz_size = 0;
@@ -257,6 +322,7 @@ static int do_vbutil_kernel(int argc, char *argv[])
 	uint64_t vmlinuz_header_address = 0;
 	uint32_t vmlinuz_header_offset = 0;
 	struct vb2_kernel_preamble *preamble = NULL;
+	struct kernel_blob_s kb;
 	uint8_t *kblob_data = NULL;
 	uint32_t kblob_size = 0;
 	uint8_t *vblock_data = NULL;
@@ -443,35 +509,28 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		if (!vmlinuz_size)
 			Fatal("Empty vmlinuz file\n");
 
-		kblob_data = CreateKernelBlob(
-			vmlinuz_buf, vmlinuz_size,
-			arch, kernel_body_load_address,
-			t_config_data, t_config_size,
-			t_bootloader_data, t_bootloader_size,
-			&kblob_size);
-		if (!kblob_data)
+		if (CreateKernelBlobParts(&kb, vmlinuz_buf, vmlinuz_size,
+					  arch, kernel_body_load_address,
+					  t_config_data, t_config_size,
+					  t_bootloader_data, t_bootloader_size))
 			Fatal("Unable to create kernel blob\n");
 
-		Debug("kblob_size = 0x%x\n", kblob_size);
+		Debug("kblob_size = 0x%x\n", kb.blob_size);
 
-		vblock_data = SignKernelBlob(kblob_data, kblob_size, opt_pad,
-					     version, kernel_body_load_address,
-					     t_keyblock, signpriv_key, flags,
-					     &vblock_size);
+		vblock_data = SignKernelBlobParts(&kb, opt_pad,
+						  version,
+						  kernel_body_load_address,
+						  t_keyblock, signpriv_key,
+						  flags, &vblock_size);
 		if (!vblock_data)
 			Fatal("Unable to sign kernel blob\n");
 
 		Debug("vblock_size = 0x%x\n", vblock_size);
 
-		if (opt_vblockonly)
-			rv = WriteSomeParts(filename,
-					    vblock_data, vblock_size,
-					    NULL, 0);
-		else
-			rv = WriteSomeParts(filename,
-					    vblock_data, vblock_size,
-					    kblob_data, kblob_size);
+		rv = WriteKernelParts(filename, vblock_data, vblock_size,
+				      opt_vblockonly ? NULL : &kb);
 
+		FreeKernelBlobParts(&kb);
 		free(vmlinuz_buf);
 		free(t_config_data);
 		free(t_bootloader_data);
@@ -494,14 +553,16 @@ static int do_vbutil_kernel(int argc, char *argv[])
 			Fatal("Missing previously packed blob.\n");
 
 		/* Load the kernel partition */
-		kpart_data = ReadOldKPartFromFileOrDie(oldfile, &kpart_size);
+		kpart_data = ReadOldKPartFromFileOrDie(oldfile, &kpart_size,
+						       NULL, NULL);
 
 		/* Make sure we have a kernel partition */
 		if (FILE_TYPE_KERN_PREAMBLE !=
 		    futil_file_type_buf(kpart_data, kpart_size))
 			Fatal("%s is not a kernel blob\n", oldfile);
 
-		kblob_data = unpack_kernel_partition(kpart_data, kpart_size,
+		kblob_data = unpack_kernel_partition(&kb, kpart_data,
+						     kpart_size,
 						     opt_pad, &keyblock,
 						     &preamble, &kblob_size);
 
@@ -518,7 +579,7 @@ static int do_vbutil_kernel(int argc, char *argv[])
 			if (!t_config_data)
 				Fatal("Error reading config file.\n");
 			if (0 != UpdateKernelBlobConfig(
-				    kblob_data, kblob_size,
+				    &kb, kblob_data, kblob_size,
 				    t_config_data, t_config_size))
 				Fatal("Unable to update config\n");
 		}
@@ -537,7 +598,8 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		}
 
 		/* Reuse previous body size */
-		vblock_data = SignKernelBlob(kblob_data, kblob_size, opt_pad,
+		vblock_data = SignKernelBlob(&kb, kblob_data, kblob_size,
+					     opt_pad,
 					     version, kernel_body_load_address,
 					     t_keyblock ? t_keyblock : keyblock,
 					     signpriv_key, flags, &vblock_size);
@@ -567,15 +629,22 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		/* Do it */
 
 		/* Load the kernel partition */
-		kpart_data = ReadOldKPartFromFileOrDie(filename, &kpart_size);
+		kpart_data = ReadOldKPartFromFileOrDie(filename, &kpart_size,
+						       body_digest,
+						       &body_digest_alg);
 
-		kblob_data = unpack_kernel_partition(kpart_data, kpart_size,
+		kblob_data = unpack_kernel_partition(&kb, kpart_data,
+						     kpart_size,
 						     opt_pad, 0, 0,
 						     &kblob_size);
 		if (!kblob_data)
 			Fatal("Unable to unpack kernel partition\n");
 
-		rv = VerifyKernelBlob(kblob_data, kblob_size,
+		/* The blob was hashed as it was read */
+		kb.body_digest_alg = body_digest_alg;
+		memcpy(kb.body_digest, body_digest, sizeof(kb.body_digest));
+
+		rv = VerifyKernelBlob(&kb, kblob_data, kblob_size,
 				      signpub_key, keyblock_file, min_version);
 
 		return rv;
@@ -590,9 +659,11 @@ static int do_vbutil_kernel(int argc, char *argv[])
 			return 1;
 		}
 
-		kpart_data = ReadOldKPartFromFileOrDie(filename, &kpart_size);
+		kpart_data = ReadOldKPartFromFileOrDie(filename, &kpart_size,
+						       NULL, NULL);
 
-		kblob_data = unpack_kernel_partition(kpart_data, kpart_size,
+		kblob_data = unpack_kernel_partition(&kb, kpart_data,
+						     kpart_size,
 						     opt_pad, &keyblock,
 						     &preamble, &kblob_size);
 
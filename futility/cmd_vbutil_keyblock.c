@@ -151,6 +151,11 @@ static int Pack(const char *outfile, const char *datapubkey,
 	if (signing_key)
 		free(signing_key);
 
+	if (!block) {
+		fprintf(stderr, "vbutil_keyblock: Error creating key block.\n");
+		return 1;
+	}
+
 	if (VB2_SUCCESS != vb2_write_keyblock(outfile, block)) {
 		fprintf(stderr, "vbutil_keyblock: Error writing key block.\n");
 		return 1;
@@ -28,6 +28,10 @@
 
 typedef ssize_t (*ReadFullyFn)(void *ctx, void *buf, size_t count);
 
+/* Move forward count bytes without reading them. Return 0 on success, or
+ * nonzero if the stream can't do that (the position must not change). */
+typedef int (*SkipFn)(void *ctx, size_t count);
+
 static ssize_t ReadFullyWithRead(void *ctx, void *buf, size_t count)
 {
 	ssize_t nr_read = 0;
@@ -45,6 +49,30 @@ static ssize_t ReadFullyWithRead(void *ctx, void *buf, size_t count)
 	return nr_read;
 }
 
+static int SkipWithSeek(void *ctx, size_t count)
+{
+	int fd = *((int*)ctx);
+	off_t now, end;
+
+	/* Pipes and such can't seek, so they'll have to read */
+	now = lseek(fd, 0, SEEK_CUR);
+	if (now < 0)
+		return -1;
+
+	/* Don't go past the end, like read would have told us */
+	end = lseek(fd, 0, SEEK_END);
+	if (end < now || (uint64_t)(end - now) < count) {
+		lseek(fd, now, SEEK_SET);
+		return -1;
+	}
+
+	if (lseek(fd, now + count, SEEK_SET) < 0) {
+		lseek(fd, now, SEEK_SET);
+		return -1;
+	}
+	return 0;
+}
+
 #ifdef USE_MTD
 static ssize_t ReadFullyWithMtdRead(void *ctx, void *buf, size_t count)
 {
@@ -71,7 +99,17 @@ static int SkipWithRead(void *ctx, ReadFullyFn read_fn, size_t count)
 	return 0;
 }
 
+/* Skip the stream with |skip_fn| if there is one and it works, or else with
+ * |read_fn|. Return 0 on success. */
+static int Skip(void *ctx, ReadFullyFn read_fn, SkipFn skip_fn, size_t count)
+{
+	if (skip_fn && !skip_fn(ctx, count))
+		return 0;
+	return SkipWithRead(ctx, read_fn, count);
+}
+
 static char *FindKernelConfigFromStream(void *ctx, ReadFullyFn read_fn,
+					SkipFn skip_fn,
 					uint64_t kernel_body_load_address)
 {
 	struct vb2_keyblock keyblock;
@@ -85,7 +123,7 @@ static char *FindKernelConfigFromStream(void *ctx, ReadFullyFn read_fn,
 		return NULL;
 	}
 	ssize_t to_skip = keyblock.keyblock_size - sizeof(keyblock);
-	if (to_skip < 0 || SkipWithRead(ctx, read_fn, to_skip)) {
+	if (to_skip < 0 || Skip(ctx, read_fn, skip_fn, to_skip)) {
 		VbExError("keyblock_size advances past the end of the blob\n");
 		return NULL;
 	}
@@ -97,7 +135,7 @@ static char *FindKernelConfigFromStream(void *ctx, ReadFullyFn read_fn,
 		return NULL;
 	}
 	to_skip = preamble.preamble_size - sizeof(preamble);
-	if (to_skip < 0 || SkipWithRead(ctx, read_fn, to_skip)) {
+	if (to_skip < 0 || Skip(ctx, read_fn, skip_fn, to_skip)) {
 		VbExError("preamble_size advances past the end of the blob\n");
 		return NULL;
 	}
@@ -115,7 +153,7 @@ static char *FindKernelConfigFromStream(void *ctx, ReadFullyFn read_fn,
 	    (kernel_body_load_address + CROS_PARAMS_SIZE +
 	     CROS_CONFIG_SIZE) + now;
 	to_skip = offset - now;
-	if (to_skip < 0 || SkipWithRead(ctx, read_fn, to_skip)) {
+	if (to_skip < 0 || Skip(ctx, read_fn, skip_fn, to_skip)) {
 		VbExError("params are outside of the memory blob: %x\n",
 			  offset);
 		return NULL;
@@ -145,6 +183,7 @@ char *FindKernelConfig(const char *infile, uint64_t kernel_body_load_address)
 
 	void *ctx = &fd;
 	ReadFullyFn read_fn = ReadFullyWithRead;
+	SkipFn skip_fn = SkipWithSeek;
 
 #ifdef USE_MTD
 	struct stat stat_buf;
@@ -161,10 +200,12 @@ char *FindKernelConfig(const char *infile, uint64_t kernel_body_load_address)
 			return NULL;
 		}
 		read_fn = ReadFullyWithMtdRead;
+		/* MTD reads step over bad blocks, so offsets aren't linear */
+		skip_fn = NULL;
 	}
 #endif
 
-	newstr = FindKernelConfigFromStream(ctx, read_fn,
+	newstr = FindKernelConfigFromStream(ctx, read_fn, skip_fn,
 					    kernel_body_load_address);
 
 #ifdef USE_MTD
@@ -14,9 +14,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "2sysincludes.h"
+#include "2common.h"
+#include "2rsa.h"
+#include "bdb_struct.h"
 #include "file_type.h"
+#include "fmap.h"
 #include "futility.h"
 #include "gbb_header.h"
+#include "vb2_struct.h"
+#include "vb21_struct.h"
 
 /* Description and functions to handle each file type */
 struct futil_file_type_s {
@@ -81,21 +88,149 @@ void print_file_types_and_exit(int retval)
 	exit(retval);
 }
 
+/*
+ * Cheap facts about a buffer, gathered once before any recognizer runs. Most
+ * of the recognizers do real work (copying the buffer, verifying signatures,
+ * scanning the whole thing for an FMAP), so we only call the ones whose
+ * header magic or minimum size says they could possibly match.
+ */
+struct file_sniff_s {
+	uint32_t magic;			/* First 32 bits, or 0 if too short */
+	uint32_t tail_magic;		/* Start of the reserved sig area, or 0 */
+	FmapHeader *fmap;
+	int has_pem;
+	int keyblock;
+	int gbb;
+	int vb1_pubkey;
+	int der_at_8;
+};
+
+static uint32_t read_u32(const uint8_t *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+/*
+ * A PEM file is text, and its "-----BEGIN" line comes after nothing more than
+ * a few lines of comments, so there's no need to look through all of a large
+ * binary for one.
+ */
+#define PEM_SNIFF_SIZE (64 * 1024)
+
+/* The buffer futil_file_type_buf() is working on, and the FMAP it found */
+static struct {
+	uint8_t *buf;
+	uint32_t len;
+	FmapHeader *fmap;
+} sniffed;
+
+FmapHeader *futil_file_type_fmap(uint8_t *buf, uint32_t len)
+{
+	if (sniffed.buf && buf == sniffed.buf && len == sniffed.len)
+		return sniffed.fmap;
+	return fmap_find(buf, len);
+}
+
+static void sniff_buf(uint8_t *buf, uint32_t len, struct file_sniff_s *s)
+{
+	static const char pem_begin[] = "-----BEGIN ";
+	struct vb2_packed_key pubkey;
+
+	memset(s, 0, sizeof(*s));
+
+	if (len >= sizeof(uint32_t))
+		s->magic = read_u32(buf);
+	if (len >= SIGNATURE_RSVD_SIZE)
+		s->tail_magic = read_u32(buf + len - SIGNATURE_RSVD_SIZE);
+
+	s->keyblock = len >= sizeof(struct vb2_keyblock) &&
+		!memcmp(buf, KEY_BLOCK_MAGIC, KEY_BLOCK_MAGIC_SIZE);
+	s->gbb = len >= sizeof(GoogleBinaryBlockHeader) &&
+		!memcmp(buf, GBB_SIGNATURE, GBB_SIGNATURE_SIZE);
+
+	if (len >= sizeof(pubkey)) {
+		memcpy(&pubkey, buf, sizeof(pubkey));
+		s->vb1_pubkey = vb2_crypto_to_signature(pubkey.algorithm) !=
+			VB2_SIG_INVALID;
+	}
+	/* A vb1 private key is a DER SEQUENCE after a 64-bit algorithm */
+	s->der_at_8 = len > sizeof(uint64_t) && buf[sizeof(uint64_t)] == 0x30;
+
+	/* Only the FMAP has to be looked for through the whole buffer */
+	s->fmap = fmap_find(buf, len);
+	s->has_pem = !!memmem(buf, len < PEM_SNIFF_SIZE ? len : PEM_SNIFF_SIZE,
+			      pem_begin, sizeof(pem_begin) - 1);
+}
+
+/* Could the recognizer for this type possibly say yes? */
+static int could_be(enum futil_file_type type, const struct file_sniff_s *s)
+{
+	switch (type) {
+	case FILE_TYPE_BIOS_IMAGE:
+	case FILE_TYPE_OLD_BIOS_IMAGE:
+		return !!s->fmap;
+	case FILE_TYPE_GBB:
+		return s->gbb;
+	case FILE_TYPE_FW_PREAMBLE:
+	case FILE_TYPE_KERN_PREAMBLE:
+	case FILE_TYPE_KEYBLOCK:
+		return s->keyblock;
+	case FILE_TYPE_PUBKEY:
+	case FILE_TYPE_PRIVKEY:
+		return s->vb1_pubkey || s->der_at_8;
+	case FILE_TYPE_VB2_PUBKEY:
+	case FILE_TYPE_VB2_PRIVKEY:
+		return s->magic == VB21_MAGIC_PACKED_KEY ||
+			s->magic == VB21_MAGIC_PACKED_PRIVATE_KEY;
+	case FILE_TYPE_PEM:
+		return s->has_pem;
+	case FILE_TYPE_RWSIG:
+		return s->magic == VB21_MAGIC_SIGNATURE || s->fmap ||
+			s->tail_magic == VB21_MAGIC_SIGNATURE;
+	case FILE_TYPE_BDB:
+		return s->magic == BDB_HEADER_MAGIC;
+	default:
+		/* No cheap test, so just ask */
+		return 1;
+	}
+}
+
 /* Try to figure out what we're looking at */
 enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len)
 {
-	enum futil_file_type type;
-	int i;
+	struct file_sniff_s sniff;
+	enum futil_file_type type = FILE_TYPE_UNKNOWN;
+	int i, j;
+
+	sniff_buf(buf, len, &sniff);
+
+	/* Recognizers that need the FMAP can have the one we just found */
+	sniffed.buf = buf;
+	sniffed.len = len;
+	sniffed.fmap = sniff.fmap;
 
 	for (i = 0; i < NUM_FILE_TYPES; i++) {
-		if (futil_file_types[i].recognize) {
-			type = futil_file_types[i].recognize(buf, len);
-			if (type != FILE_TYPE_UNKNOWN)
-				return type;
-		}
+		if (!futil_file_types[i].recognize || !could_be(i, &sniff))
+			continue;
+
+		/* Several types share a recognizer. It said no the first time */
+		for (j = 0; j < i; j++)
+			if (futil_file_types[j].recognize ==
+			    futil_file_types[i].recognize)
+				break;
+		if (j < i)
+			continue;
+
+		type = futil_file_types[i].recognize(buf, len);
+		if (type != FILE_TYPE_UNKNOWN)
+			break;
 	}
 
-	return FILE_TYPE_UNKNOWN;
+	sniffed.buf = NULL;
+	return type;
 }
 
 enum futil_file_err futil_file_type(const char *filename,
@@ -124,7 +259,7 @@ enum futil_file_err futil_file_type(const char *filename,
 	}
 
 	if (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)) {
-		err = futil_map_file(ifd, MAP_RO, &buf, &buf_len);
+		err = futil_map_file_head(ifd, MAP_RO, &buf, &buf_len);
 		if (err) {
 			close(ifd);
 			return err;
@@ -6,6 +6,8 @@
 #ifndef VBOOT_REFERENCE_FUTILITY_FILE_TYPE_H_
 #define VBOOT_REFERENCE_FUTILITY_FILE_TYPE_H_
 
+#include "fmap.h"
+
 /* What type of things do I know how to handle? */
 enum futil_file_type {
 	FILE_TYPE_UNKNOWN,
@@ -15,6 +17,12 @@ enum futil_file_type {
 	NUM_FILE_TYPES
 };
 
+/*
+ * RW-only device images (those without an FMAP) keep their vb21 signature in
+ * this many bytes at the very end.
+ */
+#define SIGNATURE_RSVD_SIZE 1024
+
 /* Short name for file types */
 const char * const futil_file_type_name(enum futil_file_type type);
 
@@ -32,6 +40,13 @@ int futil_str_to_file_type(const char *str, enum futil_file_type *type);
  */
 enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len);
 
+/*
+ * Find the FMAP in a buffer. While futil_file_type_buf() is asking the
+ * recognizers about that same buffer, this hands back what it already found
+ * instead of searching again.
+ */
+FmapHeader *futil_file_type_fmap(uint8_t *buf, uint32_t len);
+
 /*
  * This opens a file and tries to match it to one of the known file types.
  * It's not an error if it returns FILE_TYPE_UKNOWN.
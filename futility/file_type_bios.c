@@ -7,7 +7,11 @@
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "bmpblk_header.h"
 #include "fmap.h"
@@ -194,7 +198,7 @@ BUILD_ASSERT(ARRAY_SIZE(fmap_show_fn) == NUM_BIOS_COMPONENTS);
 
 int ft_show_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 {
-	FmapHeader *fmap;
+	struct fmap_handle *fmap;
 	FmapAreaHeader *ah = 0;
 	char ah_name[FMAP_NAMELEN + 1];
 	enum bios_component c;
@@ -206,11 +210,13 @@ int ft_show_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 	printf("BIOS:                    %s\n", name);
 
 	/* We've already checked, so we know this will work. */
-	fmap = fmap_find(buf, len);
+	fmap = fmap_open(buf, len);
+	if (!fmap)
+		return 1;
 	for (c = 0; c < NUM_BIOS_COMPONENTS; c++) {
 		/* We know one of these will work, too */
-		if (fmap_find_by_name(buf, len, fmap, fmap_name[c], &ah) ||
-		    fmap_find_by_name(buf, len, fmap, fmap_oldname[c], &ah)) {
+		if ((ah = fmap_area_by_name(fmap, fmap_name[c])) ||
+		    (ah = fmap_area_by_name(fmap, fmap_oldname[c]))) {
 			/* But the file might be truncated */
 			fmap_limit_area(ah, len);
 			/* The name is not necessarily null-terminated */
@@ -236,6 +242,7 @@ int ft_show_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 		}
 	}
 
+	fmap_close(fmap);
 	return retval;
 }
 
@@ -325,18 +332,24 @@ whatever:
 	return 0;
 }
 
-static int write_new_preamble(struct bios_area_s *vblock,
-			      struct bios_area_s *fw_body,
-			      struct vb2_private_key *signkey,
-			      struct vb2_keyblock *keyblock)
+/*
+ * Sign the firmware body and return a new keyblock + preamble for it, in a
+ * malloc'ed buffer. Returns NULL on error.
+ */
+static uint8_t *make_vblock(struct bios_area_s *fw_body,
+			   struct vb2_private_key *signkey,
+			   struct vb2_keyblock *keyblock,
+			   uint32_t *vblock_size)
 {
 	struct vb2_signature *body_sig;
 	struct vb2_fw_preamble *preamble;
+	uint8_t *vblock;
 
+	futil_map_will_read(fw_body->buf, fw_body->len);
 	body_sig = vb2_calculate_signature(fw_body->buf, fw_body->len, signkey);
 	if (!body_sig) {
 		fprintf(stderr, "Error calculating body signature\n");
-		return 1;
+		return NULL;
 	}
 
 	preamble = vb2_create_fw_preamble(sign_option.version,
@@ -344,24 +357,137 @@ static int write_new_preamble(struct bios_area_s *vblock,
 			body_sig,
 			signkey,
 			sign_option.flags);
+	free(body_sig);
 	if (!preamble) {
 		fprintf(stderr, "Error creating firmware preamble.\n");
-		free(body_sig);
-		return 1;
+		return NULL;
 	}
 
-	/* Write the new keyblock */
+	/* The new keyblock, then the new preamble */
 	uint32_t more = keyblock->keyblock_size;
-	memcpy(vblock->buf, keyblock, more);
-	/* and the new preamble */
-	memcpy(vblock->buf + more, preamble, preamble->preamble_size);
+	*vblock_size = more + preamble->preamble_size;
+	vblock = malloc(*vblock_size);
+	if (!vblock)
+		DIE;
+	memcpy(vblock, keyblock, more);
+	memcpy(vblock + more, preamble, preamble->preamble_size);
 
 	free(preamble);
-	free(body_sig);
+	return vblock;
+}
+
+static int write_vblock(struct bios_area_s *vblock,
+			const uint8_t *data, uint32_t size)
+{
+	if (size > vblock->len) {
+		fprintf(stderr, "New keyblock and preamble won't fit\n");
+		return 1;
+	}
+	memcpy(vblock->buf, data, size);
+	futil_map_dirty(vblock->buf, size);
+	return 0;
+}
+
+static int write_new_preamble(struct bios_area_s *vblock,
+			      struct bios_area_s *fw_body,
+			      struct vb2_private_key *signkey,
+			      struct vb2_keyblock *keyblock)
+{
+	uint8_t *data;
+	uint32_t size;
+	int retval;
+
+	data = make_vblock(fw_body, signkey, keyblock, &size);
+	if (!data)
+		return 1;
+	retval = write_vblock(vblock, data, size);
+	free(data);
+	return retval;
+}
+
+/* A preamble being signed by a child process */
+struct preamble_job_s {
+	pid_t pid;
+	int fd;
+};
+
+/*
+ * Start signing a preamble in a child process, which sends it back to us
+ * through a pipe. Returns non-zero if it couldn't be started, in which case
+ * the caller should just do it itself.
+ */
+static int start_new_preamble(struct preamble_job_s *job,
+			      struct bios_area_s *fw_body,
+			      struct vb2_private_key *signkey,
+			      struct vb2_keyblock *keyblock)
+{
+	int fds[2];
+	uint8_t *data;
+	uint32_t size = 0;
+
+	if (pipe(fds) < 0)
+		return 1;
+
+	/* Don't let the child repeat our buffered output */
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+
+	if (!job->pid) {
+		close(fds[0]);
+		data = make_vblock(fw_body, signkey, keyblock, &size);
+		/* A size of zero tells the parent we failed */
+		if (write(fds[1], &size, sizeof(size)) != sizeof(size) ||
+		    (data && write(fds[1], data, size) != size))
+			_exit(1);
+		fflush(NULL);
+		_exit(!data);
+	}
 
+	close(fds[1]);
+	job->fd = fds[0];
 	return 0;
 }
 
+/* Collect the preamble from start_new_preamble(). Returns zero on success. */
+static int finish_new_preamble(struct preamble_job_s *job,
+			       struct bios_area_s *vblock)
+{
+	uint8_t *data = NULL;
+	uint32_t size = 0, got = 0;
+	ssize_t n;
+	int status;
+	int retval = 1;
+
+	if (read(job->fd, &size, sizeof(size)) == sizeof(size) && size) {
+		data = malloc(size);
+		if (!data)
+			DIE;
+		while (got < size) {
+			n = read(job->fd, data + got, size - got);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			got += n;
+		}
+	}
+	close(job->fd);
+
+	if (waitpid(job->pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status))
+		fprintf(stderr, "Error signing firmware preamble\n");
+	else if (data && got == size)
+		retval = write_vblock(vblock, data, size);
+
+	free(data);
+	return retval;
+}
+
 static int write_loem(const char *ab, struct bios_area_s *vblock)
 {
 	char filename[PATH_MAX];
@@ -396,13 +522,22 @@ static int write_loem(const char *ab, struct bios_area_s *vblock)
 	return 0;
 }
 
-/* This signs a full BIOS image after it's been traversed. */
+/*
+ * This signs a full BIOS image after it's been traversed.
+ *
+ * When FW_MAIN_A and FW_MAIN_B are the same, they're signed with the same key
+ * and options, so VBLOCK_B is just a copy of VBLOCK_A and the body is hashed
+ * only once. When they differ, B is signed by a child process while we sign A.
+ */
 static int sign_bios_at_end(struct bios_state_s *state)
 {
 	struct bios_area_s *vblock_a = &state->area[BIOS_FMAP_VBLOCK_A];
 	struct bios_area_s *vblock_b = &state->area[BIOS_FMAP_VBLOCK_B];
 	struct bios_area_s *fw_a = &state->area[BIOS_FMAP_FW_MAIN_A];
 	struct bios_area_s *fw_b = &state->area[BIOS_FMAP_FW_MAIN_B];
+	struct preamble_job_s job_b;
+	uint8_t *data;
+	uint32_t size;
 	int retval = 0;
 
 	if (!vblock_a->is_valid || !vblock_b->is_valid ||
@@ -412,6 +547,8 @@ static int sign_bios_at_end(struct bios_state_s *state)
 	}
 
 	/* Do A & B differ ? */
+	futil_map_will_read(fw_a->buf, fw_a->len);
+	futil_map_will_read(fw_b->buf, fw_b->len);
 	if (fw_a->len != fw_b->len ||
 	    memcmp(fw_a->buf, fw_b->buf, fw_a->len)) {
 		/* Yes, must use DEV keys for A */
@@ -420,23 +557,34 @@ static int sign_bios_at_end(struct bios_state_s *state)
 				"FW A & B differ. DEV keys are required.\n");
 			return 1;
 		}
+
+		/* FW B is always normal keys */
+		if (start_new_preamble(&job_b, fw_b,
+				       sign_option.signprivate,
+				       sign_option.keyblock)) {
+			retval |= write_new_preamble(vblock_b, fw_b,
+						     sign_option.signprivate,
+						     sign_option.keyblock);
+			job_b.pid = 0;
+		}
+
 		retval |= write_new_preamble(vblock_a, fw_a,
 					     sign_option.devsignprivate,
 					     sign_option.devkeyblock);
+
+		if (job_b.pid)
+			retval |= finish_new_preamble(&job_b, vblock_b);
 	} else {
-		retval |= write_new_preamble(vblock_a, fw_a,
-					     sign_option.signprivate,
-					     sign_option.keyblock);
+		/* Same body, same keys: sign it once, use it for both */
+		data = make_vblock(fw_a, sign_option.signprivate,
+				   sign_option.keyblock, &size);
+		if (!data)
+			return 1;
+		retval |= write_vblock(vblock_a, data, size);
+		retval |= write_vblock(vblock_b, data, size);
+		free(data);
 	}
 
-	/* FW B is always normal keys */
-	retval |= write_new_preamble(vblock_b, fw_b,
-				     sign_option.signprivate,
-				     sign_option.keyblock);
-
-
-
-
 	if (sign_option.loemid) {
 		retval |= write_loem("A", vblock_a);
 		retval |= write_loem("B", vblock_b);
@@ -458,7 +606,7 @@ BUILD_ASSERT(ARRAY_SIZE(fmap_sign_fn) == NUM_BIOS_COMPONENTS);
 
 int ft_sign_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 {
-	FmapHeader *fmap;
+	struct fmap_handle *fmap;
 	FmapAreaHeader *ah = 0;
 	char ah_name[FMAP_NAMELEN + 1];
 	enum bios_component c;
@@ -468,11 +616,13 @@ int ft_sign_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 	memset(&state, 0, sizeof(state));
 
 	/* We've already checked, so we know this will work. */
-	fmap = fmap_find(buf, len);
+	fmap = fmap_open(buf, len);
+	if (!fmap)
+		return 1;
 	for (c = 0; c < NUM_BIOS_COMPONENTS; c++) {
 		/* We know one of these will work, too */
-		if (fmap_find_by_name(buf, len, fmap, fmap_name[c], &ah) ||
-		    fmap_find_by_name(buf, len, fmap, fmap_oldname[c], &ah)) {
+		if ((ah = fmap_area_by_name(fmap, fmap_name[c])) ||
+		    (ah = fmap_area_by_name(fmap, fmap_oldname[c]))) {
 			/* But the file might be truncated */
 			fmap_limit_area(ah, len);
 			/* The name is not necessarily null-terminated */
@@ -497,6 +647,8 @@ int ft_sign_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 		}
 	}
 
+	fmap_close(fmap);
+
 	retval += sign_bios_at_end(&state);
 
 	return retval;
@@ -504,24 +656,29 @@ int ft_sign_bios(const char *name, uint8_t *buf, uint32_t len, void *data)
 
 enum futil_file_type ft_recognize_bios_image(uint8_t *buf, uint32_t len)
 {
-	FmapHeader *fmap;
+	struct fmap_handle *fmap;
+	enum futil_file_type type = FILE_TYPE_UNKNOWN;
 	enum bios_component c;
 
-	fmap = fmap_find(buf, len);
+	fmap = fmap_open_header(buf, len, futil_file_type_fmap(buf, len));
 	if (!fmap)
 		return FILE_TYPE_UNKNOWN;
 
 	for (c = 0; c < NUM_BIOS_COMPONENTS; c++)
-		if (!fmap_find_by_name(buf, len, fmap, fmap_name[c], 0))
+		if (!fmap_area_by_name(fmap, fmap_name[c]))
 			break;
-	if (c == NUM_BIOS_COMPONENTS)
-		return FILE_TYPE_BIOS_IMAGE;
+	if (c == NUM_BIOS_COMPONENTS) {
+		type = FILE_TYPE_BIOS_IMAGE;
+		goto done;
+	}
 
 	for (c = 0; c < NUM_BIOS_COMPONENTS; c++)
-		if (!fmap_find_by_name(buf, len, fmap, fmap_oldname[c], 0))
+		if (!fmap_area_by_name(fmap, fmap_oldname[c]))
 			break;
 	if (c == NUM_BIOS_COMPONENTS)
-		return FILE_TYPE_OLD_BIOS_IMAGE;
+		type = FILE_TYPE_OLD_BIOS_IMAGE;
 
-	return FILE_TYPE_UNKNOWN;
+done:
+	fmap_close(fmap);
+	return type;
 }
@@ -31,8 +31,6 @@
 #include "host_signature2.h"
 #include "util_misc.h"
 
-#define SIGNATURE_RSVD_SIZE 1024
-
 static inline void vb2_print_bytes(const void *ptr, uint32_t len)
 {
 	const uint8_t *buf = (const uint8_t *)ptr;
@@ -182,6 +180,7 @@ int ft_show_rwsig(const char *name, uint8_t *buf, uint32_t len, void *nuthin)
 
 		vb2_workbuf_init(&wb, workbuf, sizeof(workbuf));
 
+		futil_map_will_read(data, data_size);
 		if (vb21_verify_data(data, data_size,
 				     (struct vb21_signature *)sigbuf,
 				     (const struct vb2_public_key *)&key,
@@ -284,6 +283,7 @@ int ft_sign_rwsig(const char *name, uint8_t *buf, uint32_t len, void *nuthin)
 		data_size = sign_option.data_size;
 
 	/* Sign the blob */
+	futil_map_will_read(data, data_size);
 	r = vb21_sign_data(&tmp_sig, data, data_size, sign_option.prikey, 0);
 	if (r) {
 		fprintf(stderr,
@@ -301,6 +301,7 @@ int ft_sign_rwsig(const char *name, uint8_t *buf, uint32_t len, void *nuthin)
 		}
 		memset(buf + len - sig_size, 0xff, sig_size);
 		memcpy(buf + len - sig_size, tmp_sig, tmp_sig->c.total_size);
+		futil_map_dirty(buf + len - sig_size, sig_size);
 	} else {
 		/* Write the signature to a new file */
 		r = vb21_write_object(sign_option.outfile, tmp_sig);
@@ -371,6 +372,7 @@ int ft_sign_rwsig(const char *name, uint8_t *buf, uint32_t len, void *nuthin)
 
 		memset(new_pubkey, 0xff, fmaparea->area_size);
 		memcpy(new_pubkey, packedkey, packedkey->c.total_size);
+		futil_map_dirty(new_pubkey, fmaparea->area_size);
 	}
 
 	/* Finally */
@@ -397,7 +399,7 @@ enum futil_file_type ft_recognize_rwsig(uint8_t *buf, uint32_t len)
 	if (!vb21_verify_signature((const struct vb21_signature *)buf, len))
 		return FILE_TYPE_RWSIG;
 
-	fmap = fmap_find(buf, len);
+	fmap = futil_file_type_fmap(buf, len);
 	if (fmap) {
 		/* This looks like a full image. */
 		FmapAreaHeader *fmaparea;
@@ -137,6 +137,7 @@ int ft_sign_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 	Debug("sig_offset   0x%08x\n", sig_offset);
 
 	/* Sign the blob */
+	futil_map_will_read(buf + rw_offset, rw_size);
 	r = vb21_sign_data(&sig_ptr, buf + rw_offset, rw_size, key_ptr, "Bah");
 	if (r) {
 		fprintf(stderr,
@@ -157,7 +158,7 @@ int ft_sign_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 	memcpy(buf + sig_offset,
 	       (uint8_t *)sig_ptr + sig_ptr->sig_offset,
 	       sig_ptr->sig_size);
-
+	futil_map_dirty(buf + sig_offset, sig_ptr->sig_size);
 
 	/* If there's no RO section, we're done. */
 	if (!ro_size) {
@@ -237,6 +238,7 @@ int ft_sign_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 	       4);
 	/* Pad with 0xff */
 	memset(buf + dst_ofs_n0inv + 4, 0xff, pub_pad);
+	futil_map_dirty(buf + pub_offset, pub_size);
 
 	/* Finally */
 	retval = 0;
@@ -367,12 +369,97 @@ static void show_usbpd1_stuff(const char *name,
 }
 
 
+/*
+ * The RW image is hashed up to where its signature starts, and the size of
+ * the signature depends on the RSA algorithm. Rather than hash the image
+ * again for every combination we try, each hash algorithm makes one pass over
+ * it, and finalizes a copy of its context at each place a signature could
+ * start. So identifying an image costs at most one pass per hash algorithm.
+ */
+struct usbpd1_digests_s {
+	const uint8_t *rw;
+	uint32_t rw_size;
+	int hashed[ARRAY_SIZE(hashes)];
+	uint8_t digest[ARRAY_SIZE(hashes)][ARRAY_SIZE(sigs)]
+		[VB2_MAX_DIGEST_SIZE];
+};
+
+static void usbpd1_digests_init(struct usbpd1_digests_s *d,
+				const uint8_t *rw, uint32_t rw_size)
+{
+	memset(d, 0, sizeof(*d));
+	d->rw = rw;
+	d->rw_size = rw_size;
+}
+
+/* Returns VB2_SUCCESS or random error code */
+static int usbpd1_hash_rw(struct usbpd1_digests_s *d, int h)
+{
+	struct vb2_digest_context dc, tmp;
+	uint32_t digest_size = vb2_digest_size(hashes[h]);
+	uint32_t done = 0, data_size, sig_size;
+	int finished[ARRAY_SIZE(sigs)];
+	int s, next;
+	int rv;
+
+	if (d->hashed[h])
+		return VB2_SUCCESS;
+
+	rv = vb2_digest_init(&dc, hashes[h]);
+	if (rv)
+		return rv;
+
+	futil_map_will_read(d->rw, d->rw_size);
+
+	/* Visit each place a signature could start, nearest first */
+	memset(finished, 0, sizeof(finished));
+	for (;;) {
+		next = -1;
+		for (s = 0; s < ARRAY_SIZE(sigs); s++) {
+			sig_size = vb2_rsa_sig_size(sigs[s]);
+			if (finished[s] || sig_size > d->rw_size)
+				continue;
+			if (next < 0 ||
+			    sig_size > vb2_rsa_sig_size(sigs[next]))
+				next = s;
+		}
+		if (next < 0)
+			break;
+
+		data_size = d->rw_size - vb2_rsa_sig_size(sigs[next]);
+		rv = vb2_digest_extend(&dc, d->rw + done, data_size - done);
+		if (rv)
+			return rv;
+		done = data_size;
+
+		/* Finalizing is destructive, so keep going with the original */
+		tmp = dc;
+		rv = vb2_digest_finalize(&tmp, d->digest[h][next],
+					 digest_size);
+		if (rv)
+			return rv;
+		finished[next] = 1;
+
+		/* Other algorithms with the same signature size share it */
+		for (s = 0; s < ARRAY_SIZE(sigs); s++)
+			if (!finished[s] && vb2_rsa_sig_size(sigs[s]) ==
+			    vb2_rsa_sig_size(sigs[next])) {
+				memcpy(d->digest[h][s], d->digest[h][next],
+				       digest_size);
+				finished[s] = 1;
+			}
+	}
+
+	d->hashed[h] = 1;
+	return VB2_SUCCESS;
+}
+
 /* Returns VB2_SUCCESS or random error code */
 static int try_our_own(enum vb2_signature_algorithm sig_alg,
 		       enum vb2_hash_algorithm hash_alg,
 		       const uint8_t *o_pubkey, uint32_t o_pubkey_size,
 		       const uint8_t *o_sig, uint32_t o_sig_size,
-		       const uint8_t *data, uint32_t data_size)
+		       const uint8_t *digest, uint32_t data_size)
 {
 	struct vb2_public_key pubkey;
 	struct vb21_signature *sig;
@@ -391,21 +478,34 @@ static int try_our_own(enum vb2_signature_algorithm sig_alg,
 				       o_sig, o_sig_size, data_size)))
 	    return rv;
 
-	rv = vb21_verify_data(data, data_size, sig, &pubkey, &wb);
+	rv = vb21_verify_digest(&pubkey, sig, digest, &wb);
 
 	free(sig);
 
 	return rv;
 }
 
+/* Return 1 if the modulus and its Montgomery constant agree, 0 if not */
+static int usbpd1_key_looks_ok(const uint8_t *o_pubkey, uint32_t sig_size)
+{
+	uint32_t n0, n0inv;
+
+	memcpy(&n0, o_pubkey, sizeof(n0));
+	memcpy(&n0inv, o_pubkey + 2 * sig_size, sizeof(n0inv));
+
+	return (uint32_t)(n0 * n0inv) == 0xffffffff;
+}
+
 /* Returns VB2_SUCCESS if the image validates itself */
 static int check_self_consistency(const uint8_t *buf,
 				  const char *name,
 				  uint32_t ro_size, uint32_t rw_size,
 				  uint32_t ro_offset, uint32_t rw_offset,
-				  enum vb2_signature_algorithm sig_alg,
-				  enum vb2_hash_algorithm hash_alg)
+				  struct usbpd1_digests_s *digests,
+				  int s, int h)
 {
+	enum vb2_signature_algorithm sig_alg = sigs[s];
+	enum vb2_hash_algorithm hash_alg = hashes[h];
 	/* Where are the important bits? */
 	uint32_t sig_size = vb2_rsa_sig_size(sig_alg);
 	uint32_t sig_offset = rw_offset + rw_size - sig_size;
@@ -417,10 +517,22 @@ static int check_self_consistency(const uint8_t *buf,
 	if (sig_size > rw_size || pubkey_size > ro_size)
 		return VB2_ERROR_UNKNOWN;
 
+	/*
+	 * A real key has n0inv = -1 / n[0] mod 2^32. Checking that is much
+	 * cheaper than hashing the RW image only to have the signature fail.
+	 */
+	if (!usbpd1_key_looks_ok(buf + pubkey_offset, sig_size))
+		return VB2_ERROR_UNKNOWN;
+
+	rv = usbpd1_hash_rw(digests, h);
+	if (rv)
+		return rv;
+
 	rv = try_our_own(sig_alg, hash_alg,		   /* algs */
 			 buf + pubkey_offset, pubkey_size, /* pubkey blob */
 			 buf + sig_offset, sig_size,	   /* sig blob */
-			 buf + rw_offset, rw_size - sig_size); /* RW image */
+			 digests->digest[h][s],		   /* RW digest */
+			 rw_size - sig_size);
 
 	if (rv == VB2_SUCCESS && name)
 		show_usbpd1_stuff(name, sig_alg, hash_alg,
@@ -433,6 +545,7 @@ static int check_self_consistency(const uint8_t *buf,
 int ft_show_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 {
 	uint32_t ro_size, rw_size, ro_offset, rw_offset;
+	struct usbpd1_digests_s digests;
 	int s, h;
 
 	Debug("%s(): name %s\n", __func__, name);
@@ -441,6 +554,7 @@ int ft_show_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 	/* Get image locations */
 	if (!parse_size_opts(len, &ro_size, &rw_size, &ro_offset, &rw_offset))
 		return 1;
+	usbpd1_digests_init(&digests, buf + rw_offset, rw_size);
 
 	/* TODO: If we don't have a RO image, ask for a public key
 	 * TODO: If we're given an external public key, use it (and its alg) */
@@ -455,7 +569,7 @@ int ft_show_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 			if (!check_self_consistency(buf, name,
 						    ro_size, rw_size,
 						    ro_offset, rw_offset,
-						    sigs[s], hashes[h]))
+						    &digests, s, h))
 				return 0;
 
 	printf("This doesn't appear to be a complete usbpd1 image\n");
@@ -465,6 +579,7 @@ int ft_show_usbpd1(const char *name, uint8_t *buf, uint32_t len, void *data)
 enum futil_file_type ft_recognize_usbpd1(uint8_t *buf, uint32_t len)
 {
 	uint32_t ro_size, rw_size, ro_offset, rw_offset;
+	struct usbpd1_digests_s digests;
 	int s, h;
 
 	/*
@@ -476,13 +591,14 @@ enum futil_file_type ft_recognize_usbpd1(uint8_t *buf, uint32_t len)
 	 */
 	ro_offset = 0;
 	ro_size = rw_size = rw_offset = len / 2;
+	usbpd1_digests_init(&digests, buf + rw_offset, rw_size);
 
 	for (s = 0; s < ARRAY_SIZE(sigs); s++)
 		for (h = 0; h < ARRAY_SIZE(hashes); h++)
 			if (!check_self_consistency(buf, 0,
 						    ro_size, rw_size,
 						    ro_offset, rw_offset,
-						    sigs[s], hashes[h]))
+						    &digests, s, h))
 				return FILE_TYPE_USBPD1;
 
 	return FILE_TYPE_UNKNOWN;
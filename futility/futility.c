@@ -23,6 +23,9 @@
 /* File to use for logging, if present */
 #define LOGFILE "/tmp/futility.log"
 
+/* Set this to anything but an empty string to turn logging off entirely */
+#define LOG_DISABLE_ENV "FUTILITY_DISABLE_LOGGING"
+
 /* Normally logging will only happen if the logfile already exists. Uncomment
  * this to force log file creation (and thus logging) always. */
 
@@ -30,91 +33,92 @@
 
 static int log_fd = -1;
 
-/* Write the string and a newline. Silently give up on errors */
-static void log_str(char *prefix, char *str)
+/*
+ * Each invocation's record is put together here, then appended to the log
+ * with a single write(). With O_APPEND, that keeps records from parallel
+ * invocations from interleaving without anyone having to take a lock.
+ */
+static char *log_rec;
+static size_t log_len, log_size;
+
+static void log_add(const char *str, size_t len)
 {
-	int len, done, n;
+	char *tmp;
+	size_t size;
+
+	if (log_len + len > log_size) {
+		size = log_size ? log_size : 1024;
+		while (size < log_len + len)
+			size *= 2;
+		tmp = realloc(log_rec, size);
+		if (!tmp)
+			return;
+		log_rec = tmp;
+		log_size = size;
+	}
 
+	memcpy(log_rec + log_len, str, len);
+	log_len += len;
+}
+
+/* Add the string and a newline to the record */
+static void log_str(char *prefix, char *str)
+{
 	if (log_fd < 0)
 		return;
 
 	if (!str)
 		str = "(NULL)";
 
-	if (prefix && *prefix) {
-		len = strlen(prefix);
-		for (done = 0; done < len; done += n) {
-			n = write(log_fd, prefix + done, len - done);
-			if (n < 0)
-				return;
-		}
-	}
+	if (prefix && *prefix)
+		log_add(prefix, strlen(prefix));
 
-	len = strlen(str);
-	if (len == 0) {
+	if (!*str)
 		str = "(EMPTY)";
-		len = strlen(str);
-	}
 
-	for (done = 0; done < len; done += n) {
-		n = write(log_fd, str + done, len - done);
-		if (n < 0)
-			return;
-	}
-
-	if (write(log_fd, "\n", 1) < 0)
-		return;
+	log_add(str, strlen(str));
+	log_add("\n", 1);
 }
 
+/* Write the record out. Silently give up on errors */
 static void log_close(void)
 {
-	struct flock lock;
+	size_t done;
+	ssize_t n;
 
-	if (log_fd >= 0) {
-		memset(&lock, 0, sizeof(lock));
-		lock.l_type = F_UNLCK;
-		lock.l_whence = SEEK_SET;
-		if (fcntl(log_fd, F_SETLKW, &lock))
-			perror("Unable to unlock log file");
+	if (log_fd < 0)
+		return;
 
-		close(log_fd);
-		log_fd = -1;
+	for (done = 0; done < log_len; done += n) {
+		n = write(log_fd, log_rec + done, log_len - done);
+		if (n < 0)
+			break;
 	}
+
+	close(log_fd);
+	log_fd = -1;
+	free(log_rec);
+	log_rec = NULL;
+	log_len = log_size = 0;
 }
 
 static void log_open(void)
 {
-	struct flock lock;
-	int ret;
+	const char *disable = getenv(LOG_DISABLE_ENV);
+
+	if (disable && *disable)
+		return;
 
 #ifdef FORCE_LOGGING_ON
 	log_fd = open(LOGFILE, O_WRONLY | O_APPEND | O_CREAT, 0666);
 #else
 	log_fd = open(LOGFILE, O_WRONLY | O_APPEND);
 #endif
-	if (log_fd < 0) {
-
-		if (errno != EACCES)
-			return;
-
-		/* Permission problems should improve shortly ... */
-		sleep(1);
-		log_fd = open(LOGFILE, O_WRONLY | O_APPEND | O_CREAT, 0666);
-		if (log_fd < 0)	/* Nope, they didn't */
-			return;
-	}
+	if (log_fd < 0)
+		return;
 
 	/* Let anyone have a turn */
 	fchmod(log_fd, 0666);
-
-	/* But only one at a time */
-	memset(&lock, 0, sizeof(lock));
-	lock.l_type = F_WRLCK;
-	lock.l_whence = SEEK_END;
-
-	ret = fcntl(log_fd, F_SETLKW, &lock);	/* this blocks */
-	if (ret < 0)
-		log_close();
 }
 
 static void log_args(int argc, char *argv[])
@@ -127,6 +131,8 @@ static void log_args(int argc, char *argv[])
 	char caller_buf[PATH_MAX];
 
 	log_open();
+	if (log_fd < 0)
+		return;
 
 	/* delimiter */
 	log_str(NULL, "##### LOG #####");
@@ -113,6 +113,9 @@ void update_hwid_digest(GoogleBinaryBlockHeader *gbb);
 int print_hwid_digest(GoogleBinaryBlockHeader *gbb,
 		      const char *banner, const char *footer);
 
+/* Copies a file. Returns non-zero (with an error message) if it can't. */
+int futil_copy_file(const char *infile, const char *outfile);
+
 /* Copies a file or dies with an error message */
 void futil_copy_file_or_die(const char *infile, const char *outfile);
 
@@ -140,13 +143,34 @@ enum futil_file_err {
 	FILE_ERR_SOCK,
 };
 
-/* Wrapper for mmap/munmap. Skips stupidly large files. */
+/*
+ * Wrappers for mmap/munmap. futil_map_file() maps the whole file, and won't
+ * map one that's larger than 4GB. futil_map_window() maps any part of any
+ * size file or block device. futil_map_file_head() maps the whole file if it
+ * can, or just the first FUTIL_HEAD_WINDOW_SIZE bytes if it's too big.
+ *
+ * Anything mapped with MAP_RW is written back by futil_unmap_file(). If
+ * futil_map_dirty() has been told which parts of it were changed, only those
+ * are synced. Otherwise, the whole thing is.
+ *
+ * futil_map_will_read() hints that a range is about to be read (hashed,
+ * usually) from start to finish. It's harmless on buffers that weren't mapped
+ * with these functions.
+ */
 #define MAP_RO 0
 #define MAP_RW 1
+#define FUTIL_HEAD_WINDOW_SIZE (64 * 1024 * 1024)
+enum futil_file_err futil_file_size(int fd, uint64_t *size);
 enum futil_file_err futil_map_file(int fd, int writeable,
 				   uint8_t **buf, uint32_t *len);
+enum futil_file_err futil_map_file_head(int fd, int writeable,
+					uint8_t **buf, uint32_t *len);
+enum futil_file_err futil_map_window(int fd, int writeable, uint64_t offset,
+				     uint64_t size, uint8_t **buf);
 enum futil_file_err futil_unmap_file(int fd, int writeable,
-				     uint8_t *buf, uint32_t len);
+				     uint8_t *buf, uint64_t len);
+void futil_map_dirty(const uint8_t *ptr, uint64_t len);
+void futil_map_will_read(const uint8_t *ptr, uint64_t len);
 
 /* The CPU architecture is occasionally important */
 enum arch_t {
@@ -29,6 +29,7 @@ struct show_option_s {
 	enum futil_file_type type;
 	struct vb21_packed_key *pkey;
 	uint32_t sig_size;
+	uint32_t jobs;
 };
 extern struct show_option_s show_option;
 
@@ -66,6 +67,11 @@ struct sign_option_s {
 	uint32_t ro_offset, rw_offset;
 	uint32_t data_size, sig_size;
 	struct vb2_private_key *prikey;
+	struct vb2_private_key *pem_private;
+	char *manifest;
+	uint32_t jobs;
+	char *server;
+	int digest;
 };
 extern struct sign_option_s sign_option;
 
@@ -5,8 +5,10 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #ifndef HAVE_MACOS
-#include <linux/fs.h>		/* For BLKGETSIZE64 */
+#include <linux/fs.h>		/* For BLKGETSIZE64, FICLONE */
 #endif
 #include <stdarg.h>
 #include <stdint.h>
@@ -15,9 +17,12 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#ifndef HAVE_MACOS
+#include <sys/sendfile.h>
+#endif
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include "2sysincludes.h"
@@ -181,67 +186,171 @@ void update_hwid_digest(GoogleBinaryBlockHeader *gbb)
 			  gbb->hwid_digest, sizeof(gbb->hwid_digest));
 }
 
+/*
+ * Copy everything from ifd to ofd, the cheapest way we can. Returns zero on
+ * success, or sets errno and returns non-zero.
+ */
+static int copy_fd(int ifd, int ofd)
+{
+	uint8_t buf[64 * 1024];
+	ssize_t n, w, done;
+	int copied = 0;
+
+#ifdef FICLONE
+	/* On a copy-on-write filesystem, the copy can share the data */
+	if (0 == ioctl(ofd, FICLONE, ifd))
+		return 0;
+#endif
+
+#ifdef __NR_copy_file_range
+	/* Or let the kernel copy it, possibly without moving the data */
+	while ((n = syscall(__NR_copy_file_range, ifd, NULL, ofd, NULL,
+			    1 << 30, 0)) > 0)
+		copied = 1;
+	if (n == 0)
+		return 0;
+	if (copied)
+		return 1;
+#endif
+
+#ifndef HAVE_MACOS
+	/* Older kernels can at least copy it without bouncing it through us */
+	while ((n = sendfile(ofd, ifd, NULL, 1 << 30)) > 0)
+		copied = 1;
+	if (n == 0)
+		return 0;
+	if (copied)
+		return 1;
+#endif
+
+	/* Fine, do it ourselves */
+	while ((n = read(ifd, buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		for (done = 0; done < n; done += w) {
+			w = write(ofd, buf + done, n - done);
+			if (w < 0) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /*
  * TODO: All sorts of race conditions likely here, and everywhere this is used.
  * Do we care? If so, fix it.
  */
-void futil_copy_file_or_die(const char *infile, const char *outfile)
+int futil_copy_file(const char *infile, const char *outfile)
 {
-	pid_t pid;
-	int status;
+	struct stat isb, osb;
+	int ifd, ofd = -1;
+	int rv = 1;
 
 	Debug("%s(%s, %s)\n", __func__, infile, outfile);
 
-	pid = fork();
+	ifd = open(infile, O_RDONLY);
+	if (ifd < 0 || 0 != fstat(ifd, &isb)) {
+		fprintf(stderr, "Can't open %s: %s\n", infile, strerror(errno));
+		goto done;
+	}
 
-	if (pid < 0) {
-		fprintf(stderr, "Couldn't fork /bin/cp process: %s\n",
-			strerror(errno));
-		exit(1);
+	/* Like cp, new files get the same permissions as the original */
+	ofd = open(outfile, O_WRONLY | O_CREAT, isb.st_mode & 0777);
+	if (ofd < 0 || 0 != fstat(ofd, &osb)) {
+		fprintf(stderr, "Can't open %s for writing: %s\n",
+			outfile, strerror(errno));
+		goto done;
 	}
 
-	/* child */
-	if (!pid) {
-		execl("/bin/cp", "/bin/cp", infile, outfile, NULL);
-		fprintf(stderr, "Child couldn't exec /bin/cp: %s\n",
-			strerror(errno));
-		exit(1);
+	/* Don't truncate what we're about to copy */
+	if (isb.st_dev == osb.st_dev && isb.st_ino == osb.st_ino) {
+		fprintf(stderr, "%s and %s are the same file\n",
+			infile, outfile);
+		goto done;
 	}
 
-	/* parent - wait for child to finish */
-	if (wait(&status) == -1) {
-		fprintf(stderr,
-			"Couldn't wait for /bin/cp process to exit: %s\n",
-			strerror(errno));
-		exit(1);
+	if ((S_ISREG(osb.st_mode) && 0 != ftruncate(ofd, 0)) ||
+	    0 != copy_fd(ifd, ofd)) {
+		fprintf(stderr, "Can't copy %s to %s: %s\n",
+			infile, outfile, strerror(errno));
+		goto done;
 	}
 
-	if (WIFEXITED(status)) {
-		status = WEXITSTATUS(status);
-		/* zero is normal exit */
-		if (!status)
-			return;
-		fprintf(stderr, "/bin/cp exited with status %d\n", status);
-		exit(1);
+	rv = 0;
+	if (0 != close(ofd)) {
+		fprintf(stderr, "Error when closing %s: %s\n",
+			outfile, strerror(errno));
+		rv = 1;
 	}
+	ofd = -1;
+
+done:
+	if (ofd >= 0)
+		close(ofd);
+	if (ifd >= 0)
+		close(ifd);
+	return rv;
+}
 
-	if (WIFSIGNALED(status)) {
-		status = WTERMSIG(status);
-		fprintf(stderr, "/bin/cp was killed with signal %d\n", status);
+void futil_copy_file_or_die(const char *infile, const char *outfile)
+{
+	if (futil_copy_file(infile, outfile))
 		exit(1);
-	}
+}
 
-	fprintf(stderr, "I have no idea what just happened\n");
-	exit(1);
+
+/*
+ * Every mapping handed out by futil_map_window() is remembered here, so that
+ * futil_unmap_file() can find the page-aligned mmap() behind the caller's
+ * pointer and msync() only the parts that were written.
+ */
+#define MAX_DIRTY_RANGES 16
+
+struct futil_mapping_s {
+	struct futil_mapping_s *next;
+	uint8_t *base;			/* What mmap() returned */
+	size_t base_len;
+	int writeable;
+	int ndirty;			/* -1 means sync everything */
+	struct {
+		size_t start, end;	/* Relative to base */
+	} dirty[MAX_DIRTY_RANGES];
+};
+
+static struct futil_mapping_s *futil_mappings;
+
+static struct futil_mapping_s *find_mapping(const uint8_t *ptr)
+{
+	struct futil_mapping_s *m;
+
+	for (m = futil_mappings; m; m = m->next)
+		if (ptr >= m->base && ptr < m->base + m->base_len)
+			return m;
+
+	return NULL;
 }
 
+static size_t page_size(void)
+{
+	static size_t size;
 
-enum futil_file_err futil_map_file(int fd, int writeable,
-				   uint8_t **buf, uint32_t *len)
+	if (!size)
+		size = sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+enum futil_file_err futil_file_size(int fd, uint64_t *size)
 {
 	struct stat sb;
-	void *mmap_ptr;
-	uint32_t reasonable_len;
 
 	if (0 != fstat(fd, &sb)) {
 		fprintf(stderr, "Can't stat input file: %s\n",
@@ -254,51 +363,229 @@ enum futil_file_err futil_map_file(int fd, int writeable,
 		ioctl(fd, BLKGETSIZE64, &sb.st_size);
 #endif
 
-	/* If the image is larger than 2^32 bytes, it's wrong. */
-	if (sb.st_size < 0 || sb.st_size > UINT32_MAX) {
+	if (sb.st_size < 0) {
+		fprintf(stderr, "Image size is unreasonable\n");
+		return FILE_ERR_SIZE;
+	}
+
+	*size = sb.st_size;
+	return FILE_ERR_NONE;
+}
+
+enum futil_file_err futil_map_window(int fd, int writeable, uint64_t offset,
+				     uint64_t size, uint8_t **buf)
+{
+	struct futil_mapping_s *m;
+	uint64_t file_size, skew;
+	void *mmap_ptr;
+	enum futil_file_err err;
+
+	err = futil_file_size(fd, &file_size);
+	if (err)
+		return err;
+
+	if (offset > file_size || size > file_size - offset) {
+		fprintf(stderr, "Can't map 0x%" PRIx64 " bytes at 0x%" PRIx64
+			" from a file of 0x%" PRIx64 " bytes\n",
+			size, offset, file_size);
+		return FILE_ERR_SIZE;
+	}
+
+	/* mmap() wants a page-aligned file offset */
+	skew = offset % page_size();
+	if (size + skew > SIZE_MAX) {
 		fprintf(stderr, "Image size is unreasonable\n");
 		return FILE_ERR_SIZE;
 	}
-	reasonable_len = (uint32_t)sb.st_size;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return FILE_ERR_MMAP;
 
 	if (writeable)
-		mmap_ptr = mmap(0, sb.st_size,
-				PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		mmap_ptr = mmap(0, size + skew, PROT_READ|PROT_WRITE,
+				MAP_SHARED, fd, offset - skew);
 	else
-		mmap_ptr = mmap(0, sb.st_size,
-				PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		mmap_ptr = mmap(0, size + skew, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE, fd, offset - skew);
 
 	if (mmap_ptr == (void *)-1) {
 		fprintf(stderr, "Can't mmap %s file: %s\n",
 			writeable ? "output" : "input",
 			strerror(errno));
+		free(m);
 		return FILE_ERR_MMAP;
 	}
 
-	*buf = (uint8_t *)mmap_ptr;
-	*len = reasonable_len;
+	m->base = (uint8_t *)mmap_ptr;
+	m->base_len = size + skew;
+	m->writeable = writeable;
+	m->next = futil_mappings;
+	futil_mappings = m;
+
+	*buf = m->base + skew;
 	return FILE_ERR_NONE;
 }
 
+enum futil_file_err futil_map_file(int fd, int writeable,
+				   uint8_t **buf, uint32_t *len)
+{
+	uint64_t size;
+	enum futil_file_err err;
+
+	err = futil_file_size(fd, &size);
+	if (err)
+		return err;
+
+	/* Bigger than that has to be looked at through futil_map_window() */
+	if (size > UINT32_MAX) {
+		fprintf(stderr, "Image is too large to map all at once\n");
+		return FILE_ERR_SIZE;
+	}
+
+	err = futil_map_window(fd, writeable, 0, size, buf);
+	if (err)
+		return err;
+
+	*len = (uint32_t)size;
+	return FILE_ERR_NONE;
+}
+
+enum futil_file_err futil_map_file_head(int fd, int writeable,
+					uint8_t **buf, uint32_t *len)
+{
+	uint64_t size;
+	enum futil_file_err err;
+
+	err = futil_file_size(fd, &size);
+	if (err)
+		return err;
+
+	if (size > UINT32_MAX)
+		size = FUTIL_HEAD_WINDOW_SIZE;
+
+	err = futil_map_window(fd, writeable, 0, size, buf);
+	if (err)
+		return err;
+
+	*len = (uint32_t)size;
+	return FILE_ERR_NONE;
+}
+
+void futil_map_dirty(const uint8_t *ptr, uint64_t len)
+{
+	struct futil_mapping_s *m = find_mapping(ptr);
+	size_t start, end;
+	int i, j;
+
+	if (!m || !m->writeable || !len || m->ndirty < 0)
+		return;
+
+	start = ptr - m->base;
+	end = len < m->base_len - start ? start + len : m->base_len;
+
+	/* Swallow any ranges this one overlaps or touches */
+	for (i = j = 0; i < m->ndirty; i++) {
+		if (m->dirty[i].end < start || m->dirty[i].start > end) {
+			m->dirty[j++] = m->dirty[i];
+			continue;
+		}
+		if (m->dirty[i].start < start)
+			start = m->dirty[i].start;
+		if (m->dirty[i].end > end)
+			end = m->dirty[i].end;
+	}
+	m->ndirty = j;
+
+	/* Too scattered to bother keeping track of */
+	if (m->ndirty == MAX_DIRTY_RANGES) {
+		m->ndirty = -1;
+		return;
+	}
+
+	m->dirty[m->ndirty].start = start;
+	m->dirty[m->ndirty].end = end;
+	m->ndirty++;
+}
+
+void futil_map_will_read(const uint8_t *ptr, uint64_t len)
+{
+	struct futil_mapping_s *m = find_mapping(ptr);
+	size_t start, end;
+
+	if (!m || !len)
+		return;
+
+	start = (ptr - m->base) / page_size() * page_size();
+	end = len < m->base_len - (ptr - m->base) ?
+		(ptr - m->base) + len : m->base_len;
+
+	/* These are only hints, so it doesn't matter if they don't work */
+	madvise(m->base + start, end - start, MADV_SEQUENTIAL);
+	madvise(m->base + start, end - start, MADV_WILLNEED);
+}
+
+static enum futil_file_err sync_range(uint8_t *ptr, size_t len)
+{
+	if (0 != msync(ptr, len, MS_SYNC|MS_INVALIDATE)) {
+		fprintf(stderr, "msync failed: %s\n", strerror(errno));
+		return FILE_ERR_MSYNC;
+	}
+	return FILE_ERR_NONE;
+}
+
+/*
+ * Write back what's been changed. If the caller never said what that was,
+ * that has to be the whole thing.
+ */
+static enum futil_file_err sync_mapping(struct futil_mapping_s *m)
+{
+	enum futil_file_err err = FILE_ERR_NONE;
+	size_t start, end;
+	int i;
+
+	if (m->ndirty <= 0)
+		return sync_range(m->base, m->base_len);
+
+	for (i = 0; i < m->ndirty; i++) {
+		start = m->dirty[i].start / page_size() * page_size();
+		end = m->dirty[i].end;
+		if (!err)
+			err = sync_range(m->base + start, end - start);
+	}
+
+	return err;
+}
+
 enum futil_file_err futil_unmap_file(int fd, int writeable,
-				     uint8_t *buf, uint32_t len)
+				     uint8_t *buf, uint64_t len)
 {
-	void *mmap_ptr = buf;
+	struct futil_mapping_s *m = find_mapping(buf);
+	struct futil_mapping_s **mp;
 	enum futil_file_err err = FILE_ERR_NONE;
 
-	if (writeable &&
-	    (0 != msync(mmap_ptr, len, MS_SYNC|MS_INVALIDATE))) {
-		fprintf(stderr, "msync failed: %s\n", strerror(errno));
-		err = FILE_ERR_MSYNC;
+	if (!m) {
+		fprintf(stderr, "Can't munmap pointer: not mapped\n");
+		return FILE_ERR_MUNMAP;
 	}
 
-	if (0 != munmap(mmap_ptr, len)) {
+	if (writeable)
+		err = sync_mapping(m);
+
+	if (0 != munmap(m->base, m->base_len)) {
 		fprintf(stderr, "Can't munmap pointer: %s\n",
 			strerror(errno));
 		if (err == FILE_ERR_NONE)
 			err = FILE_ERR_MUNMAP;
 	}
 
+	for (mp = &futil_mappings; *mp; mp = &(*mp)->next)
+		if (*mp == m) {
+			*mp = m->next;
+			break;
+		}
+	free(m);
+
 	return err;
 }
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2016 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * The framed protocol spoken between "futility sign_server" and the
+ * "futility sign --server" client over a local Unix socket.
+ *
+ * Each request is a struct sign_server_request followed by data_size bytes
+ * of payload, and is answered by a struct sign_server_response followed by
+ * data_size bytes of result. A connection may carry any number of requests.
+ * Both ends are on the same host, so the fields are in native byte order.
+ */
+
+#ifndef VBOOT_REFERENCE_FUTILITY_SIGN_SERVER_H_
+#define VBOOT_REFERENCE_FUTILITY_SIGN_SERVER_H_
+#include <stdint.h>
+
+#define SIGN_SERVER_REQUEST_MAGIC	0x51525356	/* "VSRQ" */
+#define SIGN_SERVER_RESPONSE_MAGIC	0x53525356	/* "VSRS" */
+
+/* Largest payload either end will accept */
+#define SIGN_SERVER_MAX_DATA_SIZE	(64 * 1024 * 1024)
+
+enum sign_server_op {
+	/* Payload is a packed public key; result is a keyblock */
+	SIGN_SERVER_OP_KEYBLOCK = 1,
+	/* Payload is a firmware body; result is keyblock + fw preamble */
+	SIGN_SERVER_OP_FW_PREAMBLE,
+	/*
+	 * Payload is a kernel blob; result is keyblock + kernel preamble. If
+	 * keyblock_size is non-zero, the payload starts with that many bytes
+	 * of keyblock to return instead of the server's own.
+	 */
+	SIGN_SERVER_OP_KERN_PREAMBLE,
+	/* Payload is a digest; result is the raw RSA signature of it */
+	SIGN_SERVER_OP_DIGEST,
+};
+
+struct sign_server_request {
+	uint32_t magic;
+	uint32_t op;			/* enum sign_server_op */
+	uint32_t version;
+	uint32_t flags;
+	uint32_t kloadaddr;
+	uint32_t padding;
+	/* Kernel blob layout, for SIGN_SERVER_OP_KERN_PREAMBLE */
+	uint64_t bootloader_address;
+	uint64_t vmlinuz_header_address;
+	uint32_t bootloader_size;
+	uint32_t vmlinuz_header_size;
+	uint32_t data_size;
+	uint32_t keyblock_size;
+};
+
+enum sign_server_status {
+	SIGN_SERVER_OK = 0,
+	SIGN_SERVER_BAD_REQUEST,
+	SIGN_SERVER_NO_KEY,
+	SIGN_SERVER_SIGN_FAILED,
+};
+
+struct sign_server_response {
+	uint32_t magic;
+	uint32_t status;		/* enum sign_server_status */
+	uint32_t data_size;
+};
+
+/*
+ * Connect to the sign server listening on socket_path. Returns the connected
+ * fd, or -1 on error.
+ */
+int sign_server_connect(const char *socket_path);
+
+/*
+ * Send one request with its payload over fd and wait for the answer. On
+ * success, *result is a malloc'ed buffer the caller must free. Returns zero
+ * on success, non-zero on any error (which has already been reported).
+ */
+int sign_server_call(int fd, const struct sign_server_request *req,
+		     const void *data, uint8_t **result,
+		     uint32_t *result_size);
+
+#endif	/* VBOOT_REFERENCE_FUTILITY_SIGN_SERVER_H_ */
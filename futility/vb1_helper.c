@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>		/* For PRIu64 */
 #include <stdio.h>
 #include <string.h>
@@ -24,39 +25,6 @@
 #include "vb1_helper.h"
 #include "vb2_common.h"
 
-/****************************************************************************/
-/* Here are globals containing all the bits & pieces I'm working on.
- *
- * kernel vblock    = keyblock + kernel preamble + padding to 64K (or whatever)
- * kernel blob      = 32-bit kernel + config file + params + bootloader stub +
- *                    vmlinuz_header
- * kernel partition = kernel vblock + kernel blob
- *
- * The vb2_kernel_preamble.preamble_size includes the padding.
- */
-
-/* The keyblock, preamble, and kernel blob are kept in separate places. */
-static struct vb2_keyblock *g_keyblock;
-static struct vb2_kernel_preamble *g_preamble;
-static uint8_t *g_kernel_blob_data;
-static uint32_t g_kernel_blob_size;
-
-/* These refer to individual parts within the kernel blob. */
-static uint8_t *g_kernel_data;
-static uint32_t g_kernel_size;
-static uint8_t *g_config_data;
-static uint32_t g_config_size;
-static uint8_t *g_param_data;
-static uint32_t g_param_size;
-static uint8_t *g_bootloader_data;
-static uint32_t g_bootloader_size;
-static uint8_t *g_vmlinuz_header_data;
-static uint32_t g_vmlinuz_header_size;
-
-static uint64_t g_ondisk_bootloader_addr;
-static uint64_t g_ondisk_vmlinuz_header_addr;
-
-
 /*
  * Read the kernel command line from a file. Get rid of \n characters along
  * the way and verify that the line fits into a 4K buffer.
@@ -154,9 +122,10 @@ static int KernelSize(uint8_t *kernel_buf,
 	return kernel_size - kernel32_start;
 }
 
-/* This extracts g_kernel_* and g_param_* from a standard vmlinuz file.
- * It returns nonzero on error. */
-static int PickApartVmlinuz(uint8_t *kernel_buf,
+/* This finds the kernel part of kb in a standard vmlinuz file, and fills in
+ * the params from it. It returns nonzero on error. */
+static int PickApartVmlinuz(struct kernel_blob_s *kb,
+			    uint8_t *kernel_buf,
 			    uint32_t kernel_size,
 			    enum arch_t arch,
 			    uint64_t kernel_body_load_address)
@@ -181,8 +150,8 @@ static int PickApartVmlinuz(uint8_t *kernel_buf,
 		Debug(" kernel16_size=0x%" PRIx64 "\n", kernel32_start);
 
 		/* Copy the original zeropage data from kernel_buf into
-		 * g_param_data, then tweak a few fields for our purposes */
-		params = (struct linux_kernel_params *)(g_param_data);
+		 * kb->param_data, then tweak a few fields for our purposes */
+		params = (struct linux_kernel_params *)(kb->param_data);
 		memcpy(&(params->setup_sects), &(lh->setup_sects),
 		       offsetof(struct linux_kernel_params, e820_entries)
 		       - offsetof(struct linux_kernel_params, setup_sects));
@@ -194,7 +163,7 @@ static int PickApartVmlinuz(uint8_t *kernel_buf,
 		 * will come right after the 32-bit part of the kernel. */
 		params->cmd_line_ptr = kernel_body_load_address +
 			roundup(kernel32_size, CROS_ALIGN) +
-			find_cmdline_start(g_config_data, g_config_size);
+			find_cmdline_start(kb->config_data, kb->config_size);
 		Debug(" cmdline_addr=0x%x\n", params->cmd_line_ptr);
 		Debug(" version=0x%x\n", params->version);
 		Debug(" kernel_alignment=0x%x\n", params->kernel_alignment);
@@ -212,20 +181,18 @@ static int PickApartVmlinuz(uint8_t *kernel_buf,
 	Debug(" kernel32_start=0x%" PRIx64 "\n", kernel32_start);
 	Debug(" kernel32_size=0x%" PRIx64 "\n", kernel32_size);
 
-	/* Keep just the 32-bit kernel. */
-	if (kernel32_size) {
-		g_kernel_size = kernel32_size;
-		memcpy(g_kernel_data, kernel_buf + kernel32_start,
-		       g_kernel_size);
-	}
+	/* Keep just the 32-bit kernel. It isn't copied anywhere yet. */
+	kb->kernel_size = kernel32_size;
+	kb->kernel_data = kernel_buf + kernel32_start;
 
 	/* done */
 	return 0;
 }
 
-/* Split a kernel blob into separate g_kernel, g_param, g_config,
- * g_bootloader, and g_vmlinuz_header parts. */
-static void UnpackKernelBlob(uint8_t *kernel_blob_data)
+/* Split a kernel blob into separate kernel, param, config, bootloader, and
+ * vmlinuz_header parts. */
+static void UnpackKernelBlob(struct kernel_blob_s *kb,
+			     uint8_t *kernel_blob_data)
 {
 	uint32_t now;
 	uint32_t vmlinuz_header_size = 0;
@@ -235,70 +202,72 @@ static void UnpackKernelBlob(uint8_t *kernel_blob_data)
 	   only describes the bootloader and vmlinuz stubs. */
 
 	/* Vmlinuz Header is at the end */
-	vb2_kernel_get_vmlinuz_header(g_preamble,
+	vb2_kernel_get_vmlinuz_header(kb->preamble,
 				      &vmlinuz_header_address,
 				      &vmlinuz_header_size);
 	if (vmlinuz_header_size) {
-		now = vmlinuz_header_address - g_preamble->body_load_address;
-		g_vmlinuz_header_size = vmlinuz_header_size;
-		g_vmlinuz_header_data = kernel_blob_data + now;
+		now = vmlinuz_header_address - kb->preamble->body_load_address;
+		kb->vmlinuz_header_size = vmlinuz_header_size;
+		kb->vmlinuz_header_data = kernel_blob_data + now;
 
 		Debug("vmlinuz_header_size     = 0x%x\n",
-		      g_vmlinuz_header_size);
+		      kb->vmlinuz_header_size);
 		Debug("vmlinuz_header_ofs      = 0x%x\n", now);
 	}
 
 	/* Where does the bootloader stub begin? */
-	now = g_preamble->bootloader_address - g_preamble->body_load_address;
+	now = kb->preamble->bootloader_address - kb->preamble->body_load_address;
 
 	/* Bootloader is at the end */
-	g_bootloader_size = g_preamble->bootloader_size;
-	g_bootloader_data = kernel_blob_data + now;
+	kb->bootloader_size = kb->preamble->bootloader_size;
+	kb->bootloader_data = kernel_blob_data + now;
 	/* TODO: What to do if this is beyond the end of the blob? */
 
-	Debug("bootloader_size     = 0x%x\n", g_bootloader_size);
+	Debug("bootloader_size     = 0x%x\n", kb->bootloader_size);
 	Debug("bootloader_ofs      = 0x%x\n", now);
 
 	/* Before that is the params */
 	now -= CROS_PARAMS_SIZE;
-	g_param_size = CROS_PARAMS_SIZE;
-	g_param_data = kernel_blob_data + now;
+	kb->param_size = CROS_PARAMS_SIZE;
+	kb->param_data = kernel_blob_data + now;
 	Debug("param_ofs           = 0x%x\n", now);
 
 	/* Before that is the config */
 	now -= CROS_CONFIG_SIZE;
-	g_config_size = CROS_CONFIG_SIZE;
-	g_config_data = kernel_blob_data + now;
+	kb->config_size = CROS_CONFIG_SIZE;
+	kb->config_data = kernel_blob_data + now;
 	Debug("config_ofs          = 0x%x\n", now);
 
 	/* The kernel starts at offset 0 and extends up to the config */
-	g_kernel_data = kernel_blob_data;
-	g_kernel_size = now;
-	Debug("kernel_size         = 0x%x\n", g_kernel_size);
+	kb->kernel_data = kernel_blob_data;
+	kb->kernel_size = now;
+	Debug("kernel_size         = 0x%x\n", kb->kernel_size);
 }
 
 
 /* Replaces the config section of the specified kernel blob.
  * Return nonzero on error. */
-int UpdateKernelBlobConfig(uint8_t *kblob_data, uint32_t kblob_size,
+int UpdateKernelBlobConfig(struct kernel_blob_s *kb,
+			   uint8_t *kblob_data, uint32_t kblob_size,
 			   uint8_t *config_data, uint32_t config_size)
 {
 	/* We should have already examined this blob. If not, we could do it
 	 * again, but it's more likely due to an error. */
-	if (kblob_data != g_kernel_blob_data ||
-	    kblob_size != g_kernel_blob_size) {
+	if (kblob_data != kb->blob_data ||
+	    kblob_size != kb->blob_size) {
 		fprintf(stderr, "Trying to update some other blob\n");
 		return -1;
 	}
 
-	memset(g_config_data, 0, g_config_size);
-	memcpy(g_config_data, config_data, config_size);
+	memset(kb->config_data, 0, kb->config_size);
+	memcpy(kb->config_data, config_data, config_size);
 
 	return 0;
 }
 
 /* Split a kernel partition into separate vblock and blob parts. */
-uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
+uint8_t *unpack_kernel_partition(struct kernel_blob_s *kb,
+				 uint8_t *kpart_data,
 				 uint32_t kpart_size,
 				 uint32_t padding,
 				 struct vb2_keyblock **keyblock_ptr,
@@ -310,6 +279,8 @@ uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
 	uint64_t vmlinuz_header_address = 0;
 	uint32_t now = 0;
 
+	memset(kb, 0, sizeof(*kb));
+
 	/* Sanity-check the keyblock */
 	struct vb2_keyblock *keyblock = (struct vb2_keyblock *)kpart_data;
 	Debug("Keyblock is 0x%x bytes\n", keyblock->keyblock_size);
@@ -327,7 +298,7 @@ uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
 	}
 
 	/* LGTM */
-	g_keyblock = keyblock;
+	kb->keyblock = keyblock;
 
 	/* And the preamble */
 	preamble = (struct vb2_kernel_preamble *)(kpart_data + now);
@@ -353,8 +324,8 @@ uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
 	uint32_t flags = vb2_kernel_get_flags(preamble);
 	Debug(" flags = 0x%x\n", flags);
 
-	g_preamble = preamble;
-	g_ondisk_bootloader_addr = g_preamble->bootloader_address;
+	kb->preamble = preamble;
+	kb->ondisk_bootloader_addr = kb->preamble->bootloader_address;
 
 	vb2_kernel_get_vmlinuz_header(preamble,
 				      &vmlinuz_header_address,
@@ -363,67 +334,63 @@ uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
 		Debug(" vmlinuz_header_address = 0x%" PRIx64 "\n",
 		      vmlinuz_header_address);
 		Debug(" vmlinuz_header_size = 0x%x\n", vmlinuz_header_size);
-		g_ondisk_vmlinuz_header_addr = vmlinuz_header_address;
+		kb->ondisk_vmlinuz_header_addr = vmlinuz_header_address;
 	}
 
 	Debug("kernel blob is at offset 0x%x\n", now);
-	g_kernel_blob_data = kpart_data + now;
-	g_kernel_blob_size = preamble->body_signature.data_size;
+	kb->blob_data = kpart_data + now;
+	kb->blob_size = preamble->body_signature.data_size;
+	kb->parts[0].iov_base = kb->blob_data;
+	kb->parts[0].iov_len = kb->blob_size;
+	kb->num_parts = 1;
 
 	/* Sanity check */
-	if (g_kernel_blob_size < preamble->body_signature.data_size)
+	if (kb->blob_size < preamble->body_signature.data_size)
 		fprintf(stderr,
 			"Warning: kernel file only has 0x%x bytes\n",
-			g_kernel_blob_size);
+			kb->blob_size);
 
 	/* Update the blob pointers */
-	UnpackKernelBlob(g_kernel_blob_data);
+	UnpackKernelBlob(kb, kb->blob_data);
 
 	if (keyblock_ptr)
 		*keyblock_ptr = keyblock;
 	if (preamble_ptr)
 		*preamble_ptr = preamble;
 	if (blob_size_ptr)
-		*blob_size_ptr = g_kernel_blob_size;
+		*blob_size_ptr = kb->blob_size;
 
-	return g_kernel_blob_data;
+	return kb->blob_data;
 }
 
-uint8_t *SignKernelBlob(uint8_t *kernel_blob,
-			uint32_t kernel_size,
-			uint32_t padding,
-			int version,
-			uint64_t kernel_body_load_address,
-			struct vb2_keyblock *keyblock,
-			struct vb2_private_key *signpriv_key,
-			uint32_t flags,
-			uint32_t *vblock_size_ptr)
+/* Wrap an already-made body signature in a kernel vblock */
+static uint8_t *MakeKernelVblock(const struct kernel_blob_s *kb,
+				 struct vb2_signature *body_sig,
+				 uint32_t padding,
+				 int version,
+				 uint64_t kernel_body_load_address,
+				 struct vb2_keyblock *keyblock,
+				 struct vb2_private_key *signpriv_key,
+				 uint32_t flags,
+				 uint32_t *vblock_size_ptr)
 {
 	/* Make sure the preamble fills up the rest of the required padding */
 	uint32_t min_size = padding > keyblock->keyblock_size
 		? padding - keyblock->keyblock_size : 0;
 
-	/* Sign the kernel data */
-	struct vb2_signature *body_sig = vb2_calculate_signature(kernel_blob,
-								 kernel_size,
-								 signpriv_key);
-	if (!body_sig) {
-		fprintf(stderr, "Error calculating body signature\n");
-		return NULL;
-	}
-
 	/* Create preamble */
 	struct vb2_kernel_preamble *preamble =
 		vb2_create_kernel_preamble(version,
 					   kernel_body_load_address,
-					   g_ondisk_bootloader_addr,
-					   g_bootloader_size,
+					   kb->ondisk_bootloader_addr,
+					   kb->bootloader_size,
 					   body_sig,
-					   g_ondisk_vmlinuz_header_addr,
-					   g_vmlinuz_header_size,
+					   kb->ondisk_vmlinuz_header_addr,
+					   kb->vmlinuz_header_size,
 					   flags,
 					   min_size,
 					   signpriv_key);
+	free(body_sig);
 	if (!preamble) {
 		fprintf(stderr, "Error creating preamble.\n");
 		return 0;
@@ -434,64 +401,177 @@ uint8_t *SignKernelBlob(uint8_t *kernel_blob,
 	memcpy(outbuf, keyblock, keyblock->keyblock_size);
 	memcpy(outbuf + keyblock->keyblock_size,
 	       preamble, preamble->preamble_size);
+	free(preamble);
 
 	if (vblock_size_ptr)
 		*vblock_size_ptr = outsize;
 	return outbuf;
 }
 
-/* Returns zero on success */
-int WriteSomeParts(const char *outfile,
-		   void *part1_data, uint32_t part1_size,
-		   void *part2_data, uint32_t part2_size)
+uint8_t *SignKernelBlob(const struct kernel_blob_s *kb,
+			uint8_t *kernel_blob,
+			uint32_t kernel_size,
+			uint32_t padding,
+			int version,
+			uint64_t kernel_body_load_address,
+			struct vb2_keyblock *keyblock,
+			struct vb2_private_key *signpriv_key,
+			uint32_t flags,
+			uint32_t *vblock_size_ptr)
 {
-	FILE *f;
+	/* Sign the kernel data */
+	futil_map_will_read(kernel_blob, kernel_size);
+	struct vb2_signature *body_sig = vb2_calculate_signature(kernel_blob,
+								 kernel_size,
+								 signpriv_key);
+	if (!body_sig) {
+		fprintf(stderr, "Error calculating body signature\n");
+		return NULL;
+	}
 
-	/* Write the output file */
-	Debug("writing %s with 0x%" PRIx64 ", 0x%" PRIx64 "\n",
-	      outfile, part1_size, part2_size);
+	return MakeKernelVblock(kb, body_sig, padding, version,
+				kernel_body_load_address, keyblock,
+				signpriv_key, flags, vblock_size_ptr);
+}
 
-	f = fopen(outfile, "wb");
-	if (!f) {
+uint8_t *SignKernelBlobParts(const struct kernel_blob_s *kb,
+			     uint32_t padding,
+			     int version,
+			     uint64_t kernel_body_load_address,
+			     struct vb2_keyblock *keyblock,
+			     struct vb2_private_key *signpriv_key,
+			     uint32_t flags,
+			     uint32_t *vblock_size_ptr)
+{
+	struct vb2_digest_context dc;
+	uint8_t digest[VB2_MAX_DIGEST_SIZE];
+	uint32_t digest_size = vb2_digest_size(signpriv_key->hash_alg);
+	struct vb2_signature *body_sig = NULL;
+	int i;
+
+	/* Hash each part where it is, instead of gathering them first */
+	if (VB2_SUCCESS == vb2_digest_init(&dc, signpriv_key->hash_alg)) {
+		for (i = 0; i < kb->num_parts; i++)
+			if (VB2_SUCCESS !=
+			    vb2_digest_extend(&dc, kb->parts[i].iov_base,
+					      kb->parts[i].iov_len))
+				break;
+		if (i == kb->num_parts &&
+		    VB2_SUCCESS == vb2_digest_finalize(&dc, digest,
+						       digest_size))
+			body_sig = vb2_sign_digest(digest, digest_size,
+						   kb->blob_size,
+						   signpriv_key);
+	}
+	if (!body_sig) {
+		fprintf(stderr, "Error calculating body signature\n");
+		return NULL;
+	}
+
+	return MakeKernelVblock(kb, body_sig, padding, version,
+				kernel_body_load_address, keyblock,
+				signpriv_key, flags, vblock_size_ptr);
+}
+
+/* Write out a list of buffers in order, with as few syscalls as we can. */
+static int WriteParts(const char *outfile, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
 		fprintf(stderr, "Can't open output file %s: %s\n",
 			outfile, strerror(errno));
 		return -1;
 	}
 
-	if (part1_data && part1_size) {
-		if (1 != fwrite(part1_data, part1_size, 1, f)) {
-			fprintf(stderr, "Can't write output file %s: %s\n",
-				outfile, strerror(errno));
-			fclose(f);
-			unlink(outfile);
-			return -1;
+	while (iovcnt > 0) {
+		/* Skip anything that's empty or already written */
+		if (!iov->iov_len) {
+			iov++;
+			iovcnt--;
+			continue;
 		}
-	}
-
-	if (part2_data && part2_size) {
-		if (1 != fwrite(part2_data, part2_size, 1, f)) {
+		n = writev(fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
 			fprintf(stderr, "Can't write output file %s: %s\n",
 				outfile, strerror(errno));
-			fclose(f);
+			close(fd);
 			unlink(outfile);
 			return -1;
 		}
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (n) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
 	}
 
-	fclose(f);
+	if (close(fd)) {
+		fprintf(stderr, "Can't write output file %s: %s\n",
+			outfile, strerror(errno));
+		unlink(outfile);
+		return -1;
+	}
 
 	/* Success */
 	return 0;
 }
 
+/* Returns zero on success */
+int WriteSomeParts(const char *outfile,
+		   void *part1_data, uint32_t part1_size,
+		   void *part2_data, uint32_t part2_size)
+{
+	struct iovec iov[2];
+
+	/* Write the output file */
+	Debug("writing %s with 0x%" PRIx64 ", 0x%" PRIx64 "\n",
+	      outfile, part1_size, part2_size);
+
+	iov[0].iov_base = part1_data;
+	iov[0].iov_len = part1_data ? part1_size : 0;
+	iov[1].iov_base = part2_data;
+	iov[1].iov_len = part2_data ? part2_size : 0;
+
+	return WriteParts(outfile, iov, 2);
+}
+
+/* Returns zero on success */
+int WriteKernelParts(const char *outfile,
+		     void *vblock_data, uint32_t vblock_size,
+		     const struct kernel_blob_s *kb)
+{
+	struct iovec iov[1 + KERNEL_BLOB_MAX_PARTS];
+	int i, iovcnt = 0;
+
+	Debug("writing %s with 0x%" PRIx64 ", 0x%" PRIx64 "\n",
+	      outfile, vblock_size, kb ? kb->blob_size : 0);
+
+	iov[iovcnt].iov_base = vblock_data;
+	iov[iovcnt++].iov_len = vblock_size;
+	for (i = 0; kb && i < kb->num_parts; i++)
+		iov[iovcnt++] = kb->parts[i];
+
+	return WriteParts(outfile, iov, iovcnt);
+}
+
 /* Returns 0 on success */
-int VerifyKernelBlob(uint8_t *kernel_blob,
+int VerifyKernelBlob(const struct kernel_blob_s *kb,
+		     uint8_t *kernel_blob,
 		     uint32_t kernel_size,
 		     struct vb2_packed_key *signpub_key,
 		     const char *keyblock_outfile,
 		     uint32_t min_version)
 {
-	int rv = -1;
+	int rv = -1, body_rv;
 	uint32_t vmlinuz_header_size = 0;
 	uint64_t vmlinuz_header_address = 0;
 
@@ -506,32 +586,32 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 			goto done;
 		}
 		if (VB2_SUCCESS !=
-		    vb2_verify_keyblock(g_keyblock, g_keyblock->keyblock_size,
+		    vb2_verify_keyblock(kb->keyblock, kb->keyblock->keyblock_size,
 					&pubkey, &wb)) {
 			fprintf(stderr, "Error verifying key block.\n");
 			goto done;
 		}
 	} else if (VB2_SUCCESS !=
-		   vb2_verify_keyblock_hash(g_keyblock,
-					    g_keyblock->keyblock_size,
+		   vb2_verify_keyblock_hash(kb->keyblock,
+					    kb->keyblock->keyblock_size,
 					    &wb)) {
 		fprintf(stderr, "Error verifying key block.\n");
 		goto done;
 	}
 
 	printf("Key block:\n");
-	struct vb2_packed_key *data_key = &g_keyblock->data_key;
+	struct vb2_packed_key *data_key = &kb->keyblock->data_key;
 	printf("  Signature:           %s\n",
 	       signpub_key ? "valid" : "ignored");
-	printf("  Size:                0x%x\n", g_keyblock->keyblock_size);
-	printf("  Flags:               %u ", g_keyblock->keyblock_flags);
-	if (g_keyblock->keyblock_flags & KEY_BLOCK_FLAG_DEVELOPER_0)
+	printf("  Size:                0x%x\n", kb->keyblock->keyblock_size);
+	printf("  Flags:               %u ", kb->keyblock->keyblock_flags);
+	if (kb->keyblock->keyblock_flags & KEY_BLOCK_FLAG_DEVELOPER_0)
 		printf(" !DEV");
-	if (g_keyblock->keyblock_flags & KEY_BLOCK_FLAG_DEVELOPER_1)
+	if (kb->keyblock->keyblock_flags & KEY_BLOCK_FLAG_DEVELOPER_1)
 		printf(" DEV");
-	if (g_keyblock->keyblock_flags & KEY_BLOCK_FLAG_RECOVERY_0)
+	if (kb->keyblock->keyblock_flags & KEY_BLOCK_FLAG_RECOVERY_0)
 		printf(" !REC");
-	if (g_keyblock->keyblock_flags & KEY_BLOCK_FLAG_RECOVERY_1)
+	if (kb->keyblock->keyblock_flags & KEY_BLOCK_FLAG_RECOVERY_1)
 		printf(" REC");
 	printf("\n");
 	printf("  Data key algorithm:  %u %s\n", data_key->algorithm,
@@ -548,7 +628,7 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 				keyblock_outfile, strerror(errno));
 			goto done;
 		}
-		if (1 != fwrite(g_keyblock, g_keyblock->keyblock_size, 1, f)) {
+		if (1 != fwrite(kb->keyblock, kb->keyblock->keyblock_size, 1, f)) {
 			fprintf(stderr, "Can't write key block file %s: %s\n",
 				keyblock_outfile, strerror(errno));
 			fclose(f);
@@ -571,27 +651,27 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 
 	/* Verify preamble */
 	if (VB2_SUCCESS != vb2_verify_kernel_preamble(
-			(struct vb2_kernel_preamble *)g_preamble,
-			g_preamble->preamble_size, &pubkey, &wb)) {
+			(struct vb2_kernel_preamble *)kb->preamble,
+			kb->preamble->preamble_size, &pubkey, &wb)) {
 		fprintf(stderr, "Error verifying preamble.\n");
 		goto done;
 	}
 
 	printf("Preamble:\n");
-	printf("  Size:                0x%x\n", g_preamble->preamble_size);
+	printf("  Size:                0x%x\n", kb->preamble->preamble_size);
 	printf("  Header version:      %u.%u\n",
-	       g_preamble->header_version_major,
-	       g_preamble->header_version_minor);
-	printf("  Kernel version:      %u\n", g_preamble->kernel_version);
+	       kb->preamble->header_version_major,
+	       kb->preamble->header_version_minor);
+	printf("  Kernel version:      %u\n", kb->preamble->kernel_version);
 	printf("  Body load address:   0x%" PRIx64 "\n",
-	       g_preamble->body_load_address);
+	       kb->preamble->body_load_address);
 	printf("  Body size:           0x%x\n",
-	       g_preamble->body_signature.data_size);
+	       kb->preamble->body_signature.data_size);
 	printf("  Bootloader address:  0x%" PRIx64 "\n",
-	       g_preamble->bootloader_address);
-	printf("  Bootloader size:     0x%x\n", g_preamble->bootloader_size);
+	       kb->preamble->bootloader_address);
+	printf("  Bootloader size:     0x%x\n", kb->preamble->bootloader_size);
 
-	vb2_kernel_get_vmlinuz_header(g_preamble,
+	vb2_kernel_get_vmlinuz_header(kb->preamble,
 				      &vmlinuz_header_address,
 				      &vmlinuz_header_size);
 	if (vmlinuz_header_size) {
@@ -602,27 +682,35 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 	}
 
 	printf("  Flags          :       0x%x\n",
-	       vb2_kernel_get_flags(g_preamble));
+	       vb2_kernel_get_flags(kb->preamble));
 
-	if (g_preamble->kernel_version < (min_version & 0xFFFF)) {
+	if (kb->preamble->kernel_version < (min_version & 0xFFFF)) {
 		fprintf(stderr,
 			"Kernel version %u is lower than minimum %u.\n",
-			g_preamble->kernel_version, (min_version & 0xFFFF));
+			kb->preamble->kernel_version, (min_version & 0xFFFF));
 		goto done;
 	}
 
-	/* Verify body */
-	if (VB2_SUCCESS !=
-	    vb2_verify_data(kernel_blob, kernel_size,
-			    &g_preamble->body_signature,
-			    &pubkey, &wb)) {
+	/* Verify body, unless it's already been hashed */
+	if (kb->body_digest_alg == pubkey.hash_alg &&
+	    kb->preamble->body_signature.data_size <= kernel_size) {
+		body_rv = vb2_verify_digest(&pubkey,
+					    &kb->preamble->body_signature,
+					    kb->body_digest, &wb);
+	} else {
+		futil_map_will_read(kernel_blob, kernel_size);
+		body_rv = vb2_verify_data(kernel_blob, kernel_size,
+					  &kb->preamble->body_signature,
+					  &pubkey, &wb);
+	}
+	if (VB2_SUCCESS != body_rv) {
 		fprintf(stderr, "Error verifying kernel body.\n");
 		goto done;
 	}
 	printf("Body verification succeeded.\n");
 
 	printf("Config:\n%s\n",
-	       kernel_blob + kernel_cmd_line_offset(g_preamble));
+	       kernel_blob + kernel_cmd_line_offset(kb->preamble));
 
 	rv = 0;
 done:
@@ -630,93 +718,179 @@ done:
 }
 
 
-uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+/* Zeros to pad the kernel and bootloader out to CROS_ALIGN */
+static const uint8_t zero_padding[CROS_ALIGN];
+
+static void AddKernelBlobPart(struct kernel_blob_s *kb,
+			      const void *data, uint32_t size)
+{
+	if (!size)
+		return;
+	kb->parts[kb->num_parts].iov_base = (void *)data;
+	kb->parts[kb->num_parts].iov_len = size;
+	kb->num_parts++;
+}
+
+int CreateKernelBlobParts(struct kernel_blob_s *kb,
+			  uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 			  enum arch_t arch, uint64_t kernel_body_load_address,
 			  uint8_t *config_data, uint32_t config_size,
-			  uint8_t *bootloader_data, uint32_t bootloader_size,
-			  uint32_t *blob_size_ptr)
+			  uint8_t *bootloader_data, uint32_t bootloader_size)
 {
 	uint32_t now = 0;
 	int tmp;
 
+	memset(kb, 0, sizeof(*kb));
+
 	/* We have all the parts. How much room do we need? */
 	tmp = KernelSize(vmlinuz_buf, vmlinuz_size, arch);
 	if (tmp < 0)
-		return NULL;
-	g_kernel_size = tmp;
-	g_config_size = CROS_CONFIG_SIZE;
-	g_param_size = CROS_PARAMS_SIZE;
-	g_bootloader_size = roundup(bootloader_size, CROS_ALIGN);
-	g_vmlinuz_header_size = vmlinuz_size-g_kernel_size;
-	g_kernel_blob_size =
-		roundup(g_kernel_size, CROS_ALIGN) +
-		g_config_size                      +
-		g_param_size                       +
-		g_bootloader_size                  +
-		g_vmlinuz_header_size;
-	Debug("g_kernel_blob_size  0x%" PRIx64 "\n", g_kernel_blob_size);
-
-	/* Allocate space for the blob. */
-	g_kernel_blob_data = malloc(g_kernel_blob_size);
-	memset(g_kernel_blob_data, 0, g_kernel_blob_size);
-
-	/* Assign the sub-pointers */
-	g_kernel_data = g_kernel_blob_data + now;
-	Debug("g_kernel_size       0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
-	      g_kernel_size, now);
-	now += roundup(g_kernel_size, CROS_ALIGN);
-
-	g_config_data = g_kernel_blob_data + now;
-	Debug("g_config_size       0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
-	      g_config_size, now);
-	now += g_config_size;
-
-	g_param_data = g_kernel_blob_data + now;
-	Debug("g_param_size        0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
-	      g_param_size, now);
-	now += g_param_size;
-
-	g_bootloader_data = g_kernel_blob_data + now;
-	Debug("g_bootloader_size   0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
-	      g_bootloader_size, now);
-	g_ondisk_bootloader_addr = kernel_body_load_address + now;
-	Debug("g_ondisk_bootloader_addr   0x%" PRIx64 "\n",
-	      g_ondisk_bootloader_addr);
-	now += g_bootloader_size;
-
-	if (g_vmlinuz_header_size) {
-		g_vmlinuz_header_data = g_kernel_blob_data + now;
-		Debug("g_vmlinuz_header_size 0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
-		      g_vmlinuz_header_size, now);
-		g_ondisk_vmlinuz_header_addr = kernel_body_load_address + now;
-		Debug("g_ondisk_vmlinuz_header_addr   0x%" PRIx64 "\n",
-		      g_ondisk_vmlinuz_header_addr);
-	}
-
-	Debug("end of kern_blob at kern_blob+0x%" PRIx64 "\n", now);
-
-	/* Copy the kernel and params bits into the correct places */
-	if (0 != PickApartVmlinuz(vmlinuz_buf, vmlinuz_size,
+		return -1;
+	kb->kernel_size = tmp;
+	kb->config_size = CROS_CONFIG_SIZE;
+	kb->param_size = CROS_PARAMS_SIZE;
+	kb->bootloader_size = roundup(bootloader_size, CROS_ALIGN);
+	kb->vmlinuz_header_size = vmlinuz_size-kb->kernel_size;
+	kb->blob_size =
+		roundup(kb->kernel_size, CROS_ALIGN) +
+		kb->config_size                      +
+		kb->param_size                       +
+		kb->bootloader_size                  +
+		kb->vmlinuz_header_size;
+	Debug("blob_size           0x%" PRIx64 "\n", kb->blob_size);
+
+	/* Only the config and params are new. Everything else is borrowed. */
+	kb->own_data = calloc(kb->config_size + kb->param_size, 1);
+	if (!kb->own_data) {
+		fprintf(stderr, "Can't allocate kernel blob\n");
+		return -1;
+	}
+
+	Debug("kernel_size         0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
+	      kb->kernel_size, now);
+	now += roundup(kb->kernel_size, CROS_ALIGN);
+
+	kb->config_data = kb->own_data;
+	Debug("config_size         0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
+	      kb->config_size, now);
+	now += kb->config_size;
+
+	kb->param_data = kb->own_data + kb->config_size;
+	Debug("param_size          0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
+	      kb->param_size, now);
+	now += kb->param_size;
+
+	kb->bootloader_data = bootloader_data;
+	Debug("bootloader_size     0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
+	      kb->bootloader_size, now);
+	kb->ondisk_bootloader_addr = kernel_body_load_address + now;
+	Debug("ondisk_bootloader_addr     0x%" PRIx64 "\n",
+	      kb->ondisk_bootloader_addr);
+	now += kb->bootloader_size;
+
+	if (kb->vmlinuz_header_size) {
+		kb->vmlinuz_header_data = vmlinuz_buf;
+		Debug("vmlinuz_header_size 0x%" PRIx64 " ofs 0x%" PRIx64 "\n",
+		      kb->vmlinuz_header_size, now);
+		kb->ondisk_vmlinuz_header_addr = kernel_body_load_address + now;
+		Debug("ondisk_vmlinuz_header_addr 0x%" PRIx64 "\n",
+		      kb->ondisk_vmlinuz_header_addr);
+	}
+
+	Debug("end of blob at blob+0x%" PRIx64 "\n", now);
+
+	/* Find the kernel and fill in the params. Note that the config
+	 * isn't there yet, so the command line starts at the beginning. */
+	if (0 != PickApartVmlinuz(kb, vmlinuz_buf, vmlinuz_size,
 				  arch, kernel_body_load_address)) {
 		fprintf(stderr, "Error picking apart kernel file.\n");
-		free(g_kernel_blob_data);
-		g_kernel_blob_data = NULL;
-		g_kernel_blob_size = 0;
+		FreeKernelBlobParts(kb);
+		kb->blob_size = 0;
+		return -1;
+	}
+
+	memcpy(kb->config_data, config_data, config_size);
+
+	/* This is the order they go in the kernel blob */
+	AddKernelBlobPart(kb, kb->kernel_data, kb->kernel_size);
+	AddKernelBlobPart(kb, zero_padding,
+			  roundup(kb->kernel_size, CROS_ALIGN) -
+			  kb->kernel_size);
+	AddKernelBlobPart(kb, kb->own_data, kb->config_size + kb->param_size);
+	AddKernelBlobPart(kb, bootloader_data, bootloader_size);
+	AddKernelBlobPart(kb, zero_padding,
+			  kb->bootloader_size - bootloader_size);
+	AddKernelBlobPart(kb, kb->vmlinuz_header_data,
+			  kb->vmlinuz_header_size);
+
+	return 0;
+}
+
+uint8_t *GatherKernelBlob(const struct kernel_blob_s *kb)
+{
+	uint8_t *blob, *now;
+	int i;
+
+	blob = malloc(kb->blob_size);
+	if (!blob)
 		return NULL;
+
+	now = blob;
+	for (i = 0; i < kb->num_parts; i++) {
+		memcpy(now, kb->parts[i].iov_base, kb->parts[i].iov_len);
+		now += kb->parts[i].iov_len;
 	}
 
-	/* Copy the other bits too */
-	memcpy(g_config_data, config_data, config_size);
-	memcpy(g_bootloader_data, bootloader_data, bootloader_size);
-	if (g_vmlinuz_header_size) {
-		memcpy(g_vmlinuz_header_data,
-		       vmlinuz_buf,
-		       g_vmlinuz_header_size);
+	return blob;
+}
+
+void FreeKernelBlobParts(struct kernel_blob_s *kb)
+{
+	free(kb->own_data);
+	kb->own_data = NULL;
+	kb->num_parts = 0;
+}
+
+uint8_t *CreateKernelBlob(struct kernel_blob_s *kb,
+			  uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+			  enum arch_t arch, uint64_t kernel_body_load_address,
+			  uint8_t *config_data, uint32_t config_size,
+			  uint8_t *bootloader_data, uint32_t bootloader_size,
+			  uint32_t *blob_size_ptr)
+{
+	uint8_t *blob;
+	uint32_t now = 0;
+
+	if (CreateKernelBlobParts(kb, vmlinuz_buf, vmlinuz_size,
+				  arch, kernel_body_load_address,
+				  config_data, config_size,
+				  bootloader_data, bootloader_size))
+		return NULL;
+
+	blob = GatherKernelBlob(kb);
+	FreeKernelBlobParts(kb);
+	if (!blob) {
+		kb->blob_size = 0;
+		return NULL;
 	}
 
+	/* Now the sub-pointers all point into the new blob */
+	kb->blob_data = blob;
+	kb->kernel_data = blob + now;
+	now += roundup(kb->kernel_size, CROS_ALIGN);
+	kb->config_data = blob + now;
+	now += kb->config_size;
+	kb->param_data = blob + now;
+	now += kb->param_size;
+	kb->bootloader_data = blob + now;
+	now += kb->bootloader_size;
+	if (kb->vmlinuz_header_size)
+		kb->vmlinuz_header_data = blob + now;
+	AddKernelBlobPart(kb, blob, kb->blob_size);
+
 	if (blob_size_ptr)
-		*blob_size_ptr = g_kernel_blob_size;
-	return g_kernel_blob_data;
+		*blob_size_ptr = kb->blob_size;
+	return kb->blob_data;
 }
 
 enum futil_file_type ft_recognize_vblock1(uint8_t *buf, uint32_t len)
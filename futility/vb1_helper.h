@@ -6,6 +6,10 @@
 #ifndef VBOOT_REFERENCE_FUTILITY_VB1_HELPER_H_
 #define VBOOT_REFERENCE_FUTILITY_VB1_HELPER_H_
 
+#include <sys/uio.h>
+
+#include "2sha.h"
+
 struct vb2_kernel_preamble;
 struct vb2_keyblock;
 struct vb2_packed_key;
@@ -13,17 +17,100 @@ struct vb2_packed_key;
 /* Display a public key with variable indentation */
 void show_pubkey(const struct vb2_packed_key *pubkey, const char *sp);
 
+/*
+ * Everything known about one kernel while it's being created, unpacked, or
+ * signed. Nothing else keeps any state, so any number of these can be in use
+ * at once.
+ *
+ * kernel vblock    = keyblock + kernel preamble + padding to 64K (or whatever)
+ * kernel blob      = 32-bit kernel + config file + params + bootloader stub +
+ *                    vmlinuz_header
+ * kernel partition = kernel vblock + kernel blob
+ *
+ * The vb2_kernel_preamble.preamble_size includes the padding.
+ */
+/* 32-bit kernel, padding, config + params, bootloader, padding, vmlinuz hdr */
+#define KERNEL_BLOB_MAX_PARTS 6
+
+struct kernel_blob_s {
+	/* The keyblock, preamble, and kernel blob are kept in separate places */
+	struct vb2_keyblock *keyblock;
+	struct vb2_kernel_preamble *preamble;
+	uint8_t *blob_data;
+	uint32_t blob_size;
+
+	/* These refer to individual parts within the kernel blob */
+	uint8_t *kernel_data;
+	uint32_t kernel_size;
+	uint8_t *config_data;
+	uint32_t config_size;
+	uint8_t *param_data;
+	uint32_t param_size;
+	uint8_t *bootloader_data;
+	uint32_t bootloader_size;
+	uint8_t *vmlinuz_header_data;
+	uint32_t vmlinuz_header_size;
+
+	/*
+	 * Where the bootloader and vmlinuz header will be once loaded, which
+	 * SignKernelBlob() records in the preamble. Setting these (and the
+	 * sizes above) lets a kernel blob made elsewhere be signed.
+	 */
+	uint64_t ondisk_bootloader_addr;
+	uint64_t ondisk_vmlinuz_header_addr;
+
+	/*
+	 * The kernel blob in order, as a list of pieces that needn't be next
+	 * to each other in memory. CreateKernelBlobParts() points these at the
+	 * caller's vmlinuz and bootloader instead of copying them, and keeps
+	 * only the config and params (which it has to make) in own_data.
+	 */
+	struct iovec parts[KERNEL_BLOB_MAX_PARTS];
+	int num_parts;
+	uint8_t *own_data;
+
+	/*
+	 * If body_digest_alg isn't VB2_HASH_INVALID, body_digest is the hash
+	 * of the kernel blob, made while it was being read. VerifyKernelBlob()
+	 * uses it instead of hashing the blob again.
+	 */
+	enum vb2_hash_algorithm body_digest_alg;
+	uint8_t body_digest[VB2_MAX_DIGEST_SIZE];
+};
+
 /* Other random functions needed for backward compatibility */
 
 uint8_t *ReadConfigFile(const char *config_file, uint32_t *config_size);
 
-uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+/*
+ * Build a new kernel blob from its parts, filling in kb. The blob is
+ * malloc'ed, and the caller must free it.
+ */
+uint8_t *CreateKernelBlob(struct kernel_blob_s *kb,
+			  uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 			  enum arch_t arch, uint64_t kernel_body_load_address,
 			  uint8_t *config_data, uint32_t config_size,
 			  uint8_t *bootloader_data, uint32_t bootloader_size,
 			  uint32_t *blob_size_ptr);
 
-uint8_t *SignKernelBlob(uint8_t *kernel_blob,
+/*
+ * Like CreateKernelBlob(), but only describe the new kernel blob in kb->parts
+ * without building it. The vmlinuz and bootloader buffers must stay around
+ * until FreeKernelBlobParts() is called. Returns nonzero on error.
+ */
+int CreateKernelBlobParts(struct kernel_blob_s *kb,
+			  uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+			  enum arch_t arch, uint64_t kernel_body_load_address,
+			  uint8_t *config_data, uint32_t config_size,
+			  uint8_t *bootloader_data, uint32_t bootloader_size);
+
+/* Copy the kernel blob described by kb->parts into a new malloc'ed buffer. */
+uint8_t *GatherKernelBlob(const struct kernel_blob_s *kb);
+
+void FreeKernelBlobParts(struct kernel_blob_s *kb);
+
+uint8_t *SignKernelBlob(const struct kernel_blob_s *kb,
+			uint8_t *kernel_blob,
 			uint32_t kernel_size,
 			uint32_t padding,
 			int version,
@@ -33,13 +120,32 @@ uint8_t *SignKernelBlob(uint8_t *kernel_blob,
 			uint32_t flags,
 			uint32_t *vblock_size_ptr);
 
+/* Same as SignKernelBlob(), but hashes the blob straight from kb->parts. */
+uint8_t *SignKernelBlobParts(const struct kernel_blob_s *kb,
+			     uint32_t padding,
+			     int version,
+			     uint64_t kernel_body_load_address,
+			     struct vb2_keyblock *keyblock,
+			     struct vb2_private_key *signpriv_key,
+			     uint32_t flags,
+			     uint32_t *vblock_size_ptr);
+
 int WriteSomeParts(const char *outfile,
 		   void *part1_data, uint32_t part1_size,
 		   void *part2_data, uint32_t part2_size);
 
+/*
+ * Write the vblock followed by the kernel blob in kb->parts (or just the
+ * vblock, if kb is NULL) to outfile. Returns zero on success.
+ */
+int WriteKernelParts(const char *outfile,
+		     void *vblock_data, uint32_t vblock_size,
+		     const struct kernel_blob_s *kb);
+
 /**
  * Unpack a kernel partition.
  *
+ * @param kb		Filled in with what was found, pointing into kpart_data
  * @param kpart_data	Kernel partition data
  * @param kpart_size	Size of kernel partition data in bytes
  * @param padding	Expected max size of keyblock+preamble
@@ -49,17 +155,20 @@ int WriteSomeParts(const char *outfile,
  *
  * @return A pointer to the kernel data blob, or NULL if error.
  */
-uint8_t *unpack_kernel_partition(uint8_t *kpart_data,
+uint8_t *unpack_kernel_partition(struct kernel_blob_s *kb,
+				 uint8_t *kpart_data,
 				 uint32_t kpart_size,
 				 uint32_t padding,
 				 struct vb2_keyblock **keyblock_ptr,
 				 struct vb2_kernel_preamble **preamble_ptr,
 				 uint32_t *blob_size_ptr);
 
-int UpdateKernelBlobConfig(uint8_t *kblob_data, uint32_t kblob_size,
+int UpdateKernelBlobConfig(struct kernel_blob_s *kb,
+			   uint8_t *kblob_data, uint32_t kblob_size,
 			   uint8_t *config_data, uint32_t config_size);
 
-int VerifyKernelBlob(uint8_t *kernel_blob,
+int VerifyKernelBlob(const struct kernel_blob_s *kb,
+		     uint8_t *kernel_blob,
 		     uint32_t kernel_size,
 		     struct vb2_packed_key *signpub_key,
 		     const char *keyblock_outfile,
@@ -215,10 +215,10 @@ int ft_show_pem(const char *name, uint8_t *buf, uint32_t len, void *data)
 		DIE;
 
 	/* Use to presence of the private exponent to decide if it's public */
-	printf("%s Key file:      %s\n", rsa_key->d ? "Private" : "Public",
+	printf("%s Key file:      %s\n", RSA_get0_d(rsa_key) ? "Private" : "Public",
 					 name);
 
-	bits = BN_num_bits(rsa_key->n);
+	bits = BN_num_bits(RSA_get0_n(rsa_key));
 	printf("  Key length:          %d\n", bits);
 
 	if (vb_keyb_from_rsa(rsa_key, &keyb, &keyb_len)) {
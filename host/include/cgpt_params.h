@@ -82,6 +82,9 @@ typedef struct CgptPrioritizeParams {
 } CgptPrioritizeParams;
 
 struct CgptFindParams;
+/* Bytes of new partition data read for each -M comparison window */
+#define CGPT_FIND_CHUNK 4096
+
 typedef void (*CgptFindShowFn)(struct CgptFindParams *params, char *filename,
                                int partnum, GptEntry *entry);
 typedef struct CgptFindParams {
@@ -96,15 +99,20 @@ typedef struct CgptFindParams {
 	uint8_t *matchbuf;
 	uint64_t matchlen;
 	uint64_t matchoffset;
-	uint8_t *comparebuf;
+	uint64_t matchrange;         /* content may start this far past offset */
+	uint8_t *comparebuf;         /* CGPT_FIND_CHUNK + matchlen - 1 bytes */
+	uint64_t comparesize;        /* at most, if matchrange is smaller */
+	uint64_t comparepos;         /* drive offset of data in comparebuf */
+	uint64_t comparelen;         /* bytes valid in comparebuf; 0 if none */
 	Guid unique_guid;
 	Guid type_guid;
 	char *label;
 	int hits;
 	int match_partnum;           /* 1-based; 0 means no match */
-	/* when working with MTD, we actually work on a temp file, but we still
-	 * need to print the device name. so this parameter is here to properly
-	 * show the correct device name in that special case. */
+	/* when working with MTD, we actually work on the GPT read from NOR
+	 * flash, but we still need to print the device name. so this parameter
+	 * is here to properly show the correct device name in that special
+	 * case. */
 	CgptFindShowFn show_fn;
 } CgptFindParams;
 
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "fmap.h"
@@ -24,23 +25,78 @@ static int is_fmap(uint8_t *ptr)
 	return 0;
 }
 
+/*
+ * fmap_find() has always searched offset zero first, then large alignments
+ * before small ones, and lower offsets first within the same alignment. This
+ * orders candidate offsets the same way, so the same FMAP wins.
+ */
+static size_t fmap_alignment(size_t offset)
+{
+	return offset & -offset;
+}
+
+static int fmap_cmp_offsets(const void *a, const void *b)
+{
+	size_t oa = *(const size_t *)a;
+	size_t ob = *(const size_t *)b;
+	size_t aa = fmap_alignment(oa);
+	size_t ab = fmap_alignment(ob);
+
+	if (aa != ab)
+		return aa > ab ? -1 : 1;
+	return oa < ob ? -1 : oa > ob;
+}
+
 /* Find and point to the FMAP header within the buffer */
 FmapHeader *fmap_find(uint8_t *ptr, size_t size)
 {
-	ssize_t offset, align;
-	ssize_t lim = size - sizeof(FmapHeader);
+	size_t lim, offset, *hits = NULL, *tmp;
+	size_t nhits = 0, maxhits = 0;
+	uint8_t *p, *end;
+	FmapHeader *fmap = NULL;
+	size_t i;
+
+	if (size < sizeof(FmapHeader))
+		return NULL;
+	lim = size - sizeof(FmapHeader);
 
-	if (lim >= 0 && is_fmap(ptr))
+	if (is_fmap(ptr))
 		return (FmapHeader *)ptr;
 
-	/* Search large alignments before small ones to find "right" FMAP. */
-	for (align = FMAP_SEARCH_STRIDE; align <= lim; align *= 2);
-	for (; align >= FMAP_SEARCH_STRIDE; align /= 2)
-		for (offset = align; offset <= lim; offset += align * 2)
-			if (is_fmap(ptr + offset))
-				return (FmapHeader *)(ptr + offset);
+	/*
+	 * One memmem() pass over the whole buffer finds every signature. There
+	 * are normally only one or two, so just remember the aligned ones.
+	 */
+	p = ptr + 1;
+	end = ptr + lim + FMAP_SIGNATURE_SIZE;
+	while (p < end &&
+	       (p = memmem(p, end - p, FMAP_SIGNATURE, FMAP_SIGNATURE_SIZE))) {
+		offset = p - ptr;
+		p++;
+		if (offset % FMAP_SEARCH_STRIDE)
+			continue;
+		if (nhits == maxhits) {
+			maxhits = maxhits ? maxhits * 2 : 4;
+			tmp = realloc(hits, maxhits * sizeof(*hits));
+			if (!tmp) {
+				/* Don't guess from a partial list */
+				free(hits);
+				return NULL;
+			}
+			hits = tmp;
+		}
+		hits[nhits++] = offset;
+	}
+
+	qsort(hits, nhits, sizeof(*hits), fmap_cmp_offsets);
+	for (i = 0; i < nhits; i++)
+		if (is_fmap(ptr + hits[i])) {
+			fmap = (FmapHeader *)(ptr + hits[i]);
+			break;
+		}
 
-	return NULL;
+	free(hits);
+	return fmap;
 }
 
 /* Search for an area by name, return pointer to its beginning */
@@ -65,3 +121,168 @@ uint8_t *fmap_find_by_name(uint8_t *ptr, size_t size, FmapHeader *fmap,
 
 	return NULL;
 }
+
+/* FNV-1a, over no more of the name than strncmp() would look at */
+static uint32_t fmap_hash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < FMAP_NAMELEN && name[i]; i++)
+		hash = (hash ^ (uint8_t)name[i]) * 16777619U;
+
+	return hash;
+}
+
+static int fmap_cmp_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+static uint64_t fmap_area_end(const FmapAreaHeader *ah)
+{
+	return (uint64_t)ah->area_offset + ah->area_size;
+}
+
+struct fmap_handle *fmap_open(uint8_t *ptr, size_t size)
+{
+	return fmap_open_header(ptr, size, fmap_find(ptr, size));
+}
+
+struct fmap_handle *fmap_open_header(uint8_t *ptr, size_t size,
+				     FmapHeader *fmap)
+{
+	struct fmap_handle *h;
+	size_t room;
+	uint32_t i, slot;
+	uint64_t max_end = 0;
+
+	if (!fmap)
+		return NULL;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	h->base = ptr;
+	h->size = size;
+	h->fmap = fmap;
+	h->areas = (FmapAreaHeader *)(fmap + 1);
+
+	/* Don't trust the header to fit within the buffer */
+	room = (ptr + size - (uint8_t *)h->areas) / sizeof(FmapAreaHeader);
+	h->nareas = fmap->fmap_nareas < room ? fmap->fmap_nareas : room;
+
+	/* At most half full, so the probe sequences stay short */
+	for (h->name_slots = 16; h->name_slots < 2 * h->nareas;
+	     h->name_slots *= 2)
+		;
+	h->by_name = malloc(h->name_slots * sizeof(*h->by_name));
+	h->by_offset = malloc((h->nareas + 1) * sizeof(*h->by_offset));
+	h->max_end = malloc((h->nareas + 1) * sizeof(*h->max_end));
+	if (!h->by_name || !h->by_offset || !h->max_end) {
+		fmap_close(h);
+		return NULL;
+	}
+
+	/*
+	 * Names may repeat. Like fmap_find_by_name(), the first one in the
+	 * FMAP is the one we want, so later duplicates aren't added.
+	 */
+	memset(h->by_name, 0xff, h->name_slots * sizeof(*h->by_name));
+	for (i = 0; i < h->nareas; i++) {
+		slot = fmap_hash_name(h->areas[i].area_name);
+		for (;; slot++) {
+			slot &= h->name_slots - 1;
+			if (h->by_name[slot] < 0) {
+				h->by_name[slot] = i;
+				break;
+			}
+			if (!strncmp(h->areas[h->by_name[slot]].area_name,
+				     h->areas[i].area_name, FMAP_NAMELEN))
+				break;
+		}
+	}
+
+	/*
+	 * The areas sorted by start, each with the largest end seen up to
+	 * that point. That's all the interval tree we need to find everything
+	 * that touches a given range without comparing every pair. Sort on
+	 * (offset, index) packed together, borrowing max_end for the keys.
+	 */
+	for (i = 0; i < h->nareas; i++)
+		h->max_end[i] = (uint64_t)h->areas[i].area_offset << 32 | i;
+	qsort(h->max_end, h->nareas, sizeof(*h->max_end), fmap_cmp_u64);
+	for (i = 0; i < h->nareas; i++)
+		h->by_offset[i] = (uint32_t)h->max_end[i];
+	for (i = 0; i < h->nareas; i++) {
+		uint64_t end = fmap_area_end(h->areas + h->by_offset[i]);
+		if (end > max_end)
+			max_end = end;
+		h->max_end[i] = max_end;
+	}
+
+	return h;
+}
+
+void fmap_close(struct fmap_handle *h)
+{
+	if (!h)
+		return;
+	free(h->by_name);
+	free(h->by_offset);
+	free(h->max_end);
+	free(h);
+}
+
+FmapAreaHeader *fmap_area_by_name(const struct fmap_handle *h,
+				  const char *name)
+{
+	uint32_t slot = fmap_hash_name(name);
+	int32_t i;
+
+	for (;; slot++) {
+		slot &= h->name_slots - 1;
+		i = h->by_name[slot];
+		if (i < 0)
+			return NULL;
+		if (!strncmp(h->areas[i].area_name, name, FMAP_NAMELEN))
+			return h->areas + i;
+	}
+}
+
+static int fmap_cmp_index(const void *a, const void *b)
+{
+	uint32_t ia = *(const uint32_t *)a;
+	uint32_t ib = *(const uint32_t *)b;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+uint32_t fmap_areas_touching(const struct fmap_handle *h,
+			     uint64_t start, uint64_t end, uint32_t *idx)
+{
+	uint32_t lo = 0, hi = h->nareas, mid, count = 0;
+	const FmapAreaHeader *ah;
+
+	/* Skip everything that starts after the range ends */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (h->areas[h->by_offset[mid]].area_offset <= end)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Walk back until nothing earlier reaches as far as the start */
+	while (lo-- > 0 && h->max_end[lo] >= start) {
+		ah = h->areas + h->by_offset[lo];
+		if (fmap_area_end(ah) >= start)
+			idx[count++] = h->by_offset[lo];
+	}
+
+	qsort(idx, count, sizeof(*idx), fmap_cmp_index);
+	return count;
+}
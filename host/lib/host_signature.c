@@ -9,8 +9,13 @@
 
 #include <openssl/rsa.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -24,95 +29,371 @@
 #include "host_signature2.h"
 #include "vb2_common.h"
 
-/* Invoke [external_signer] command with [pem_file] as an argument, contents of
- * [inbuf] passed redirected to stdin, and the stdout of the command is put
- * back into [outbuf].  Returns -1 on error, 0 on success.
+/*
+ * When asked to, an external signer which speaks the framed protocol (see
+ * vb2_external_signature() in host_signature.h) is started once for each
+ * signer and key file, and kept running until we exit.
  */
-static int sign_external(uint32_t size,
-			 const uint8_t *inbuf,
-			 uint8_t *outbuf,
-			 uint32_t outbufsize,
-			 const char *pem_file,
-			 const char *external_signer)
+struct external_signer {
+	struct external_signer *next;
+	char *signer;
+	char *pem_file;
+	pid_t owner;		/* Process which started it */
+	pid_t pid;		/* Zero if it isn't running */
+	int to_signer;
+	int from_signer;
+	int one_shot;		/* Only speaks the one-shot protocol */
+};
+
+static struct external_signer *external_signers;
+
+/* Read exactly [size] bytes. Returns 0 on success, -1 on EOF or error. */
+static int read_full(int fd, void *buf, uint32_t size)
+{
+	uint8_t *ptr = buf;
+	ssize_t n;
+
+	while (size) {
+		n = read(fd, ptr, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		ptr += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Write exactly [size] bytes. Returns 0 on success, -1 on error.
+ *
+ * A signer which exits early would kill us with SIGPIPE, so it's ignored
+ * while we write, and we see EPIPE instead.
+ */
+static int write_full(int fd, const void *buf, uint32_t size)
+{
+	const uint8_t *ptr = buf;
+	struct sigaction ignore, old;
+	ssize_t n;
+	int rv = 0;
+
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGPIPE, &ignore, &old);
+
+	while (size) {
+		n = write(fd, ptr, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n < 0 && errno == EPIPE)
+				VB2_DEBUG("External signer went away\n");
+			rv = -1;
+			break;
+		}
+		ptr += n;
+		size -= n;
+	}
+
+	sigaction(SIGPIPE, &old, NULL);
+	return rv;
+}
+
+/* Start "[external_signer] [option] [pem_file]" as a co-process, with pipes
+ * to its stdin and from its stdout. [option] may be NULL.  Returns the pid of
+ * the signer, or -1 on error.
+ */
+static pid_t start_signer(const char *external_signer, const char *option,
+			  const char *pem_file, int *to_signer,
+			  int *from_signer)
 {
-	int rv = 0, n;
 	int p_to_c[2], c_to_p[2];  /* pipe descriptors */
 	pid_t pid;
 
-	VB2_DEBUG("Will invoke \"%s %s\" to perform signing.\n"
+	VB2_DEBUG("Will invoke \"%s %s%s%s\" to perform signing.\n"
 		 "Input to the signer will be provided on standard in.\n"
 		 "Output of the signer will be read from standard out.\n",
-		  external_signer, pem_file);
+		  external_signer, option ? option : "", option ? " " : "",
+		  pem_file);
 
 	/* Need two pipes since we want to invoke the external_signer as
 	 * a co-process writing to its stdin and reading from its stdout. */
-	if (pipe(p_to_c) < 0 || pipe(c_to_p) < 0) {
+	if (pipe(p_to_c) < 0)  {
+		VB2_DEBUG("pipe() error\n");
+		return -1;
+	}
+	if (pipe(c_to_p) < 0) {
 		VB2_DEBUG("pipe() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
 		return -1;
 	}
+
+	/* Don't let other signers we start inherit our ends of the pipes, or
+	 * they'd never see EOF. */
+	fcntl(p_to_c[STDOUT_FILENO], F_SETFD, FD_CLOEXEC);
+	fcntl(c_to_p[STDIN_FILENO], F_SETFD, FD_CLOEXEC);
+
 	if ((pid = fork()) < 0) {
 		VB2_DEBUG("fork() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		close(c_to_p[0]);
+		close(c_to_p[1]);
 		return -1;
-	} else if (pid > 0) {  /* Parent. */
-		close(p_to_c[STDIN_FILENO]);
-		close(c_to_p[STDOUT_FILENO]);
-
-		/* We provide input to the child process (external signer). */
-		if (write(p_to_c[STDOUT_FILENO], inbuf, size) != size) {
-			VB2_DEBUG("write() error\n");
-			rv = -1;
-		} else {
-			/* Send EOF to child (signer process). */
-			close(p_to_c[STDOUT_FILENO]);
-
-			do {
-				n = read(c_to_p[STDIN_FILENO], outbuf,
-					 outbufsize);
-				outbuf += n;
-				outbufsize -= n;
-			} while (n > 0 && outbufsize);
-
-			if (n < 0) {
-				VB2_DEBUG("read() error\n");
-				rv = -1;
-			}
-		}
-		if (waitpid(pid, NULL, 0) < 0) {
-			VB2_DEBUG("waitpid() error\n");
-			rv = -1;
-		}
-	} else {  /* Child. */
-		close (p_to_c[STDOUT_FILENO]);
-		close (c_to_p[STDIN_FILENO]);
+	} else if (pid == 0) {  /* Child. */
 		/* Map the stdin to the first pipe (this pipe gets input
-		 * from the parent) */
-		if (STDIN_FILENO != p_to_c[STDIN_FILENO]) {
-			if (dup2(p_to_c[STDIN_FILENO], STDIN_FILENO) !=
-			    STDIN_FILENO) {
-				VB2_DEBUG("stdin dup2() failed\n");
-				close(p_to_c[0]);
-				return -1;
-			}
-		}
-		/* Map the stdout to the second pipe (this pipe sends back
-		 * signer output to the parent) */
-		if (STDOUT_FILENO != c_to_p[STDOUT_FILENO]) {
-			if (dup2(c_to_p[STDOUT_FILENO], STDOUT_FILENO) !=
-			    STDOUT_FILENO) {
-				VB2_DEBUG("stdout dup2() failed\n");
-				close(c_to_p[STDOUT_FILENO]);
-				return -1;
-			}
+		 * from the parent), and the stdout to the second pipe (this
+		 * pipe sends back signer output to the parent) */
+		if (dup2(p_to_c[STDIN_FILENO], STDIN_FILENO) < 0 ||
+		    dup2(c_to_p[STDOUT_FILENO], STDOUT_FILENO) < 0) {
+			VB2_DEBUG("dup2() failed\n");
+			_exit(127);
 		}
+		close(p_to_c[STDIN_FILENO]);
+		close(c_to_p[STDOUT_FILENO]);
 		/* External signer is invoked here. */
-		if (execl(external_signer, external_signer, pem_file,
-			  (char *) 0) < 0) {
-			VB2_DEBUG("execl() of external signer failed\n");
-		}
+		if (option)
+			execl(external_signer, external_signer, option,
+			      pem_file, (char *) 0);
+		else
+			execl(external_signer, external_signer, pem_file,
+			      (char *) 0);
+		VB2_DEBUG("execl() of external signer failed\n");
+		_exit(127);
+	}
+
+	/* Parent. */
+	close(p_to_c[STDIN_FILENO]);
+	close(c_to_p[STDOUT_FILENO]);
+	*to_signer = p_to_c[STDOUT_FILENO];
+	*from_signer = c_to_p[STDIN_FILENO];
+	return pid;
+}
+
+/* Invoke [external_signer] command with [pem_file] as an argument, contents of
+ * [inbuf] passed redirected to stdin, and the stdout of the command is put
+ * back into [outbuf].  Returns -1 on error, 0 on success.
+ */
+static int sign_one_shot(uint32_t size,
+			 const uint8_t *inbuf,
+			 uint8_t *outbuf,
+			 uint32_t outbufsize,
+			 const char *pem_file,
+			 const char *external_signer)
+{
+	int rv = 0, n = 0;
+	int to_signer, from_signer;
+	pid_t pid;
+
+	pid = start_signer(external_signer, NULL, pem_file,
+			   &to_signer, &from_signer);
+	if (pid < 0)
+		return -1;
+
+	/* We provide input to the child process (external signer). */
+	if (write_full(to_signer, inbuf, size)) {
+		VB2_DEBUG("write() error\n");
+		rv = -1;
+	}
+	/* Send EOF to child (signer process). */
+	close(to_signer);
+
+	while (rv == 0 && outbufsize) {
+		n = read(from_signer, outbuf, outbufsize);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		outbuf += n;
+		outbufsize -= n;
+	}
+	if (n < 0) {
+		VB2_DEBUG("read() error\n");
+		rv = -1;
+	}
+	close(from_signer);
+
+	if (waitpid(pid, NULL, 0) < 0) {
+		VB2_DEBUG("waitpid() error\n");
+		rv = -1;
 	}
 	return rv;
 }
 
+/* Stop a framed signer, killing it if it may not be listening to us. */
+static void stop_framed(struct external_signer *s, int kill_it)
+{
+	if (!s->pid)
+		return;
+
+	close(s->to_signer);
+	close(s->from_signer);
+	if (s->owner == getpid()) {
+		if (kill_it)
+			kill(s->pid, SIGTERM);
+		waitpid(s->pid, NULL, 0);
+	}
+	s->pid = 0;
+}
+
+static void stop_external_signers(void)
+{
+	struct external_signer *s, *next;
+
+	for (s = external_signers; s; s = next) {
+		next = s->next;
+		stop_framed(s, 0);
+		free(s->signer);
+		free(s->pem_file);
+		free(s);
+	}
+	external_signers = NULL;
+}
+
+/* Find (or add) the entry for [external_signer] using [pem_file]. */
+static struct external_signer *find_signer(const char *pem_file,
+					   const char *external_signer)
+{
+	struct external_signer *s;
+
+	for (s = external_signers; s; s = s->next) {
+		if (strcmp(s->signer, external_signer) ||
+		    strcmp(s->pem_file, pem_file))
+			continue;
+		/* A signer started before we forked belongs to our parent. */
+		if (s->pid && s->owner != getpid())
+			stop_framed(s, 0);
+		return s;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->signer = strdup(external_signer);
+	s->pem_file = strdup(pem_file);
+	if (!s->signer || !s->pem_file) {
+		free(s->signer);
+		free(s->pem_file);
+		free(s);
+		return NULL;
+	}
+
+	if (!external_signers)
+		atexit(stop_external_signers);
+	s->next = external_signers;
+	external_signers = s;
+	return s;
+}
+
+/* Start a framed signer and wait for its greeting. Returns 0 on success. */
+static int start_framed(struct external_signer *s)
+{
+	uint8_t magic[EXTERNAL_SIGNER_MAGIC_SIZE];
+	struct pollfd pfd;
+
+	s->pid = start_signer(s->signer, EXTERNAL_SIGNER_FRAMED_OPTION,
+			      s->pem_file, &s->to_signer, &s->from_signer);
+	if (s->pid < 0) {
+		s->pid = 0;
+		return -1;
+	}
+	s->owner = getpid();
+
+	pfd.fd = s->from_signer;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, EXTERNAL_SIGNER_GREETING_MS) <= 0 ||
+	    read_full(s->from_signer, magic, sizeof(magic)) ||
+	    memcmp(magic, EXTERNAL_SIGNER_MAGIC, sizeof(magic))) {
+		VB2_DEBUG("\"%s\" doesn't speak the framed protocol\n",
+			  s->signer);
+		stop_framed(s, 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Sign [inbuf] with a framed signer. Returns 0 on success, -1 if the signer
+ * couldn't sign it, or 1 if the signer can't be used this way at all.
+ */
+static int sign_framed(struct external_signer *s,
+		       uint32_t size,
+		       const uint8_t *inbuf,
+		       uint8_t *outbuf,
+		       uint32_t outbufsize)
+{
+	uint8_t len[4];
+	uint32_t sig_size;
+
+	if (!s->pid && start_framed(s))
+		return 1;
+
+	len[0] = size;
+	len[1] = size >> 8;
+	len[2] = size >> 16;
+	len[3] = size >> 24;
+	if (write_full(s->to_signer, len, sizeof(len)) ||
+	    write_full(s->to_signer, inbuf, size) ||
+	    read_full(s->from_signer, len, sizeof(len)))
+		goto broken;
+
+	sig_size = len[0] | len[1] << 8 | len[2] << 16 | (uint32_t)len[3] << 24;
+	if (!sig_size) {
+		VB2_DEBUG("External signer couldn't sign\n");
+		return -1;
+	}
+	if (sig_size > outbufsize ||
+	    read_full(s->from_signer, outbuf, sig_size))
+		goto broken;
+
+	return 0;
+
+broken:
+	VB2_DEBUG("Lost the framed external signer\n");
+	stop_framed(s, 1);
+	return 1;
+}
+
+/* Is the framed protocol wanted? Signers which don't know about it may wait
+ * for EOF instead of greeting us, so we only try it when asked.
+ */
+static int want_framed(void)
+{
+	const char *val = getenv(EXTERNAL_SIGNER_FRAMED_ENV);
+
+	return val && *val && strcmp(val, "0");
+}
+
+/* Sign [inbuf] with [external_signer], reusing one framed signer process for
+ * all the signatures made with [pem_file] if asked to and it can, or starting
+ * a new process for each one if not.  Returns -1 on error, 0 on success.
+ */
+static int sign_external(uint32_t size,
+			 const uint8_t *inbuf,
+			 uint8_t *outbuf,
+			 uint32_t outbufsize,
+			 const char *pem_file,
+			 const char *external_signer)
+{
+	struct external_signer *s = NULL;
+	int rv;
+
+	if (want_framed())
+		s = find_signer(pem_file, external_signer);
+	if (s && !s->one_shot) {
+		rv = sign_framed(s, size, inbuf, outbuf, outbufsize);
+		if (rv <= 0)
+			return rv;
+		/* Don't try again. */
+		s->one_shot = 1;
+	}
+
+	return sign_one_shot(size, inbuf, outbuf, outbufsize,
+			     pem_file, external_signer);
+}
+
 struct vb2_signature *vb2_external_signature(const uint8_t *data,
 					     uint32_t size,
 					     const char *key_file,
@@ -35,7 +35,10 @@ typedef struct _FmapAreaHeader {
 } __attribute__((packed)) FmapAreaHeader;
 
 
-/* Find and point to the FMAP header within the buffer */
+/*
+ * Find and point to the FMAP header within the buffer. Returns NULL if there
+ * isn't one, or if there wasn't enough memory to search for it.
+ */
 FmapHeader *fmap_find(uint8_t *ptr, size_t size);
 
 /* Search for an area by name, return pointer to its beginning */
@@ -47,4 +50,59 @@ uint8_t *fmap_find_by_name(uint8_t *ptr, size_t size,
 			   /* optional, return pointer to entry if not NULL */
 			   FmapAreaHeader **ah);
 
+/*
+ * A parsed FMAP. Looking areas up by name through this costs a hash probe
+ * instead of a scan of the whole area table, which matters to callers that
+ * ask for many areas in the same image.
+ */
+struct fmap_handle {
+	/* The image and its FMAP, which point into it */
+	uint8_t *base;
+	size_t size;
+	FmapHeader *fmap;
+	FmapAreaHeader *areas;
+	/* Number of areas that actually fit in the image */
+	uint32_t nareas;
+	/* Open-addressed table of area indexes by name, -1 if unused */
+	int32_t *by_name;
+	uint32_t name_slots;
+	/* Area indexes sorted by offset, and the furthest end up to each */
+	uint32_t *by_offset;
+	uint64_t *max_end;
+};
+
+/*
+ * Find the FMAP in the buffer and index it. Returns NULL if there isn't one
+ * (or we run out of memory). The buffer must outlive the handle. Free the
+ * handle with fmap_close().
+ */
+struct fmap_handle *fmap_open(uint8_t *ptr, size_t size);
+
+/*
+ * Like fmap_open(), for a caller that already has the FMAP header from
+ * fmap_find(ptr, size), so the buffer isn't searched again. A NULL fmap
+ * returns NULL.
+ */
+struct fmap_handle *fmap_open_header(uint8_t *ptr, size_t size,
+				     FmapHeader *fmap);
+
+/* Free a handle from fmap_open(). NULL is okay. */
+void fmap_close(struct fmap_handle *h);
+
+/*
+ * Return the first area with the given name, or NULL if there isn't one.
+ * Names are compared like fmap_find_by_name() does.
+ */
+FmapAreaHeader *fmap_area_by_name(const struct fmap_handle *h,
+				  const char *name);
+
+/*
+ * Find every area that overlaps or touches the inclusive range [start, end],
+ * that is, every area where area_offset <= end and area_offset + area_size
+ * >= start. Their indexes into h->areas are stored in ascending order in
+ * idx, which must have room for h->nareas entries. Returns how many.
+ */
+uint32_t fmap_areas_touching(const struct fmap_handle *h,
+			     uint64_t start, uint64_t end, uint32_t *idx);
+
 #endif  /* __FMAP_H__ */
@@ -58,6 +58,20 @@ int vb2_copy_signature(struct vb2_signature *dest,
  */
 struct vb2_signature *vb2_sha512_signature(const uint8_t *data, uint32_t size);
 
+/**
+ * Sign a digest which has already been calculated.
+ *
+ * @param digest		Digest of the data, using the key's hash algorithm
+ * @param digest_size		Length of digest in bytes
+ * @param data_size		Length of the data the digest covers
+ * @param key			Private key to use to sign the digest
+ *
+ * @return The signature, or NULL if error.  Caller must free() it.
+ */
+struct vb2_signature *vb2_sign_digest(const uint8_t *digest,
+				      uint32_t digest_size, uint32_t data_size,
+				      const struct vb2_private_key *key);
+
 /**
  * Calculate a signature for the data using the specified key.
  *
@@ -71,6 +85,28 @@ struct vb2_signature *vb2_calculate_signature(
 		const uint8_t *data, uint32_t size,
 		const struct vb2_private_key *key);
 
+/*
+ * External signers are given the name of the private key file, read the data
+ * to sign (DigestInfo and digest) on stdin and write the signature to stdout.
+ *
+ * In the original one-shot protocol, the signer is run as "SIGNER KEYFILE"
+ * once for each signature, and signs everything it reads up to EOF.
+ *
+ * If EXTERNAL_SIGNER_FRAMED_ENV is set in the environment, the signer is
+ * instead run once as "SIGNER --framed KEYFILE" and kept running. It must
+ * first write the 8-byte magic below, then answer each request until EOF.
+ * Requests and replies are framed the same way: a 4-byte little-endian
+ * length, followed by that many bytes. A reply with a length of 0 means the
+ * signer couldn't sign the request. A signer which doesn't greet us within
+ * EXTERNAL_SIGNER_GREETING_MS is stopped and the one-shot protocol is used
+ * instead.
+ */
+#define EXTERNAL_SIGNER_FRAMED_ENV "VB2_EXTERNAL_SIGNER_FRAMED"
+#define EXTERNAL_SIGNER_FRAMED_OPTION "--framed"
+#define EXTERNAL_SIGNER_MAGIC "VB2SIGN1"
+#define EXTERNAL_SIGNER_MAGIC_SIZE 8
+#define EXTERNAL_SIGNER_GREETING_MS 5000
+
 /**
  * Calculate a signature for the data using an external signer.
  *
@@ -564,8 +564,8 @@ int vb2_public_key_hash(struct vb2_public_key *key,
 
 enum vb2_signature_algorithm vb2_rsa_sig_alg(struct rsa_st *rsa)
 {
-	int exp = BN_get_word(rsa->e);
-	int bits = BN_num_bits(rsa->n);
+	int exp = BN_get_word(RSA_get0_e(rsa));
+	int bits = BN_num_bits(RSA_get0_n(rsa));
 
 	switch (exp) {
 	case RSA_3:
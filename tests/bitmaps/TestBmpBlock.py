@@ -148,6 +148,52 @@ class TestPackUnpack(TempDirTestCase):
       self.doPackUnpackImplicitZ(str(c), [x for x in self._allowed if x != c])
 
 
+class TestDedup(TempDirTestCase):
+
+  def testDedup(self):
+    """Identical images under different names are only stored once"""
+    foo = os.path.join(self.tempdir, 'FOO')
+    bar = os.path.join(self.tempdir, 'BAR')
+    for comp in ['0', '1', '2']:
+      os.chdir(self._cwd)
+      rc, out, err = runprog(prog, '-z', comp, '-c', 'case_dedup.yaml', foo)
+      self.assertEqual(0, rc)
+      rc, out, err = runprog(prog, foo)
+      self.assertEqual(0, rc)
+      self.assertTrue(out.count("2 discrete images"))
+      rc, out, err = runprog(prog, '-f', '-x', '-d', self.tempdir, foo)
+      self.assertEqual(0, rc)
+      os.chdir(self.tempdir)
+      rc, out, err = runprog(prog, '-c', 'config.yaml', bar)
+      self.assertEqual(0, rc)
+      rc, out, err = runprog('/usr/bin/cmp', foo, bar)
+      self.assertEqual(0, rc)
+
+
+class TestJobs(TempDirTestCase):
+
+  def testJobs(self):
+    """Compressing several images at once shouldn't change the output"""
+    foo = os.path.join(self.tempdir, 'FOO')
+    bar = os.path.join(self.tempdir, 'BAR')
+    for comp in ['0', '1', '2']:
+      rc, out, err = runprog(prog, '-j', '1', '-z', comp,
+                             '-c', 'case_reuse.yaml', foo)
+      self.assertEqual(0, rc)
+      rc, out, err = runprog(prog, '-j', '4', '-z', comp,
+                             '-c', 'case_reuse.yaml', bar)
+      self.assertEqual(0, rc)
+      rc, out, err = runprog('/usr/bin/cmp', foo, bar)
+      self.assertEqual(0, rc)
+
+  def testBadJobs(self):
+    """Zero jobs can't get anything done"""
+    rc, out, err = runprog(prog, '-j', '0', '-c', 'case_simple.yaml',
+                           self.tempfile)
+    self.assertNotEqual(0, rc)
+    self.assertTrue(err.count("invalid argument to -j"))
+
+
 class TestReproducable(TempDirTestCase):
 
   def disabledTestReproduce(self):
@@ -0,0 +1,213 @@
+/* Copyright 2016 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compare the cost of checking GPT entry arrays the way GptSanityCheck() used
+ * to (one CRC pass per check, then walking every entry for every used entry)
+ * with the single scan per array it does now.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgptlib.h"
+#include "cgptlib_internal.h"
+#include "crc32.h"
+#include "gpt.h"
+#include "timer_utils.h"
+
+#define ITERATIONS 2000
+#define DRIVE_SECTORS 16777216
+#define USED_ENTRIES 12
+#define ENTRIES_SIZE (MAX_NUMBER_OF_ENTRIES * sizeof(GptEntry))
+
+uint8_t VbExOverrideGptEntryPriority(const GptEntry *e)
+{
+	return 0;
+}
+
+static uint8_t primary_header[512];
+static uint8_t secondary_header[512];
+static uint8_t primary_entries[ENTRIES_SIZE];
+static uint8_t secondary_entries[ENTRIES_SIZE];
+
+/* Number of GptEntry structs read by the legacy checks */
+static uint64_t legacy_reads;
+
+/* Counted the same way by cgptlib_internal.c, built with FOR_TEST */
+extern uint64_t gpt_entry_reads;
+
+/* The entries check as it was before ScanEntries() */
+static int LegacyCheckEntries(GptEntry *entries, GptHeader *h)
+{
+	GptEntry *entry;
+	uint32_t crc32;
+	uint32_t i;
+
+	crc32 = Crc32((const uint8_t *)entries,
+		      h->size_of_entry * h->number_of_entries);
+	legacy_reads += h->number_of_entries;
+	if (crc32 != h->entries_crc32)
+		return GPT_ERROR_CRC_CORRUPTED;
+
+	for (i = 0, entry = entries; i < h->number_of_entries; i++, entry++) {
+		GptEntry *e2;
+		uint32_t i2;
+
+		legacy_reads++;
+		if (IsUnusedEntry(entry))
+			continue;
+
+		if ((entry->starting_lba < h->first_usable_lba) ||
+		    (entry->ending_lba > h->last_usable_lba) ||
+		    (entry->ending_lba < entry->starting_lba))
+			return GPT_ERROR_OUT_OF_REGION;
+
+		for (i2 = 0, e2 = entries; i2 < h->number_of_entries;
+		     i2++, e2++) {
+			legacy_reads++;
+			if (i2 == i || IsUnusedEntry(e2))
+				continue;
+
+			if ((entry->starting_lba >= e2->starting_lba) &&
+			    (entry->starting_lba <= e2->ending_lba))
+				return GPT_ERROR_START_LBA_OVERLAP;
+			if ((entry->ending_lba >= e2->starting_lba) &&
+			    (entry->ending_lba <= e2->ending_lba))
+				return GPT_ERROR_END_LBA_OVERLAP;
+			if (0 == memcmp(&entry->unique, &e2->unique,
+					sizeof(Guid)))
+				return GPT_ERROR_DUP_GUID;
+		}
+	}
+
+	return 0;
+}
+
+/* Build a GPT laid out like a Chrome OS disk, with USED_ENTRIES partitions. */
+static void BuildGpt(GptData *gpt)
+{
+	GptHeader *h = (GptHeader *)primary_header;
+	GptEntry *e = (GptEntry *)primary_entries;
+	Guid type = GPT_ENT_TYPE_CHROMEOS_KERNEL;
+	uint64_t lba = 64;
+	int i;
+
+	memset(gpt, 0, sizeof(*gpt));
+	gpt->primary_header = primary_header;
+	gpt->secondary_header = secondary_header;
+	gpt->primary_entries = primary_entries;
+	gpt->secondary_entries = secondary_entries;
+	gpt->sector_bytes = 512;
+	gpt->streaming_drive_sectors = gpt->gpt_drive_sectors = DRIVE_SECTORS;
+
+	memset(primary_header, 0, sizeof(primary_header));
+	memset(primary_entries, 0, sizeof(primary_entries));
+	memcpy(h->signature, GPT_HEADER_SIGNATURE, GPT_HEADER_SIGNATURE_SIZE);
+	h->revision = GPT_HEADER_REVISION;
+	h->size = sizeof(GptHeader);
+	h->my_lba = GPT_PMBR_SECTORS;
+	h->alternate_lba = DRIVE_SECTORS - GPT_HEADER_SECTORS;
+	h->entries_lba = 2;
+	h->first_usable_lba = 34;
+	h->last_usable_lba = DRIVE_SECTORS - 34;
+	h->number_of_entries = MAX_NUMBER_OF_ENTRIES;
+	h->size_of_entry = sizeof(GptEntry);
+
+	for (i = 0; i < USED_ENTRIES; i++, lba += 4096) {
+		memcpy(&e[i].type, &type, sizeof(Guid));
+		memset(&e[i].unique, 0, sizeof(Guid));
+		e[i].unique.u.raw[0] = i + 1;
+		e[i].starting_lba = lba;
+		e[i].ending_lba = lba + 4095;
+	}
+
+	/* Fills in the CRCs and the secondary copy. */
+	GptModified(gpt);
+}
+
+static void Report(const char *name, uint32_t legacy_msecs,
+		   uint32_t scan_msecs, uint64_t reads, uint64_t scan_reads)
+{
+	fprintf(stderr, "# %s: legacy %u ms, %.1f array passes; "
+		"scan %u ms, %.1f array passes\n", name,
+		legacy_msecs, (double)reads / MAX_NUMBER_OF_ENTRIES,
+		scan_msecs, (double)scan_reads / MAX_NUMBER_OF_ENTRIES);
+	fprintf(stdout, "legacy_msecs_%s:%u\n", name, legacy_msecs);
+	fprintf(stdout, "scan_msecs_%s:%u\n", name, scan_msecs);
+	fprintf(stdout, "legacy_array_passes_%s:%f\n", name,
+		(double)reads / MAX_NUMBER_OF_ENTRIES);
+	fprintf(stdout, "scan_array_passes_%s:%f\n", name,
+		(double)scan_reads / MAX_NUMBER_OF_ENTRIES);
+}
+
+/*
+ * Check both arrays against the primary header, and if neither matches,
+ * against the secondary header too, the way GptSanityCheck() does.
+ */
+static void Compare(const char *name, GptData *gpt)
+{
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
+	GptEntry *e1 = (GptEntry *)gpt->primary_entries;
+	GptEntry *e2 = (GptEntry *)gpt->secondary_entries;
+	GptEntriesScan scan1, scan2;
+	ClockTimerState ct;
+	uint32_t legacy_msecs, scan_msecs;
+	uint64_t reads, scan_reads;
+	int i, ok;
+
+	legacy_reads = 0;
+	StartTimer(&ct);
+	for (i = 0; i < ITERATIONS; i++) {
+		ok = !LegacyCheckEntries(e1, h1);
+		ok |= !LegacyCheckEntries(e2, h1);
+		if (!ok) {
+			LegacyCheckEntries(e1, h2);
+			LegacyCheckEntries(e2, h2);
+		}
+	}
+	StopTimer(&ct);
+	legacy_msecs = GetDurationMsecs(&ct);
+	reads = legacy_reads / ITERATIONS;
+
+	gpt_entry_reads = 0;
+	StartTimer(&ct);
+	for (i = 0; i < ITERATIONS; i++) {
+		ScanEntries(&scan1, e1, h1);
+		ScanEntries(&scan2, e2, h1);
+		ok = !CheckScannedEntries(e1, h1, &scan1);
+		ok |= !CheckScannedEntries(e2, h1, &scan2);
+		if (!ok) {
+			CheckScannedEntries(e1, h2, &scan1);
+			CheckScannedEntries(e2, h2, &scan2);
+		}
+	}
+	StopTimer(&ct);
+	scan_msecs = GetDurationMsecs(&ct);
+	scan_reads = gpt_entry_reads / ITERATIONS;
+
+	Report(name, legacy_msecs, scan_msecs, reads, scan_reads);
+}
+
+int main(int argc, char *argv[])
+{
+	GptData gpt;
+	GptHeader *h1 = (GptHeader *)primary_header;
+
+	BuildGpt(&gpt);
+	if (GptSanityCheck(&gpt) != GPT_SUCCESS) {
+		fprintf(stderr, "Benchmark GPT is not valid\n");
+		return 1;
+	}
+	Compare("valid", &gpt);
+
+	/* Primary header has a stale entries CRC; both arrays get rechecked */
+	h1->entries_crc32 ^= 1;
+	h1->header_crc32 = HeaderCrc(h1);
+	Compare("stale_crc", &gpt);
+
+	return 0;
+}
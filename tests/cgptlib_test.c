@@ -704,6 +704,50 @@ static int EntriesCrcTest(void)
 	return TEST_OK;
 }
 
+/*
+ * Test that a single scan of the entries gives the same CRC as checksumming the
+ * whole array, finds the used entries, and can be reused with another header.
+ */
+static int EntriesScanTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
+	GptEntry *e1 = (GptEntry *)(gpt->primary_entries);
+	GptEntriesScan scan;
+
+	BuildTestGptData(gpt);
+	EXPECT(0 == ScanEntries(&scan, e1, h1));
+	EXPECT(TOTAL_ENTRIES_SIZE == scan.size);
+	EXPECT(Crc32(e1, TOTAL_ENTRIES_SIZE) == scan.crc32);
+	EXPECT(Crc32Update(Crc32(e1, 100), (uint8_t *)e1 + 100,
+			   TOTAL_ENTRIES_SIZE - 100) == scan.crc32);
+	EXPECT(4 == scan.num_used);
+	EXPECT(0 == scan.used[0]);
+	EXPECT(3 == scan.used[3]);
+	EXPECT(0 == CheckScannedEntries(e1, h1, &scan));
+	EXPECT(0 == CheckScannedEntries(e1, h2, &scan));
+
+	/* A stale CRC in one header doesn't need a rescan to detect. */
+	h2->entries_crc32 ^= 1;
+	EXPECT(GPT_ERROR_CRC_CORRUPTED == CheckScannedEntries(e1, h2, &scan));
+
+	/* Unused entries are not collected. */
+	BuildTestGptData(gpt);
+	memset(&e1[2].type, 0, sizeof(e1[2].type));
+	EXPECT(0 == ScanEntries(&scan, e1, h1));
+	EXPECT(3 == scan.num_used);
+	EXPECT(3 == scan.used[2]);
+
+	/* We can't parse entries of a different size. */
+	h1->size_of_entry = 256;
+	h1->number_of_entries = 64;
+	EXPECT(1 == ScanEntries(&scan, e1, h1));
+	EXPECT(GPT_ERROR_INVALID_ENTRIES == CheckEntries(e1, h1));
+
+	return TEST_OK;
+}
+
 /*
  * Test if partition geometry is checked.
  * All active (non-zero PartitionTypeGUID) partition entries should have:
@@ -1573,6 +1617,60 @@ static int GetKernelGuidTest(void)
 	return TEST_OK;
 }
 
+/* Test finding entries through the GPT index */
+static int FindEntryTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h = (GptHeader *)gpt->primary_header;
+	GptEntry *e = (GptEntry *)gpt->primary_entries;
+	uint16_t name[36];
+	int i;
+
+	BuildTestGptData(gpt);
+	EXPECT(GPT_SUCCESS == GptInit(gpt));
+	EXPECT(&e[0] == GptFindNthEntry(gpt, &guid_kernel, 0));
+	EXPECT(&e[3] == GptFindNthEntry(gpt, &guid_kernel, 1));
+	EXPECT(NULL == GptFindNthEntry(gpt, &guid_kernel, 2));
+	EXPECT(&e[2] == GptFindNthEntry(gpt, &guid_rootfs, 1));
+	EXPECT(e == gpt->index.entries);
+	/* Unused entries are still found by their zero type */
+	EXPECT(&e[4] == GptFindNthEntry(gpt, &guid_zero, 0));
+
+	EXPECT(2 == GptIndexFind(gpt, e, h->number_of_entries,
+				 GPT_INDEX_UNIQUE, &e[2].unique, -1));
+	EXPECT(-1 == GptIndexFind(gpt, e, h->number_of_entries,
+				  GPT_INDEX_UNIQUE, &e[2].unique, 2));
+
+	/* Labels match whole names only */
+	memset(name, 0, sizeof(name));
+	name[0] = 'A';
+	e[1].name[0] = 'A';
+	e[1].name[1] = 'B';
+	e[3].name[0] = 'A';
+	GptModified(gpt);
+	EXPECT(NULL == gpt->index.entries);
+	EXPECT(3 == GptIndexFind(gpt, e, h->number_of_entries,
+				 GPT_INDEX_LABEL, name, -1));
+	name[1] = 'B';
+	EXPECT(1 == GptIndexFind(gpt, e, h->number_of_entries,
+				 GPT_INDEX_LABEL, name, -1));
+	for (i = 0; i < 36; i++)
+		name[i] = e[0].name[i] = 'x';
+	GptModified(gpt);
+	EXPECT(0 == GptIndexFind(gpt, e, h->number_of_entries,
+				 GPT_INDEX_LABEL, name, -1));
+
+	/* The index follows changes made through GptModified() */
+	memcpy(&e[1].type, &guid_kernel, sizeof(Guid));
+	GptModified(gpt);
+	EXPECT(&e[1] == GptFindNthEntry(gpt, &guid_kernel, 1));
+	EXPECT(&e[3] == GptFindNthEntry(gpt, &guid_kernel, 2));
+	EXPECT(&e[2] == GptFindNthEntry(gpt, &guid_rootfs, 0));
+	EXPECT(NULL == GptFindNthEntry(gpt, &guid_rootfs, 1));
+
+	return TEST_OK;
+}
+
 /* Test getting GPT error text strings */
 static int ErrorTextTest(void)
 {
@@ -1675,6 +1773,7 @@ int main(int argc, char *argv[])
 		{ TEST_CASE(MyLbaTest), },
 		{ TEST_CASE(FirstUsableLbaAndLastUsableLbaTest), },
 		{ TEST_CASE(EntriesCrcTest), },
+		{ TEST_CASE(EntriesScanTest), },
 		{ TEST_CASE(ValidEntryTest), },
 		{ TEST_CASE(OverlappedPartitionTest), },
 		{ TEST_CASE(SanityCheckTest), },
@@ -1690,6 +1789,7 @@ int main(int argc, char *argv[])
 		{ TEST_CASE(DuplicateUniqueGuidTest), },
 		{ TEST_CASE(TestCrc32TestVectors), },
 		{ TEST_CASE(GetKernelGuidTest), },
+		{ TEST_CASE(FindEntryTest), },
 		{ TEST_CASE(ErrorTextTest), },
 		{ TEST_CASE(CheckHeaderOffDevice), },
 	};
@@ -0,0 +1,202 @@
+/* Copyright 2016 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compare EfiCompress() with its Patricia tree match finder against the hash
+ * chain one, on the test bitmaps or on the files named on the command line.
+ * Every stream is decompressed again to make sure it is still valid, and
+ * EfiDecompress() throughput is measured on the tree's output.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eficompress.h"
+#include "timer_utils.h"
+
+#define ITERATIONS 10
+#define DECOMPRESS_ITERATIONS 200
+
+static const char *const default_files[] = {
+	"tests/bitmaps/Background.bmp",
+	"tests/bitmaps/Word.bmp",
+	"tests/bitmaps/FontFile.bin",
+};
+
+static uint8_t *read_file(const char *filename, uint32_t *size)
+{
+	FILE *f;
+	uint8_t *buf;
+	long len;
+
+	f = fopen(filename, "rb");
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len ? len : 1);
+	if (buf && len && fread(buf, len, 1, f) != 1) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+/* Compress ITERATIONS times, then check the result decompresses to buf */
+static int Run(const uint8_t *buf, uint32_t size, uint32_t finder,
+	       uint32_t *msecs, uint32_t *out_size)
+{
+	ClockTimerState ct;
+	uint8_t *out, *back, *scratch;
+	uint32_t out_max = size + size / 8 + 64;
+	uint32_t back_size, scratch_size;
+	int i, rv = 1;
+
+	out = malloc(out_max);
+	if (!out)
+		return 1;
+
+	StartTimer(&ct);
+	for (i = 0; i < ITERATIONS; i++) {
+		*out_size = out_max;
+		if (EfiCompressEx((uint8_t *)buf, size, out, out_size,
+				  finder) != EFI_SUCCESS)
+			goto out;
+	}
+	StopTimer(&ct);
+	*msecs = GetDurationMsecs(&ct);
+
+	if (EfiGetInfo(out, *out_size, &back_size, &scratch_size) !=
+	    EFI_SUCCESS || back_size != size)
+		goto out;
+	back = malloc(back_size + 1);
+	scratch = malloc(scratch_size);
+	if (back && scratch &&
+	    EfiDecompress(out, *out_size, back, back_size,
+			  scratch, scratch_size) == EFI_SUCCESS &&
+	    !memcmp(back, buf, size))
+		rv = 0;
+	free(back);
+	free(scratch);
+out:
+	free(out);
+	return rv;
+}
+
+/* Decompress the tree's stream DECOMPRESS_ITERATIONS times */
+static int Expand(const uint8_t *buf, uint32_t size, uint32_t *msecs)
+{
+	ClockTimerState ct;
+	uint8_t *out, *back, *scratch = NULL;
+	uint32_t out_size = size + size / 8 + 64;
+	uint32_t back_size, scratch_size;
+	int i, rv = 1;
+
+	out = malloc(out_size);
+	back = malloc(size + 1);
+	if (!out || !back ||
+	    EfiCompress((uint8_t *)buf, size, out, &out_size) != EFI_SUCCESS ||
+	    EfiGetInfo(out, out_size, &back_size, &scratch_size) !=
+	    EFI_SUCCESS)
+		goto out;
+	scratch = malloc(scratch_size);
+	if (!scratch)
+		goto out;
+
+	StartTimer(&ct);
+	for (i = 0; i < DECOMPRESS_ITERATIONS; i++) {
+		if (EfiDecompress(out, out_size, back, back_size,
+				  scratch, scratch_size) != EFI_SUCCESS)
+			goto out;
+	}
+	StopTimer(&ct);
+	*msecs = GetDurationMsecs(&ct);
+
+	if (!memcmp(back, buf, size))
+		rv = 0;
+out:
+	free(scratch);
+	free(back);
+	free(out);
+	return rv;
+}
+
+static int Compare(const char *filename)
+{
+	const char *name = strrchr(filename, '/') ? : filename - 1;
+	uint32_t size, tree_msecs, tree_size, hc_msecs, hc_size, dec_msecs;
+	double speed;
+	uint8_t *buf;
+
+	name++;
+	buf = read_file(filename, &size);
+	if (!buf) {
+		fprintf(stderr, "Can't read %s\n", filename);
+		return 1;
+	}
+
+	if (Run(buf, size, EFI_COMPRESS_MATCH_TREE, &tree_msecs, &tree_size)) {
+		fprintf(stderr, "%s: tree round trip failed\n", name);
+		free(buf);
+		return 1;
+	}
+	if (Run(buf, size, EFI_COMPRESS_MATCH_HASH_CHAIN,
+		&hc_msecs, &hc_size)) {
+		fprintf(stderr, "%s: hash chain round trip failed\n", name);
+		free(buf);
+		return 1;
+	}
+	if (Expand(buf, size, &dec_msecs)) {
+		fprintf(stderr, "%s: decompression failed\n", name);
+		free(buf);
+		return 1;
+	}
+	/* Mbytes/sec */
+	speed = (double)size * DECOMPRESS_ITERATIONS / 1e6 /
+		((dec_msecs ? dec_msecs : 1) / 1e3);
+
+	fprintf(stderr, "# %s: %u bytes; tree %u ms, %u bytes; "
+		"hash chain %u ms, %u bytes\n", name, size,
+		tree_msecs, tree_size, hc_msecs, hc_size);
+	fprintf(stdout, "tree_msecs_%s:%u\n", name, tree_msecs);
+	fprintf(stdout, "tree_bytes_%s:%u\n", name, tree_size);
+	fprintf(stdout, "hash_chain_msecs_%s:%u\n", name, hc_msecs);
+	fprintf(stdout, "hash_chain_bytes_%s:%u\n", name, hc_size);
+	fprintf(stderr, "# %s: decompress %u ms, %f Mbytes/sec\n", name,
+		dec_msecs, speed);
+	fprintf(stdout, "decompress_mbytes_per_sec_%s:%f\n", name, speed);
+
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[PATH_MAX];
+	const char *srcdir;
+	int i, rv = 0;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			rv |= Compare(argv[i]);
+		return rv;
+	}
+
+	srcdir = getenv("SRCDIR");
+	if (!srcdir)
+		srcdir = ".";
+	for (i = 0; i < sizeof(default_files) / sizeof(default_files[0]);
+	     i++) {
+		snprintf(filename, sizeof(filename), "%s/%s",
+			 srcdir, default_files[i]);
+		rv |= Compare(filename);
+	}
+
+	return rv;
+}
@@ -1,9 +1,43 @@
 #!/bin/bash
 
-if [ $# -ne 1 ]; then
-  echo "Usage: $0 <private_key_pem_file>"
+usage() {
+  echo "Usage: $0 [--framed] <private_key_pem_file>"
   echo "Reads data to sign from stdin, encrypted data is output to stdout"
+  echo "With --framed, signs each length-prefixed request until EOF"
   exit 1
+}
+
+# Lets tests see how often the signer is started
+if [ -n "${EXTERNAL_SIGNER_LOG:-}" ]; then
+  echo "$@" >> "${EXTERNAL_SIGNER_LOG}"
+fi
+
+if [ "${1:-}" != "--framed" ]; then
+  if [ $# -ne 1 ]; then
+    usage
+  fi
+  openssl rsautl -sign -inkey $1
+  exit
 fi
 
-openssl rsautl -sign -inkey $1
+if [ $# -ne 2 ]; then
+  usage
+fi
+key=$2
+sig=$(mktemp)
+trap "rm -f ${sig}" EXIT
+
+# Write a 4-byte little-endian length
+put_size() {
+  printf "$(printf '\\x%02x\\x%02x\\x%02x\\x%02x' \
+    $(($1 & 255)) $(($1 >> 8 & 255)) $(($1 >> 16 & 255)) $(($1 >> 24)))"
+}
+
+printf "VB2SIGN1"
+while size=$(head -c 4 | od -An -tu4 --endian=little) && [ -n "${size}" ]; do
+  if ! head -c ${size} | openssl rsautl -sign -inkey ${key} > ${sig}; then
+    : > ${sig}
+  fi
+  put_size $(stat -c %s ${sig})
+  cat ${sig}
+done
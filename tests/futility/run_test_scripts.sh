@@ -46,8 +46,10 @@ ${SCRIPTDIR}/test_dump_fmap.sh
 ${SCRIPTDIR}/test_gbb_utility.sh
 ${SCRIPTDIR}/test_load_fmap.sh
 ${SCRIPTDIR}/test_main.sh
+${SCRIPTDIR}/test_map_file.sh
 ${SCRIPTDIR}/test_rwsig.sh
 ${SCRIPTDIR}/test_show_contents.sh
+${SCRIPTDIR}/test_show_jobs.sh
 ${SCRIPTDIR}/test_show_kernel.sh
 ${SCRIPTDIR}/test_show_vs_verify.sh
 ${SCRIPTDIR}/test_show_usbpd1.sh
@@ -55,6 +57,8 @@ ${SCRIPTDIR}/test_sign_firmware.sh
 ${SCRIPTDIR}/test_sign_fw_main.sh
 ${SCRIPTDIR}/test_sign_kernel.sh
 ${SCRIPTDIR}/test_sign_keyblocks.sh
+${SCRIPTDIR}/test_sign_manifest.sh
+${SCRIPTDIR}/test_sign_server.sh
 ${SCRIPTDIR}/test_sign_usbpd1.sh
 ${SCRIPTDIR}/test_file_types.sh
 "
@@ -46,6 +46,14 @@ cmp "${SCRIPTDIR}/data_fmap2_expect_hh.txt" "$TMP"
 "$FUTILITY" dump_fmap -hhH "${SCRIPTDIR}/data_fmap2.bin" > "$TMP"
 cmp "${SCRIPTDIR}/data_fmap2_expect_hhH.txt" "$TMP"
 
+# An FMAP header at a smaller alignment doesn't win, even if it comes first.
+cp "${SCRIPTDIR}/data_fmap.bin" ${TMP}.decoy
+dd if="${SCRIPTDIR}/data_fmap.bin" of=${TMP}.decoy bs=4 skip=512 count=16 \
+    seek=1 conv=notrunc
+"$FUTILITY" dump_fmap -p ${TMP}.decoy > "$TMP"
+cmp "${SCRIPTDIR}/data_fmap_expect_p.txt" "$TMP"
+"$FUTILITY" dump_fmap ${TMP}.decoy | grep -q 'hit at 0x00000800'
+
 
 # cleanup
 rm -f ${TMP}* FMAP SI_DESC FOO
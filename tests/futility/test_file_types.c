@@ -38,7 +38,7 @@ static struct {
 	{FILE_TYPE_PEM,             "tests/testkeys/key_rsa2048.pem"},
 	{FILE_TYPE_USBPD1,          "tests/futility/data/zinger_mp_image.bin"},
 	{FILE_TYPE_BDB,             "tests/futility/data/bdb.bin"},
-	{FILE_TYPE_RWSIG,           },		/* need a test for this */
+	{FILE_TYPE_RWSIG,           "tests/futility/data/hammer_dev.bin"},
 };
 BUILD_ASSERT(ARRAY_SIZE(test_case) == NUM_FILE_TYPES);
 
@@ -45,6 +45,21 @@ test_case "prikey21"        "tests/futility/data/sample.vbprik2"
 test_case "pem"             "tests/testkeys/key_rsa2048.pem"
 test_case "pem"             "tests/testkeys/key_rsa8192.pub.pem"
 test_case "bdb"             "tests/futility/data/bdb.bin"
+test_case "usbpd1"          "tests/futility/data/zinger_mp_image.bin"
+test_case "rwsig"           "tests/futility/data/hammer_dev.bin"
+
+# PEM data doesn't have to be at the start of the file
+( echo "Some commentary"; cat "${SRCDIR}/tests/testkeys/key_rsa2048.pem" ) \
+    > ${TMP}.commented.pem
+[ "$(${FUTILITY} show -t ${TMP}.commented.pem | awk '{print $NF}')" = "pem" ]
+
+# An RW-only image has no FMAP, just the signature in its last 1K
+dd if="${SRCDIR}/tests/futility/data/hammer_dev.bin" of=${TMP}.rw \
+    bs=4 skip=16384 count=16009
+dd if="${SRCDIR}/tests/futility/data/hammer_dev.bin" of=${TMP}.sig \
+    bs=4 skip=32393 count=256
+cat ${TMP}.sig >> ${TMP}.rw
+[ "$(${FUTILITY} show -t ${TMP}.rw | awk '{print $NF}')" = "rwsig" ]
 
 # Expect failure here.
 fail_case "/Sir/Not/Appearing/In/This/Film"
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2016 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for working on more than one kernel blob at a time.
+ */
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "2sysincludes.h"
+#include "2common.h"
+#include "futility.h"
+#include "host_common.h"
+#include "host_key.h"
+#include "host_misc.h"
+#include "kernel_blob.h"
+#include "test_common.h"
+#include "vb1_helper.h"
+#include "vb2_common.h"
+
+#define LOAD_ADDRESS 0x100000
+#define PADDING 0x10000
+
+static char filename[PATH_MAX];
+static const char *srcdir;
+
+static const char *path(const char *file)
+{
+	snprintf(filename, sizeof(filename), "%s/%s", srcdir, file);
+	return filename;
+}
+
+/* Glue the vblock and the blob together, the way they'd be on disk */
+static uint8_t *make_kpart(uint8_t *vblock, uint32_t vblock_size,
+			   uint8_t *blob, uint32_t blob_size)
+{
+	uint8_t *kpart = malloc(vblock_size + blob_size);
+
+	memcpy(kpart, vblock, vblock_size);
+	memcpy(kpart + vblock_size, blob, blob_size);
+	return kpart;
+}
+
+int main(int argc, char *argv[])
+{
+	struct kernel_blob_s kb_a, kb_b, un_a, un_b, kb_p;
+	struct vb2_kernel_preamble *pre_a, *pre_b;
+	struct vb2_private_key *signkey;
+	struct vb2_keyblock *keyblock;
+	uint8_t *vmlinuz, *blob_a, *blob_b, *vblock_a, *vblock_b;
+	uint8_t *kpart_a, *kpart_b, *blob_p, *vblock_p;
+	uint32_t vmlinuz_size, keyblock_size, blob_a_size, blob_b_size;
+	uint32_t vblock_a_size, vblock_b_size, vblock_p_size;
+	uint8_t config_a[] = "console=ttyS0 cros_secure A";
+	uint8_t config_b[] = "console=tty1 cros_secure B";
+	uint8_t config_c[] = "replaced";
+	uint8_t bootloader_a[512], bootloader_b[8192];
+
+	/* Where's the source directory? */
+	srcdir = getenv("SRCDIR");
+	if (argc > 1)
+		srcdir = argv[1];
+	if (!srcdir)
+		srcdir = ".";
+
+	signkey = vb2_read_private_key(
+		path("tests/devkeys/kernel_data_key.vbprivk"));
+	TEST_PTR_NEQ(signkey, NULL, "Read signing key");
+	TEST_SUCC(vb2_read_file(path("tests/devkeys/kernel.keyblock"),
+				(uint8_t **)&keyblock, &keyblock_size),
+		  "Read keyblock");
+	TEST_SUCC(vb2_read_file(path("tests/futility/data/vmlinuz-amd64.bin"),
+				&vmlinuz, &vmlinuz_size),
+		  "Read vmlinuz");
+	if (!signkey || !keyblock || !vmlinuz)
+		return 1;
+	memset(bootloader_a, 'a', sizeof(bootloader_a));
+	memset(bootloader_b, 'b', sizeof(bootloader_b));
+
+	/* Create two different blobs before signing either of them */
+	blob_a = CreateKernelBlob(&kb_a, vmlinuz, vmlinuz_size, ARCH_X86,
+				  LOAD_ADDRESS, config_a, sizeof(config_a),
+				  bootloader_a, sizeof(bootloader_a),
+				  &blob_a_size);
+	blob_b = CreateKernelBlob(&kb_b, vmlinuz, vmlinuz_size, ARCH_ARM,
+				  LOAD_ADDRESS, config_b, sizeof(config_b),
+				  bootloader_b, sizeof(bootloader_b),
+				  &blob_b_size);
+	TEST_PTR_NEQ(blob_a, NULL, "Create blob A");
+	TEST_PTR_NEQ(blob_b, NULL, "Create blob B");
+	TEST_PTR_EQ(kb_a.blob_data, blob_a, "  A is still A");
+	TEST_NEQ(kb_a.vmlinuz_header_size, 0, "  A has a vmlinuz header");
+	TEST_EQ(kb_b.vmlinuz_header_size, 0, "  B doesn't");
+
+	/* Each is signed with its own layout */
+	vblock_a = SignKernelBlob(&kb_a, blob_a, blob_a_size, PADDING, 1,
+				  LOAD_ADDRESS, keyblock, signkey, 0,
+				  &vblock_a_size);
+	vblock_b = SignKernelBlob(&kb_b, blob_b, blob_b_size, PADDING, 2,
+				  LOAD_ADDRESS, keyblock, signkey, 0,
+				  &vblock_b_size);
+	TEST_PTR_NEQ(vblock_a, NULL, "Sign blob A");
+	TEST_PTR_NEQ(vblock_b, NULL, "Sign blob B");
+	TEST_EQ(vblock_a_size, PADDING, "  A is padded");
+	TEST_EQ(vblock_b_size, PADDING, "  B is padded");
+	pre_a = (struct vb2_kernel_preamble *)
+		(vblock_a + keyblock->keyblock_size);
+	pre_b = (struct vb2_kernel_preamble *)
+		(vblock_b + keyblock->keyblock_size);
+	TEST_EQ(pre_a->bootloader_size, kb_a.bootloader_size,
+		"  A's bootloader");
+	TEST_EQ(pre_b->bootloader_size, kb_b.bootloader_size,
+		"  B's bootloader");
+	TEST_NEQ(pre_a->bootloader_size, pre_b->bootloader_size,
+		 "  They're different");
+	TEST_EQ(pre_a->bootloader_address, kb_a.ondisk_bootloader_addr,
+		"  A's bootloader address");
+	TEST_EQ(pre_b->bootloader_address, kb_b.ondisk_bootloader_addr,
+		"  B's bootloader address");
+
+	/* Unpack both, then look at each */
+	kpart_a = make_kpart(vblock_a, vblock_a_size, blob_a, blob_a_size);
+	kpart_b = make_kpart(vblock_b, vblock_b_size, blob_b, blob_b_size);
+	TEST_PTR_EQ(unpack_kernel_partition(&un_a, kpart_a,
+					    vblock_a_size + blob_a_size,
+					    PADDING, 0, 0, 0),
+		    kpart_a + vblock_a_size, "Unpack A");
+	TEST_PTR_EQ(unpack_kernel_partition(&un_b, kpart_b,
+					    vblock_b_size + blob_b_size,
+					    PADDING, 0, 0, 0),
+		    kpart_b + vblock_b_size, "Unpack B");
+	TEST_EQ(un_a.bootloader_size, kb_a.bootloader_size,
+		"  A's bootloader size");
+	TEST_EQ(un_a.vmlinuz_header_size, kb_a.vmlinuz_header_size,
+		"  A's vmlinuz header size");
+	TEST_EQ(un_b.preamble->kernel_version, 2, "  B's version");
+
+	TEST_SUCC(VerifyKernelBlob(&un_a, un_a.blob_data, un_a.blob_size,
+				   NULL, NULL, 0), "Verify A");
+	TEST_SUCC(VerifyKernelBlob(&un_b, un_b.blob_data, un_b.blob_size,
+				   NULL, NULL, 0), "Verify B");
+
+	/* Changing one doesn't touch the other */
+	TEST_NEQ(UpdateKernelBlobConfig(&un_a, un_b.blob_data, un_b.blob_size,
+					config_c, sizeof(config_c)), 0,
+		 "Can't update B through A");
+	TEST_SUCC(UpdateKernelBlobConfig(&un_a, un_a.blob_data, un_a.blob_size,
+					 config_c, sizeof(config_c)),
+		  "Update A's config");
+	TEST_STR_EQ((char *)un_a.config_data, (char *)config_c,
+		    "  A's config changed");
+	TEST_STR_EQ((char *)un_b.config_data, (char *)config_b,
+		    "  B's config didn't");
+
+	/* Describing the blob in pieces gives the same blob and signature */
+	TEST_SUCC(CreateKernelBlobParts(&kb_p, vmlinuz, vmlinuz_size, ARCH_X86,
+					LOAD_ADDRESS, config_a,
+					sizeof(config_a), bootloader_a,
+					sizeof(bootloader_a)),
+		  "Create parts of A");
+	TEST_EQ(kb_p.blob_size, blob_a_size, "  Same size");
+	TEST_PTR_EQ(kb_p.vmlinuz_header_data, vmlinuz, "  Nothing copied");
+	blob_p = GatherKernelBlob(&kb_p);
+	TEST_SUCC(memcmp(blob_p, blob_a, blob_a_size), "  Same blob");
+	vblock_p = SignKernelBlobParts(&kb_p, PADDING, 1, LOAD_ADDRESS,
+				       keyblock, signkey, 0, &vblock_p_size);
+	TEST_PTR_NEQ(vblock_p, NULL, "Sign parts of A");
+	TEST_EQ(vblock_p_size, vblock_a_size, "  Same size");
+	TEST_SUCC(memcmp(vblock_p, vblock_a, vblock_a_size),
+		  "  Same vblock");
+	FreeKernelBlobParts(&kb_p);
+	free(blob_p);
+	free(vblock_p);
+
+	free(kpart_a);
+	free(kpart_b);
+	free(vblock_a);
+	free(vblock_b);
+	free(blob_a);
+	free(blob_b);
+	free(vmlinuz);
+	free(keyblock);
+	vb2_free_private_key(signkey);
+
+	return !gTestSuccess;
+}
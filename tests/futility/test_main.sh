@@ -22,6 +22,21 @@ LOG="/tmp/futility.log"
 touch ${LOG}
 ${FUTILITY} help
 grep ${FUTILITY} ${LOG}
+
+# Each invocation adds one whole record, even when run in parallel.
+: > ${LOG}
+for i in $(seq 1 20); do
+  ${FUTILITY} help > /dev/null &
+done
+wait
+[ "$(grep -c '^##### LOG #####$' ${LOG})" = "20" ]
+[ "$(grep -c "^${FUTILITY}\$" ${LOG})" = "20" ]
+[ "$(grep -c '^help$' ${LOG})" = "20" ]
+
+# But none at all if we say so.
+: > ${LOG}
+FUTILITY_DISABLE_LOGGING=1 ${FUTILITY} help
+[ ! -s ${LOG} ]
 rm -f ${LOG}
 [ -f ${LOG}.backup ] && mv ${LOG}.backup ${LOG}
 
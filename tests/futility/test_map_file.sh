@@ -0,0 +1,80 @@
+#!/bin/bash -eux
+# Copyright 2016 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+me=${0##*/}
+TMP="$me.tmp"
+
+# Work in scratch directory
+cd "$OUTDIR"
+
+# Changing a few areas of an image in place must leave the rest alone.
+IMAGE=${SRCDIR}/tests/futility/data/hammer_dev.bin
+cp ${IMAGE} ${TMP}.image
+head -c 32 /dev/urandom > ${TMP}.fwid
+head -c 3072 /dev/urandom > ${TMP}.key
+${FUTILITY} load_fmap ${TMP}.image RW_FWID:${TMP}.fwid KEY_RO:${TMP}.key
+
+cmp -n 32 -i 0:$((0x100c4)) ${TMP}.fwid ${TMP}.image
+cmp -n 3072 -i 0:$((0xe400)) ${TMP}.key ${TMP}.image
+cmp -n $((0xe400)) ${TMP}.image ${IMAGE}
+cmp -i $((0xf000)) -n $((0x100c4 - 0xf000)) ${TMP}.image ${IMAGE}
+cmp -i $((0x100e4)) ${TMP}.image ${IMAGE}
+
+# Same thing, but to a new file. The original mustn't change.
+rm -f ${TMP}.copy
+${FUTILITY} load_fmap -o ${TMP}.copy ${IMAGE} RW_FWID:${TMP}.fwid \
+  KEY_RO:${TMP}.key
+cmp ${TMP}.copy ${TMP}.image
+
+# Copying over a longer file leaves nothing of it behind.
+head -c 200000 /dev/urandom > ${TMP}.copy
+${FUTILITY} load_fmap -o ${TMP}.copy ${IMAGE} RW_FWID:${TMP}.fwid \
+  KEY_RO:${TMP}.key
+cmp ${TMP}.copy ${TMP}.image
+
+# But a file can't be copied over itself.
+if ${FUTILITY} load_fmap -o ${TMP}.copy ${TMP}.copy \
+  RW_FWID:${TMP}.fwid; then false; fi
+cmp ${TMP}.copy ${TMP}.image
+
+# A file too big to map all at once is looked at from the start.
+KEYBLOCK=${SRCDIR}/tests/devkeys/kernel.keyblock
+cp ${KEYBLOCK} ${TMP}.huge
+truncate -s 5G ${TMP}.huge
+${FUTILITY} show -t ${TMP}.huge | grep -q "keyblock"
+${FUTILITY} show ${TMP}.huge | sed -e "s|${TMP}.huge|FILE|" > ${TMP}.huge.out
+${FUTILITY} show ${KEYBLOCK} | sed -e "s|${KEYBLOCK}|FILE|" > ${TMP}.small.out
+cmp ${TMP}.huge.out ${TMP}.small.out
+rm -f ${TMP}.huge
+
+# A kernel partition that big can still be resigned in place.
+KEYDIR=${SRCDIR}/tests/devkeys
+echo "hi there" > ${TMP}.config.txt
+dd if=/dev/urandom bs=512 count=1 of=${TMP}.bootloader.bin
+dd if=/dev/urandom bs=1024 count=64 of=${TMP}.vmlinuz
+${FUTILITY} sign \
+  --signprivate ${KEYDIR}/kernel_data_key.vbprivk \
+  --keyblock ${KEYDIR}/kernel.keyblock \
+  --version 1 \
+  --config ${TMP}.config.txt \
+  --bootloader ${TMP}.bootloader.bin \
+  --vmlinuz ${TMP}.vmlinuz \
+  --arch arm \
+  ${TMP}.kpart
+cp ${TMP}.kpart ${TMP}.huge
+truncate -s 5G ${TMP}.huge
+for f in ${TMP}.kpart ${TMP}.huge; do
+  ${FUTILITY} sign \
+    --signprivate ${KEYDIR}/kernel_data_key.vbprivk \
+    --version 2 \
+    ${f}
+done
+cmp -n $(stat -c %s ${TMP}.kpart) ${TMP}.kpart ${TMP}.huge
+${FUTILITY} show ${TMP}.huge | grep -q "Kernel version:.*2"
+rm -f ${TMP}.huge
+
+# cleanup
+rm -rf ${TMP}*
+exit 0
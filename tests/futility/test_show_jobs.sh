@@ -0,0 +1,55 @@
+#!/bin/bash -eux
+# Copyright 2016 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+me=${0##*/}
+TMP="$me.tmp"
+
+# Work in scratch directory
+cd "$OUTDIR"
+
+# A mix of things that show fine, things that don't verify, and things that
+# aren't there at all.
+FILES="
+${SRCDIR}/tests/devkeys/root_key.vbpubk
+${SRCDIR}/tests/devkeys/kernel.keyblock
+${SRCDIR}/tests/futility/data/fw_vblock.bin
+${SRCDIR}/tests/futility/data/random_noise.bin
+/Sir/Not/Appearing/In/This/Film
+${SRCDIR}/tests/futility/data/kern_preamble.bin
+${SRCDIR}/tests/futility/data/sample.vbpubk2
+${SRCDIR}/tests/testkeys/key_rsa2048.pem
+${SRCDIR}/tests/futility/data/zinger_mp_image.bin
+${SRCDIR}/tests/futility/data/hammer_dev.bin
+${SRCDIR}/tests/futility/data/bdb.bin
+"
+
+# Running several at once should say exactly the same things, in the same
+# order, and succeed or fail the same way.
+for cmd in "show" "show -t" "verify" "show --strict"; do
+  ${FUTILITY} ${cmd} ${FILES} > ${TMP}.out.1 2> ${TMP}.err.1 \
+    && rc1=$? || rc1=$?
+  for jobs in 2 3 0; do
+    ${FUTILITY} ${cmd} --jobs ${jobs} ${FILES} \
+      > ${TMP}.out.${jobs} 2> ${TMP}.err.${jobs} \
+      && rc=$? || rc=$?
+    [ "$rc" = "$rc1" ]
+    cmp ${TMP}.out.1 ${TMP}.out.${jobs}
+    cmp ${TMP}.err.1 ${TMP}.err.${jobs}
+  done
+done
+
+# And the same when everything is good
+${FUTILITY} show --jobs 3 ${SRCDIR}/tests/devkeys/*.keyblock > ${TMP}.out.3
+${FUTILITY} show ${SRCDIR}/tests/devkeys/*.keyblock > ${TMP}.out.1
+cmp ${TMP}.out.1 ${TMP}.out.3
+
+# Bad --jobs values are rejected
+if ${FUTILITY} show --jobs foo ${SRCDIR}/tests/devkeys/root_key.vbpubk; then
+  false
+fi
+
+# cleanup
+rm -rf ${TMP}*
+exit 0
@@ -50,6 +50,36 @@ ${FUTILITY} show ${TMP}.kernel.test \
 
 echo 'Test kernel blob looks good'
 
+# A kernel partition is mostly empty space after the kernel. Only the kernel
+# should matter when verifying or repacking it.
+cp ${TMP}.kernel.test ${TMP}.kpart.test
+truncate -s 64M ${TMP}.kpart.test
+${FUTILITY} vbutil_kernel --verify ${TMP}.kernel.test \
+    --signpubkey ${DEVKEYS}/kernel_subkey.vbpubk > ${TMP}.verify.small
+${FUTILITY} vbutil_kernel --verify ${TMP}.kpart.test \
+    --signpubkey ${DEVKEYS}/kernel_subkey.vbpubk > ${TMP}.verify.big
+cmp ${TMP}.verify.small ${TMP}.verify.big
+${FUTILITY} vbutil_kernel --repack ${TMP}.repack.test \
+    --oldblob ${TMP}.kpart.test \
+    --signprivate ${TESTKEYS}/key_rsa2048.sha256.vbprivk
+cmp ${TMP}.kernel.test ${TMP}.repack.test
+
+# The config is found the same way whether it can seek to it or not.
+${FUTILITY} dump_kernel_config ${TMP}.kpart.test > ${TMP}.config.seek
+cat ${TMP}.kpart.test | ${FUTILITY} dump_kernel_config /dev/stdin \
+    > ${TMP}.config.read
+cmp ${TMP}.config.seek ${TMP}.config.read
+grep -q "hi there" ${TMP}.config.seek
+
+# But a kernel that's been cut short is bad, and a changed one doesn't verify.
+head -c 70000 ${TMP}.kernel.test > ${TMP}.short.test
+if ${FUTILITY} vbutil_kernel --verify ${TMP}.short.test; then false; fi
+head -c 40000 ${TMP}.kernel.test > ${TMP}.short.test
+if ${FUTILITY} dump_kernel_config ${TMP}.short.test; then false; fi
+printf 'X' | dd of=${TMP}.kpart.test bs=1 seek=70000 conv=notrunc
+if ${FUTILITY} vbutil_kernel --verify ${TMP}.kpart.test \
+    --signpubkey ${DEVKEYS}/kernel_subkey.vbpubk; then false; fi
+
 # Mess up the padding, make sure it fails.
 rc=0
 ${FUTILITY} show ${TMP}.kernel.test \
@@ -104,6 +104,83 @@ ${FUTILITY} --debug sign \
 
 cmp ${TMP}.keyblock4 ${TMP}.keyblock5
 
+# The signature is really there
+${FUTILITY} vbutil_keyblock --unpack ${TMP}.keyblock5 \
+  --signpubkey ${TESTKEYS}/key_rsa4096.sha512.vbpubk | grep -q "valid"
+
+# One external signer process is kept for all the keyblocks in a manifest
+cat > ${TMP}.manifest <<END
+${DEVKEYS}/firmware_data_key.vbpubk ${TMP}.keyblock.framed.1
+${DEVKEYS}/kernel_data_key.vbpubk ${TMP}.keyblock.framed.2
+${DEVKEYS}/recovery_key.vbpubk ${TMP}.keyblock.framed.3
+END
+rm -f ${TMP}.signer.log
+VB2_EXTERNAL_SIGNER_FRAMED=1 EXTERNAL_SIGNER_LOG=${PWD}/${TMP}.signer.log \
+  ${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --pem_external ${SIGNER} \
+  --flags 19 \
+  --manifest ${TMP}.manifest
+[ "$(grep -c -- --framed ${TMP}.signer.log)" = "1" ]
+[ "$(wc -l < ${TMP}.signer.log)" = "1" ]
+
+# Unless asked for, the framed protocol isn't tried
+sed -e 's/framed/default/' ${TMP}.manifest > ${TMP}.manifest3
+rm -f ${TMP}.signer.log
+EXTERNAL_SIGNER_LOG=${PWD}/${TMP}.signer.log ${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --pem_external ${SIGNER} \
+  --flags 19 \
+  --manifest ${TMP}.manifest3
+[ "$(grep -c -- --framed ${TMP}.signer.log)" = "0" ]
+[ "$(wc -l < ${TMP}.signer.log)" = "3" ]
+
+# A framed signer which exits partway through is replaced by one-shot ones.
+# It only sees the first request: a 4-byte length, then a SHA-512 DigestInfo
+# (19 bytes) and digest (64 bytes).
+cat > ${TMP}.dying_signer.sh <<END
+#!/bin/bash
+if [ "\$1" = "--framed" ]; then
+  exec ${SIGNER} "\$@" < <(head -c 87)
+fi
+exec ${SIGNER} "\$@"
+END
+chmod +x ${TMP}.dying_signer.sh
+sed -e 's/framed/dying/' ${TMP}.manifest > ${TMP}.manifest4
+VB2_EXTERNAL_SIGNER_FRAMED=1 ${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --pem_external ${PWD}/${TMP}.dying_signer.sh \
+  --flags 19 \
+  --manifest ${TMP}.manifest4
+
+# A signer which only knows the one-shot protocol still works
+cat > ${TMP}.oneshot_signer.sh <<END
+#!/bin/bash
+[ \$# -eq 1 ] || exit 1
+exec ${SIGNER} "\$@"
+END
+chmod +x ${TMP}.oneshot_signer.sh
+sed -e 's/framed/oneshot/' ${TMP}.manifest > ${TMP}.manifest2
+rm -f ${TMP}.signer.log
+VB2_EXTERNAL_SIGNER_FRAMED=1 EXTERNAL_SIGNER_LOG=${PWD}/${TMP}.signer.log \
+  ${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --pem_external ${PWD}/${TMP}.oneshot_signer.sh \
+  --flags 19 \
+  --manifest ${TMP}.manifest2
+[ "$(wc -l < ${TMP}.signer.log)" = "3" ]
+for i in 1 2 3; do
+  cmp ${TMP}.keyblock.framed.$i ${TMP}.keyblock.oneshot.$i
+  cmp ${TMP}.keyblock.framed.$i ${TMP}.keyblock.default.$i
+  cmp ${TMP}.keyblock.framed.$i ${TMP}.keyblock.dying.$i
+  ${FUTILITY} vbutil_keyblock --unpack ${TMP}.keyblock.framed.$i \
+    --signpubkey ${TESTKEYS}/key_rsa4096.sha512.vbpubk | grep -q "valid"
+done
+
 
 # cleanup
 rm -rf ${TMP}*
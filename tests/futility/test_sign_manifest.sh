@@ -0,0 +1,102 @@
+#!/bin/bash -eux
+# Copyright 2016 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+me=${0##*/}
+TMP="$me.tmp"
+
+# Work in scratch directory
+cd "$OUTDIR"
+
+KEYDIR=${SRCDIR}/tests/devkeys
+TESTKEYS=${SRCDIR}/tests/testkeys
+
+# Some firmware blobs, each signed on its own
+: > ${TMP}.manifest
+for i in 1 2 3 4 5; do
+  dd bs=1024 count=16 if=/dev/urandom of=${TMP}.fw_main.$i
+  ${FUTILITY} sign \
+    --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+    --keyblock ${KEYDIR}/firmware.keyblock \
+    --kernelkey ${KEYDIR}/kernel_subkey.vbpubk \
+    --version 12 \
+    --fv ${TMP}.fw_main.$i \
+    ${TMP}.vblock.one.$i
+  echo "${TMP}.fw_main.$i ${TMP}.vblock.many.$i" >> ${TMP}.manifest
+done
+
+# Now all at once, with the keys read only once
+for jobs in 1 3; do
+  rm -f ${TMP}.vblock.many.*
+  ${FUTILITY} sign \
+    --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+    --keyblock ${KEYDIR}/firmware.keyblock \
+    --kernelkey ${KEYDIR}/kernel_subkey.vbpubk \
+    --version 12 \
+    --type fwblob \
+    --jobs $jobs \
+    --manifest ${TMP}.manifest
+  for i in 1 2 3 4 5; do
+    cmp ${TMP}.vblock.one.$i ${TMP}.vblock.many.$i
+  done
+done
+
+# Keyblocks from a PEM key, with comments and blank lines in the manifest
+cat > ${TMP}.manifest <<END
+# pubkey keyblock
+
+${KEYDIR}/firmware_data_key.vbpubk ${TMP}.keyblock.many.1
+${KEYDIR}/kernel_data_key.vbpubk ${TMP}.keyblock.many.2
+END
+${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --flags 9 \
+  --jobs 0 \
+  --manifest ${TMP}.manifest
+${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --flags 9 \
+  ${KEYDIR}/kernel_data_key.vbpubk ${TMP}.keyblock.one.2
+cmp ${TMP}.keyblock.one.2 ${TMP}.keyblock.many.2
+${FUTILITY} vbutil_keyblock --unpack ${TMP}.keyblock.many.1 \
+  --signpubkey ${TESTKEYS}/key_rsa4096.sha512.vbpubk
+
+# A bad file is reported, but doesn't stop the others
+rm -f ${TMP}.keyblock.many.*
+echo "${TMP}.missing ${TMP}.keyblock.many.3" >> ${TMP}.manifest
+if ${FUTILITY} sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --flags 9 \
+  --jobs 2 \
+  --manifest ${TMP}.manifest 2> ${TMP}.errors; then false; fi
+grep -q "${TMP}.missing: signing failed" ${TMP}.errors
+[ "$(grep -c 'signing failed' ${TMP}.errors)" = "1" ]
+cmp ${TMP}.keyblock.one.2 ${TMP}.keyblock.many.2
+
+# Even when signing one file at a time in this process, and a file that has to
+# be copied to its output before it's signed can't be
+DATADIR=${SRCDIR}/tests/futility/data
+cat > ${TMP}.manifest <<END
+${DATADIR}/zinger.unsigned ${TMP}.nosuchdir/zinger.1
+${DATADIR}/zinger.unsigned ${TMP}.zinger.2
+END
+if ${FUTILITY} sign \
+  --type usbpd1 \
+  --pem ${DATADIR}/zinger.pem \
+  --jobs 1 \
+  --manifest ${TMP}.manifest 2> ${TMP}.errors; then false; fi
+grep -q "zinger.unsigned: signing failed" ${TMP}.errors
+[ "$(grep -c 'signing failed' ${TMP}.errors)" = "1" ]
+cmp ${DATADIR}/zinger.signed ${TMP}.zinger.2
+
+# The manifest replaces the usual file args
+if ${FUTILITY} sign --manifest ${TMP}.manifest \
+  ${KEYDIR}/kernel_data_key.vbpubk; then false; fi
+
+# cleanup
+rm -rf ${TMP}*
+exit 0
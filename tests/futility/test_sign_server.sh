@@ -0,0 +1,169 @@
+#!/bin/bash -eux
+# Copyright 2016 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+me=${0##*/}
+TMP="$me.tmp"
+
+# Work in scratch directory
+cd "$OUTDIR"
+
+KEYDIR=${SRCDIR}/tests/devkeys
+TESTKEYS=${SRCDIR}/tests/testkeys
+
+# Unix socket paths are short, so they can't live in OUTDIR
+SOCKDIR=$(mktemp -d /tmp/${me}.XXXXXX)
+PIDS=
+cleanup() {
+  [ -z "$PIDS" ] || kill $PIDS || true
+  wait || true
+  rm -rf "$SOCKDIR"
+}
+trap cleanup EXIT
+
+# Start a server with the given keys, and wait for it to listen
+start_server() {
+  local sock=$1
+  shift
+  ${FUTILITY} sign_server --socket ${sock} "$@" &
+  PIDS="$PIDS $!"
+  for i in $(seq 100); do
+    [ -S ${sock} ] && return 0
+    sleep 0.1
+  done
+  echo "server didn't start" 1>&2
+  return 1
+}
+
+start_server ${SOCKDIR}/fw \
+  --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+  --keyblock ${KEYDIR}/firmware.keyblock \
+  --kernelkey ${KEYDIR}/kernel_subkey.vbpubk
+start_server ${SOCKDIR}/kern \
+  --signprivate ${KEYDIR}/kernel_data_key.vbprivk \
+  --keyblock ${KEYDIR}/kernel.keyblock
+start_server ${SOCKDIR}/digest \
+  --signprivate ${TESTKEYS}/key_rsa2048.sha256.vbprivk
+
+# Only the owner can reach the sockets, whatever the umask was
+for sock in fw kern digest; do
+  [ "$(stat -c %a ${SOCKDIR}/${sock})" = "600" ]
+done
+
+# Firmware preambles, several at once
+for i in 1 2 3 4 5; do
+  dd bs=1024 count=16 if=/dev/urandom of=${TMP}.fw_main.$i
+  ${FUTILITY} sign \
+    --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+    --keyblock ${KEYDIR}/firmware.keyblock \
+    --kernelkey ${KEYDIR}/kernel_subkey.vbpubk \
+    --version 12 \
+    --fv ${TMP}.fw_main.$i \
+    ${TMP}.vblock.local.$i
+done
+clients=
+for i in 1 2 3 4 5; do
+  ${FUTILITY} sign --server ${SOCKDIR}/fw \
+    --version 12 \
+    --fv ${TMP}.fw_main.$i \
+    ${TMP}.vblock.server.$i &
+  clients="$clients $!"
+done
+for pid in $clients; do
+  wait $pid
+done
+for i in 1 2 3 4 5; do
+  cmp ${TMP}.vblock.local.$i ${TMP}.vblock.server.$i
+done
+
+# Keyblocks
+${FUTILITY} sign \
+  --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+  --flags 7 \
+  ${KEYDIR}/kernel_subkey.vbpubk ${TMP}.keyblock.local
+${FUTILITY} sign --server ${SOCKDIR}/fw \
+  --flags 7 \
+  ${KEYDIR}/kernel_subkey.vbpubk ${TMP}.keyblock.server
+cmp ${TMP}.keyblock.local ${TMP}.keyblock.server
+
+# A new kernel partition, then resigned in place
+echo "hi there" > ${TMP}.config.txt
+dd if=/dev/urandom bs=512 count=1 of=${TMP}.bootloader.bin
+dd if=/dev/urandom bs=1024 count=64 of=${TMP}.vmlinuz
+for where in local server; do
+  if [ "$where" = "local" ]; then
+    keys="--signprivate ${KEYDIR}/kernel_data_key.vbprivk
+          --keyblock ${KEYDIR}/kernel.keyblock"
+  else
+    keys="--server ${SOCKDIR}/kern"
+  fi
+  ${FUTILITY} sign ${keys} \
+    --version 3 \
+    --config ${TMP}.config.txt \
+    --bootloader ${TMP}.bootloader.bin \
+    --vmlinuz ${TMP}.vmlinuz \
+    --arch arm \
+    ${TMP}.kpart.${where}
+  ${FUTILITY} sign ${keys} --version 4 ${TMP}.kpart.${where}
+done
+cmp ${TMP}.kpart.local ${TMP}.kpart.server
+
+# Resigning a kernel partition keeps the keyblock it already has, just as it
+# does without the server
+for where in local server; do
+  ${FUTILITY} sign \
+    --signprivate ${KEYDIR}/recovery_kernel_data_key.vbprivk \
+    --keyblock ${KEYDIR}/recovery_kernel.keyblock \
+    --version 3 \
+    --config ${TMP}.config.txt \
+    --bootloader ${TMP}.bootloader.bin \
+    --vmlinuz ${TMP}.vmlinuz \
+    --arch arm \
+    ${TMP}.kpart.rec.${where}
+done
+${FUTILITY} sign --signprivate ${KEYDIR}/kernel_data_key.vbprivk \
+  --version 4 ${TMP}.kpart.rec.local
+${FUTILITY} sign --server ${SOCKDIR}/kern --version 4 ${TMP}.kpart.rec.server
+cmp ${TMP}.kpart.rec.local ${TMP}.kpart.rec.server
+cmp -n $(stat -c %s ${KEYDIR}/recovery_kernel.keyblock) \
+  ${KEYDIR}/recovery_kernel.keyblock ${TMP}.kpart.rec.server
+
+# Local keys can't be mixed with the server's
+if ${FUTILITY} sign --server ${SOCKDIR}/kern \
+    --keyblock ${KEYDIR}/kernel.keyblock \
+    --version 5 ${TMP}.kpart.rec.server 2> ${TMP}.errors; then false; fi
+grep -q "can't be used with local keys" ${TMP}.errors
+cmp ${TMP}.kpart.rec.local ${TMP}.kpart.rec.server
+
+# Raw digests match what openssl makes of the same key
+dd bs=1024 count=4 if=/dev/urandom of=${TMP}.data
+openssl dgst -sha256 -binary ${TMP}.data > ${TMP}.digest
+openssl dgst -sha256 -sign ${TESTKEYS}/key_rsa2048.pem \
+  -out ${TMP}.sig.openssl ${TMP}.data
+${FUTILITY} sign --digest \
+  --signprivate ${TESTKEYS}/key_rsa2048.sha256.vbprivk \
+  ${TMP}.digest ${TMP}.sig.local
+${FUTILITY} sign --digest --server ${SOCKDIR}/digest \
+  ${TMP}.digest ${TMP}.sig.server
+cmp ${TMP}.sig.openssl ${TMP}.sig.local
+cmp ${TMP}.sig.openssl ${TMP}.sig.server
+
+# Requests the server can't handle are refused, and it keeps going
+if ${FUTILITY} sign --digest --server ${SOCKDIR}/digest \
+    ${TMP}.data ${TMP}.sig.bad; then false; fi
+if ${FUTILITY} sign --server ${SOCKDIR}/digest \
+    --version 1 --fv ${TMP}.fw_main.1 ${TMP}.vblock.bad; then false; fi
+${FUTILITY} sign --digest --server ${SOCKDIR}/digest \
+  ${TMP}.digest ${TMP}.sig.server2
+cmp ${TMP}.sig.openssl ${TMP}.sig.server2
+
+# Stopping the server removes its socket
+kill ${PIDS}
+wait ${PIDS}
+PIDS=
+[ ! -e ${SOCKDIR}/fw ]
+
+# cleanup
+rm -rf ${TMP}*
+exit 0
@@ -147,6 +147,85 @@ run_basic_tests() {
 }
 run_basic_tests
 
+echo "Find partitions by type, unique id and label..."
+X=$($CGPT find $MTD -n -l "${ROOTFS_LABEL}" ${DEV})
+[ "$X" = "$ROOTFS_NUM" ] || error
+assert_fail $CGPT find $MTD -n -l "ESP" ${DEV}
+X=$($CGPT find $MTD -n -t ${KERN_GUID} -l "${ESP_LABEL}" ${DEV} | tr '\n' ' ')
+[ "$X" = "$KERN_NUM $ESP_NUM " ] || error
+U=$($CGPT show $MTD -u -i $RANDOM_NUM ${DEV})
+X=$($CGPT find $MTD -n -u $U ${DEV})
+[ "$X" = "$RANDOM_NUM" ] || error
+
+# Partition contents only live in ${DEV} when the GPT is on the device.
+if [ -z "$MTD" ]; then
+  echo "Find partitions by their content..."
+  printf "CHROMEOS" > magic.bin
+  dd if=magic.bin of=${DEV} bs=1 seek=$((KERN_START * 512 + 1000)) \
+    conv=notrunc 2>/dev/null
+  X=$($CGPT find -n -M magic.bin -O 1000 -t ${KERN_GUID} ${DEV})
+  [ "$X" = "$KERN_NUM" ] || error
+  assert_fail $CGPT find -n -M magic.bin -O 990 -t ${KERN_GUID} ${DEV}
+  X=$($CGPT find -n -M magic.bin -O 990 -R 10 -t ${KERN_GUID} ${DEV})
+  [ "$X" = "$KERN_NUM" ] || error
+  assert_fail $CGPT find -n -M magic.bin -O 990 -R 9 -t ${KERN_GUID} ${DEV}
+  # The window is clipped to the end of the partition.
+  X=$($CGPT find -n -M magic.bin -O 0 -R $((KERN_SIZE * 512)) \
+    -t ${KERN_GUID} ${DEV})
+  [ "$X" = "$KERN_NUM" ] || error
+  # Large ranges are searched a window at a time, without missing content
+  # that straddles a window boundary or lies a few windows in.
+  printf "STRADDLE" > straddle.bin
+  for off in 4100 9000; do
+    dd if=/dev/zero of=${DEV} bs=512 seek=${KERN_START} count=${KERN_SIZE} \
+      conv=notrunc 2>/dev/null
+    dd if=straddle.bin of=${DEV} bs=1 seek=$((KERN_START * 512 + off)) \
+      conv=notrunc 2>/dev/null
+    X=$($CGPT find -n -M straddle.bin -O 0 -R $((KERN_SIZE * 512)) \
+      -t ${KERN_GUID} ${DEV})
+    [ "$X" = "$KERN_NUM" ] || error
+    assert_fail $CGPT find -n -M straddle.bin -O 0 -R $((off - 1)) \
+      -t ${KERN_GUID} ${DEV}
+  done
+fi
+
+echo "Test the GPT parse cache..."
+rm -rf cgpt_cache
+X=$($CGPT show $MTD ${DEV})
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+[ -n "$(ls cgpt_cache)" ] || error
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+X=$(CGPT_CACHE_DIR=cgpt_cache $CGPT find $MTD -n -l "${KERN_LABEL}" ${DEV})
+[ "$X" = "$KERN_NUM" ] || error
+# A modified GPT must not be served from the cache.
+$CGPT add $MTD -i $KERN_NUM -l "cached kernel" ${DEV}
+X=$($CGPT show $MTD ${DEV})
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+X=$(CGPT_CACHE_DIR=cgpt_cache $CGPT find $MTD -n -l "cached kernel" ${DEV})
+[ "$X" = "$KERN_NUM" ] || error
+$CGPT add $MTD -i $KERN_NUM -l "${KERN_LABEL}" ${DEV}
+# A cache that doesn't agree with the headers on the drive is not used.
+X=$($CGPT show $MTD ${DEV})
+rm -rf cgpt_cache
+CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV} >/dev/null
+CACHE=$(ls cgpt_cache/*)
+# (the name of entry 2 in the cached primary array)
+printf "XX" | dd of=${CACHE} bs=1 seek=2288 conv=notrunc 2>/dev/null
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+truncate -s 2200 ${CACHE}
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+# Nor is a cache directory that others can write to.
+rm -rf cgpt_cache
+mkdir -m 0770 cgpt_cache
+Y=$(CGPT_CACHE_DIR=cgpt_cache $CGPT show $MTD ${DEV})
+[ "$X" = "$Y" ] || error
+[ -z "$(ls cgpt_cache)" ] || error
+rm -rf cgpt_cache
 
 echo "Set the boot partition.."
 $CGPT boot $MTD -i ${KERN_NUM} ${DEV} >/dev/null
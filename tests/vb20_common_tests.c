@@ -51,7 +51,7 @@ static void test_struct_packing(void)
 static void test_helper_functions(void)
 {
 	{
-		uint8_t *p = (uint8_t *)test_helper_functions;
+		uint8_t *p = (uint8_t *)(uintptr_t)0x1000;
 		TEST_EQ((int)vb2_offset_of(p, p), 0, "vb2_offset_of() equal");
 		TEST_EQ((int)vb2_offset_of(p, p+10), 10,
 			"vb2_offset_of() positive");
@@ -82,7 +82,7 @@ static void test_helper_functions(void)
 	}
 
 	{
-		uint8_t *p = (uint8_t *)test_helper_functions;
+		uint8_t *p = (uint8_t *)(uintptr_t)0x1000;
 		TEST_SUCC(vb2_verify_member_inside(p, 20, p, 6, 11, 3),
 			  "MemberInside ok 1");
 		TEST_SUCC(vb2_verify_member_inside(p, 20, p+4, 4, 8, 4),
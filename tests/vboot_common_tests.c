@@ -55,7 +55,7 @@ static void ArraySizeTest(void)
 static void VerifyHelperFunctions(void)
 {
 	{
-		uint8_t *p = (uint8_t *)VerifyHelperFunctions;
+		uint8_t *p = (uint8_t *)(uintptr_t)0x1000;
 		TEST_EQ((int)OffsetOf(p, p), 0, "OffsetOf() equal");
 		TEST_EQ((int)OffsetOf(p, p+10), 10, "OffsetOf() positive");
 		TEST_EQ((int)OffsetOf(p, p+0x12345678), 0x12345678,
@@ -79,7 +79,7 @@ static void VerifyHelperFunctions(void)
 	}
 
 	{
-		uint8_t *p = (uint8_t *)VerifyHelperFunctions;
+		uint8_t *p = (uint8_t *)(uintptr_t)0x1000;
 		TEST_EQ(VerifyMemberInside(p, 20, p, 6, 11, 3), 0,
 			"MemberInside ok 1");
 		TEST_EQ(VerifyMemberInside(p, 20, p+4, 4, 8, 4), 0,
@@ -15,6 +15,7 @@
 #include "2misc.h"
 #include "2nvstorage.h"
 #include "bmpblk_font.h"
+#include "gbb_access.h"
 #include "gbb_header.h"
 #include "host_common.h"
 #include "region.h"
@@ -34,6 +35,11 @@ static BmpBlockHeader *bhdr;
 static char debug_info[4096];
 static struct vb2_context ctx;
 static uint8_t workbuf[VB2_KERNEL_WORKBUF_RECOMMENDED_SIZE];
+static uint32_t mock_decompress_count;
+static uint32_t mock_decompress_size;
+
+#define COMPRESSED_SIZE		16
+#define ORIGINAL_SIZE		400
 
 /* Reset mock data (for use before each test) */
 static void ResetMocks(void)
@@ -90,6 +96,36 @@ static void ResetMocks(void)
 	VbSharedDataInit(shared, sizeof(shared_data));
 
 	*debug_info = 0;
+	mock_decompress_count = 0;
+	mock_decompress_size = ORIGINAL_SIZE;
+}
+
+/* Give each localization one screen, with a compressed image first */
+static void AddImages(void)
+{
+	ScreenLayout *layout;
+	ImageInfo *image_info;
+	int gbb_used, i;
+
+	bhdr->number_of_screenlayouts = 1;
+	gbb_used = gbb->bmpfv_offset + sizeof(BmpBlockHeader);
+	layout = (ScreenLayout *)(gbb_data + gbb_used);
+	gbb_used += bhdr->number_of_localizations * sizeof(*layout);
+
+	image_info = (ImageInfo *)(gbb_data + gbb_used);
+	image_info->format = FORMAT_BMP;
+	image_info->compressed_size = COMPRESSED_SIZE;
+	image_info->original_size = ORIGINAL_SIZE;
+	image_info->compression = COMPRESS_LZMA1;
+	for (i = 0; i < bhdr->number_of_localizations; i++) {
+		layout[i].images[0].x = i + 1;
+		layout[i].images[0].image_info_offset =
+			gbb_used - gbb->bmpfv_offset;
+	}
+	gbb_used += sizeof(*image_info) + COMPRESSED_SIZE;
+
+	gbb->bmpfv_size = gbb_used - gbb->bmpfv_offset;
+	memcpy(cparams.gbb, gbb, sizeof(*gbb));
 }
 
 /* Mocks */
@@ -101,6 +137,16 @@ VbError_t VbExDisplayDebugInfo(const char *info_str)
 	return VBERROR_SUCCESS;
 }
 
+VbError_t VbExDecompress(void *inbuf, uint32_t in_size,
+			 uint32_t compression_type,
+			 void *outbuf, uint32_t *out_size)
+{
+	mock_decompress_count++;
+	*out_size = mock_decompress_size;
+	strcpy(outbuf, "decompressed");
+	return VBERROR_SUCCESS;
+}
+
 /* Test displaying debug info */
 static void DebugInfoTest(void)
 {
@@ -263,12 +309,88 @@ static void FontTest(void)
 
 }
 
+/* Test keeping decoded images between redraws */
+static void ImageCacheTest(void)
+{
+	ScreenLayout layout;
+	ImageInfo image_info;
+	char *data;
+	uint32_t size;
+
+	ResetMocks();
+	AddImages();
+	TEST_EQ(VbDisplayScreenFromGBB(&ctx, &cparams,
+				       VB_SCREEN_DEVELOPER_WARNING, 0),
+		VBERROR_SUCCESS, "Display screen");
+	TEST_EQ(mock_decompress_count, 1, "  image decompressed");
+	TEST_EQ(VbDisplayScreenFromGBB(&ctx, &cparams,
+				       VB_SCREEN_DEVELOPER_WARNING, 0),
+		VBERROR_SUCCESS, "Redraw screen");
+	TEST_EQ(mock_decompress_count, 1, "  image not decompressed again");
+
+	memset(&layout, 0, sizeof(layout));
+	memset(&image_info, 0, sizeof(image_info));
+	TEST_EQ(VbGbbReadImageCached(&cparams, 0, 0, 0, &layout, &image_info,
+				     &data, &size), VBERROR_SUCCESS,
+		"Cached image");
+	TEST_EQ(layout.images[0].x, 1, "  layout");
+	TEST_EQ(image_info.compression, COMPRESS_LZMA1, "  image info");
+	TEST_STR_EQ(data, "decompressed", "  image data");
+	TEST_EQ(size, ORIGINAL_SIZE, "  image size");
+	TEST_EQ(mock_decompress_count, 1, "  not decompressed again");
+
+	TEST_EQ(VbGbbReadImageCached(&cparams, 0, 0, 1, &layout, &image_info,
+				     &data, &size), VBERROR_NO_IMAGE_PRESENT,
+		"Missing image");
+	TEST_EQ(VbGbbReadImageCached(&cparams, 0, 0, 1, &layout, &image_info,
+				     &data, &size), VBERROR_NO_IMAGE_PRESENT,
+		"Missing image cached");
+
+	TEST_EQ(VbGbbReadImageCached(&cparams, 1, 0, 0, &layout, &image_info,
+				     &data, &size), VBERROR_SUCCESS,
+		"Other localization");
+	TEST_EQ(layout.images[0].x, 2, "  layout");
+	TEST_EQ(mock_decompress_count, 2, "  decompressed");
+	VbApiKernelFree(&cparams);
+	TEST_PTR_EQ(cparams.image_cache, NULL, "  cache freed");
+
+	/* Images bigger than the whole cache aren't kept */
+	ResetMocks();
+	AddImages();
+	mock_decompress_size = VB_IMAGE_CACHE_SIZE;
+	VbGbbReadImageCached(&cparams, 0, 0, 0, &layout, &image_info,
+			     &data, &size);
+	TEST_EQ(VbGbbReadImageCached(&cparams, 0, 0, 0, &layout, &image_info,
+				     &data, &size), VBERROR_SUCCESS,
+		"Image too big to cache");
+	TEST_STR_EQ(data, "decompressed", "  image data");
+	TEST_EQ(mock_decompress_count, 2, "  decompressed again");
+	VbApiKernelFree(&cparams);
+
+	/* The least recently used image goes first */
+	ResetMocks();
+	AddImages();
+	mock_decompress_size = VB_IMAGE_CACHE_SIZE / 2;
+	VbGbbReadImageCached(&cparams, 0, 0, 0, &layout, &image_info,
+			     &data, &size);
+	VbGbbReadImageCached(&cparams, 1, 0, 0, &layout, &image_info,
+			     &data, &size);
+	VbGbbReadImageCached(&cparams, 1, 0, 0, &layout, &image_info,
+			     &data, &size);
+	TEST_EQ(mock_decompress_count, 2, "Newer image kept");
+	VbGbbReadImageCached(&cparams, 0, 0, 0, &layout, &image_info,
+			     &data, &size);
+	TEST_EQ(mock_decompress_count, 3, "Older image dropped");
+	VbApiKernelFree(&cparams);
+}
+
 int main(void)
 {
 	DebugInfoTest();
 	LocalizationTest();
 	DisplayKeyTest();
 	FontTest();
+	ImageCacheTest();
 
 	return gTestSuccess ? 0 : 255;
 }
@@ -16,6 +16,12 @@
 #include <string.h>
 #include <yaml.h>
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <set>
+#include <thread>
+
 #include "bmpblk_utility.h"
 #include "image_types.h"
 #include "vboot_api.h"
@@ -34,6 +40,17 @@ static void error(const char *format, ...) {
   exit(1);
 }
 
+// Like error(), but returns the message for the caller to report, for code
+// that may be running in a job thread.
+static string job_error(const char *format, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  return buf;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // BmpBlock Utility implementation
 
@@ -51,6 +68,7 @@ namespace vboot_reference {
     set_compression_ = false;
     compression_ = COMPRESS_NONE;
     debug_ = debug;
+    jobs_ = 1;
     render_hwid_ = true;
     support_font_ = true;
     got_font_ = false;
@@ -65,6 +83,10 @@ namespace vboot_reference {
     set_compression_ = true;
   }
 
+  void BmpBlockUtil::set_jobs(int jobs) {
+    jobs_ = jobs > 0 ? jobs : 1;
+  }
+
   void BmpBlockUtil::load_from_config(const char *filename) {
     load_yaml_config(filename);
     fill_bmpblock_header();
@@ -385,7 +407,137 @@ namespace vboot_reference {
     }
   }
 
+  string BmpBlockUtil::load_image_file(ImageConfig &image) {
+    string content;
+    if (!read_image_file(image.filename.c_str(), content))
+      return job_error("%s: %s\n", image.filename.c_str(), strerror(errno));
+    image.raw_content = content;
+    image.data.original_size = content.size();
+    image.data.format =
+      identify_image_type(content.c_str(),
+                          (uint32_t)content.size(), &image.data);
+    if (FORMAT_INVALID == image.data.format) {
+      return job_error("Unsupported image format in %s\n",
+                       image.filename.c_str());
+    }
+    image.content_hash = std::hash<string>()(content);
+    return "";
+  }
+
+  string BmpBlockUtil::compress_image(ImageConfig &image) {
+    const string &content = image.raw_content;
+    switch(compression_) {
+    case COMPRESS_NONE:
+      image.data.compression = compression_;
+      image.compressed_content = content;
+      image.data.compressed_size = content.size();
+      break;
+    case COMPRESS_EFIv1:
+    {
+      // The content will always compress smaller (so sez the docs).
+      uint32_t tmpsize = content.size();
+      uint8_t *tmpbuf = (uint8_t *)malloc(tmpsize);
+      // The size of the compressed content is also returned.
+      if (EFI_SUCCESS != EfiCompress((uint8_t *)content.c_str(), tmpsize,
+                                     tmpbuf, &tmpsize)) {
+        free(tmpbuf);
+        return job_error("Unable to compress!\n");
+      }
+      image.data.compression = compression_;
+      image.compressed_content.assign((const char *)tmpbuf, tmpsize);
+      image.data.compressed_size = tmpsize;
+      free(tmpbuf);
+    }
+    break;
+    case COMPRESS_LZMA1:
+    {
+      // Calculate the worst case of buffer size.
+      uint32_t tmpsize = lzma_stream_buffer_bound(content.size());
+      uint8_t *tmpbuf = (uint8_t *)malloc(tmpsize);
+      lzma_stream stream = LZMA_STREAM_INIT;
+      lzma_options_lzma options;
+      lzma_ret result;
+
+      lzma_lzma_preset(&options, 9);
+      result = lzma_alone_encoder(&stream, &options);
+      if (result != LZMA_OK) {
+        free(tmpbuf);
+        return job_error("Unable to initialize easy encoder (error: %d)!\n",
+                         result);
+      }
+
+      stream.next_in = (uint8_t *)content.data();
+      stream.avail_in = content.size();
+      stream.next_out = tmpbuf;
+      stream.avail_out = tmpsize;
+      result = lzma_code(&stream, LZMA_FINISH);
+      if (result != LZMA_STREAM_END) {
+        lzma_end(&stream);
+        free(tmpbuf);
+        return job_error("Unable to encode data (error: %d)!\n", result);
+      }
+
+      image.data.compression = compression_;
+      image.compressed_content.assign((const char *)tmpbuf,
+                                      tmpsize - stream.avail_out);
+      image.data.compressed_size = tmpsize - stream.avail_out;
+      lzma_end(&stream);
+      free(tmpbuf);
+    }
+    break;
+    default:
+      return job_error("Unsupported compression method attempted.\n");
+    }
+    return "";
+  }
+
+  void BmpBlockUtil::run_jobs(const vector<ImageConfig *> &images,
+                              string (BmpBlockUtil::*fn)(ImageConfig &image)) {
+    string err;
+
+    if (jobs_ <= 1 || images.size() <= 1) {
+      for (unsigned int i = 0; i < images.size() && err.empty(); i++)
+        err = (this->*fn)(*images[i]);
+      if (!err.empty())
+        error("%s", err.c_str());
+      return;
+    }
+
+    // Each job takes the next image nobody has started yet. Every result
+    // lands in its own ImageConfig, and pack_bmpblock() decides the order,
+    // so the output is the same no matter which job finishes first. A job
+    // that fails stops the others from starting anything new, and the first
+    // failure is reported here once they've all finished.
+    std::atomic<size_t> next(0);
+    vector<std::future<string> > jobs;
+    for (int j = 0; j < jobs_ && (size_t)j < images.size(); j++) {
+      jobs.push_back(std::async(std::launch::async,
+                                [this, &images, &next, fn] {
+            string err;
+            for (size_t i = next++; i < images.size(); i = next++) {
+              err = (this->*fn)(*images[i]);
+              if (!err.empty()) {
+                next = images.size();
+                break;
+              }
+            }
+            return err;
+          }));
+    }
+    for (unsigned int j = 0; j < jobs.size(); j++) {
+      string job_err = jobs[j].get();
+      if (err.empty())
+        err = job_err;
+    }
+    if (!err.empty())
+      error("%s", err.c_str());
+  }
+
   void BmpBlockUtil::load_all_image_files() {
+    vector<ImageConfig *> images, unique;
+    std::set<ImageConfig *> seen;
+    std::multimap<size_t, ImageConfig *> by_hash;
+
     for (unsigned int i = 0; i < config_.image_names.size(); i++) {
       StrImageConfigMap::iterator it =
         config_.images_map.find(config_.image_names[i]);
@@ -394,84 +546,50 @@ namespace vboot_reference {
                config_.image_names[i].c_str(),
                it->second.filename.c_str());
       }
-      const string &content = read_image_file(it->second.filename.c_str());
-      it->second.raw_content = content;
-      it->second.data.original_size = content.size();
-      it->second.data.format =
-        identify_image_type(content.c_str(),
-                            (uint32_t)content.size(), &it->second.data);
-      if (FORMAT_INVALID == it->second.data.format) {
-        error("Unsupported image format in %s\n", it->second.filename.c_str());
-      }
-      switch(compression_) {
-      case COMPRESS_NONE:
-        it->second.data.compression = compression_;
-        it->second.compressed_content = content;
-        it->second.data.compressed_size = content.size();
-        break;
-      case COMPRESS_EFIv1:
-      {
-        // The content will always compress smaller (so sez the docs).
-        uint32_t tmpsize = content.size();
-        uint8_t *tmpbuf = (uint8_t *)malloc(tmpsize);
-        // The size of the compressed content is also returned.
-        if (EFI_SUCCESS != EfiCompress((uint8_t *)content.c_str(), tmpsize,
-                                       tmpbuf, &tmpsize)) {
-          error("Unable to compress!\n");
+      // Don't let two jobs work on the same image.
+      if (seen.insert(&it->second).second)
+        images.push_back(&it->second);
+    }
+
+    run_jobs(images, &BmpBlockUtil::load_image_file);
+
+    // Different names often refer to the same picture (the same icon in
+    // every locale, say). Only compress each picture once.
+    for (unsigned int i = 0; i < images.size(); i++) {
+      ImageConfig *image = images[i];
+      std::pair<std::multimap<size_t, ImageConfig *>::iterator,
+                std::multimap<size_t, ImageConfig *>::iterator> range =
+        by_hash.equal_range(image->content_hash);
+      for (; range.first != range.second; ++range.first) {
+        if (range.first->second->raw_content == image->raw_content) {
+          image->same_as = range.first->second;
+          break;
         }
-        it->second.data.compression = compression_;
-        it->second.compressed_content.assign((const char *)tmpbuf, tmpsize);
-        it->second.data.compressed_size = tmpsize;
-        free(tmpbuf);
       }
-      break;
-      case COMPRESS_LZMA1:
-      {
-        // Calculate the worst case of buffer size.
-        uint32_t tmpsize = lzma_stream_buffer_bound(content.size());
-        uint8_t *tmpbuf = (uint8_t *)malloc(tmpsize);
-        lzma_stream stream = LZMA_STREAM_INIT;
-        lzma_options_lzma options;
-        lzma_ret result;
-
-        lzma_lzma_preset(&options, 9);
-        result = lzma_alone_encoder(&stream, &options);
-        if (result != LZMA_OK) {
-          error("Unable to initialize easy encoder (error: %d)!\n", result);
-        }
+      if (!image->same_as) {
+        by_hash.insert(std::make_pair(image->content_hash, image));
+        unique.push_back(image);
+      }
+    }
 
-        stream.next_in = (uint8_t *)content.data();
-        stream.avail_in = content.size();
-        stream.next_out = tmpbuf;
-        stream.avail_out = tmpsize;
-        result = lzma_code(&stream, LZMA_FINISH);
-        if (result != LZMA_STREAM_END) {
-          error("Unable to encode data (error: %d)!\n", result);
-        }
+    run_jobs(unique, &BmpBlockUtil::compress_image);
 
-        it->second.data.compression = compression_;
-        it->second.compressed_content.assign((const char *)tmpbuf,
-                                             tmpsize - stream.avail_out);
-        it->second.data.compressed_size = tmpsize - stream.avail_out;
-        lzma_end(&stream);
-        free(tmpbuf);
-      }
-      break;
-      default:
-        error("Unsupported compression method attempted.\n");
+    for (unsigned int i = 0; i < images.size(); i++) {
+      ImageConfig *image = images[i];
+      if (image->same_as) {
+        image->data.compression = image->same_as->data.compression;
+        image->compressed_content = image->same_as->compressed_content;
+        image->data.compressed_size = image->same_as->data.compressed_size;
       }
     }
   }
 
-  const string BmpBlockUtil::read_image_file(const char *filename) {
-    string content;
+  bool BmpBlockUtil::read_image_file(const char *filename, string &content) {
     vector<char> buffer;
 
     FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-      perror(filename);
-      exit(errno);
-    }
+    if (!fp)
+      return false;
 
     if (fseek(fp, 0, SEEK_END) == 0) {
       buffer.resize(ftell(fp));
@@ -480,15 +598,17 @@ namespace vboot_reference {
 
     if (!buffer.empty()) {
       if(fread(&buffer[0], buffer.size(), 1, fp) != 1) {
-        perror(filename);
-        buffer.clear();
-      } else {
-        content.assign(buffer.begin(), buffer.end());
+        // A short read leaves errno alone.
+        int err = ferror(fp) ? errno : EIO;
+        fclose(fp);
+        errno = err;
+        return false;
       }
+      content.assign(buffer.begin(), buffer.end());
     }
 
     fclose(fp);
-    return content;
+    return true;
   }
 
   void BmpBlockUtil::fill_bmpblock_header() {
@@ -504,20 +624,49 @@ namespace vboot_reference {
       assert(config_.header.number_of_screenlayouts ==
              config_.localizations[i].size());
     }
-    config_.header.number_of_imageinfos = config_.images_map.size();
+    config_.header.number_of_imageinfos = 0;  // Filled by pack_bmpblock()
     config_.header.locale_string_offset = 0; // Filled by pack_bmpblock()
   }
 
   void BmpBlockUtil::pack_bmpblock() {
     bmpblock_.clear();
 
-    /* Compute the ImageInfo offsets from start of BMPBLOCK. */
+    /* Compute the ImageInfo offsets from start of BMPBLOCK. Images that
+     * would be stored exactly the same way are only stored once. */
+    std::multimap<size_t, ImageConfig *> stored;
     uint32_t current_offset = sizeof(BmpBlockHeader) +
       sizeof(ScreenLayout) * (config_.header.number_of_localizations *
                               config_.header.number_of_screenlayouts);
+    config_.header.number_of_imageinfos = 0;
     for (StrImageConfigMap::iterator it = config_.images_map.begin();
          it != config_.images_map.end();
          ++it) {
+      ImageConfig &image = it->second;
+      image.shared = false;
+      if (image.data.compressed_size) {
+        std::pair<std::multimap<size_t, ImageConfig *>::iterator,
+                  std::multimap<size_t, ImageConfig *>::iterator> range =
+          stored.equal_range(image.content_hash);
+        for (; range.first != range.second; ++range.first) {
+          ImageConfig *other = range.first->second;
+          if (!memcmp(&other->data, &image.data, sizeof(image.data)) &&
+              other->compressed_content == image.compressed_content) {
+            image.offset = other->offset;
+            image.shared = true;
+            break;
+          }
+        }
+      }
+      if (image.shared) {
+        if (debug_)
+          printf("  \"%s\": filename=\"%s\" shares offset=0x%x\n",
+                 it->first.c_str(),
+                 it->second.filename.c_str(),
+                 it->second.offset);
+        continue;
+      }
+      stored.insert(std::make_pair(image.content_hash, &image));
+      config_.header.number_of_imageinfos++;
       it->second.offset = current_offset;
       if (debug_)
         printf("  \"%s\": filename=\"%s\" offset=0x%x tag=%d fmt=%d\n",
@@ -583,6 +732,8 @@ namespace vboot_reference {
     for (StrImageConfigMap::iterator it = config_.images_map.begin();
          it != config_.images_map.end();
          ++it) {
+      if (it->second.shared)
+        continue;
       current_filled = bmpblock_.begin() + it->second.offset;
       current_offset = it->second.offset;
       if (debug_)
@@ -649,12 +800,14 @@ namespace vboot_reference {
       "\n"
       "To create a new BMPBLOCK file using config from YAML file:\n"
       "\n"
-      "  %s [-z NUM] -c YAML BMPBLOCK\n"
+      "  %s [-z NUM] [-j NUM] -c YAML BMPBLOCK\n"
       "\n"
       "    -z NUM  = compression algorithm to use\n"
       "              0 = none\n"
       "              1 = EFIv1\n"
       "              2 = LZMA1\n"
+      "    -j NUM  = number of images to compress at once\n"
+      "              (default is one per CPU)\n"
       "\n", prog_name);
     printf(
       "To display the contents of a BMPBLOCK:\n"
@@ -688,6 +841,7 @@ namespace vboot_reference {
     int overwrite = 0, extract_mode = 0;
     int compression = 0;
     int set_compression = 0;
+    int jobs = std::thread::hardware_concurrency();
     const char *config_fn = 0, *bmpblock_fn = 0, *extract_dir = ".";
     int show_as_yaml = 0;
     bool debug = false;
@@ -696,7 +850,7 @@ namespace vboot_reference {
     opterr = 0;                           // quiet
     int errorcnt = 0;
     char *e = 0;
-    while ((opt = getopt(argc, argv, ":c:xz:fd:yD")) != -1) {
+    while ((opt = getopt(argc, argv, ":c:xz:j:fd:yD")) != -1) {
       switch (opt) {
       case 'c':
         config_fn = optarg;
@@ -721,6 +875,14 @@ namespace vboot_reference {
         }
         set_compression = 1;
         break;
+      case 'j':
+        jobs = (int)strtoul(optarg, &e, 0);
+        if (!*optarg || (e && *e) || jobs < 1) {
+          fprintf(stderr, "%s: invalid argument to -%c: \"%s\"\n",
+                  prog_name, opt, optarg);
+          errorcnt++;
+        }
+        break;
       case 'f':
         overwrite = 1;
         break;
@@ -760,6 +922,7 @@ namespace vboot_reference {
     if (config_fn) {
       if (set_compression)
         util.force_compression(compression);
+      util.set_jobs(jobs);
       util.load_from_config(config_fn);
       util.pack_bmpblock();
       util.write_to_bmpblock(bmpblock_fn);
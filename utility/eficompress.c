@@ -57,7 +57,7 @@ typedef INT16             NODE;
 #define MAX_HASH_VAL      (3 * WNDSIZ + (WNDSIZ / 512 + 1) * UINT8_MAX)
 #define HASH(p, c)        ((p) + ((c) << (WNDBIT - 9)) + WNDSIZ * 2)
 #define CRCPOLY           0xA001
-#define UPDATE_CRC(c)     mCrc = mCrcTable[(mCrc ^ (c)) & 0xFF] ^ (mCrc >> UINT8_BIT)
+#define UPDATE_CRC(c)     Sd->mCrc = Sd->mCrcTable[(Sd->mCrc ^ (c)) & 0xFF] ^ (Sd->mCrc >> UINT8_BIT)
 
 //
 // C: the Char&Len Set; P: the Position Set; T: the exTra Set
@@ -75,6 +75,72 @@ typedef INT16             NODE;
   #define                 NPT NP
 #endif
 
+//
+// Hash chains: the first three bytes of a string pick its chain, and the
+// chain links earlier positions with the same hash, newest first
+//
+
+#define HC_HASH_BIT       15
+#define HC_HASH_SIZE      (1U << HC_HASH_BIT)
+#define HC_HASH(p)        ((((UINT32)(p)[0] << 10) ^ ((UINT32)(p)[1] << 5) ^ (p)[2]) & (HC_HASH_SIZE - 1))
+#define HC_MAX_CHAIN      256
+
+typedef struct {
+  UINT8   *mSrc;
+  UINT8   *mDst;
+  UINT8   *mSrcUpperLimit;
+  UINT8   *mDstUpperLimit;
+
+  UINT8   *mLevel;
+  UINT8   *mText;
+  UINT8   *mChildCount;
+  UINT8   *mBuf;
+  UINT8   mCLen[NC];
+  UINT8   mPTLen[NPT];
+  UINT8   *mLen;
+  INT16   mHeap[NC + 1];
+  INT32   mRemainder;
+  INT32   mMatchLen;
+  INT32   mBitCount;
+  INT32   mHeapSize;
+  INT32   mN;
+  INT32   mDepth;     // Recursion depth in CountLen()
+  UINT32  mBufSiz;
+  UINT32  mOutputPos;
+  UINT32  mOutputMask;
+  UINT32  mCPos;      // Position of the current flag byte in mBuf
+  UINT32  mSubBitBuf;
+  UINT32  mCrc;
+  UINT32  mCompSize;
+  UINT32  mOrigSize;
+
+  UINT16  *mFreq;
+  UINT16  *mSortPtr;
+  UINT16  mLenCnt[17];
+  UINT16  mLeft[2 * NC - 1];
+  UINT16  mRight[2 * NC - 1];
+  UINT16  mCrcTable[UINT8_MAX + 1];
+  UINT16  mCFreq[2 * NC - 1];
+  UINT16  mCCode[NC];
+  UINT16  mPFreq[2 * NP - 1];
+  UINT16  mPTCode[NPT];
+  UINT16  mTFreq[2 * NT - 1];
+
+  NODE    mPos;
+  NODE    mMatchPos;
+  NODE    mAvail;
+  NODE    *mPosition;
+  NODE    *mParent;
+  NODE    *mPrev;
+  NODE    *mNext;
+
+  UINT8   mHashChain;   // Find matches with hash chains instead of the tree
+  UINT8   mInsertOnly;  // The next match won't be used; don't look for one
+  UINT32  mSlideBase;   // Stream offset of mText[0]
+  UINT32  *mHashHead;   // Newest position + 1 for each hash, 0 if none
+  UINT32  *mHashPrev;   // Next older position + 1, indexed by position
+} SCRATCH_DATA;
+
 //
 // Function Prototypes
 //
@@ -82,27 +148,32 @@ typedef INT16             NODE;
 STATIC
 VOID
 PutDword(
+  IN SCRATCH_DATA *Sd,
   IN UINT32 Data
   );
 
 STATIC
 EFI_STATUS
 AllocateMemory (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 FreeMemory (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 InitSlide (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 NODE
 Child (
+  IN SCRATCH_DATA *Sd,
   IN NODE q,
   IN UINT8 c
   );
@@ -110,6 +181,7 @@ Child (
 STATIC
 VOID
 MakeChild (
+  IN SCRATCH_DATA *Sd,
   IN NODE q,
   IN UINT8 c,
   IN NODE r
@@ -118,37 +190,50 @@ MakeChild (
 STATIC
 VOID
 Split (
+  IN SCRATCH_DATA *Sd,
   IN NODE Old
   );
 
 STATIC
 VOID
 InsertNode (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 DeleteNode (
+  IN SCRATCH_DATA *Sd
+  );
+
+STATIC
+VOID
+HashChainInsert (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 GetNextMatch (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 EFI_STATUS
 Encode (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 CountTFreq (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 WritePTLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 n,
   IN INT32 nbit,
   IN INT32 Special
@@ -157,28 +242,33 @@ WritePTLen (
 STATIC
 VOID
 WriteCLen (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 EncodeC (
+  IN SCRATCH_DATA *Sd,
   IN INT32 c
   );
 
 STATIC
 VOID
 EncodeP (
+  IN SCRATCH_DATA *Sd,
   IN UINT32 p
   );
 
 STATIC
 VOID
 SendBlock (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 Output (
+  IN SCRATCH_DATA *Sd,
   IN UINT32 c,
   IN UINT32 p
   );
@@ -186,21 +276,25 @@ Output (
 STATIC
 VOID
 HufEncodeStart (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 HufEncodeEnd (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 MakeCrcTable (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 PutBits (
+  IN SCRATCH_DATA *Sd,
   IN INT32 n,
   IN UINT32 x
   );
@@ -208,6 +302,7 @@ PutBits (
 STATIC
 INT32
 FreadCrc (
+  IN SCRATCH_DATA *Sd,
   OUT UINT8 *p,
   IN  INT32 n
   );
@@ -215,29 +310,34 @@ FreadCrc (
 STATIC
 VOID
 InitPutBits (
+  IN SCRATCH_DATA *Sd
   );
 
 STATIC
 VOID
 CountLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 i
   );
 
 STATIC
 VOID
 MakeLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 Root
   );
 
 STATIC
 VOID
 DownHeap (
+  IN SCRATCH_DATA *Sd,
   IN INT32 i
   );
 
 STATIC
 VOID
 MakeCode (
+  IN SCRATCH_DATA *Sd,
   IN  INT32 n,
   IN  UINT8 Len[],
   OUT UINT16 Code[]
@@ -246,6 +346,7 @@ MakeCode (
 STATIC
 INT32
 MakeTree (
+  IN SCRATCH_DATA *Sd,
   IN  INT32   NParm,
   IN  UINT16  FreqParm[],
   OUT UINT8   LenParm[],
@@ -254,40 +355,57 @@ MakeTree (
 
 
 //
-//  Global Variables
+// functions
 //
 
-STATIC UINT8  *mSrc, *mDst, *mSrcUpperLimit, *mDstUpperLimit;
+EFI_STATUS
+EfiCompress (
+  IN      UINT8   *SrcBuffer,
+  IN      UINT32  SrcSize,
+  IN      UINT8   *DstBuffer,
+  IN OUT  UINT32  *DstSize
+  )
+/*++
 
-STATIC UINT8  *mLevel, *mText, *mChildCount, *mBuf, mCLen[NC], mPTLen[NPT], *mLen;
-STATIC INT16  mHeap[NC + 1];
-STATIC INT32  mRemainder, mMatchLen, mBitCount, mHeapSize, mN;
-STATIC UINT32 mBufSiz = 0, mOutputPos, mOutputMask, mSubBitBuf, mCrc;
-STATIC UINT32 mCompSize, mOrigSize;
+Routine Description:
 
-STATIC UINT16 *mFreq, *mSortPtr, mLenCnt[17], mLeft[2 * NC - 1], mRight[2 * NC - 1],
-              mCrcTable[UINT8_MAX + 1], mCFreq[2 * NC - 1], mCCode[NC],
-              mPFreq[2 * NP - 1], mPTCode[NPT], mTFreq[2 * NT - 1];
+  The main compression routine.
 
-STATIC NODE   mPos, mMatchPos, mAvail, *mPosition, *mParent, *mPrev, *mNext = NULL;
+Arguments:
 
+  SrcBuffer   - The buffer storing the source data
+  SrcSize     - The size of source data
+  DstBuffer   - The buffer to store the compressed data
+  DstSize     - On input, the size of DstBuffer; On output,
+                the size of the actual compressed data.
 
-//
-// functions
-//
+Returns:
+
+  EFI_BUFFER_TOO_SMALL  - The DstBuffer is too small. In this case,
+                DstSize contains the size needed.
+  EFI_SUCCESS           - Compression is successful.
+
+--*/
+{
+  return EfiCompressEx (SrcBuffer, SrcSize, DstBuffer, DstSize,
+                        EFI_COMPRESS_MATCH_TREE);
+}
 
 EFI_STATUS
-EfiCompress (
+EfiCompressEx (
   IN      UINT8   *SrcBuffer,
   IN      UINT32  SrcSize,
   IN      UINT8   *DstBuffer,
-  IN OUT  UINT32  *DstSize
+  IN OUT  UINT32  *DstSize,
+  IN      UINT32  MatchFinder
   )
 /*++
 
 Routine Description:
 
-  The main compression routine.
+  The main compression routine, with a choice of how repeated strings
+  are found. All state lives in a scratch area allocated for this call,
+  so any number of compressions may run at once.
 
 Arguments:
 
@@ -296,84 +414,92 @@ Arguments:
   DstBuffer   - The buffer to store the compressed data
   DstSize     - On input, the size of DstBuffer; On output,
                 the size of the actual compressed data.
+  MatchFinder - EFI_COMPRESS_MATCH_TREE for the original Patricia tree,
+                EFI_COMPRESS_MATCH_HASH_CHAIN for hash chains. Both
+                produce streams that EfiDecompress() understands, but
+                not necessarily the same bytes.
 
 Returns:
 
   EFI_BUFFER_TOO_SMALL  - The DstBuffer is too small. In this case,
                 DstSize contains the size needed.
+  EFI_INVALID_PARAMETER - MatchFinder is not recognized.
+  EFI_OUT_OF_RESOURCES  - Not enough memory for compression process
   EFI_SUCCESS           - Compression is successful.
 
 --*/
 {
-  EFI_STATUS Status = EFI_SUCCESS;
+  EFI_STATUS    Status = EFI_SUCCESS;
+  SCRATCH_DATA  *Sd;
+
+  if (MatchFinder != EFI_COMPRESS_MATCH_TREE &&
+      MatchFinder != EFI_COMPRESS_MATCH_HASH_CHAIN) {
+    return EFI_INVALID_PARAMETER;
+  }
 
   //
   // Initializations
   //
-  mBufSiz = 0;
-  mBuf = NULL;
-  mText       = NULL;
-  mLevel      = NULL;
-  mChildCount = NULL;
-  mPosition   = NULL;
-  mParent     = NULL;
-  mPrev       = NULL;
-  mNext       = NULL;
-
+  Sd = calloc (1, sizeof (*Sd));
+  if (Sd == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Sd->mHashChain = (MatchFinder == EFI_COMPRESS_MATCH_HASH_CHAIN);
 
-  mSrc = SrcBuffer;
-  mSrcUpperLimit = mSrc + SrcSize;
-  mDst = DstBuffer;
-  mDstUpperLimit = mDst + *DstSize;
+  Sd->mSrc = SrcBuffer;
+  Sd->mSrcUpperLimit = Sd->mSrc + SrcSize;
+  Sd->mDst = DstBuffer;
+  Sd->mDstUpperLimit = Sd->mDst + *DstSize;
 
-  PutDword(0L);
-  PutDword(0L);
+  PutDword(Sd, 0L);
+  PutDword(Sd, 0L);
 
-  MakeCrcTable ();
+  MakeCrcTable (Sd);
 
-  mOrigSize = mCompSize = 0;
-  mCrc = INIT_CRC;
+  Sd->mOrigSize = Sd->mCompSize = 0;
+  Sd->mCrc = INIT_CRC;
 
   //
   // Compress it
   //
 
-  Status = Encode();
+  Status = Encode(Sd);
   if (EFI_ERROR (Status)) {
+    free (Sd);
     return EFI_OUT_OF_RESOURCES;
   }
 
   //
   // Null terminate the compressed data
   //
-  if (mDst < mDstUpperLimit) {
-    *mDst++ = 0;
+  if (Sd->mDst < Sd->mDstUpperLimit) {
+    *Sd->mDst++ = 0;
   }
 
   //
   // Fill in compressed size and original size
   //
-  mDst = DstBuffer;
-  PutDword(mCompSize+1);
-  PutDword(mOrigSize);
+  Sd->mDst = DstBuffer;
+  PutDword(Sd, Sd->mCompSize+1);
+  PutDword(Sd, Sd->mOrigSize);
 
   //
   // Return
   //
 
-  if (mCompSize + 1 + 8 > *DstSize) {
-    *DstSize = mCompSize + 1 + 8;
-    return EFI_BUFFER_TOO_SMALL;
-  } else {
-    *DstSize = mCompSize + 1 + 8;
-    return EFI_SUCCESS;
+  if (Sd->mCompSize + 1 + 8 > *DstSize) {
+    Status = EFI_BUFFER_TOO_SMALL;
   }
+  *DstSize = Sd->mCompSize + 1 + 8;
 
+  free (Sd);
+  return Status;
 }
 
 STATIC
 VOID
 PutDword(
+  IN SCRATCH_DATA *Sd,
   IN UINT32 Data
   )
 /*++
@@ -384,39 +510,44 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   Data    - the dword to put
 
 Returns: (VOID)
 
 --*/
 {
-  if (mDst < mDstUpperLimit) {
-    *mDst++ = (UINT8)(((UINT8)(Data        )) & 0xff);
+  if (Sd->mDst < Sd->mDstUpperLimit) {
+    *Sd->mDst++ = (UINT8)(((UINT8)(Data        )) & 0xff);
   }
 
-  if (mDst < mDstUpperLimit) {
-    *mDst++ = (UINT8)(((UINT8)(Data >> 0x08)) & 0xff);
+  if (Sd->mDst < Sd->mDstUpperLimit) {
+    *Sd->mDst++ = (UINT8)(((UINT8)(Data >> 0x08)) & 0xff);
   }
 
-  if (mDst < mDstUpperLimit) {
-    *mDst++ = (UINT8)(((UINT8)(Data >> 0x10)) & 0xff);
+  if (Sd->mDst < Sd->mDstUpperLimit) {
+    *Sd->mDst++ = (UINT8)(((UINT8)(Data >> 0x10)) & 0xff);
   }
 
-  if (mDst < mDstUpperLimit) {
-    *mDst++ = (UINT8)(((UINT8)(Data >> 0x18)) & 0xff);
+  if (Sd->mDst < Sd->mDstUpperLimit) {
+    *Sd->mDst++ = (UINT8)(((UINT8)(Data >> 0x18)) & 0xff);
   }
 }
 
 STATIC
 EFI_STATUS
-AllocateMemory ()
+AllocateMemory (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Allocate memory spaces for data structures used in compression process
 
-Argements: (VOID)
+Argements:
+
+  Sd      - The global scratch data
 
 Returns:
 
@@ -427,74 +558,94 @@ Returns:
 {
   UINT32      i;
 
-  mText       = malloc (WNDSIZ * 2 + MAXMATCH);
+  Sd->mText       = malloc (WNDSIZ * 2 + MAXMATCH);
   for (i = 0 ; i < WNDSIZ * 2 + MAXMATCH; i ++) {
-    mText[i] = 0;
+    Sd->mText[i] = 0;
   }
 
-  mLevel      = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*mLevel));
-  mChildCount = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*mChildCount));
-  mPosition   = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*mPosition));
-  mParent     = malloc (WNDSIZ * 2 * sizeof(*mParent));
-  mPrev       = malloc (WNDSIZ * 2 * sizeof(*mPrev));
-  mNext       = malloc ((MAX_HASH_VAL + 1) * sizeof(*mNext));
-
-  mBufSiz = 16 * 1024U;
-  while ((mBuf = malloc(mBufSiz)) == NULL) {
-    mBufSiz = (mBufSiz / 10U) * 9U;
-    if (mBufSiz < 4 * 1024U) {
+  if (Sd->mHashChain) {
+    Sd->mHashHead = calloc (HC_HASH_SIZE, sizeof(*Sd->mHashHead));
+    Sd->mHashPrev = malloc (WNDSIZ * sizeof(*Sd->mHashPrev));
+    if (Sd->mHashHead == NULL || Sd->mHashPrev == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  } else {
+    Sd->mLevel      = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*Sd->mLevel));
+    Sd->mChildCount = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*Sd->mChildCount));
+    Sd->mPosition   = malloc ((WNDSIZ + UINT8_MAX + 1) * sizeof(*Sd->mPosition));
+    Sd->mParent     = malloc (WNDSIZ * 2 * sizeof(*Sd->mParent));
+    Sd->mPrev       = malloc (WNDSIZ * 2 * sizeof(*Sd->mPrev));
+    Sd->mNext       = malloc ((MAX_HASH_VAL + 1) * sizeof(*Sd->mNext));
+  }
+
+  Sd->mBufSiz = 16 * 1024U;
+  while ((Sd->mBuf = malloc(Sd->mBufSiz)) == NULL) {
+    Sd->mBufSiz = (Sd->mBufSiz / 10U) * 9U;
+    if (Sd->mBufSiz < 4 * 1024U) {
       return EFI_OUT_OF_RESOURCES;
     }
   }
-  mBuf[0] = 0;
+  Sd->mBuf[0] = 0;
 
   return EFI_SUCCESS;
 }
 
 VOID
-FreeMemory ()
+FreeMemory (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Called when compression is completed to free memory previously allocated.
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
 --*/
 {
-  if (mText) {
-    free (mText);
+  if (Sd->mText) {
+    free (Sd->mText);
   }
 
-  if (mLevel) {
-    free (mLevel);
+  if (Sd->mLevel) {
+    free (Sd->mLevel);
   }
 
-  if (mChildCount) {
-    free (mChildCount);
+  if (Sd->mChildCount) {
+    free (Sd->mChildCount);
   }
 
-  if (mPosition) {
-    free (mPosition);
+  if (Sd->mPosition) {
+    free (Sd->mPosition);
   }
 
-  if (mParent) {
-    free (mParent);
+  if (Sd->mParent) {
+    free (Sd->mParent);
   }
 
-  if (mPrev) {
-    free (mPrev);
+  if (Sd->mPrev) {
+    free (Sd->mPrev);
   }
 
-  if (mNext) {
-    free (mNext);
+  if (Sd->mNext) {
+    free (Sd->mNext);
   }
 
-  if (mBuf) {
-    free (mBuf);
+  if (Sd->mHashHead) {
+    free (Sd->mHashHead);
+  }
+
+  if (Sd->mHashPrev) {
+    free (Sd->mHashPrev);
+  }
+
+  if (Sd->mBuf) {
+    free (Sd->mBuf);
   }
 
   return;
@@ -503,14 +654,18 @@ Returns: (VOID)
 
 STATIC
 VOID
-InitSlide ()
+InitSlide (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Initialize String Info Log data structures
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -519,20 +674,20 @@ Returns: (VOID)
   NODE i;
 
   for (i = WNDSIZ; i <= WNDSIZ + UINT8_MAX; i++) {
-    mLevel[i] = 1;
-    mPosition[i] = NIL;  /* sentinel */
+    Sd->mLevel[i] = 1;
+    Sd->mPosition[i] = NIL;  /* sentinel */
   }
   for (i = WNDSIZ; i < WNDSIZ * 2; i++) {
-    mParent[i] = NIL;
+    Sd->mParent[i] = NIL;
   }
-  mAvail = 1;
+  Sd->mAvail = 1;
   for (i = 1; i < WNDSIZ - 1; i++) {
-    mNext[i] = (NODE)(i + 1);
+    Sd->mNext[i] = (NODE)(i + 1);
   }
 
-  mNext[WNDSIZ - 1] = NIL;
+  Sd->mNext[WNDSIZ - 1] = NIL;
   for (i = WNDSIZ * 2; i <= MAX_HASH_VAL; i++) {
-    mNext[i] = NIL;
+    Sd->mNext[i] = NIL;
   }
 }
 
@@ -540,6 +695,7 @@ Returns: (VOID)
 STATIC
 NODE
 Child (
+  IN SCRATCH_DATA *Sd,
   IN NODE q,
   IN UINT8 c
   )
@@ -551,6 +707,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   q       - the parent node
   c       - the edge character
 
@@ -562,10 +719,10 @@ Returns:
 {
   NODE r;
 
-  r = mNext[HASH(q, c)];
-  mParent[NIL] = q;  /* sentinel */
-  while (mParent[r] != q) {
-    r = mNext[r];
+  r = Sd->mNext[HASH(q, c)];
+  Sd->mParent[NIL] = q;  /* sentinel */
+  while (Sd->mParent[r] != q) {
+    r = Sd->mNext[r];
   }
 
   return r;
@@ -574,6 +731,7 @@ Returns:
 STATIC
 VOID
 MakeChild (
+  IN SCRATCH_DATA *Sd,
   IN NODE q,
   IN UINT8 c,
   IN NODE r
@@ -586,6 +744,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   q       - the parent node
   c       - the edge character
   r       - the child node
@@ -597,18 +756,19 @@ Returns: (VOID)
   NODE h, t;
 
   h = (NODE)HASH(q, c);
-  t = mNext[h];
-  mNext[h] = r;
-  mNext[r] = t;
-  mPrev[t] = r;
-  mPrev[r] = h;
-  mParent[r] = q;
-  mChildCount[q]++;
+  t = Sd->mNext[h];
+  Sd->mNext[h] = r;
+  Sd->mNext[r] = t;
+  Sd->mPrev[t] = r;
+  Sd->mPrev[r] = h;
+  Sd->mParent[r] = q;
+  Sd->mChildCount[q]++;
 }
 
 STATIC
 VOID
 Split (
+  IN SCRATCH_DATA *Sd,
   NODE Old
   )
 /*++
@@ -619,6 +779,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   Old     - the node to split
 
 Returns: (VOID)
@@ -627,32 +788,36 @@ Returns: (VOID)
 {
   NODE New, t;
 
-  New = mAvail;
-  mAvail = mNext[New];
-  mChildCount[New] = 0;
-  t = mPrev[Old];
-  mPrev[New] = t;
-  mNext[t] = New;
-  t = mNext[Old];
-  mNext[New] = t;
-  mPrev[t] = New;
-  mParent[New] = mParent[Old];
-  mLevel[New] = (UINT8)mMatchLen;
-  mPosition[New] = mPos;
-  MakeChild(New, mText[mMatchPos + mMatchLen], Old);
-  MakeChild(New, mText[mPos + mMatchLen], mPos);
+  New = Sd->mAvail;
+  Sd->mAvail = Sd->mNext[New];
+  Sd->mChildCount[New] = 0;
+  t = Sd->mPrev[Old];
+  Sd->mPrev[New] = t;
+  Sd->mNext[t] = New;
+  t = Sd->mNext[Old];
+  Sd->mNext[New] = t;
+  Sd->mPrev[t] = New;
+  Sd->mParent[New] = Sd->mParent[Old];
+  Sd->mLevel[New] = (UINT8)Sd->mMatchLen;
+  Sd->mPosition[New] = Sd->mPos;
+  MakeChild(Sd, New, Sd->mText[Sd->mMatchPos + Sd->mMatchLen], Old);
+  MakeChild(Sd, New, Sd->mText[Sd->mPos + Sd->mMatchLen], Sd->mPos);
 }
 
 STATIC
 VOID
-InsertNode ()
+InsertNode (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Insert string info for current position into the String Info Log
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -661,7 +826,7 @@ Returns: (VOID)
   NODE q, r, j, t;
   UINT8 c, *t1, *t2;
 
-  if (mMatchLen >= 4) {
+  if (Sd->mMatchLen >= 4) {
 
     //
     // We have just got a long match, the target tree
@@ -671,21 +836,21 @@ Returns: (VOID)
     // in DeleteNode() later.
     //
 
-    mMatchLen--;
-    r = (INT16)((mMatchPos + 1) | WNDSIZ);
-    while ((q = mParent[r]) == NIL) {
-      r = mNext[r];
+    Sd->mMatchLen--;
+    r = (INT16)((Sd->mMatchPos + 1) | WNDSIZ);
+    while ((q = Sd->mParent[r]) == NIL) {
+      r = Sd->mNext[r];
     }
-    while (mLevel[q] >= mMatchLen) {
-      r = q;  q = mParent[q];
+    while (Sd->mLevel[q] >= Sd->mMatchLen) {
+      r = q;  q = Sd->mParent[q];
     }
     t = q;
-    while (mPosition[t] < 0) {
-      mPosition[t] = mPos;
-      t = mParent[t];
+    while (Sd->mPosition[t] < 0) {
+      Sd->mPosition[t] = Sd->mPos;
+      t = Sd->mParent[t];
     }
     if (t < WNDSIZ) {
-      mPosition[t] = (NODE)(mPos | PERC_FLAG);
+      Sd->mPosition[t] = (NODE)(Sd->mPos | PERC_FLAG);
     }
   } else {
 
@@ -693,14 +858,14 @@ Returns: (VOID)
     // Locate the target tree
     //
 
-    q = (INT16)(mText[mPos] + WNDSIZ);
-    c = mText[mPos + 1];
-    if ((r = Child(q, c)) == NIL) {
-      MakeChild(q, c, mPos);
-      mMatchLen = 1;
+    q = (INT16)(Sd->mText[Sd->mPos] + WNDSIZ);
+    c = Sd->mText[Sd->mPos + 1];
+    if ((r = Child(Sd, q, c)) == NIL) {
+      MakeChild(Sd, q, c, Sd->mPos);
+      Sd->mMatchLen = 1;
       return;
     }
-    mMatchLen = 2;
+    Sd->mMatchLen = 2;
   }
 
   //
@@ -712,55 +877,57 @@ Returns: (VOID)
   for ( ; ; ) {
     if (r >= WNDSIZ) {
       j = MAXMATCH;
-      mMatchPos = r;
+      Sd->mMatchPos = r;
     } else {
-      j = mLevel[r];
-      mMatchPos = (NODE)(mPosition[r] & ~PERC_FLAG);
+      j = Sd->mLevel[r];
+      Sd->mMatchPos = (NODE)(Sd->mPosition[r] & ~PERC_FLAG);
     }
-    if (mMatchPos >= mPos) {
-      mMatchPos -= WNDSIZ;
+    if (Sd->mMatchPos >= Sd->mPos) {
+      Sd->mMatchPos -= WNDSIZ;
     }
-    t1 = &mText[mPos + mMatchLen];
-    t2 = &mText[mMatchPos + mMatchLen];
-    while (mMatchLen < j) {
+    t1 = &Sd->mText[Sd->mPos + Sd->mMatchLen];
+    t2 = &Sd->mText[Sd->mMatchPos + Sd->mMatchLen];
+    while (Sd->mMatchLen < j) {
       if (*t1 != *t2) {
-        Split(r);
+        Split(Sd, r);
         return;
       }
-      mMatchLen++;
+      Sd->mMatchLen++;
       t1++;
       t2++;
     }
-    if (mMatchLen >= MAXMATCH) {
+    if (Sd->mMatchLen >= MAXMATCH) {
       break;
     }
-    mPosition[r] = mPos;
+    Sd->mPosition[r] = Sd->mPos;
     q = r;
-    if ((r = Child(q, *t1)) == NIL) {
-      MakeChild(q, *t1, mPos);
+    if ((r = Child(Sd, q, *t1)) == NIL) {
+      MakeChild(Sd, q, *t1, Sd->mPos);
       return;
     }
-    mMatchLen++;
+    Sd->mMatchLen++;
   }
-  t = mPrev[r];
-  mPrev[mPos] = t;
-  mNext[t] = mPos;
-  t = mNext[r];
-  mNext[mPos] = t;
-  mPrev[t] = mPos;
-  mParent[mPos] = q;
-  mParent[r] = NIL;
+  t = Sd->mPrev[r];
+  Sd->mPrev[Sd->mPos] = t;
+  Sd->mNext[t] = Sd->mPos;
+  t = Sd->mNext[r];
+  Sd->mNext[Sd->mPos] = t;
+  Sd->mPrev[t] = Sd->mPos;
+  Sd->mParent[Sd->mPos] = q;
+  Sd->mParent[r] = NIL;
 
   //
   // Special usage of 'next'
   //
-  mNext[r] = mPos;
+  Sd->mNext[r] = Sd->mPos;
 
 }
 
 STATIC
 VOID
-DeleteNode ()
+DeleteNode (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
@@ -768,7 +935,9 @@ Routine Description:
   Delete outdated string info. (The Usage of PERC_FLAG
   ensures a clean deletion)
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -776,65 +945,131 @@ Returns: (VOID)
 {
   NODE q, r, s, t, u;
 
-  if (mParent[mPos] == NIL) {
+  if (Sd->mParent[Sd->mPos] == NIL) {
     return;
   }
 
-  r = mPrev[mPos];
-  s = mNext[mPos];
-  mNext[r] = s;
-  mPrev[s] = r;
-  r = mParent[mPos];
-  mParent[mPos] = NIL;
-  if (r >= WNDSIZ || --mChildCount[r] > 1) {
+  r = Sd->mPrev[Sd->mPos];
+  s = Sd->mNext[Sd->mPos];
+  Sd->mNext[r] = s;
+  Sd->mPrev[s] = r;
+  r = Sd->mParent[Sd->mPos];
+  Sd->mParent[Sd->mPos] = NIL;
+  if (r >= WNDSIZ || --Sd->mChildCount[r] > 1) {
     return;
   }
-  t = (NODE)(mPosition[r] & ~PERC_FLAG);
-  if (t >= mPos) {
+  t = (NODE)(Sd->mPosition[r] & ~PERC_FLAG);
+  if (t >= Sd->mPos) {
     t -= WNDSIZ;
   }
   s = t;
-  q = mParent[r];
-  while ((u = mPosition[q]) & PERC_FLAG) {
+  q = Sd->mParent[r];
+  while ((u = Sd->mPosition[q]) & PERC_FLAG) {
     u &= ~PERC_FLAG;
-    if (u >= mPos) {
+    if (u >= Sd->mPos) {
       u -= WNDSIZ;
     }
     if (u > s) {
       s = u;
     }
-    mPosition[q] = (INT16)(s | WNDSIZ);
-    q = mParent[q];
+    Sd->mPosition[q] = (INT16)(s | WNDSIZ);
+    q = Sd->mParent[q];
   }
   if (q < WNDSIZ) {
-    if (u >= mPos) {
+    if (u >= Sd->mPos) {
       u -= WNDSIZ;
     }
     if (u > s) {
       s = u;
     }
-    mPosition[q] = (INT16)(s | WNDSIZ | PERC_FLAG);
-  }
-  s = Child(r, mText[t + mLevel[r]]);
-  t = mPrev[s];
-  u = mNext[s];
-  mNext[t] = u;
-  mPrev[u] = t;
-  t = mPrev[r];
-  mNext[t] = s;
-  mPrev[s] = t;
-  t = mNext[r];
-  mPrev[t] = s;
-  mNext[s] = t;
-  mParent[s] = mParent[r];
-  mParent[r] = NIL;
-  mNext[r] = mAvail;
-  mAvail = r;
+    Sd->mPosition[q] = (INT16)(s | WNDSIZ | PERC_FLAG);
+  }
+  s = Child(Sd, r, Sd->mText[t + Sd->mLevel[r]]);
+  t = Sd->mPrev[s];
+  u = Sd->mNext[s];
+  Sd->mNext[t] = u;
+  Sd->mPrev[u] = t;
+  t = Sd->mPrev[r];
+  Sd->mNext[t] = s;
+  Sd->mPrev[s] = t;
+  t = Sd->mNext[r];
+  Sd->mPrev[t] = s;
+  Sd->mNext[s] = t;
+  Sd->mParent[s] = Sd->mParent[r];
+  Sd->mParent[r] = NIL;
+  Sd->mNext[r] = Sd->mAvail;
+  Sd->mAvail = r;
 }
 
 STATIC
 VOID
-GetNextMatch ()
+HashChainInsert (
+  IN SCRATCH_DATA *Sd
+  )
+/*++
+
+Routine Description:
+
+  Add the current position to its hash chain, then find the longest match
+  for it by walking the rest of the chain. This stands in for
+  DeleteNode() and InsertNode(); positions that have left the window are
+  never deleted, the walk just stops when it reaches one.
+
+Arguments:
+
+  Sd      - The global scratch data
+
+Returns: (VOID)
+
+--*/
+{
+  UINT8   *Cur, *Cand;
+  UINT32  Pos, Next, Dist, Hash;
+  INT32   Chain, Len;
+
+  Cur  = &Sd->mText[Sd->mPos];
+  Pos  = Sd->mSlideBase + Sd->mPos + 1;
+  Hash = HC_HASH(Cur);
+  Next = Sd->mHashHead[Hash];
+  Sd->mHashPrev[Sd->mPos & (WNDSIZ - 1)] = Next;
+  Sd->mHashHead[Hash] = Pos;
+
+  Sd->mMatchLen = 0;
+  if (Sd->mInsertOnly) {
+    return;
+  }
+  for (Chain = HC_MAX_CHAIN; Next != 0 && Chain > 0; Chain--) {
+
+    //
+    // Pointers can reach back at most WNDSIZ - 1 bytes, the same
+    // distance the tree keeps
+    //
+
+    Dist = Pos - Next;
+    if (Dist >= WNDSIZ) {
+      break;
+    }
+    Cand = Cur - Dist;
+    if (Cand[Sd->mMatchLen] == Cur[Sd->mMatchLen]) {
+      for (Len = 0; Len < MAXMATCH && Cand[Len] == Cur[Len]; Len++) {
+      }
+      if (Len > Sd->mMatchLen) {
+        Sd->mMatchLen = Len;
+        Sd->mMatchPos = (NODE)(Sd->mPos - Dist);
+        if (Len == MAXMATCH) {
+          break;
+        }
+      }
+    }
+    Next = Sd->mHashPrev[(Next - 1) & (WNDSIZ - 1)];
+  }
+}
+
+STATIC
+VOID
+GetNextMatch (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
@@ -842,7 +1077,9 @@ Routine Description:
   Advance the current position (read in new data if needed).
   Delete outdated string info. Find a match string for current position.
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -850,27 +1087,36 @@ Returns: (VOID)
 {
   INT32 n;
 
-  mRemainder--;
-  if (++mPos == WNDSIZ * 2) {
-    memmove(&mText[0], &mText[WNDSIZ], WNDSIZ + MAXMATCH);
-    n = FreadCrc(&mText[WNDSIZ + MAXMATCH], WNDSIZ);
-    mRemainder += n;
-    mPos = WNDSIZ;
+  Sd->mRemainder--;
+  if (++Sd->mPos == WNDSIZ * 2) {
+    memmove(&Sd->mText[0], &Sd->mText[WNDSIZ], WNDSIZ + MAXMATCH);
+    n = FreadCrc(Sd, &Sd->mText[WNDSIZ + MAXMATCH], WNDSIZ);
+    Sd->mRemainder += n;
+    Sd->mPos = WNDSIZ;
+    Sd->mSlideBase += WNDSIZ;
+  }
+  if (Sd->mHashChain) {
+    HashChainInsert(Sd);
+  } else {
+    DeleteNode(Sd);
+    InsertNode(Sd);
   }
-  DeleteNode();
-  InsertNode();
 }
 
 STATIC
 EFI_STATUS
-Encode ()
+Encode (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   The main controlling routine for compression process.
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns:
 
@@ -883,72 +1129,90 @@ Returns:
   INT32       LastMatchLen;
   NODE        LastMatchPos;
 
-  Status = AllocateMemory();
+  Status = AllocateMemory(Sd);
   if (EFI_ERROR(Status)) {
-    FreeMemory();
+    FreeMemory(Sd);
     return Status;
   }
 
-  InitSlide();
+  if (!Sd->mHashChain) {
+    InitSlide(Sd);
+  }
 
-  HufEncodeStart();
+  HufEncodeStart(Sd);
 
-  mRemainder = FreadCrc(&mText[WNDSIZ], WNDSIZ + MAXMATCH);
+  Sd->mRemainder = FreadCrc(Sd, &Sd->mText[WNDSIZ], WNDSIZ + MAXMATCH);
 
-  mMatchLen = 0;
-  mPos = WNDSIZ;
-  InsertNode();
-  if (mMatchLen > mRemainder) {
-    mMatchLen = mRemainder;
+  Sd->mMatchLen = 0;
+  Sd->mPos = WNDSIZ;
+  if (Sd->mHashChain) {
+    HashChainInsert(Sd);
+  } else {
+    InsertNode(Sd);
+  }
+  if (Sd->mMatchLen > Sd->mRemainder) {
+    Sd->mMatchLen = Sd->mRemainder;
   }
-  while (mRemainder > 0) {
-    LastMatchLen = mMatchLen;
-    LastMatchPos = mMatchPos;
-    GetNextMatch();
-    if (mMatchLen > mRemainder) {
-      mMatchLen = mRemainder;
+  while (Sd->mRemainder > 0) {
+    LastMatchLen = Sd->mMatchLen;
+    LastMatchPos = Sd->mMatchPos;
+    GetNextMatch(Sd);
+    if (Sd->mMatchLen > Sd->mRemainder) {
+      Sd->mMatchLen = Sd->mRemainder;
     }
 
-    if (mMatchLen > LastMatchLen || LastMatchLen < THRESHOLD) {
+    if (Sd->mMatchLen > LastMatchLen || LastMatchLen < THRESHOLD) {
 
       //
       // Not enough benefits are gained by outputting a pointer,
       // so just output the original character
       //
 
-      Output(mText[mPos - 1], 0);
+      Output(Sd, Sd->mText[Sd->mPos - 1], 0);
     } else {
 
       //
       // Outputting a pointer is beneficial enough, do it.
       //
 
-      Output(LastMatchLen + (UINT8_MAX + 1 - THRESHOLD),
-             (mPos - LastMatchPos - 2) & (WNDSIZ - 1));
+      Output(Sd, LastMatchLen + (UINT8_MAX + 1 - THRESHOLD),
+             (Sd->mPos - LastMatchPos - 2) & (WNDSIZ - 1));
       while (--LastMatchLen > 0) {
-        GetNextMatch();
+
+        //
+        // Only the match found at the last of these positions is used.
+        // The tree has to search in order to insert, hash chains don't.
+        //
+
+        Sd->mInsertOnly = (UINT8)(LastMatchLen > 1);
+        GetNextMatch(Sd);
       }
-      if (mMatchLen > mRemainder) {
-        mMatchLen = mRemainder;
+      Sd->mInsertOnly = 0;
+      if (Sd->mMatchLen > Sd->mRemainder) {
+        Sd->mMatchLen = Sd->mRemainder;
       }
     }
   }
 
-  HufEncodeEnd();
-  FreeMemory();
+  HufEncodeEnd(Sd);
+  FreeMemory(Sd);
   return EFI_SUCCESS;
 }
 
 STATIC
 VOID
-CountTFreq ()
+CountTFreq (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Count the frequencies for the Extra Set
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -957,33 +1221,33 @@ Returns: (VOID)
   INT32 i, k, n, Count;
 
   for (i = 0; i < NT; i++) {
-    mTFreq[i] = 0;
+    Sd->mTFreq[i] = 0;
   }
   n = NC;
-  while (n > 0 && mCLen[n - 1] == 0) {
+  while (n > 0 && Sd->mCLen[n - 1] == 0) {
     n--;
   }
   i = 0;
   while (i < n) {
-    k = mCLen[i++];
+    k = Sd->mCLen[i++];
     if (k == 0) {
       Count = 1;
-      while (i < n && mCLen[i] == 0) {
+      while (i < n && Sd->mCLen[i] == 0) {
         i++;
         Count++;
       }
       if (Count <= 2) {
-        mTFreq[0] = (UINT16)(mTFreq[0] + Count);
+        Sd->mTFreq[0] = (UINT16)(Sd->mTFreq[0] + Count);
       } else if (Count <= 18) {
-        mTFreq[1]++;
+        Sd->mTFreq[1]++;
       } else if (Count == 19) {
-        mTFreq[0]++;
-        mTFreq[1]++;
+        Sd->mTFreq[0]++;
+        Sd->mTFreq[1]++;
       } else {
-        mTFreq[2]++;
+        Sd->mTFreq[2]++;
       }
     } else {
-      mTFreq[k + 2]++;
+      Sd->mTFreq[k + 2]++;
     }
   }
 }
@@ -991,6 +1255,7 @@ Returns: (VOID)
 STATIC
 VOID
 WritePTLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 n,
   IN INT32 nbit,
   IN INT32 Special
@@ -1003,6 +1268,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   n       - the number of symbols
   nbit    - the number of bits needed to represent 'n'
   Special - the special symbol that needs to be take care of
@@ -1013,37 +1279,41 @@ Returns: (VOID)
 {
   INT32 i, k;
 
-  while (n > 0 && mPTLen[n - 1] == 0) {
+  while (n > 0 && Sd->mPTLen[n - 1] == 0) {
     n--;
   }
-  PutBits(nbit, n);
+  PutBits(Sd, nbit, n);
   i = 0;
   while (i < n) {
-    k = mPTLen[i++];
+    k = Sd->mPTLen[i++];
     if (k <= 6) {
-      PutBits(3, k);
+      PutBits(Sd, 3, k);
     } else {
-      PutBits(k - 3, (1U << (k - 3)) - 2);
+      PutBits(Sd, k - 3, (1U << (k - 3)) - 2);
     }
     if (i == Special) {
-      while (i < 6 && mPTLen[i] == 0) {
+      while (i < 6 && Sd->mPTLen[i] == 0) {
         i++;
       }
-      PutBits(2, (i - 3) & 3);
+      PutBits(Sd, 2, (i - 3) & 3);
     }
   }
 }
 
 STATIC
 VOID
-WriteCLen ()
+WriteCLen (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Outputs the code length array for Char&Length Set
 
-Arguments: (VOID)
+Arguments:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -1052,36 +1322,36 @@ Returns: (VOID)
   INT32 i, k, n, Count;
 
   n = NC;
-  while (n > 0 && mCLen[n - 1] == 0) {
+  while (n > 0 && Sd->mCLen[n - 1] == 0) {
     n--;
   }
-  PutBits(CBIT, n);
+  PutBits(Sd, CBIT, n);
   i = 0;
   while (i < n) {
-    k = mCLen[i++];
+    k = Sd->mCLen[i++];
     if (k == 0) {
       Count = 1;
-      while (i < n && mCLen[i] == 0) {
+      while (i < n && Sd->mCLen[i] == 0) {
         i++;
         Count++;
       }
       if (Count <= 2) {
         for (k = 0; k < Count; k++) {
-          PutBits(mPTLen[0], mPTCode[0]);
+          PutBits(Sd, Sd->mPTLen[0], Sd->mPTCode[0]);
         }
       } else if (Count <= 18) {
-        PutBits(mPTLen[1], mPTCode[1]);
-        PutBits(4, Count - 3);
+        PutBits(Sd, Sd->mPTLen[1], Sd->mPTCode[1]);
+        PutBits(Sd, 4, Count - 3);
       } else if (Count == 19) {
-        PutBits(mPTLen[0], mPTCode[0]);
-        PutBits(mPTLen[1], mPTCode[1]);
-        PutBits(4, 15);
+        PutBits(Sd, Sd->mPTLen[0], Sd->mPTCode[0]);
+        PutBits(Sd, Sd->mPTLen[1], Sd->mPTCode[1]);
+        PutBits(Sd, 4, 15);
       } else {
-        PutBits(mPTLen[2], mPTCode[2]);
-        PutBits(CBIT, Count - 20);
+        PutBits(Sd, Sd->mPTLen[2], Sd->mPTCode[2]);
+        PutBits(Sd, CBIT, Count - 20);
       }
     } else {
-      PutBits(mPTLen[k + 2], mPTCode[k + 2]);
+      PutBits(Sd, Sd->mPTLen[k + 2], Sd->mPTCode[k + 2]);
     }
   }
 }
@@ -1089,15 +1359,17 @@ Returns: (VOID)
 STATIC
 VOID
 EncodeC (
+  IN SCRATCH_DATA *Sd,
   IN INT32 c
   )
 {
-  PutBits(mCLen[c], mCCode[c]);
+  PutBits(Sd, Sd->mCLen[c], Sd->mCCode[c]);
 }
 
 STATIC
 VOID
 EncodeP (
+  IN SCRATCH_DATA *Sd,
   IN UINT32 p
   )
 {
@@ -1109,22 +1381,26 @@ EncodeP (
     q >>= 1;
     c++;
   }
-  PutBits(mPTLen[c], mPTCode[c]);
+  PutBits(Sd, Sd->mPTLen[c], Sd->mPTCode[c]);
   if (c > 1) {
-    PutBits(c - 1, p & (0xFFFFU >> (17 - c)));
+    PutBits(Sd, c - 1, p & (0xFFFFU >> (17 - c)));
   }
 }
 
 STATIC
 VOID
-SendBlock ()
+SendBlock (
+  IN SCRATCH_DATA *Sd
+  )
 /*++
 
 Routine Description:
 
   Huffman code the block and output it.
 
-Argument: (VOID)
+Argument:
+
+  Sd      - The global scratch data
 
 Returns: (VOID)
 
@@ -1133,53 +1409,53 @@ Returns: (VOID)
   UINT32 i, k, Flags, Root, Pos, Size;
   Flags = 0;
 
-  Root = MakeTree(NC, mCFreq, mCLen, mCCode);
-  Size = mCFreq[Root];
-  PutBits(16, Size);
+  Root = MakeTree(Sd, NC, Sd->mCFreq, Sd->mCLen, Sd->mCCode);
+  Size = Sd->mCFreq[Root];
+  PutBits(Sd, 16, Size);
   if (Root >= NC) {
-    CountTFreq();
-    Root = MakeTree(NT, mTFreq, mPTLen, mPTCode);
+    CountTFreq(Sd);
+    Root = MakeTree(Sd, NT, Sd->mTFreq, Sd->mPTLen, Sd->mPTCode);
     if (Root >= NT) {
-      WritePTLen(NT, TBIT, 3);
+      WritePTLen(Sd, NT, TBIT, 3);
     } else {
-      PutBits(TBIT, 0);
-      PutBits(TBIT, Root);
+      PutBits(Sd, TBIT, 0);
+      PutBits(Sd, TBIT, Root);
     }
-    WriteCLen();
+    WriteCLen(Sd);
   } else {
-    PutBits(TBIT, 0);
-    PutBits(TBIT, 0);
-    PutBits(CBIT, 0);
-    PutBits(CBIT, Root);
+    PutBits(Sd, TBIT, 0);
+    PutBits(Sd, TBIT, 0);
+    PutBits(Sd, CBIT, 0);
+    PutBits(Sd, CBIT, Root);
   }
-  Root = MakeTree(NP, mPFreq, mPTLen, mPTCode);
+  Root = MakeTree(Sd, NP, Sd->mPFreq, Sd->mPTLen, Sd->mPTCode);
   if (Root >= NP) {
-    WritePTLen(NP, PBIT, -1);
+    WritePTLen(Sd, NP, PBIT, -1);
   } else {
-    PutBits(PBIT, 0);
-    PutBits(PBIT, Root);
+    PutBits(Sd, PBIT, 0);
+    PutBits(Sd, PBIT, Root);
   }
   Pos = 0;
   for (i = 0; i < Size; i++) {
     if (i % UINT8_BIT == 0) {
-      Flags = mBuf[Pos++];
+      Flags = Sd->mBuf[Pos++];
     } else {
       Flags <<= 1;
     }
     if (Flags & (1U << (UINT8_BIT - 1))) {
-      EncodeC(mBuf[Pos++] + (1U << UINT8_BIT));
-      k = mBuf[Pos++] << UINT8_BIT;
-      k += mBuf[Pos++];
-      EncodeP(k);
+      EncodeC(Sd, Sd->mBuf[Pos++] + (1U << UINT8_BIT));
+      k = Sd->mBuf[Pos++] << UINT8_BIT;
+      k += Sd->mBuf[Pos++];
+      EncodeP(Sd, k);
     } else {
-      EncodeC(mBuf[Pos++]);
+      EncodeC(Sd, Sd->mBuf[Pos++]);
     }
   }
   for (i = 0; i < NC; i++) {
-    mCFreq[i] = 0;
+    Sd->mCFreq[i] = 0;
   }
   for (i = 0; i < NP; i++) {
-    mPFreq[i] = 0;
+    Sd->mPFreq[i] = 0;
   }
 }
 
@@ -1187,6 +1463,7 @@ Returns: (VOID)
 STATIC
 VOID
 Output (
+  IN SCRATCH_DATA *Sd,
   IN UINT32 c,
   IN UINT32 p
   )
@@ -1198,6 +1475,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   c     - The original character or the 'String Length' element of a Pointer
   p     - The 'Position' field of a Pointer
 
@@ -1205,59 +1483,61 @@ Returns: (VOID)
 
 --*/
 {
-  STATIC UINT32 CPos;
-
-  if ((mOutputMask >>= 1) == 0) {
-    mOutputMask = 1U << (UINT8_BIT - 1);
-    if (mOutputPos >= mBufSiz - 3 * UINT8_BIT) {
-      SendBlock();
-      mOutputPos = 0;
+  if ((Sd->mOutputMask >>= 1) == 0) {
+    Sd->mOutputMask = 1U << (UINT8_BIT - 1);
+    if (Sd->mOutputPos >= Sd->mBufSiz - 3 * UINT8_BIT) {
+      SendBlock(Sd);
+      Sd->mOutputPos = 0;
     }
-    CPos = mOutputPos++;
-    mBuf[CPos] = 0;
+    Sd->mCPos = Sd->mOutputPos++;
+    Sd->mBuf[Sd->mCPos] = 0;
   }
-  mBuf[mOutputPos++] = (UINT8) c;
-  mCFreq[c]++;
+  Sd->mBuf[Sd->mOutputPos++] = (UINT8) c;
+  Sd->mCFreq[c]++;
   if (c >= (1U << UINT8_BIT)) {
-    mBuf[CPos] |= mOutputMask;
-    mBuf[mOutputPos++] = (UINT8)(p >> UINT8_BIT);
-    mBuf[mOutputPos++] = (UINT8) p;
+    Sd->mBuf[Sd->mCPos] |= Sd->mOutputMask;
+    Sd->mBuf[Sd->mOutputPos++] = (UINT8)(p >> UINT8_BIT);
+    Sd->mBuf[Sd->mOutputPos++] = (UINT8) p;
     c = 0;
     while (p) {
       p >>= 1;
       c++;
     }
-    mPFreq[c]++;
+    Sd->mPFreq[c]++;
   }
 }
 
 STATIC
 VOID
-HufEncodeStart ()
+HufEncodeStart (
+  IN SCRATCH_DATA *Sd
+  )
 {
   INT32 i;
 
   for (i = 0; i < NC; i++) {
-    mCFreq[i] = 0;
+    Sd->mCFreq[i] = 0;
   }
   for (i = 0; i < NP; i++) {
-    mPFreq[i] = 0;
+    Sd->mPFreq[i] = 0;
   }
-  mOutputPos = mOutputMask = 0;
-  InitPutBits();
+  Sd->mOutputPos = Sd->mOutputMask = 0;
+  InitPutBits(Sd);
   return;
 }
 
 STATIC
 VOID
-HufEncodeEnd ()
+HufEncodeEnd (
+  IN SCRATCH_DATA *Sd
+  )
 {
-  SendBlock();
+  SendBlock(Sd);
 
   //
   // Flush remaining bits
   //
-  PutBits(UINT8_BIT - 1, 0);
+  PutBits(Sd, UINT8_BIT - 1, 0);
 
   return;
 }
@@ -1265,7 +1545,9 @@ HufEncodeEnd ()
 
 STATIC
 VOID
-MakeCrcTable ()
+MakeCrcTable (
+  IN SCRATCH_DATA *Sd
+  )
 {
   UINT32 i, j, r;
 
@@ -1278,13 +1560,14 @@ MakeCrcTable ()
         r >>= 1;
       }
     }
-    mCrcTable[i] = (UINT16)r;
+    Sd->mCrcTable[i] = (UINT16)r;
   }
 }
 
 STATIC
 VOID
 PutBits (
+  IN SCRATCH_DATA *Sd,
   IN INT32 n,
   IN UINT32 x
   )
@@ -1296,6 +1579,7 @@ Routine Description:
 
 Argments:
 
+  Sd      - The global scratch data
   n   - the rightmost n bits of the data is used
   x   - the data
 
@@ -1305,27 +1589,27 @@ Returns: (VOID)
 {
   UINT8 Temp;
 
-  if (n < mBitCount) {
-    mSubBitBuf |= x << (mBitCount -= n);
+  if (n < Sd->mBitCount) {
+    Sd->mSubBitBuf |= x << (Sd->mBitCount -= n);
   } else {
 
-    Temp = (UINT8)(mSubBitBuf | (x >> (n -= mBitCount)));
-    if (mDst < mDstUpperLimit) {
-      *mDst++ = Temp;
+    Temp = (UINT8)(Sd->mSubBitBuf | (x >> (n -= Sd->mBitCount)));
+    if (Sd->mDst < Sd->mDstUpperLimit) {
+      *Sd->mDst++ = Temp;
     }
-    mCompSize++;
+    Sd->mCompSize++;
 
     if (n < UINT8_BIT) {
-      mSubBitBuf = x << (mBitCount = UINT8_BIT - n);
+      Sd->mSubBitBuf = x << (Sd->mBitCount = UINT8_BIT - n);
     } else {
 
       Temp = (UINT8)(x >> (n - UINT8_BIT));
-      if (mDst < mDstUpperLimit) {
-        *mDst++ = Temp;
+      if (Sd->mDst < Sd->mDstUpperLimit) {
+        *Sd->mDst++ = Temp;
       }
-      mCompSize++;
+      Sd->mCompSize++;
 
-      mSubBitBuf = x << (mBitCount = 2 * UINT8_BIT - n);
+      Sd->mSubBitBuf = x << (Sd->mBitCount = 2 * UINT8_BIT - n);
     }
   }
 }
@@ -1333,6 +1617,7 @@ Returns: (VOID)
 STATIC
 INT32
 FreadCrc (
+  IN SCRATCH_DATA *Sd,
   OUT UINT8 *p,
   IN  INT32 n
   )
@@ -1344,6 +1629,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   p   - the buffer to hold the data
   n   - number of bytes to read
 
@@ -1355,13 +1641,13 @@ Returns:
 {
   INT32 i;
 
-  for (i = 0; mSrc < mSrcUpperLimit && i < n; i++) {
-    *p++ = *mSrc++;
+  for (i = 0; Sd->mSrc < Sd->mSrcUpperLimit && i < n; i++) {
+    *p++ = *Sd->mSrc++;
   }
   n = i;
 
   p -= n;
-  mOrigSize += n;
+  Sd->mOrigSize += n;
   while (--i >= 0) {
     UPDATE_CRC(*p++);
   }
@@ -1371,15 +1657,18 @@ Returns:
 
 STATIC
 VOID
-InitPutBits ()
+InitPutBits (
+  IN SCRATCH_DATA *Sd
+  )
 {
-  mBitCount = UINT8_BIT;
-  mSubBitBuf = 0;
+  Sd->mBitCount = UINT8_BIT;
+  Sd->mSubBitBuf = 0;
 }
 
 STATIC
 VOID
 CountLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 i
   )
 /*++
@@ -1390,27 +1679,27 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   i   - the top node
 
 Returns: (VOID)
 
 --*/
 {
-  STATIC INT32 Depth = 0;
-
-  if (i < mN) {
-    mLenCnt[(Depth < 16) ? Depth : 16]++;
+  if (i < Sd->mN) {
+    Sd->mLenCnt[(Sd->mDepth < 16) ? Sd->mDepth : 16]++;
   } else {
-    Depth++;
-    CountLen(mLeft [i]);
-    CountLen(mRight[i]);
-    Depth--;
+    Sd->mDepth++;
+    CountLen(Sd, Sd->mLeft [i]);
+    CountLen(Sd, Sd->mRight[i]);
+    Sd->mDepth--;
   }
 }
 
 STATIC
 VOID
 MakeLen (
+  IN SCRATCH_DATA *Sd,
   IN INT32 Root
   )
 /*++
@@ -1421,6 +1710,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   Root   - the root of the tree
 
 --*/
@@ -1429,9 +1719,9 @@ Arguments:
   UINT32 Cum;
 
   for (i = 0; i <= 16; i++) {
-    mLenCnt[i] = 0;
+    Sd->mLenCnt[i] = 0;
   }
-  CountLen(Root);
+  CountLen(Sd, Root);
 
   //
   // Adjust the length count array so that
@@ -1440,23 +1730,23 @@ Arguments:
 
   Cum = 0;
   for (i = 16; i > 0; i--) {
-    Cum += mLenCnt[i] << (16 - i);
+    Cum += Sd->mLenCnt[i] << (16 - i);
   }
   while (Cum != (1U << 16)) {
-    mLenCnt[16]--;
+    Sd->mLenCnt[16]--;
     for (i = 15; i > 0; i--) {
-      if (mLenCnt[i] != 0) {
-        mLenCnt[i]--;
-        mLenCnt[i+1] += 2;
+      if (Sd->mLenCnt[i] != 0) {
+        Sd->mLenCnt[i]--;
+        Sd->mLenCnt[i+1] += 2;
         break;
       }
     }
     Cum--;
   }
   for (i = 16; i > 0; i--) {
-    k = mLenCnt[i];
+    k = Sd->mLenCnt[i];
     while (--k >= 0) {
-      mLen[*mSortPtr++] = (UINT8)i;
+      Sd->mLen[*Sd->mSortPtr++] = (UINT8)i;
     }
   }
 }
@@ -1464,6 +1754,7 @@ Arguments:
 STATIC
 VOID
 DownHeap (
+  IN SCRATCH_DATA *Sd,
   IN INT32 i
   )
 {
@@ -1473,23 +1764,24 @@ DownHeap (
   // priority queue: send i-th entry down heap
   //
 
-  k = mHeap[i];
-  while ((j = 2 * i) <= mHeapSize) {
-    if (j < mHeapSize && mFreq[mHeap[j]] > mFreq[mHeap[j + 1]]) {
+  k = Sd->mHeap[i];
+  while ((j = 2 * i) <= Sd->mHeapSize) {
+    if (j < Sd->mHeapSize && Sd->mFreq[Sd->mHeap[j]] > Sd->mFreq[Sd->mHeap[j + 1]]) {
       j++;
     }
-    if (mFreq[k] <= mFreq[mHeap[j]]) {
+    if (Sd->mFreq[k] <= Sd->mFreq[Sd->mHeap[j]]) {
       break;
     }
-    mHeap[i] = mHeap[j];
+    Sd->mHeap[i] = Sd->mHeap[j];
     i = j;
   }
-  mHeap[i] = (INT16)k;
+  Sd->mHeap[i] = (INT16)k;
 }
 
 STATIC
 VOID
 MakeCode (
+  IN SCRATCH_DATA *Sd,
   IN  INT32 n,
   IN  UINT8 Len[],
   OUT UINT16 Code[]
@@ -1502,6 +1794,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   n     - number of symbols
   Len   - the code length array
   Code  - stores codes for each symbol
@@ -1515,7 +1808,7 @@ Returns: (VOID)
 
   Start[1] = 0;
   for (i = 1; i <= 16; i++) {
-    Start[i + 1] = (UINT16)((Start[i] + mLenCnt[i]) << 1);
+    Start[i + 1] = (UINT16)((Start[i] + Sd->mLenCnt[i]) << 1);
   }
   for (i = 0; i < n; i++) {
     Code[i] = Start[Len[i]]++;
@@ -1525,6 +1818,7 @@ Returns: (VOID)
 STATIC
 INT32
 MakeTree (
+  IN SCRATCH_DATA *Sd,
   IN  INT32   NParm,
   IN  UINT16  FreqParm[],
   OUT UINT8   LenParm[],
@@ -1538,6 +1832,7 @@ Routine Description:
 
 Arguments:
 
+  Sd      - The global scratch data
   NParm    - number of symbols
   FreqParm - frequency of each symbol
   LenParm  - code length for each symbol
@@ -1555,52 +1850,52 @@ Returns:
   // make tree, calculate len[], return root
   //
 
-  mN = NParm;
-  mFreq = FreqParm;
-  mLen = LenParm;
-  Avail = mN;
-  mHeapSize = 0;
-  mHeap[1] = 0;
-  for (i = 0; i < mN; i++) {
-    mLen[i] = 0;
-    if (mFreq[i]) {
-      mHeap[++mHeapSize] = (INT16)i;
+  Sd->mN = NParm;
+  Sd->mFreq = FreqParm;
+  Sd->mLen = LenParm;
+  Avail = Sd->mN;
+  Sd->mHeapSize = 0;
+  Sd->mHeap[1] = 0;
+  for (i = 0; i < Sd->mN; i++) {
+    Sd->mLen[i] = 0;
+    if (Sd->mFreq[i]) {
+      Sd->mHeap[++Sd->mHeapSize] = (INT16)i;
     }
   }
-  if (mHeapSize < 2) {
-    CodeParm[mHeap[1]] = 0;
-    return mHeap[1];
+  if (Sd->mHeapSize < 2) {
+    CodeParm[Sd->mHeap[1]] = 0;
+    return Sd->mHeap[1];
   }
-  for (i = mHeapSize / 2; i >= 1; i--) {
+  for (i = Sd->mHeapSize / 2; i >= 1; i--) {
 
     //
     // make priority queue
     //
-    DownHeap(i);
+    DownHeap(Sd, i);
   }
-  mSortPtr = CodeParm;
+  Sd->mSortPtr = CodeParm;
   do {
-    i = mHeap[1];
-    if (i < mN) {
-      *mSortPtr++ = (UINT16)i;
+    i = Sd->mHeap[1];
+    if (i < Sd->mN) {
+      *Sd->mSortPtr++ = (UINT16)i;
     }
-    mHeap[1] = mHeap[mHeapSize--];
-    DownHeap(1);
-    j = mHeap[1];
-    if (j < mN) {
-      *mSortPtr++ = (UINT16)j;
+    Sd->mHeap[1] = Sd->mHeap[Sd->mHeapSize--];
+    DownHeap(Sd, 1);
+    j = Sd->mHeap[1];
+    if (j < Sd->mN) {
+      *Sd->mSortPtr++ = (UINT16)j;
     }
     k = Avail++;
-    mFreq[k] = (UINT16)(mFreq[i] + mFreq[j]);
-    mHeap[1] = (INT16)k;
-    DownHeap(1);
-    mLeft[k] = (UINT16)i;
-    mRight[k] = (UINT16)j;
-  } while (mHeapSize > 1);
-
-  mSortPtr = CodeParm;
-  MakeLen(k);
-  MakeCode(NParm, LenParm, CodeParm);
+    Sd->mFreq[k] = (UINT16)(Sd->mFreq[i] + Sd->mFreq[j]);
+    Sd->mHeap[1] = (INT16)k;
+    DownHeap(Sd, 1);
+    Sd->mLeft[k] = (UINT16)i;
+    Sd->mRight[k] = (UINT16)j;
+  } while (Sd->mHeapSize > 1);
+
+  Sd->mSortPtr = CodeParm;
+  MakeLen(Sd, k);
+  MakeCode(Sd, NParm, LenParm, CodeParm);
 
   //
   // return root
@@ -25,6 +25,7 @@ Abstract:
 --*/
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +46,12 @@ Abstract:
 #define CODE_BIT  16
 #define BAD_TABLE - 1
 
+//
+// Index widths of mCTable and of mCFastTable, which Decode() tries first
+//
+#define CTABLEBITS 12
+#define CFASTBITS  10
+
 //
 // C: Char&Len Set; P: Position Set; T: exTra Set
 //
@@ -66,9 +73,9 @@ typedef struct {
   UINT32  mOutBuf;
   UINT32  mInBuf;
 
-  UINT16  mBitCount;
-  UINT32  mBitBuf;
-  UINT32  mSubBitBuf;
+  UINT16  mBitCount;  // Number of valid bits in mBitBuf64
+  UINT32  mBitBuf;    // The next BITBUFSIZ bits, the top half of mBitBuf64
+  UINT64  mBitBuf64;  // Bits read ahead from the source, left aligned
   UINT16  mBlockSize;
   UINT32  mCompSize;
   UINT32  mOrigSize;
@@ -88,8 +95,26 @@ typedef struct {
   // For Tiano de/compression algorithm, mPBit = 5
   //
   UINT8   mPBit;
+
+  //
+  // What the next CFASTBITS bits decode to: one Char&Len symbol, or two
+  // literals if both their codes fit. See FAST_* below; 0 means the code
+  // is longer. Only usable when mCFastValid is set for the current block.
+  // Building it costs about as much as decoding 1U << CFASTBITS symbols,
+  // so small blocks go without. It must stay last; Decompress() doesn't
+  // clear it.
+  //
+  UINT8   mCFastValid;
+  UINT32  mCFastTable[1U << CFASTBITS];
 } SCRATCH_DATA;
 
+#define FAST_CHAR1(e)   ((e) & 0x1FF)
+#define FAST_CHAR2(e)   (((e) >> 9) & 0xFF)
+#define FAST_LEN(e)     (((e) >> 17) & 0x1F)
+#define FAST_COUNT(e)   ((e) >> 22)
+#define FAST_ENTRY(c1, c2, len, count) \
+  ((UINT32) (c1) | ((UINT32) (c2) << 9) | ((UINT32) (len) << 17) | ((UINT32) (count) << 22))
+
 STATIC
 VOID
 FillBuf (
@@ -101,6 +126,8 @@ FillBuf (
 Routine Description:
 
   Shift mBitBuf NumOfBits left. Read in NumOfBits of bits from source.
+  Bits are read ahead into a 64-bit buffer, so most calls don't touch the
+  source at all.
 
 Arguments:
 
@@ -111,33 +138,25 @@ Returns: (VOID)
 
 --*/
 {
-  Sd->mBitBuf = (UINT32) (Sd->mBitBuf << NumOfBits);
-
-  while (NumOfBits > Sd->mBitCount) {
-
-    Sd->mBitBuf |= (UINT32) (Sd->mSubBitBuf << (NumOfBits = (UINT16) (NumOfBits - Sd->mBitCount)));
-
-    if (Sd->mCompSize > 0) {
-      //
-      // Get 1 byte into SubBitBuf
-      //
-      Sd->mCompSize--;
-      Sd->mSubBitBuf  = 0;
-      Sd->mSubBitBuf  = Sd->mSrcBase[Sd->mInBuf++];
-      Sd->mBitCount   = 8;
+  Sd->mBitBuf64 <<= NumOfBits;
+  Sd->mBitCount = (UINT16) (Sd->mBitCount - NumOfBits);
 
-    } else {
-      //
-      // No more bits from the source, just pad zero bit.
-      //
-      Sd->mSubBitBuf  = 0;
-      Sd->mBitCount   = 8;
+  //
+  // Top up to at least 57 bits, so the next BITBUFSIZ are always there.
+  // Past the end of the source, pad with zero bits.
+  //
+  if (Sd->mBitCount < BITBUFSIZ) {
+    while (Sd->mBitCount <= 56) {
+      if (Sd->mCompSize > 0) {
+        Sd->mCompSize--;
+        Sd->mBitBuf64 |= (UINT64) Sd->mSrcBase[Sd->mInBuf++] << (56 - Sd->mBitCount);
+      }
 
+      Sd->mBitCount = (UINT16) (Sd->mBitCount + 8);
     }
   }
 
-  Sd->mBitCount = (UINT16) (Sd->mBitCount - NumOfBits);
-  Sd->mBitBuf |= Sd->mSubBitBuf >> Sd->mBitCount;
+  Sd->mBitBuf = (UINT32) (Sd->mBitBuf64 >> (64 - BITBUFSIZ));
 }
 
 STATIC
@@ -331,6 +350,7 @@ Returns:
 --*/
 {
   UINT16  Val;
+  UINT16  Len;
   UINT32  Mask;
   UINT32  Pos;
 
@@ -351,9 +371,17 @@ Returns:
     } while (Val >= MAXNP);
   }
   //
-  // Advance what we have read
+  // Advance what we have read. If the extra bits are already in mBitBuf,
+  // take them in the same step.
   //
-  FillBuf (Sd, Sd->mPTLen[Val]);
+  Len = Sd->mPTLen[Val];
+  if (Val > 1 && Len + Val - 1 <= BITBUFSIZ) {
+    Pos = (UINT32) ((1U << (Val - 1)) + ((Sd->mBitBuf64 << Len) >> (64 - (Val - 1))));
+    FillBuf (Sd, (UINT16) (Len + Val - 1));
+    return Pos;
+  }
+
+  FillBuf (Sd, Len);
 
   Pos = Val;
   if (Val > 1) {
@@ -445,6 +473,83 @@ Returns:
   return MakeTable (Sd, nn, Sd->mPTLen, 8, Sd->mPTTable);
 }
 
+STATIC
+VOID
+MakeFastTable (
+  IN  SCRATCH_DATA  *Sd
+  )
+/*++
+
+Routine Description:
+
+  Fills mCFastTable from a complete mCTable, so Decode() can take a symbol,
+  or two literals, with one lookup. Each code in a complete table is the
+  only one with its prefix, so if the bits left after the first literal
+  already hold all of the second code, it's the same whatever follows.
+
+Arguments:
+
+  Sd    - The global scratch data
+
+Returns: (VOID)
+
+--*/
+{
+  UINT32  Index;
+  UINT32  Sum;
+  UINT16  Char1;
+  UINT16  Char2;
+  UINT16  Len1;
+  UINT16  Len2;
+
+  //
+  // MakeTable() only checks the code space sum modulo 1 << 16, so make
+  // sure it's really complete before relying on it
+  //
+  Sum = 0;
+  for (Index = 0; Index < NC; Index++) {
+    if (Sd->mCLen[Index] != 0) {
+      Sum += 1U << (16 - Sd->mCLen[Index]);
+    }
+  }
+
+  if (Sum != (1U << 16)) {
+    Sd->mCFastValid = 0;
+    return ;
+  }
+
+  for (Index = 0; Index < (1U << CFASTBITS); Index++) {
+    Sd->mCFastTable[Index] = 0;
+
+    Char1 = Sd->mCTable[Index << (CTABLEBITS - CFASTBITS)];
+    if (Char1 >= NC) {
+      continue;
+    }
+
+    Len1 = Sd->mCLen[Char1];
+    if (Len1 > CFASTBITS) {
+      continue;
+    }
+
+    Sd->mCFastTable[Index] = FAST_ENTRY (Char1, 0, Len1, 1);
+    if (Char1 > UINT8_MAX || Len1 == CFASTBITS) {
+      continue;
+    }
+
+    Char2 = Sd->mCTable[((Index << Len1) & ((1U << CFASTBITS) - 1)) << (CTABLEBITS - CFASTBITS)];
+    if (Char2 > UINT8_MAX) {
+      continue;
+    }
+
+    Len2 = Sd->mCLen[Char2];
+    if (Len1 + Len2 <= CFASTBITS) {
+      Sd->mCFastTable[Index] = FAST_ENTRY (Char1, Char2, Len1 + Len2, 2);
+    }
+  }
+
+  Sd->mCFastValid = 1;
+}
+
 STATIC
 VOID
 ReadCLen (
@@ -482,6 +587,7 @@ Returns: (VOID)
       Sd->mCTable[Index] = CharC;
     }
 
+    Sd->mCFastValid = 0;
     return ;
   }
 
@@ -534,7 +640,15 @@ Returns: (VOID)
     Sd->mCLen[Index++] = 0;
   }
 
-  MakeTable (Sd, NC, Sd->mCLen, 12, Sd->mCTable);
+  if (MakeTable (Sd, NC, Sd->mCLen, CTABLEBITS, Sd->mCTable) == 0 &&
+      Sd->mBlockSize >= (1U << CFASTBITS)) {
+    MakeFastTable (Sd);
+  } else {
+    //
+    // A bad mCTable is left as it was; let DecodeC() cope with it as ever
+    //
+    Sd->mCFastValid = 0;
+  }
 
   return ;
 }
@@ -582,10 +696,10 @@ Returns:
   }
 
   Sd->mBlockSize--;
-  Index2 = Sd->mCTable[Sd->mBitBuf >> (BITBUFSIZ - 12)];
+  Index2 = Sd->mCTable[Sd->mBitBuf >> (BITBUFSIZ - CTABLEBITS)];
 
   if (Index2 >= NC) {
-    Mask = 1U << (BITBUFSIZ - 1 - 12);
+    Mask = 1U << (BITBUFSIZ - 1 - CTABLEBITS);
 
     do {
       if (Sd->mBitBuf & Mask) {
@@ -627,15 +741,42 @@ Returns: (VOID)
   UINT16  BytesRemain;
   UINT32  DataIdx;
   UINT16  CharC;
+  UINT32  Fast;
+  UINT8   *Dst;
+  UINT8   *Src;
 
   BytesRemain = (UINT16) (-1);
 
   DataIdx     = 0;
 
   for (;;) {
-    CharC = DecodeC (Sd);
-    if (Sd->mBadTableFlag != 0) {
-      return ;
+    //
+    // Use the fast table when whatever it holds fits in this block and in
+    // the destination. Long codes and the ends of blocks go to DecodeC().
+    //
+    Fast = 0;
+    if (Sd->mCFastValid && Sd->mBlockSize >= 2 &&
+        Sd->mOrigSize - Sd->mOutBuf >= 2) {
+      Fast = Sd->mCFastTable[Sd->mBitBuf >> (BITBUFSIZ - CFASTBITS)];
+    }
+
+    if (FAST_COUNT (Fast) == 2) {
+      Sd->mBlockSize = (UINT16) (Sd->mBlockSize - 2);
+      Sd->mDstBase[Sd->mOutBuf++] = (UINT8) FAST_CHAR1 (Fast);
+      Sd->mDstBase[Sd->mOutBuf++] = (UINT8) FAST_CHAR2 (Fast);
+      FillBuf (Sd, (UINT16) FAST_LEN (Fast));
+      continue;
+    }
+
+    if (Fast != 0) {
+      Sd->mBlockSize--;
+      CharC = (UINT16) FAST_CHAR1 (Fast);
+      FillBuf (Sd, (UINT16) FAST_LEN (Fast));
+    } else {
+      CharC = DecodeC (Sd);
+      if (Sd->mBadTableFlag != 0) {
+        return ;
+      }
     }
 
     if (CharC < 256) {
@@ -658,14 +799,23 @@ Returns: (VOID)
 
       DataIdx     = Sd->mOutBuf - DecodeP (Sd) - 1;
 
-      BytesRemain--;
-      while ((INT16) (BytesRemain) >= 0) {
-        Sd->mDstBase[Sd->mOutBuf++] = Sd->mDstBase[DataIdx++];
-        if (Sd->mOutBuf >= Sd->mOrigSize) {
-          return ;
-        }
+      //
+      // Stop at the end of the destination. The copy may overlap itself,
+      // so it has to go a byte at a time.
+      //
+      if (BytesRemain > Sd->mOrigSize - Sd->mOutBuf) {
+        BytesRemain = (UINT16) (Sd->mOrigSize - Sd->mOutBuf);
+      }
+
+      Dst = &Sd->mDstBase[Sd->mOutBuf];
+      Src = &Sd->mDstBase[DataIdx];
+      Sd->mOutBuf += BytesRemain;
+      while (BytesRemain-- > 0) {
+        *Dst++ = *Src++;
+      }
 
-        BytesRemain--;
+      if (Sd->mOutBuf >= Sd->mOrigSize) {
+        return ;
       }
     }
   }
@@ -790,7 +940,7 @@ Returns:
 
   Src = Src + 8;
 
-  for (Index = 0; Index < sizeof (SCRATCH_DATA); Index++) {
+  for (Index = 0; Index < offsetof (SCRATCH_DATA, mCFastTable); Index++) {
     ((UINT8 *) Sd)[Index] = 0;
   }
   //
@@ -822,7 +972,7 @@ Returns:
   //
   // Fill the first BITBUFSIZ bits
   //
-  FillBuf (Sd, BITBUFSIZ);
+  FillBuf (Sd, 0);
 
   //
   // Decompress it
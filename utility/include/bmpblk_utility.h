@@ -29,6 +29,9 @@ typedef struct ImageConfig {
   string raw_content;
   string compressed_content;
   uint32_t offset;
+  size_t content_hash;           /* hash of raw_content */
+  struct ImageConfig *same_as;   /* earlier image with the same raw_content */
+  bool shared;                   /* stored at the offset of another image */
 } ImageConfig;
 
 /* Internal struct for contructing ScreenLayout. */
@@ -68,6 +71,9 @@ class BmpBlockUtil {
   /* What compression to use for the images */
   void force_compression(uint32_t compression);
 
+  /* How many images to read and compress at once (1 = one at a time) */
+  void set_jobs(int jobs);
+
  private:
   /* Elemental function called from load_from_config.
    * Load the config file (yaml format) and parse it. */
@@ -77,6 +83,18 @@ class BmpBlockUtil {
    * Load all image files into the internal variables. */
   void load_all_image_files();
 
+  /* Helpers for load_all_image_files. Read and identify one image, or
+   * compress one. These touch nothing but the ImageConfig they're given, so
+   * several of them can run at once. They return an error message, or an
+   * empty string on success. */
+  string load_image_file(ImageConfig &image);
+  string compress_image(ImageConfig &image);
+
+  /* Run fn on each of the images, in up to jobs_ threads at once. Exits
+   * with the first error any of them returns, once they've all stopped. */
+  void run_jobs(const vector<ImageConfig *> &images,
+                string (BmpBlockUtil::*fn)(ImageConfig &image));
+
   /* Elemental function called from load_from_config.
    * Contruct the BmpBlockHeader struct. */
   void fill_bmpblock_header();
@@ -94,11 +112,16 @@ class BmpBlockUtil {
   void parse_locale_index(yaml_parser_t *parser);
 
   /* Useful functions */
-  const string read_image_file(const char *filename);
+  /* Read a whole file into content. Returns false (with errno set) if it
+   * can't. */
+  bool read_image_file(const char *filename, string &content);
 
   /* Verbosity flags */
   bool debug_;
 
+  /* Number of images to load at once */
+  int jobs_;
+
   /* Internal variable for string the BmpBlock version. */
   uint16_t major_version_;
   uint16_t minor_version_;